@@ -0,0 +1,295 @@
+#ifdef CORT_CORE_BENCHMARK
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../cort_proto.h"
+#include "../cort_channel.h"
+#include "../stackful/cort_stackful.h"
+
+//Microbenchmark of the core coroutine machinery. Every case prints ns/op, instructions/op and cache misses/op as one JSON object.
+//Instructions and cache misses are read by perf_event_open. They are null if perf events are not permitted(see /proc/sys/kernel/perf_event_paranoid).
+//Usage: ./cort_core_benchmark.out [op_count] > result.json
+
+struct perf_counters{
+    int fd_instructions;
+    int fd_cache_misses;
+    uint64_t instructions;
+    uint64_t cache_misses;
+
+    static int open_counter(uint64_t config, int group_fd){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = (group_fd == -1 ? 1 : 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+
+    perf_counters(){
+        fd_instructions = open_counter(PERF_COUNT_HW_INSTRUCTIONS, -1);
+        fd_cache_misses = -1;
+        if(fd_instructions >= 0){
+            fd_cache_misses = open_counter(PERF_COUNT_HW_CACHE_MISSES, fd_instructions);
+        }
+        instructions = 0;
+        cache_misses = 0;
+    }
+
+    ~perf_counters(){
+        if(fd_cache_misses >= 0){
+            close(fd_cache_misses);
+        }
+        if(fd_instructions >= 0){
+            close(fd_instructions);
+        }
+    }
+
+    void start(){
+        if(fd_instructions >= 0){
+            ioctl(fd_instructions, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fd_instructions, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void stop(){
+        if(fd_instructions >= 0){
+            ioctl(fd_instructions, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            if(read(fd_instructions, &instructions, sizeof(instructions)) != sizeof(instructions)){
+                instructions = 0;
+            }
+        }
+        if(fd_cache_misses >= 0){
+            if(read(fd_cache_misses, &cache_misses, sizeof(cache_misses)) != sizeof(cache_misses)){
+                cache_misses = 0;
+            }
+        }
+    }
+};
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//Every benchmark case runs op_count operations in its run function.
+struct benchmark_case{
+    const char* name;
+    void (*run)(size_t op_count);
+};
+
+bool first_output = true;
+
+void output_counter(const char* key, int fd, uint64_t value, size_t op_count){
+    if(fd < 0){
+        printf(", \"%s\": null", key);
+    }
+    else{
+        printf(", \"%s\": %.3f", key, ((double)value) / op_count);
+    }
+}
+
+void run_case(const benchmark_case& bench, size_t op_count, perf_counters& counters){
+    bench.run(op_count / 10 + 1);   //warm up
+    counters.start();
+    double begin = now_ns();
+    bench.run(op_count);
+    double cost = now_ns() - begin;
+    counters.stop();
+    printf("%s    {\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.3f", first_output ? "" : ",\n", bench.name, op_count, cost / op_count);
+    output_counter("instructions_per_op", counters.fd_instructions, counters.instructions, op_count);
+    output_counter("cache_misses_per_op", counters.fd_cache_misses, counters.cache_misses, op_count);
+    printf("}");
+    first_output = false;
+}
+
+//A child that finishes in cort_start.
+struct finished_cort : public cort_proto{
+    CO_DECL(finished_cort)
+    cort_proto* start(){
+        CO_BEGIN
+        CO_END
+    }
+};
+
+//A child that waits until the driver resumes it.
+struct leaf_cort : public cort_proto{
+    CO_DECL(leaf_cort)
+    cort_proto* start(){
+        CO_BEGIN
+            CO_YIELD();
+        CO_END
+    }
+};
+
+finished_cort finished_child;
+leaf_cort leaves[10];
+
+//CO_AWAIT on an already finished child.
+struct await_finished_cort : public cort_proto{
+    CO_DECL(await_finished_cort)
+    size_t rest_count;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_AGAIN_IF(rest_count-- != 0, &finished_child);
+        CO_END
+    }
+};
+
+void run_await_finished(size_t op_count){
+    await_finished_cort cort;
+    cort.rest_count = op_count;
+    cort.start();
+}
+
+//The suspended parent is resumed by decr_wait_count when the leaf finishes.
+struct await_leaf_cort : public cort_proto{
+    CO_DECL(await_leaf_cort)
+    size_t rest_count;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_AGAIN_IF(rest_count-- != 0, &leaves[0]);
+        CO_END
+    }
+};
+
+void run_resume_parent(size_t op_count){
+    await_leaf_cort cort;
+    cort.rest_count = op_count;
+    cort.start();
+    while(!cort.is_finished()){
+        leaves[0].resume();
+    }
+}
+
+//One op: start the parent, resume every child, the parent finishes after the last one.
+#define CORT_BENCHMARK_AWAIT_ALL(n, ...) \
+struct await_all_##n##_cort : public cort_proto{ \
+    CO_DECL(await_all_##n##_cort) \
+    cort_proto* start(){ \
+        CO_BEGIN \
+            CO_AWAIT_ALL(__VA_ARGS__); \
+        CO_END \
+    } \
+}; \
+void run_await_all_##n(size_t op_count){ \
+    await_all_##n##_cort cort; \
+    for(size_t i = 0; i < op_count; ++i){ \
+        cort.start(); \
+        for(size_t j = 0; j < n; ++j){ \
+            leaves[j].resume(); \
+        } \
+    } \
+}
+
+CORT_BENCHMARK_AWAIT_ALL(1, &leaves[0])
+CORT_BENCHMARK_AWAIT_ALL(2, &leaves[0], &leaves[1])
+CORT_BENCHMARK_AWAIT_ALL(5, &leaves[0], &leaves[1], &leaves[2], &leaves[3], &leaves[4])
+CORT_BENCHMARK_AWAIT_ALL(10, &leaves[0], &leaves[1], &leaves[2], &leaves[3], &leaves[4], \
+    &leaves[5], &leaves[6], &leaves[7], &leaves[8], &leaves[9])
+
+//One op: start the parent(new cort_wait_n), the first child resumes the parent, the second one deletes the cort_wait_n.
+struct await_any_cort : public cort_proto{
+    CO_DECL(await_any_cort)
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_ANY(&leaves[0], &leaves[1]);
+        CO_END
+    }
+};
+
+void run_await_any(size_t op_count){
+    await_any_cort cort;
+    for(size_t i = 0; i < op_count; ++i){
+        cort.start();
+        leaves[0].resume();
+        leaves[1].resume();
+    }
+}
+
+//One op: push wakes the consumer, the consumer pops and waits again.
+cort_channel channel;
+struct channel_consumer_cort : public cort_proto{
+    CO_DECL(channel_consumer_cort)
+    size_t rest_count;
+    bool waited;
+    cort_proto* start(){
+        CO_BEGIN
+            if(waited){
+                channel.pop();
+                --rest_count;
+            }
+            CO_AWAIT_AGAIN_IF(rest_count != 0, (waited = true, &channel));
+        CO_END
+    }
+};
+
+void run_channel(size_t op_count){
+    channel_consumer_cort cort;
+    cort.rest_count = op_count;
+    cort.waited = false;
+    cort.start();
+    while(!cort.is_finished()){
+        channel.push();
+    }
+}
+
+//One op: switch to the stackful coroutine and switch back by cort_stackful_switch.
+struct stackful_yield_cort : public cort_proto, public cort_stackful{
+    CO_STACKFUL_DECL(stackful_yield_cort)
+    size_t rest_count;
+    stackful_yield_cort(){
+        alloc_stack();
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            while(rest_count-- != 0){
+                cort_stackful_await(this);
+            }
+        CO_END
+    }
+};
+
+void run_stackful_switch(size_t op_count){
+    stackful_yield_cort cort;
+    cort.rest_count = op_count;
+    cort.cort_start();
+    while(!cort.is_finished()){
+        cort.resume();
+    }
+}
+
+int main(int argc, char* argv[]){
+    size_t op_count = 1000000;
+    if(argc > 1){
+        op_count = (size_t)atol(argv[1]);
+    }
+    const benchmark_case cases[] = {
+        {"await_finished", &run_await_finished},
+        {"resume_parent", &run_resume_parent},
+        {"await_all_1", &run_await_all_1},
+        {"await_all_2", &run_await_all_2},
+        {"await_all_5", &run_await_all_5},
+        {"await_all_10", &run_await_all_10},
+        {"await_any_2", &run_await_any},
+        {"channel_push_pop", &run_channel},
+        {"stackful_switch", &run_stackful_switch}
+    };
+    perf_counters counters;
+    printf("{\"benchmarks\": [\n");
+    for(size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i){
+        run_case(cases[i], op_count, counters);
+    }
+    printf("\n]}\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifdef CORT_ECHO_LATENCY_BENCHMARK
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "../net/cort_tcp_ctrler.h"
+
+//Loopback echo latency of cort_tcp_ctrler with and without optimistic recv(set_disable_optimistic_recv).
+//One op sends depth requests of 32 bytes in one send, then receives the depth responses one by one on a keep alive connection.
+//With depth > 1 the later responses have arrived before try_recv, which is where optimistic recv saves an epoll round trip.
+//Every case prints us/op as one JSON object.
+//Usage: ./cort_echo_latency_benchmark.out [op_count] > result.json
+
+const static size_t request_size = 32;
+char request_content[request_size * 64];
+
+//A blocking echo server in a child process.
+int fork_echo_server(unsigned short& port){
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0
+        || getsockname(listen_fd, (struct sockaddr*)&addr, &len) != 0){
+        printf("echo server error\n");
+        exit(1);
+    }
+    port = ntohs(addr.sin_port);
+    int pid = fork();
+    if(pid == 0){
+        char buffer[4096];
+        while(true){
+            int fd = accept(listen_fd, 0, 0);
+            if(fd < 0){
+                continue;
+            }
+            ssize_t result;
+            while((result = read(fd, buffer, sizeof(buffer))) > 0){
+                if(write(fd, buffer, result) != result){
+                    break;
+                }
+            }
+            close(fd);
+        }
+    }
+    close(listen_fd);
+    return pid;
+}
+
+//The ctrler loops by itself because the connection waiter can only be awaited by the ctrler that locks it.
+//The connection is kept by the ctrler between the cases.
+struct echo_client : public cort_tcp_ctrler{
+    CO_DECL(echo_client)
+    //Awaits try_send or try_recv of the locked waiter, so one CO_AWAIT_AGAIN serves both.
+    struct waiter_step{
+        cort_tcp_connection_waiter* waiter;
+        bool is_send;
+        cort_proto* cort_start(){
+            return is_send ? waiter->try_send() : waiter->try_recv();
+        }
+    }step;
+    size_t rest_op_count;
+    size_t depth;
+    size_t rest_recv_count;
+
+    static recv_buffer_ctrl::recv_buffer_size_t recv_check_function(recv_buffer_ctrl*, cort_tcp_ctrler*){
+        return request_size;
+    }
+
+    echo_client(){
+        set_recv_check_function(&recv_check_function);
+        rest_recv_count = 0;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(lock_connect());
+            if(get_errno() != 0){
+                CO_RETURN;
+            }
+            if(rest_recv_count == 0){
+                if(rest_op_count-- == 0){
+                    CO_RETURN;
+                }
+                send_buffer.clear();
+                set_send_buffer(request_content, (int32_t)(request_size * depth));
+                rest_recv_count = depth;
+                step.waiter = lock_send();
+                step.is_send = true;
+            }
+            else{
+                --rest_recv_count;
+                recv_buffer.clear();
+                alloc_recv_buffer(request_size);
+                step.waiter = lock_recv();
+                step.is_send = false;
+            }
+            CO_AWAIT_AGAIN(&step);
+        CO_END
+    }
+};
+
+struct benchmark_case{
+    const char* name;
+    size_t depth;
+    bool optimistic;
+};
+
+const benchmark_case cases[] = {
+    {"echo_epoll_recv", 1, false},
+    {"echo_optimistic_recv", 1, true},
+    {"echo_epoll_recv", 4, false},
+    {"echo_optimistic_recv", 4, true},
+    {"echo_epoll_recv", 16, false},
+    {"echo_optimistic_recv", 16, true}
+};
+const static size_t case_count = sizeof(cases)/sizeof(cases[0]);
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//Every case runs op_count/10 ops to warm up, then op_count ops measured.
+struct benchmark_driver : public cort_proto{
+    CO_DECL(benchmark_driver)
+    echo_client client;
+    size_t op_count;
+    size_t step;
+    double begin;
+
+    benchmark_driver(size_t op_count_arg, unsigned short port){
+        op_count = op_count_arg;
+        step = 0;
+        begin = 0;
+        client.set_dest_addr("127.0.0.1", port);
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            if(step != 0 && (step & 1) == 0){
+                const benchmark_case& last = cases[(step >> 1) - 1];
+                printf("%s    {\"name\": \"%s\", \"depth\": %zu, \"ops\": %zu, \"us_per_op\": %.3f}", step == 2 ? "" : ",\n",
+                    last.name, last.depth, op_count, (now_ns() - begin) / op_count / 1000);
+            }
+            if(client.get_errno() != 0){
+                printf("error: %s\n", cort_socket_error_codes::error_info(client.get_errno()));
+                CO_RETURN;
+            }
+            if(step == case_count * 2){
+                client.connection_waiter.clear();
+                CO_RETURN;
+            }
+            client.clear();
+            client.depth = cases[step >> 1].depth;
+            client.set_disable_optimistic_recv(cases[step >> 1].optimistic ? 0 : 1);
+            client.rest_op_count = ((step & 1) == 0 ? op_count / 10 + 1 : op_count);
+            begin = now_ns();
+            ++step;
+            CO_AWAIT_AGAIN(&client);
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    size_t op_count = 100000;
+    if(argc > 1){
+        op_count = (size_t)atol(argv[1]);
+    }
+    memset(request_content, 'a', sizeof(request_content));
+    unsigned short port;
+    int pid = fork_echo_server(port);
+    cort_timer_init();
+    printf("{\"benchmarks\": [\n");
+    benchmark_driver driver(op_count, port);
+    driver.start();
+    cort_timer_loop();
+    printf("\n]}\n");
+    cort_timer_destroy();
+    kill(pid, SIGKILL);
+    waitpid(pid, 0, 0);
+    return 0;
+}
+#endif
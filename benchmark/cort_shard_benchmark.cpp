@@ -0,0 +1,95 @@
+#ifdef CORT_SHARD_BENCHMARK
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../net/cort_tcp_shard.h"
+
+//Routing cost of cort_tcp_shard with node_count nodes of weight 1, so node_count * SOCKET_SHARD_VIRTUAL_NODE_COUNT points on the ring.
+//"lookup" routes a hash computed before, "hash_lookup" hashes a 16 bytes key then routes it,
+//"remove_add" removes a node and adds it back, which is the cost of rebalancing.
+//Every case prints ns/op as one JSON object.
+//Usage: ./cort_shard_benchmark.out [op_count] [node_count] > result.json
+
+const static size_t key_size = 16;
+const static size_t key_mask = 4095;
+uint64_t key_hashes[key_mask + 1];
+char keys[key_mask + 1][key_size];
+volatile size_t sink;
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void run_lookup(cort_tcp_shard& shard, size_t op_count){
+    size_t result = 0;
+    for(size_t i = 0; i < op_count; ++i){
+        result += shard.lookup(key_hashes[i & key_mask]);
+    }
+    sink = result;
+}
+
+void run_hash_lookup(cort_tcp_shard& shard, size_t op_count){
+    size_t result = 0;
+    for(size_t i = 0; i < op_count; ++i){
+        result += shard.lookup(cort_tcp_shard::hash_key(keys[i & key_mask], key_size));
+    }
+    sink = result;
+}
+
+void run_remove_add(cort_tcp_shard& shard, size_t op_count){
+    for(size_t i = 0; i < op_count; ++i){
+        const cort_tcp_shard::node& node = shard.get_node(i % shard.size());
+        uint32_t ip = node.ip_v4;
+        uint16_t port = node.port_v4;
+        shard.remove_node(ip, port);
+        shard.add_node(ip, port);
+    }
+}
+
+struct benchmark_case{
+    const char* name;
+    void (*run)(cort_tcp_shard& shard, size_t op_count);
+    size_t op_divisor;      //Rebalancing is much slower than routing.
+};
+
+int main(int argc, char* argv[]){
+    size_t op_count = 10000000;
+    size_t node_count = 1000;
+    if(argc > 1){
+        op_count = (size_t)atol(argv[1]);
+    }
+    if(argc > 2){
+        node_count = (size_t)atol(argv[2]);
+    }
+    cort_tcp_shard shard;
+    for(size_t i = 0; i < node_count; ++i){
+        shard.add_node(htonl(0x0A000000 + (uint32_t)i), htons(80));
+    }
+    for(size_t i = 0; i <= key_mask; ++i){
+        snprintf(keys[i], key_size, "key:%zu", i * 7919);
+        key_hashes[i] = cort_tcp_shard::hash_key(keys[i], key_size);
+    }
+    const benchmark_case cases[] = {
+        {"lookup", &run_lookup, 1},
+        {"hash_lookup", &run_hash_lookup, 1},
+        {"remove_add", &run_remove_add, 10000}
+    };
+    printf("{\"benchmarks\": [\n");
+    for(size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i){
+        size_t case_op_count = op_count / cases[i].op_divisor + 1;
+        cases[i].run(shard, case_op_count / 10 + 1);   //warm up
+        double begin = now_ns();
+        cases[i].run(shard, case_op_count);
+        double cost = now_ns() - begin;
+        printf("%s    {\"name\": \"%s\", \"nodes\": %zu, \"points\": %zu, \"ops\": %zu, \"ns_per_op\": %.3f}", i == 0 ? "" : ",\n",
+            cases[i].name, shard.size(), shard.point_size(), case_op_count, cost / case_op_count);
+    }
+    printf("\n]}\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef CORT_CPP20_H_
+#define CORT_CPP20_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "cort_cpp20.h requires c++20 coroutine support, for example, g++ -std=c++20."
+#endif
+
+#include <stdint.h>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+#include <utility>
+#include "cort_proto.h"
+
+//cort_cpp20.h 让c++20协程(co_await)与cort_proto协程互相等待。
+//1. 在cort_task协程里可以直接co_await任意cort_proto子类的指针(使用其默认入口函数)，例如:
+//       co_await ctrler.lock_connect();
+//       co_await cort_await(&ctrler, &cort_tcp_ctrler::try_recv);  //指定入口函数
+//2. cort_task拥有cort_start函数，所以它可以被CO_AWAIT等待，也可以被另一个cort_task co_await.
+//3. cort_task协程帧默认由每线程的cort_frame_pool分配，也可以通过cort_task的第二个模板参数替换。
+//Interoperation between c++20 coroutines and cort_proto.
+//1. In a cort_task coroutine, you can co_await the pointer of any cort_proto subclass.
+//2. cort_task has cort_start so it can be awaited by CO_AWAIT, or co_await by another cort_task.
+//3. The coroutine frame is allocated by the thread local cort_frame_pool in default.
+//Example:
+//    cort_task<int> fetch(cort_tcp_request_response* req){
+//        co_await req;
+//        co_return req->get_errno();
+//    }
+
+//按64字节分级缓存协程帧的每线程内存池。超过max_pooled_size的帧直接使用malloc。
+//Thread local pool for coroutine frames. The frames are cached by 64 bytes size classes.
+struct cort_frame_pool{
+    const static size_t size_class_shift = 6;
+    const static size_t max_pooled_size = 4096;
+    const static size_t size_class_count = max_pooled_size >> size_class_shift;
+    const static uint32_t max_cached_count = 1024;   //For every size class
+
+    struct free_node{
+        free_node* next;
+    };
+
+    static free_node** get_free_list(){
+        static __thread free_node* free_list[size_class_count];
+        return free_list;
+    }
+
+    static uint32_t* get_cached_count(){
+        static __thread uint32_t cached_count[size_class_count];
+        return cached_count;
+    }
+
+    static size_t get_size_class(size_t size){
+        return (size - 1) >> size_class_shift;
+    }
+
+    static void* alloc(size_t size){
+        if(size > max_pooled_size){
+            return malloc(size);
+        }
+        size_t index = get_size_class(size);
+        free_node*& head = get_free_list()[index];
+        if(head != 0){
+            free_node* result = head;
+            head = result->next;
+            --get_cached_count()[index];
+            return result;
+        }
+        return malloc((index + 1) << size_class_shift);
+    }
+
+    static void free(void* ptr, size_t size){
+        if(size > max_pooled_size){
+            ::free(ptr);
+            return;
+        }
+        size_t index = get_size_class(size);
+        uint32_t& count = get_cached_count()[index];
+        if(count >= max_cached_count){
+            ::free(ptr);
+            return;
+        }
+        free_node* node = (free_node*)ptr;
+        free_node*& head = get_free_list()[index];
+        node->next = head;
+        head = node;
+        ++count;
+    }
+
+    //Free all the cached frames of current thread.
+    static void trim(){
+        for(size_t i = 0; i < size_class_count; ++i){
+            free_node*& head = get_free_list()[i];
+            while(head != 0){
+                free_node* next = head->next;
+                ::free(head);
+                head = next;
+            }
+            get_cached_count()[i] = 0;
+        }
+    }
+};
+
+//cort_task_bridge 是c++20协程在cort_proto世界里的代理: 它被c++20协程等待的子协程当作父协程，也被等待c++20协程的协程当作子协程。
+//The cort_proto agent of a c++20 coroutine. It is the parent of the sub-coroutine awaited by the c++20 coroutine,
+//and it is the sub-coroutine of whom awaiting the c++20 coroutine.
+struct cort_task_bridge : public cort_proto{
+    std::coroutine_handle<> handle;
+
+    cort_task_bridge(){
+        set_run_function(&resume_static);
+    }
+
+    //Start or resume the c++20 coroutine. Return 0 if it is finished.
+    cort_proto* resume_handle(){
+        handle.resume();
+        if(handle.done()){
+            return on_finish();
+        }
+        return this;
+    }
+
+    static cort_proto* resume_static(cort_proto* arg){
+        return ((cort_task_bridge*)arg)->resume_handle();
+    }
+};
+
+template<typename T>
+struct cort_start_awaiter{
+    T* cort;
+    cort_proto* sub_cort;
+
+    explicit cort_start_awaiter(T* arg) : cort(arg), sub_cort(0){}
+
+    bool await_ready(){
+        sub_cort = cort->cort_start();
+        return sub_cort == 0;
+    }
+
+    template<typename promise_t>
+    void await_suspend(std::coroutine_handle<promise_t> awaiting){
+        cort_task_bridge& bridge = awaiting.promise().bridge;
+        sub_cort->set_parent(&bridge);
+        bridge.set_wait_count(1);
+    }
+
+    decltype(auto) await_resume(){
+        if constexpr (requires { cort->get_result(); }){
+            return cort->get_result();
+        }
+    }
+};
+
+//Await a cort_proto with a non default entrance function.
+template<typename T>
+struct cort_member_awaiter{
+    T* cort;
+    cort_proto* (T::*func)();
+    cort_proto* sub_cort;
+
+    cort_member_awaiter(T* arg, cort_proto* (T::*func_arg)()) : cort(arg), func(func_arg), sub_cort(0){}
+
+    bool await_ready(){
+        sub_cort = (cort->*func)();
+        return sub_cort == 0;
+    }
+
+    template<typename promise_t>
+    void await_suspend(std::coroutine_handle<promise_t> awaiting){
+        cort_task_bridge& bridge = awaiting.promise().bridge;
+        sub_cort->set_parent(&bridge);
+        bridge.set_wait_count(1);
+    }
+
+    void await_resume(){}
+};
+
+template<typename T>
+cort_start_awaiter<T> cort_await(T* cort){
+    return cort_start_awaiter<T>(cort);
+}
+
+template<typename T, typename D>
+cort_member_awaiter<T> cort_await(T* cort, cort_proto* (D::*func)()){
+    return cort_member_awaiter<T>(cort, static_cast<cort_proto* (T::*)()>(func));
+}
+
+template<typename frame_allocator_t>
+struct cort_task_promise_base{
+    cort_task_bridge bridge;
+
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+    void unhandled_exception() { std::terminate(); }
+
+    //co_await a pointer of cort_proto subclass, or anything that has cort_start, including cort_task.
+    template<typename A>
+    decltype(auto) await_transform(A&& arg){
+        typedef std::remove_cvref_t<A> arg_type;
+        if constexpr (std::is_pointer_v<arg_type>){
+            return cort_start_awaiter<std::remove_pointer_t<arg_type> >(arg);
+        }
+        else if constexpr (requires { arg.cort_start(); }){
+            return cort_start_awaiter<std::remove_reference_t<A> >(&arg);
+        }
+        else{
+            return std::forward<A>(arg);
+        }
+    }
+
+    static void* operator new(size_t size){
+        return frame_allocator_t::alloc(size);
+    }
+
+    static void operator delete(void* ptr, size_t size){
+        frame_allocator_t::free(ptr, size);
+    }
+};
+
+template<typename T, typename frame_allocator_t>
+struct cort_task_promise : public cort_task_promise_base<frame_allocator_t>{
+    T result;
+    template<typename V>
+    void return_value(V&& value){
+        result = std::forward<V>(value);
+    }
+};
+
+template<typename frame_allocator_t>
+struct cort_task_promise<void, frame_allocator_t> : public cort_task_promise_base<frame_allocator_t>{
+    void return_void(){}
+};
+
+//cort_task 是c++20协程的返回类型。协程在第一次cort_start时才开始执行，cort_task析构时销毁协程帧。
+//所以在协程结束之前请保持cort_task对象存活，这和cort_proto子类对象的生命周期要求是一致的。
+//The c++20 coroutine starts at the first cort_start. The frame is destroyed with the cort_task,
+//so keep the cort_task alive before the coroutine finished, like any cort_proto object.
+template<typename T = void, typename frame_allocator_t = cort_frame_pool>
+struct cort_task{
+    struct promise_type : public cort_task_promise<T, frame_allocator_t>{
+        cort_task get_return_object(){
+            return cort_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    handle_type handle;
+
+    explicit cort_task(handle_type arg) : handle(arg){
+        handle.promise().bridge.handle = handle;
+    }
+
+    cort_task() : handle(){}
+
+    cort_task(cort_task&& rhs) : handle(rhs.handle){
+        rhs.handle = handle_type();
+    }
+
+    cort_task& operator=(cort_task&& rhs){
+        if(this != &rhs){
+            destroy();
+            handle = rhs.handle;
+            rhs.handle = handle_type();
+        }
+        return *this;
+    }
+
+    cort_task(const cort_task&) = delete;
+    cort_task& operator=(const cort_task&) = delete;
+
+    ~cort_task(){
+        destroy();
+    }
+
+    void destroy(){
+        if(handle){
+            handle.destroy();
+            handle = handle_type();
+        }
+    }
+
+    //So CO_AWAIT(&task) and co_await task work. Return 0 if the coroutine is finished.
+    cort_proto* cort_start(){
+        if(is_finished()){
+            return 0;
+        }
+        return handle.promise().bridge.resume_handle();
+    }
+
+    bool is_finished() const{
+        return !handle || handle.done();
+    }
+
+    //The cort_proto agent of the coroutine, for example, you can call get_resumer on it.
+    cort_proto* get_cort() const{
+        return &handle.promise().bridge;
+    }
+
+    decltype(auto) get_result() const{
+        if constexpr (!std::is_void_v<T>){
+            return (handle.promise().result);
+        }
+    }
+};
+
+#endif
@@ -357,7 +357,7 @@ public: \
             __the_sub_cort->set_parent(this); \
             this->set_wait_count(1); \
             this->set_run_function((run_type)(&this_type::do_exec_static)); \
-            return __the_sub_cort; \
+            return this; \
         }\
         goto ____action_begin; \
     }while(false); \
@@ -591,6 +591,24 @@ struct cort_wait_n : public cort_proto{
     }while(false);\
     CO_NEXT_STATE
     
+//等待协程区间中的所有协程，但同一时刻最多只有max_in_flight个子协程在运行，每完成一个才启动下一个。max_in_flight为0表示不限制。
+//注意CO_AWAIT_RANGE_LIMITED不能使用在协程函数的条件分支或者循环体内部，只能使用在第一级大括号内。
+//You can use CO_AWAIT_RANGE_LIMITED to wait all the sub-coroutines between the forward iterators,
+//but no more than max_in_flight of them are running at the same time. The next one is started after one finished.
+//It can not be used in any branch or loop.
+#define CO_AWAIT_RANGE_LIMITED(sub_cort_begin, sub_cort_end, max_in_flight) \
+    CO_AWAIT_RANGE_ANY_N_LIMITED(0, sub_cort_begin, sub_cort_end, max_in_flight)
+
+//等待协程区间中的任意n个的返回，窗口控制同CO_AWAIT_RANGE_LIMITED。n个完成后不再启动新的子协程。
+//Like CO_AWAIT_RANGE_ANY_N with the same window as CO_AWAIT_RANGE_LIMITED. No more sub-coroutine is started after n finished.
+#define CO_AWAIT_RANGE_ANY_N_LIMITED(n, sub_cort_begin, sub_cort_end, max_in_flight) do{ \
+        if(cort_wait_range_limited(this, sub_cort_begin, sub_cort_end, max_in_flight, n) != 0){ \
+            this->set_run_function((run_type)(&CO_JOIN(CO_STATE_NAME, __LINE__)::do_exec_static)); \
+            return this; \
+        } \
+    }while(false);\
+    CO_NEXT_STATE
+
 //等待许多子协程中的任意1个的返回
 #define CO_AWAIT_ANY(...) CO_AWAIT_ANY_N(1, __VA_ARGS__)
 
@@ -640,6 +658,98 @@ cort_proto* cort_wait_range_any(cort_proto* this_ptr, T begin_forward_iterator,
     return this_ptr;
 }
 
+//cort_wait_window 是CO_AWAIT_RANGE_LIMITED使用的窗口协程。它是所有已启动子协程的等待者，
+//每次只等待1个子协程完成(wait_count总是1)，于是每个子协程完成时它都会被resume一次，以便启动下一个。
+//It is the parent of all the running sub-coroutines. Its wait_count is always 1, so it is resumed once every sub-coroutine finished.
+template<typename T>
+struct cort_wait_window : public cort_proto{
+    T current;
+    T end;
+    size_t max_in_flight;
+    size_t in_flight;
+    size_t finished_count;
+    size_t wait_n;      //0 means waiting all.
+    cort_proto* last_finished;
+
+    cort_wait_window(T begin_forward_iterator, T end_forward_iterator, size_t max_in_flight_arg, size_t n){
+        current = begin_forward_iterator;
+        end = end_forward_iterator;
+        max_in_flight = (max_in_flight_arg == 0 ? size_t(-1) : max_in_flight_arg);
+        in_flight = 0;
+        finished_count = 0;
+        wait_n = n;
+        last_finished = 0;
+    }
+
+    bool is_wait_finished() const{
+        return (wait_n != 0 && finished_count >= wait_n) || (in_flight == 0 && current == end);
+    }
+
+    //Start sub-coroutines until the window is full.
+    void fill_window(){
+        while(in_flight < max_in_flight && current != end && !is_wait_finished()){
+            typename std::iterator_traits<T>::value_type tmp_cort_new = (*current);
+            ++current;
+            cort_proto *__the_sub_cort = tmp_cort_new->cort_start();
+            if(__the_sub_cort != 0){
+                __the_sub_cort->set_parent(this);
+                ++in_flight;
+            }
+            else{
+                ++finished_count;
+                last_finished = tmp_cort_new;
+            }
+        }
+    }
+
+    static cort_proto* on_sub_cort_finish(cort_proto* arg){
+        cort_wait_window* this_ptr = (cort_wait_window*)arg;
+        --this_ptr->in_flight;
+        ++this_ptr->finished_count;
+        this_ptr->last_finished = this_ptr->get_resumer();
+        this_ptr->fill_window();
+        this_ptr->set_wait_count(1);
+        cort_proto* parent = this_ptr->get_parent();
+        cort_proto* resumer = this_ptr->last_finished;
+        bool is_window_empty = (this_ptr->in_flight == 0);
+        if(parent != 0 && this_ptr->is_wait_finished()){
+            //Like cort_wait_n, we resume our parent manually and it will not wait us any more.
+            //"this_ptr" should not be visited after parent resumed, because the rest sub-coroutines may finish during that time.
+            this_ptr->remove_parent();
+            if(is_window_empty){
+                delete this_ptr;
+            }
+            parent->set_resumer(resumer);
+            parent->resume();
+        }
+        else if(is_window_empty){
+            delete this_ptr;
+        }
+        return arg; //parent has been resumed mannually so we should not return 0.
+    }
+};
+
+template<typename T>
+cort_proto* cort_wait_range_limited(cort_proto* this_ptr, T begin_forward_iterator, T end_forward_iterator, size_t max_in_flight, size_t n = 0){
+    cort_wait_window<T> *wait_window_cort = new cort_wait_window<T>(begin_forward_iterator, end_forward_iterator, max_in_flight, n);
+    wait_window_cort->fill_window();
+    if(wait_window_cort->is_wait_finished()){
+        this_ptr->set_resumer(wait_window_cort->last_finished);
+        if(wait_window_cort->in_flight == 0){
+            delete wait_window_cort;
+        }
+        else{   //Rest running sub-coroutines are waited by nobody.
+            wait_window_cort->set_wait_count(1);
+            wait_window_cort->set_run_function(&cort_wait_window<T>::on_sub_cort_finish);
+        }
+        return 0;
+    }
+    wait_window_cort->set_parent(this_ptr);
+    wait_window_cort->set_wait_count(1);
+    wait_window_cort->set_run_function(&cort_wait_window<T>::on_sub_cort_finish);
+    return this_ptr;
+}
+
 template<typename T>
 T* cort_set_parent(T* son, cort_proto* parent = 0){
     son->set_parent(parent);
@@ -0,0 +1,155 @@
+#ifndef CORT_RATE_LIMITER_H_
+#define CORT_RATE_LIMITER_H_
+#include "cort_sync.h"
+
+//cort_rate_limiter 是一个令牌桶限速器。令牌按照cort_timer_now_ms()的时间流逝补充，桶的容量即是突发(burst)的上限。
+//令牌不足时等待者按FIFO排队，由同一个补充定时器在令牌足够时成批唤醒，而不是每个等待者各自睡眠一个cort_sleeper。
+//如果设置了max_wait_ms，预计等待时间超过它的等待者会被立即拒绝，已经排队的等待者最多也只会等待max_wait_ms。
+//Token bucket. The tokens are refilled by cort_timer_now_ms() and the bucket capacity is the burst limit.
+//Waiters are queued in FIFO order and resumed in batch by one refill timer.
+//If max_wait_ms is set, a waiter whose estimated waiting time exceeds it is rejected immediately.
+//Example:
+//    CO_AWAIT(limiter.wait_acquire(&waiter));
+//    if(!waiter.is_acquired()){ //rejected or timeout
+//        CO_RETURN;
+//    }
+struct cort_rate_limiter : public cort_sync_proto{
+private:
+    struct refill_timer : public cort_timeout_waiter{
+        CO_DECL(refill_timer)
+        cort_rate_limiter* host;
+        cort_proto* start(){
+            CO_BEGIN
+                CO_YIELD();
+                host->on_refill_timer();
+                CO_YIELD_AGAIN_IF(!is_stopped() && host->has_waiter());
+            CO_END
+        }
+    };
+    friend struct refill_timer;
+
+protected:
+    double tokens;
+    double burst;
+    double rate_per_ms;
+    cort_timeout_waiter::time_ms_t last_refill_time;
+    uint32_t max_wait_ms;
+    refill_timer timer;
+
+public:
+    //rate_per_second should be positive. burst == 0 means the tokens of 1 second(at least 1).
+    cort_rate_limiter(double rate_per_second, double burst_arg = 0, uint32_t max_wait_ms_arg = 0){
+        timer.host = this;
+        tokens = 0;
+        last_refill_time = cort_timer_now_ms();
+        set_rate(rate_per_second, burst_arg);
+        tokens = burst;
+        max_wait_ms = max_wait_ms_arg;
+    }
+
+    void set_rate(double rate_per_second, double burst_arg = 0){
+        refill();
+        rate_per_ms = rate_per_second / 1000;
+        if(burst_arg <= 0){
+            burst_arg = (rate_per_second < 1 ? 1 : rate_per_second);
+        }
+        burst = burst_arg;
+        if(tokens > burst){
+            tokens = burst;
+        }
+    }
+
+    void set_max_wait(uint32_t max_wait_ms_arg){
+        max_wait_ms = max_wait_ms_arg;
+    }
+
+    double get_tokens(){
+        refill();
+        return tokens;
+    }
+
+    void refill(){
+        cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+        if(now > last_refill_time){
+            tokens += (now - last_refill_time) * rate_per_ms;
+            if(tokens > burst){
+                tokens = burst;
+            }
+        }
+        last_refill_time = now;
+    }
+
+    //New comers can not acquire before the earlier waiters.
+    bool try_acquire(size_t acquire_count = 1){
+        if(waiter_head != 0){
+            return false;
+        }
+        refill();
+        if(tokens >= acquire_count){
+            tokens -= acquire_count;
+            return true;
+        }
+        return false;
+    }
+
+    //You can await the result. timeout_ms == 0 means waiting no more than max_wait_ms, or forever if max_wait_ms is 0.
+    cort_sync_waiter* wait_acquire(cort_sync_waiter* waiter, size_t acquire_count = 1, uint32_t timeout_ms = 0){
+        if(timeout_ms == 0 || (max_wait_ms != 0 && timeout_ms > max_wait_ms)){
+            timeout_ms = max_wait_ms;
+        }
+        return waiter->prepare(this, timeout_ms, acquire_count);
+    }
+
+    grant_result try_grant(cort_sync_waiter* waiter){
+        if(try_acquire(waiter->request_count)){
+            return sync_granted;
+        }
+        if(waiter->request_count > burst){ //It will never be satisfied.
+            return sync_rejected;
+        }
+        double need_tokens = waiter_request_count + waiter->request_count - tokens;
+        if(max_wait_ms != 0 && need_tokens > max_wait_ms * rate_per_ms){
+            return sync_rejected;
+        }
+        if(waiter_head == 0){
+            //等待者将排在最前面。定时器可能还在为已经超时离开的等待者计时，所以按这个等待者的需要重新设置。
+            //The waiter will be the first one. The timer may still run for a head waiter that timed out, so it is reset.
+            timer.set_timeout(get_refill_time(waiter->request_count));
+            if(timer.is_finished()){
+                timer.start();
+            }
+        }
+        return sync_wait;
+    }
+
+    //排在最前面的等待者超时离开后，后面的等待者按它自己需要的令牌重新计算补充时间。
+    //The refill timer is for the head waiter, so it is reset for the new head.
+    void on_waiter_left(){
+        if(waiter_head != 0 && !timer.is_finished()){
+            on_refill_timer();
+        }
+    }
+
+protected:
+    uint32_t get_refill_time(size_t acquire_count) const{
+        double need_ms = (acquire_count - tokens) / rate_per_ms;
+        if(need_ms < 1){
+            return 1;
+        }
+        return (uint32_t)need_ms + 1;
+    }
+
+    //Resume all the waiters that can be satisfied now in FIFO order, then wait the refill for the next one.
+    void on_refill_timer(){
+        refill();
+        while(waiter_head != 0 && tokens >= waiter_head->request_count){
+            tokens -= waiter_head->request_count;
+            resume_front();
+        }
+        if(waiter_head != 0){
+            timer.set_timeout(get_refill_time(waiter_head->request_count));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef CORT_SYNC_H_
+#define CORT_SYNC_H_
+#include <assert.h>
+#include "cort_timeout_waiter.h"
+
+//cort_sync.h 提供单个线程(同一个epoll循环)内协程之间的同步原语：cort_semaphore, cort_mutex, cort_condition, cort_wait_group。
+//等待者是一个cort_sync_waiter协程，通常把它定义为等待方协程的成员变量，所以等待与唤醒都不需要分配内存。
+//所有等待者按照FIFO的顺序被唤醒。等待时可以设置超时(毫秒)，超时由cort_timeout_waiter的时间堆管理。
+//Synchronization primitives for the coroutines in one thread. The waiter is a cort_sync_waiter, usually a member of
+//the waiting coroutine, so wait and wakeup are allocation-free. Waiters are woken in FIFO order.
+//Example:
+//    cort_sync_waiter waiter; //member of your coroutine class
+//    ...
+//    CO_AWAIT(mutex.wait_lock(&waiter, 100));
+//    if(!waiter.is_acquired()){ //timeout
+//        CO_RETURN;
+//    }
+//    ...
+//    mutex.unlock();
+
+struct cort_sync_waiter;
+
+struct cort_sync_proto{
+private:
+    cort_sync_proto(const cort_sync_proto&);
+    cort_sync_proto& operator=(const cort_sync_proto&);
+protected:
+    cort_sync_waiter* waiter_head;
+    cort_sync_waiter* waiter_tail;
+    size_t waiter_count;
+    size_t waiter_request_count;    //Sum of the request_count of the waiters.
+public:
+    cort_sync_proto(){
+        waiter_head = 0;
+        waiter_tail = 0;
+        waiter_count = 0;
+        waiter_request_count = 0;
+    }
+    virtual ~cort_sync_proto(){
+        assert(waiter_count == 0); // Some coroutines are still waiting? This is a check.
+    }
+
+    //当前有多少个协程在等待
+    size_t get_waiter_count() const{
+        return waiter_count;
+    }
+
+    bool has_waiter() const{
+        return waiter_count != 0;
+    }
+
+    enum grant_result{
+        sync_wait = 0,
+        sync_granted = 1,
+        sync_rejected = 2
+    };
+
+    //waiter开始等待时调用。返回sync_granted表示不用等待，立即获得成功；sync_rejected表示不用等待，立即失败。
+    //Return sync_granted or sync_rejected if the waiter does not need to wait.
+    virtual grant_result try_grant(cort_sync_waiter* waiter) = 0;
+
+    //等待者因超时或者时间堆被销毁而离开队列后调用，排在它后面的等待者可能因此可以获得成功。
+    //Called after a waiter leaves the queue without being granted, so the waiters behind it may be granted now.
+    virtual void on_waiter_left(){}
+
+    inline void push_waiter(cort_sync_waiter* waiter);
+    inline void remove_waiter(cort_sync_waiter* waiter);
+
+    //唤醒最早的等待者，返回被唤醒的等待者。注意被唤醒者(和它的等待者)会在这个函数返回之前执行。
+    //Resume the earliest waiter. Notice the waiter and its parent are resumed before this function returns.
+    inline cort_sync_waiter* resume_front();
+};
+
+struct cort_sync_waiter : public cort_timeout_waiter{
+    CO_DECL(cort_sync_waiter, wait)
+
+    cort_sync_waiter* prev;
+    cort_sync_waiter* next;
+    cort_sync_proto* host;
+    size_t request_count;       //For example, the count that cort_semaphore::wait_acquire requires.
+    uint32_t wait_timeout;
+    uint8_t acquired;           //cort_sync_proto::grant_result
+
+    cort_sync_waiter(){
+        prev = 0;
+        next = 0;
+        host = 0;
+        request_count = 1;
+        wait_timeout = 0;
+        acquired = 0;
+    }
+
+    //Used by the wait_xxx functions of the primitives.
+    cort_sync_waiter* prepare(cort_sync_proto* host_arg, uint32_t timeout_ms, size_t count = 1){
+        host = host_arg;
+        wait_timeout = timeout_ms;
+        request_count = count;
+        acquired = 0;
+        return this;
+    }
+
+    //等待是否成功，false表示超时，被拒绝或者时间堆被销毁了
+    //Return false if timeout, rejected or stopped.
+    bool is_acquired() const{
+        return acquired == cort_sync_proto::sync_granted;
+    }
+
+    //The primitive refused the waiter without waiting.
+    bool is_rejected() const{
+        return acquired == cort_sync_proto::sync_rejected;
+    }
+
+    bool is_waiting() const{
+        return host != 0 && !is_finished();
+    }
+
+    cort_proto* wait(){
+        CO_BEGIN
+            //Clear the timeout result of the last time.
+            time_cost_ms = 0;
+            start_time_ms = cort_timer_now_ms();
+            acquired = (uint8_t)host->try_grant(this);
+            if(acquired != cort_sync_proto::sync_wait){
+                CO_RETURN;
+            }
+            host->push_waiter(this);
+            if(wait_timeout != 0){
+                set_timeout(wait_timeout);
+            }
+            CO_YIELD();
+            if(acquired == cort_sync_proto::sync_wait){ //timeout or stopped
+                host->remove_waiter(this);
+                host->on_waiter_left();
+            }
+        CO_END
+    }
+};
+
+inline void cort_sync_proto::push_waiter(cort_sync_waiter* waiter){
+    waiter->next = 0;
+    waiter->prev = waiter_tail;
+    if(waiter_tail != 0){
+        waiter_tail->next = waiter;
+    }
+    else{
+        waiter_head = waiter;
+    }
+    waiter_tail = waiter;
+    ++waiter_count;
+    waiter_request_count += waiter->request_count;
+}
+
+inline void cort_sync_proto::remove_waiter(cort_sync_waiter* waiter){
+    if(waiter->prev != 0){
+        waiter->prev->next = waiter->next;
+    }
+    else{
+        waiter_head = waiter->next;
+    }
+    if(waiter->next != 0){
+        waiter->next->prev = waiter->prev;
+    }
+    else{
+        waiter_tail = waiter->prev;
+    }
+    waiter->prev = 0;
+    waiter->next = 0;
+    --waiter_count;
+    waiter_request_count -= waiter->request_count;
+}
+
+inline cort_sync_waiter* cort_sync_proto::resume_front(){
+    cort_sync_waiter* waiter = waiter_head;
+    if(waiter != 0){
+        remove_waiter(waiter);
+        waiter->acquired = sync_granted;
+        waiter->resume();
+    }
+    return waiter;
+}
+
+//信号量。release时按照FIFO顺序把计数交给等待者，有等待者时新来的协程不能插队。
+//Counting semaphore. New comers can not acquire before the earlier waiters.
+struct cort_semaphore : public cort_sync_proto{
+protected:
+    size_t count;
+public:
+    cort_semaphore(size_t init_count = 0){
+        count = init_count;
+    }
+
+    size_t get_count() const{
+        return count;
+    }
+
+    //You can await the result, timeout_ms == 0 means waiting forever.
+    cort_sync_waiter* wait_acquire(cort_sync_waiter* waiter, uint32_t timeout_ms = 0, size_t acquire_count = 1){
+        return waiter->prepare(this, timeout_ms, acquire_count);
+    }
+
+    bool try_acquire(size_t acquire_count = 1){
+        if(count >= acquire_count && waiter_head == 0){
+            count -= acquire_count;
+            return true;
+        }
+        return false;
+    }
+
+    void release(size_t release_count = 1){
+        count += release_count;
+        while(waiter_head != 0 && waiter_head->request_count <= count){
+            count -= waiter_head->request_count;
+            resume_front();
+        }
+    }
+
+    grant_result try_grant(cort_sync_waiter* waiter){
+        return try_acquire(waiter->request_count) ? sync_granted : sync_wait;
+    }
+
+    //The head waiter asking for more than count may time out, then the smaller requests behind it are granted.
+    void on_waiter_left(){
+        release(0);
+    }
+};
+
+//互斥锁。unlock时如果有等待者，锁直接交给最早的等待者。
+//When unlocked, the lock is handed to the earliest waiter directly.
+struct cort_mutex : public cort_sync_proto{
+protected:
+    bool locked;
+public:
+    cort_mutex(){
+        locked = false;
+    }
+
+    bool is_locked() const{
+        return locked;
+    }
+
+    //You can await the result, timeout_ms == 0 means waiting forever.
+    cort_sync_waiter* wait_lock(cort_sync_waiter* waiter, uint32_t timeout_ms = 0){
+        return waiter->prepare(this, timeout_ms);
+    }
+
+    bool try_lock(){
+        if(!locked){
+            locked = true;
+            return true;
+        }
+        return false;
+    }
+
+    void unlock(){
+        assert(locked); // Some coroutines unlock before lock? This is a check.
+        if(waiter_head != 0){
+            resume_front();
+        }
+        else{
+            locked = false;
+        }
+    }
+
+    grant_result try_grant(cort_sync_waiter*){
+        return try_lock() ? sync_granted : sync_wait;
+    }
+};
+
+//条件变量。因为同一线程内的协程不会被抢占，所以"先unlock再wait_notified"本身就是原子的，不需要关联cort_mutex。
+//Coroutines in one thread are not preemptive, so "unlock then wait_notified" is atomic in fact.
+struct cort_condition : public cort_sync_proto{
+    //You can await the result, timeout_ms == 0 means waiting forever.
+    cort_sync_waiter* wait_notified(cort_sync_waiter* waiter, uint32_t timeout_ms = 0){
+        return waiter->prepare(this, timeout_ms);
+    }
+
+    void notify_one(){
+        resume_front();
+    }
+
+    //Only the waiters that waiting before notify_all are resumed.
+    void notify_all(){
+        size_t n = waiter_count;
+        while(n-- != 0 && resume_front() != 0){
+        }
+    }
+
+    grant_result try_grant(cort_sync_waiter*){
+        return sync_wait;
+    }
+};
+
+//等待一组任务全部完成。add增加任务个数，done减少。减到0时唤醒所有等待者。
+//add increases the task count and done decreases it. All the waiters are resumed when it decreases to 0.
+struct cort_wait_group : public cort_sync_proto{
+protected:
+    size_t count;
+public:
+    cort_wait_group(size_t init_count = 0){
+        count = init_count;
+    }
+
+    size_t get_count() const{
+        return count;
+    }
+
+    void add(size_t n = 1){
+        count += n;
+    }
+
+    void done(size_t n = 1){
+        assert(count >= n); // Some coroutines done more than added? This is a check.
+        count -= n;
+        while(count == 0 && resume_front() != 0){
+        }
+    }
+
+    //You can await the result, timeout_ms == 0 means waiting forever.
+    cort_sync_waiter* wait_all_done(cort_sync_waiter* waiter, uint32_t timeout_ms = 0){
+        return waiter->prepare(this, timeout_ms);
+    }
+
+    grant_result try_grant(cort_sync_waiter*){
+        return count == 0 ? sync_granted : sync_wait;
+    }
+};
+
+#endif
@@ -2,4 +2,5 @@
 ./make_clean.sh
 ./make_lib.sh
 ./make_unit_test.sh
-./make_pressure_test_O2.sh
\ No newline at end of file
+./make_pressure_test_O2.sh
+./make_benchmark.sh
\ No newline at end of file
@@ -0,0 +1,4 @@
+#!/bin/bash
+g++ -Wall -g -O2 -DNDEBUG $@ benchmark/*.cpp stackful/cort_stackful.cpp stackful/*.S -DCORT_CORE_BENCHMARK -o cort_core_benchmark.out
+g++ -Wall -g -O2 -DNDEBUG $@ benchmark/*.cpp *.cpp net/*.cpp -DCORT_ECHO_LATENCY_BENCHMARK -o cort_echo_latency_benchmark.out
+g++ -Wall -g -O2 -DNDEBUG $@ benchmark/*.cpp *.cpp net/*.cpp -DCORT_SHARD_BENCHMARK -o cort_shard_benchmark.out
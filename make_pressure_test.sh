@@ -3,6 +3,8 @@
 g++ -Wall -g  $@ *.cpp net/*.cpp  pressure_test/*.cpp -DCORT_SERVER_ECHO_TEST -Wl,-rpath=./ -o cort_server_echo_test.out
 g++ -Wall -g  $@ *.cpp net/*.cpp  pressure_test/*.cpp -DCORT_CLIENT_ECHO_TEST -Wl,-rpath=./ -o cort_client_echo_test.out
 g++ -Wall -g  $@ *.cpp net/*.cpp  pressure_test/*.cpp -DCORT_CLIENT_ECHO_INFINITE_TEST -Wl,-rpath=./ -o cort_client_echo_infinite_test.out
+g++ -Wall -g  $@ -std=c++20 *.cpp net/*.cpp  pressure_test/*.cpp -DCORT_CPP20_RESUME_TEST -Wl,-rpath=./ -o cort_cpp20_resume_test.out
+g++ -Wall -g  $@ *.cpp net/*.cpp  pressure_test/*.cpp -DCORT_ZERO_COPY_SEND_TEST -Wl,-rpath=./ -o cort_zero_copy_send_test.out
 
 #create a hooked version of libcurl.a
 cp pressure_test/curl/lib/libcurl.a pressure_test/curl/lib/libcurl_hook.a
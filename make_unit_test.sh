@@ -3,3 +3,18 @@
 g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_PROTO_TEST -Wl,-rpath=./ -o cort_proto_test.out
 g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TIMEOUT_WAITER_TEST -Wl,-rpath=./ -o cort_timeout_waiter_test.out
 g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_CTRLER_TEST -Wl,-rpath=./ -o cort_tcp_ctrler_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_SYNC_TEST -Wl,-rpath=./ -o cort_sync_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_MULTIPLEXER_TEST -Wl,-rpath=./ -o cort_tcp_multiplexer_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_PIPELINE_SERVER_TEST -Wl,-rpath=./ -o cort_tcp_pipeline_server_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_CONNECTION_POOL_TEST -Wl,-rpath=./ -o cort_tcp_connection_pool_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_SOURCE_ADDR_TEST -Wl,-rpath=./ -o cort_tcp_source_addr_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_CLUSTER_TEST -Wl,-rpath=./ -o cort_tcp_cluster_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_SHARD_TEST -Wl,-rpath=./ -o cort_tcp_shard_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_CIRCUIT_BREAKER_TEST -Wl,-rpath=./ -o cort_tcp_circuit_breaker_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_HEDGED_REQUEST_TEST -Wl,-rpath=./ -o cort_tcp_hedged_request_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_QUORUM_TEST -Wl,-rpath=./ -o cort_tcp_quorum_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_RETRY_REQUEST_TEST -Wl,-rpath=./ -o cort_tcp_retry_request_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_CONCURRENCY_LIMITER_TEST -Wl,-rpath=./ -o cort_tcp_concurrency_limiter_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_TCP_REQUEST_RESPONSE_TEST -Wl,-rpath=./ -o cort_tcp_request_response_test.out
+g++ -Wall -g $@ *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_RATE_LIMITER_TEST -Wl,-rpath=./ -o cort_rate_limiter_test.out
+g++ -Wall -g $@ -std=c++20 *.cpp net/*.cpp unit_test/*.cpp  pressure_test/*.cpp -DCORT_CPP20_TEST -Wl,-rpath=./ -o cort_cpp20_test.out
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cort_buffer_pool.h"
+
+namespace{
+	struct buffer_header{
+		size_t capacity;		//Usable size after the header.
+		uint32_t size_class;	//cort_buffer_pool::class_count means it is not pooled.
+	};
+
+	struct free_node{
+		free_node* next;
+	};
+
+	struct thread_pool{
+		free_node* free_list[cort_buffer_pool::class_count];
+		cort_buffer_pool::stats stat;
+		size_t high_water;
+		bool initialized;
+	};
+
+	inline thread_pool& get_thread_pool(){
+		static __thread thread_pool pool;
+		if(!pool.initialized){
+			pool.high_water = cort_buffer_pool::default_high_water;
+			pool.initialized = true;
+		}
+		return pool;
+	}
+
+	inline uint32_t get_size_class(size_t total_size){
+		if(total_size <= cort_buffer_pool::min_pooled_size){
+			return 0;
+		}
+		return (uint32_t)(64 - __builtin_clzll((unsigned long long)(total_size - 1))) - cort_buffer_pool::min_class_shift;
+	}
+
+	inline buffer_header* get_header(const void* ptr){
+		return (buffer_header*)((char*)ptr - cort_buffer_pool::header_size);
+	}
+
+	inline size_t get_cached_limit(const thread_pool& pool, uint32_t size_class){
+		return pool.high_water >> (size_class + cort_buffer_pool::min_class_shift);
+	}
+}
+
+void* cort_buffer_pool::alloc(size_t size){
+	thread_pool& pool = get_thread_pool();
+	size_t total_size = size + header_size;
+	buffer_header* header;
+	if(total_size > max_pooled_size){
+		++pool.stat.miss_count;
+		header = (buffer_header*)malloc(total_size);
+		if(header == 0){
+			return 0;
+		}
+		header->capacity = size;
+		header->size_class = class_count;
+		return (char*)header + header_size;
+	}
+	uint32_t size_class = get_size_class(total_size);
+	free_node*& head = pool.free_list[size_class];
+	size_t class_size = size_t(1) << (size_class + min_class_shift);
+	if(head != 0){
+		++pool.stat.hit_count;
+		header = (buffer_header*)head;
+		head = head->next;
+		--pool.stat.cached_count[size_class];
+		pool.stat.cached_bytes -= class_size;
+	}
+	else{
+		++pool.stat.miss_count;
+		header = (buffer_header*)malloc(class_size);
+		if(header == 0){
+			return 0;
+		}
+	}
+	header->capacity = class_size - header_size;
+	header->size_class = size_class;
+	return (char*)header + header_size;
+}
+
+void cort_buffer_pool::free(void* ptr){
+	if(ptr == 0){
+		return;
+	}
+	buffer_header* header = get_header(ptr);
+	uint32_t size_class = header->size_class;
+	if(size_class == class_count){
+		::free(header);
+		return;
+	}
+	thread_pool& pool = get_thread_pool();
+	if(pool.stat.cached_count[size_class] >= get_cached_limit(pool, size_class)){
+		++pool.stat.trim_count;
+		::free(header);
+		return;
+	}
+	free_node* node = (free_node*)header;
+	node->next = pool.free_list[size_class];
+	pool.free_list[size_class] = node;
+	++pool.stat.cached_count[size_class];
+	pool.stat.cached_bytes += size_t(1) << (size_class + min_class_shift);
+}
+
+void* cort_buffer_pool::realloc(void* ptr, size_t size){
+	if(ptr == 0){
+		return alloc(size);
+	}
+	buffer_header* header = get_header(ptr);
+	if(header->size_class == class_count){
+		if(size + header_size > max_pooled_size){
+			header = (buffer_header*)::realloc(header, size + header_size);
+			if(header == 0){
+				return 0;
+			}
+			header->capacity = size;
+			return (char*)header + header_size;
+		}
+	}
+	else if(get_size_class(size + header_size) == header->size_class){
+		return ptr;
+	}
+	void* result = alloc(size);
+	if(result == 0){
+		return 0;
+	}
+	memcpy(result, ptr, (size < header->capacity ? size : header->capacity));
+	free(ptr);
+	return result;
+}
+
+size_t cort_buffer_pool::capacity(const void* ptr){
+	return get_header(ptr)->capacity;
+}
+
+void cort_buffer_pool::set_high_water(size_t bytes){
+	get_thread_pool().high_water = bytes;
+	trim(bytes);
+}
+
+size_t cort_buffer_pool::get_high_water(){
+	return get_thread_pool().high_water;
+}
+
+void cort_buffer_pool::trim(size_t keep_bytes){
+	thread_pool& pool = get_thread_pool();
+	for(uint32_t i = 0; i < class_count; ++i){
+		size_t class_size = size_t(1) << (i + min_class_shift);
+		size_t keep_count = keep_bytes / class_size;
+		free_node*& head = pool.free_list[i];
+		while(pool.stat.cached_count[i] > keep_count){
+			free_node* next = head->next;
+			::free(head);
+			head = next;
+			--pool.stat.cached_count[i];
+			pool.stat.cached_bytes -= class_size;
+			++pool.stat.trim_count;
+		}
+	}
+}
+
+const cort_buffer_pool::stats& cort_buffer_pool::get_stats(){
+	return get_thread_pool().stat;
+}
@@ -0,0 +1,48 @@
+#ifndef CORT_BUFFER_POOL_H_
+#define CORT_BUFFER_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Thread local pool of the recv/send buffers, used by recv_buffer_ctrl and send_buffer_ctrl.
+//The buffers are cached in power of two size classes from min_pooled_size to max_pooled_size, the header is included.
+//Larger buffers are allocated by malloc directly.
+//A size class keeps no more than its high water bytes, the rest buffers are freed when released.
+//A buffer can be released in another thread, then it is cached by that thread.
+struct cort_buffer_pool{
+	const static uint32_t min_class_shift = 6;		//64 bytes
+	const static uint32_t max_class_shift = 17;		//128K bytes
+	const static uint32_t class_count = max_class_shift - min_class_shift + 1;
+	const static size_t min_pooled_size = size_t(1) << min_class_shift;
+	const static size_t max_pooled_size = size_t(1) << max_class_shift;
+	const static size_t header_size = 16;			//Keep the alignment of malloc.
+	const static size_t default_high_water = 1<<20;	//Bytes cached for every size class.
+
+	struct stats{
+		uint64_t hit_count;
+		uint64_t miss_count;		//Including the allocations larger than max_pooled_size.
+		uint64_t trim_count;		//Buffers freed because the size class is above the high water.
+		size_t cached_bytes;
+		size_t cached_count[class_count];
+	};
+
+	//Same as malloc/realloc/free, but the buffer must be released by cort_buffer_pool.
+	static void* alloc(size_t size);
+	static void* realloc(void* ptr, size_t size);
+	static void free(void* ptr);
+
+	//The usable size of a buffer, it may be larger than the size allocated.
+	static size_t capacity(const void* ptr);
+
+	//High water bytes of every size class of current thread. 0 means nothing is cached.
+	static void set_high_water(size_t bytes);
+	static size_t get_high_water();
+
+	//Free the cached buffers of current thread until every size class has no more than keep_bytes.
+	static void trim(size_t keep_bytes = 0);
+
+	//Statistics of current thread.
+	static const stats& get_stats();
+};
+
+#endif
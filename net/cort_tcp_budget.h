@@ -0,0 +1,63 @@
+#ifndef CORT_TCP_BUDGET_H_
+#define CORT_TCP_BUDGET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+
+//Extra requests(retries, backups) a caller can send now. Every normal request earns percent/100, saved up to burst,
+//and every extra request spends 1. So the extra requests add no more than percent of the load.
+struct cort_token_budget{
+	double tokens;
+
+	void init(double burst){
+		tokens = burst;
+	}
+
+	void earn(uint32_t percent, double burst){
+		tokens += percent / 100.0;
+		if(tokens > burst){
+			tokens = burst;
+		}
+	}
+
+	bool try_spend(){
+		if(tokens < 1){
+			return false;
+		}
+		tokens -= 1;
+		return true;
+	}
+};
+
+//xorshift64, it is fast and good enough for jitters and load balancing. The seed should not be 0.
+inline uint64_t cort_random_seed(const void* owner){
+	return (uint64_t)(size_t)owner ^ 0x9E3779B97F4A7C15ULL;
+}
+
+inline uint64_t cort_random_next(uint64_t& state){
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+//Called before a new entry is added to a table of destinations whose size is limited by max_count.
+//If the table is full, the entries can_forget returns true for are erased. Returns false if it is still full.
+template<typename T>
+bool cort_make_room(std::map<uint64_t, T>& table, size_t max_count, bool (*can_forget)(const T&)){
+	if(table.size() < max_count){
+		return true;
+	}
+	for(typename std::map<uint64_t, T>::iterator it = table.begin(); it != table.end();){
+		if(can_forget(it->second)){
+			table.erase(it++);
+		}
+		else{
+			++it;
+		}
+	}
+	return table.size() < max_count;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+#include "cort_tcp_circuit_breaker.h"
+#include "cort_tcp_connection_pool.h"
+#include "cort_tcp_budget.h"
+
+namespace{
+	typedef std::map<uint64_t, cort_tcp_circuit_breaker::state> breaker_table;
+
+	struct thread_breakers{
+		breaker_table* table;		//0 if disabled.
+		cort_tcp_circuit_breaker::policy* current_policy;
+		cort_tcp_circuit_breaker::stats stat;
+	};
+
+	inline thread_breakers& get_thread_breakers(){
+		static __thread thread_breakers breakers;
+		return breakers;
+	}
+
+	inline uint64_t get_key(uint32_t ip_arg, uint16_t port_arg){
+		ip_v4_key key(ip_arg, port_arg, 0);
+		return key.data.i_data;
+	}
+
+	//Forget the healthy ones when the table is full, the breakers with failures are kept.
+	bool is_healthy(const cort_tcp_circuit_breaker::state& arg){
+		return arg.status == cort_tcp_circuit_breaker::breaker_closed && arg.window_failure_count == 0;
+	}
+
+	cort_tcp_circuit_breaker::state* find_or_create(thread_breakers& breakers, uint64_t key){
+		breaker_table::iterator it = breakers.table->find(key);
+		if(it != breakers.table->end()){
+			return &it->second;
+		}
+		if(!cort_make_room(*breakers.table, cort_socket_config::SOCKET_BREAKER_MAX_COUNT, is_healthy)){
+			return 0;
+		}
+		cort_tcp_circuit_breaker::state& result = (*breakers.table)[key];
+		memset(&result, 0, sizeof(result));
+		result.window_start = cort_timer_now_ms();
+		breakers.stat.breaker_count = breakers.table->size();
+		return &result;
+	}
+
+	void open_breaker(thread_breakers& breakers, cort_tcp_circuit_breaker::state& arg, cort_timeout_waiter::time_ms_t now){
+		const cort_tcp_circuit_breaker::policy& current_policy = *breakers.current_policy;
+		uint64_t open_ms = current_policy.open_ms;
+		for(uint32_t i = 0; i < arg.reopen_count && open_ms < current_policy.max_open_ms; ++i){
+			open_ms <<= 1;
+		}
+		if(open_ms > current_policy.max_open_ms){
+			open_ms = current_policy.max_open_ms;
+		}
+		if(arg.status == cort_tcp_circuit_breaker::breaker_closed){
+			++breakers.stat.open_breaker_count;
+		}
+		arg.status = cort_tcp_circuit_breaker::breaker_open;
+		arg.open_until = now + open_ms;
+		++arg.reopen_count;
+		++arg.open_count;
+		++breakers.stat.open_count;
+	}
+
+	void close_breaker(thread_breakers& breakers, cort_tcp_circuit_breaker::state& arg, cort_timeout_waiter::time_ms_t now){
+		arg.status = cort_tcp_circuit_breaker::breaker_closed;
+		arg.reopen_count = 0;
+		arg.consecutive_failure_count = 0;
+		arg.window_request_count = 0;
+		arg.window_failure_count = 0;
+		arg.window_start = now;
+		--breakers.stat.open_breaker_count;
+		++breakers.stat.close_count;
+	}
+}
+
+cort_tcp_circuit_breaker::policy::policy(){
+	consecutive_failures = cort_socket_config::SOCKET_BREAKER_CONSECUTIVE_FAILURES;
+	failure_percent = cort_socket_config::SOCKET_BREAKER_FAILURE_PERCENT;
+	min_requests = cort_socket_config::SOCKET_BREAKER_MIN_REQUESTS;
+	window_ms = cort_socket_config::SOCKET_BREAKER_WINDOW_MS;
+	open_ms = cort_socket_config::SOCKET_BREAKER_OPEN_MS;
+	max_open_ms = cort_socket_config::SOCKET_BREAKER_MAX_OPEN_MS;
+	probe_count = cort_socket_config::SOCKET_BREAKER_PROBE_COUNT;
+	probe_timeout_ms = cort_socket_config::SOCKET_BREAKER_PROBE_TIMEOUT_MS;
+	failure_mask = default_failure_mask();
+}
+
+//The errors caused by the remote or the network. Bad responses(SOCKET_RECEIVED_CHECK_ERROR) and local errors are not included.
+uint64_t cort_tcp_circuit_breaker::policy::default_failure_mask(){
+	return (1ULL << cort_socket_error_codes::SOCKET_CONNECT_ERROR)
+		| (1ULL << cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT)
+		| (1ULL << cort_socket_error_codes::SOCKET_CONNECT_REJECTED)
+		| (1ULL << cort_socket_error_codes::SOCKET_REMOTE_CANCELED)
+		| (1ULL << cort_socket_error_codes::SOCKET_SEND_ERROR)
+		| (1ULL << cort_socket_error_codes::SOCKET_RECEIVE_ERROR);
+}
+
+void cort_tcp_circuit_breaker::set_policy(const policy* arg){
+	thread_breakers& breakers = get_thread_breakers();
+	if(arg == 0){
+		delete breakers.table;
+		breakers.table = 0;
+		delete breakers.current_policy;
+		breakers.current_policy = 0;
+		breakers.stat.open_breaker_count = 0;
+		breakers.stat.breaker_count = 0;
+		return;
+	}
+	if(breakers.table == 0){
+		breakers.table = new breaker_table();
+		breakers.current_policy = new policy();
+	}
+	*breakers.current_policy = *arg;
+	if(breakers.current_policy->probe_count == 0){
+		breakers.current_policy->probe_count = 1;
+	}
+	if(breakers.current_policy->probe_timeout_ms == 0){
+		breakers.current_policy->probe_timeout_ms = cort_socket_config::SOCKET_BREAKER_PROBE_TIMEOUT_MS;
+	}
+}
+
+bool cort_tcp_circuit_breaker::is_enabled(){
+	return get_thread_breakers().table != 0;
+}
+
+const cort_tcp_circuit_breaker::state* cort_tcp_circuit_breaker::get_state(uint32_t ip_arg, uint16_t port_arg){
+	thread_breakers& breakers = get_thread_breakers();
+	if(breakers.table == 0){
+		return 0;
+	}
+	breaker_table::const_iterator it = breakers.table->find(get_key(ip_arg, port_arg));
+	return it == breakers.table->end() ? 0 : &it->second;
+}
+
+const cort_tcp_circuit_breaker::stats& cort_tcp_circuit_breaker::get_stats(){
+	return get_thread_breakers().stat;
+}
+
+bool cort_tcp_circuit_breaker::allow(uint32_t ip_arg, uint16_t port_arg){
+	thread_breakers& breakers = get_thread_breakers();
+	if(breakers.table == 0){
+		return true;
+	}
+	breaker_table::iterator it = breakers.table->find(get_key(ip_arg, port_arg));
+	if(it == breakers.table->end() || it->second.status == breaker_closed){
+		return true;
+	}
+	state& current = it->second;
+	const policy& current_policy = *breakers.current_policy;
+	cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+	if(current.status == breaker_open){
+		if(now < current.open_until){
+			++current.reject_count;
+			++breakers.stat.reject_count;
+			return false;
+		}
+		current.status = breaker_half_open;
+		current.probe_count = 0;
+		current.probe_success_count = 0;
+		current.probe_until = now + current_policy.probe_timeout_ms;
+	}
+	else if(now >= current.probe_until){
+		if(current.probe_count != 0){ //The probes hang, maybe they are lost without a report.
+			open_breaker(breakers, current, now);
+			++current.reject_count;
+			++breakers.stat.reject_count;
+			return false;
+		}
+		current.probe_until = now + current_policy.probe_timeout_ms;
+	}
+	if(current.probe_count + current.probe_success_count < current_policy.probe_count){
+		++current.probe_count;
+		return true;
+	}
+	//The probes are still in flight.
+	++current.reject_count;
+	++breakers.stat.reject_count;
+	return false;
+}
+
+void cort_tcp_circuit_breaker::release(uint32_t ip_arg, uint16_t port_arg){
+	thread_breakers& breakers = get_thread_breakers();
+	if(breakers.table == 0){
+		return;
+	}
+	breaker_table::iterator it = breakers.table->find(get_key(ip_arg, port_arg));
+	if(it != breakers.table->end() && it->second.status == breaker_half_open && it->second.probe_count != 0){
+		--it->second.probe_count;
+	}
+}
+
+void cort_tcp_circuit_breaker::report(uint32_t ip_arg, uint16_t port_arg, uint8_t err){
+	thread_breakers& breakers = get_thread_breakers();
+	if(breakers.table == 0 || err == cort_socket_error_codes::SOCKET_CIRCUIT_OPEN){
+		return;
+	}
+	const policy& current_policy = *breakers.current_policy;
+	bool failed = (err != 0);
+	if(failed && (err >= 64 || ((current_policy.failure_mask >> err) & 1) == 0)){ //Not the fault of the destination.
+		release(ip_arg, port_arg);
+		return;
+	}
+	state* current = find_or_create(breakers, get_key(ip_arg, port_arg));
+	if(current == 0){
+		return;
+	}
+	cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+	++current->request_count;
+	if(failed){
+		++current->failure_count;
+	}
+	if(current->status == breaker_half_open){
+		if(current->probe_count != 0){
+			--current->probe_count;
+		}
+		if(failed){
+			open_breaker(breakers, *current, now);
+		}
+		else if(++current->probe_success_count >= current_policy.probe_count){
+			close_breaker(breakers, *current, now);
+		}
+		return;
+	}
+	if(current->status == breaker_open){ //Sent before it opened.
+		return;
+	}
+	if(now - current->window_start >= current_policy.window_ms){
+		current->window_start = now;
+		current->window_request_count = 0;
+		current->window_failure_count = 0;
+	}
+	++current->window_request_count;
+	if(!failed){
+		current->consecutive_failure_count = 0;
+		return;
+	}
+	++current->window_failure_count;
+	++current->consecutive_failure_count;
+	if((current_policy.consecutive_failures != 0 && current->consecutive_failure_count >= current_policy.consecutive_failures)
+		|| (current_policy.failure_percent != 0 && current->window_request_count >= current_policy.min_requests
+			&& current->window_failure_count * 100 >= current_policy.failure_percent * current->window_request_count)){
+		open_breaker(breakers, *current, now);
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef CORT_TCP_CIRCUIT_BREAKER_H_
+#define CORT_TCP_CIRCUIT_BREAKER_H_
+
+#include "cort_tcp_ctrler.h"
+
+//Thread local circuit breakers of the destinations(ip:port), used by cort_tcp_request_response.
+//A breaker opens when the destination fails consecutive_failures times in a row, or failure_percent of the requests in a window fail.
+//While it is open, the requests fail at once with SOCKET_CIRCUIT_OPEN, without connecting or waiting for the timeout.
+//After open_ms it is half open: probe_count requests are let through, it closes when all of them succeed and opens again when one fails.
+//A probe finished with an ignored error, or released without a result, is replaced by another one. The probes still in flight
+//after probe_timeout_ms open it again, so a lost probe never keeps it half open.
+//open_ms doubles every time it opens again without closing, no more than max_open_ms.
+//Only the errors in failure_mask count as failures of the destination, the other errors(memory, poll and so on) are ignored.
+//It is disabled until set_policy is called, then every destination is tracked.
+//Other ctrlers can use allow and report around their own requests.
+struct cort_tcp_circuit_breaker{
+	enum{
+		breaker_closed = 0,
+		breaker_open = 1,
+		breaker_half_open = 2
+	};
+
+	struct policy{
+		uint32_t consecutive_failures;	//0 disables it.
+		uint32_t failure_percent;		//0 disables it.
+		uint32_t min_requests;			//The failure rate is checked only when the window has so many requests.
+		uint32_t window_ms;
+		uint32_t open_ms;
+		uint32_t max_open_ms;
+		uint32_t probe_count;
+		uint32_t probe_timeout_ms;
+		uint64_t failure_mask;			//Bit n is set if the error code n(n < 64) is a failure of the destination.
+
+		policy();
+		static uint64_t default_failure_mask();
+	};
+
+	struct state{
+		uint8_t status;
+		uint32_t consecutive_failure_count;
+		uint32_t window_request_count;
+		uint32_t window_failure_count;
+		uint32_t probe_count;			//Probes in flight in half open.
+		uint32_t probe_success_count;
+		uint32_t reopen_count;			//Opened again since it was closed last time.
+		cort_timeout_waiter::time_ms_t window_start;
+		cort_timeout_waiter::time_ms_t open_until;
+		cort_timeout_waiter::time_ms_t probe_until;
+		uint64_t request_count;
+		uint64_t failure_count;
+		uint64_t reject_count;			//Requests failed by SOCKET_CIRCUIT_OPEN.
+		uint64_t open_count;
+	};
+
+	struct stats{
+		uint64_t open_count;			//Transitions to open.
+		uint64_t close_count;			//Transitions from half open to closed.
+		uint64_t reject_count;
+		size_t open_breaker_count;		//Breakers open or half open now.
+		size_t breaker_count;
+	};
+
+	//Enable the breakers of current thread, or disable and remove them if arg is 0.
+	static void set_policy(const policy* arg);
+
+	static bool is_enabled();
+
+	//Breaker of the destination, or 0 if it is not tracked. Both ip and port have to use network byte order!
+	static const state* get_state(uint32_t ip_arg, uint16_t port_arg);
+
+	//Statistics of current thread.
+	static const stats& get_stats();
+
+	//Whether a request can be sent to the destination now. A false result is counted as a rejection.
+	//Both ip and port have to use network byte order!
+	static bool allow(uint32_t ip_arg, uint16_t port_arg);
+
+	//Report the result of a request allowed. err is the error code of the ctrler, 0 means success.
+	static void report(uint32_t ip_arg, uint16_t port_arg, uint8_t err);
+
+	//A request allowed finished without a result, for example, it was canceled. Its probe is given back in half open.
+	static void release(uint32_t ip_arg, uint16_t port_arg);
+};
+
+#endif
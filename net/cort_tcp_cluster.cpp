@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "cort_tcp_cluster.h"
+#include "cort_tcp_connection_pool.h"
+#include "cort_tcp_budget.h"
+
+cort_proto* cort_tcp_cluster_call::start(){
+	CO_BEGIN
+		endpoint = cluster->select(request);
+		if(endpoint == size_t(-1)){
+			request->set_errno(cort_socket_error_codes::SOCKET_INVALID_CONNECT_ADDRESS);
+			CO_RETURN;
+		}
+		CO_AWAIT(request);
+		cluster->finish(endpoint, request);
+	CO_END
+}
+
+cort_tcp_cluster::cort_tcp_cluster(){
+	endpoints = 0;
+	endpoint_count = 0;
+	endpoint_capacity = 0;
+	random_state = cort_random_seed(this);
+	balance_policy = balance_p2c;
+}
+
+cort_tcp_cluster::~cort_tcp_cluster(){
+	free(endpoints);
+}
+
+size_t cort_tcp_cluster::find(uint32_t ip_arg, uint16_t port_arg) const{
+	for(size_t i = 0; i < endpoint_count; ++i){
+		if(endpoints[i].ip_v4 == ip_arg && endpoints[i].port_v4 == port_arg){
+			return i;
+		}
+	}
+	return size_t(-1);
+}
+
+bool cort_tcp_cluster::add_endpoint(uint32_t ip_arg, uint16_t port_arg){
+	if(find(ip_arg, port_arg) != size_t(-1)){
+		return false;
+	}
+	if(endpoint_count == endpoint_capacity){
+		size_t new_capacity = (endpoint_capacity == 0 ? 8 : (endpoint_capacity << 1));
+		endpoint* new_endpoints = (endpoint*)realloc(endpoints, new_capacity * sizeof(endpoint));
+		if(new_endpoints == 0){
+			return false;
+		}
+		endpoints = new_endpoints;
+		endpoint_capacity = new_capacity;
+	}
+	endpoint& result = endpoints[endpoint_count++];
+	memset(&result, 0, sizeof(endpoint));
+	result.ip_v4 = ip_arg;
+	result.port_v4 = port_arg;
+	return true;
+}
+
+bool cort_tcp_cluster::add_endpoint(const char* ip_arg, uint16_t port_arg){
+	return add_endpoint(inet_addr(ip_arg), htons(port_arg));
+}
+
+bool cort_tcp_cluster::remove_endpoint(uint32_t ip_arg, uint16_t port_arg){
+	size_t index = find(ip_arg, port_arg);
+	if(index == size_t(-1)){
+		return false;
+	}
+	endpoints[index] = endpoints[--endpoint_count];
+	return true;
+}
+
+double cort_tcp_cluster::get_load(const endpoint& arg) const{
+	return (arg.outstanding + 1) * (arg.ewma_cost + 1);
+}
+
+bool cort_tcp_cluster::is_better(size_t lhs, size_t rhs, uint16_t type_key) const{
+	double lhs_load = get_load(endpoints[lhs]);
+	double rhs_load = get_load(endpoints[rhs]);
+	if(lhs_load != rhs_load){
+		return lhs_load < rhs_load;
+	}
+	//The same load, reuse an idle connection instead of connecting.
+	return cort_tcp_connection_pool::get_idle_count(endpoints[lhs].ip_v4, endpoints[lhs].port_v4, type_key) != 0
+		&& cort_tcp_connection_pool::get_idle_count(endpoints[rhs].ip_v4, endpoints[rhs].port_v4, type_key) == 0;
+}
+
+size_t cort_tcp_cluster::select(cort_tcp_ctrler* ctrler){
+	if(endpoint_count == 0){
+		return size_t(-1);
+	}
+	size_t result = 0;
+	if(endpoint_count > 1){
+		if(balance_policy == balance_least_outstanding){
+			for(size_t i = 1; i < endpoint_count; ++i){
+				if(is_better(i, result, ctrler->type_key)){
+					result = i;
+				}
+			}
+		}
+		else{
+			uint64_t random = cort_random_next(random_state);
+			size_t first = (size_t)(random % endpoint_count);
+			size_t second = (size_t)((random >> 32) % (endpoint_count - 1));
+			if(second >= first){ //Two different endpoints.
+				++second;
+			}
+			result = (is_better(second, first, ctrler->type_key) ? second : first);
+		}
+	}
+	endpoint& selected = endpoints[result];
+	++selected.outstanding;
+	++selected.request_count;
+	ctrler->set_dest_addr(selected.ip_v4, selected.port_v4);
+	return result;
+}
+
+void cort_tcp_cluster::finish(size_t endpoint_index, const cort_tcp_ctrler* ctrler){
+	if(endpoint_index >= endpoint_count || endpoints[endpoint_index].ip_v4 != ctrler->ip_v4
+		|| endpoints[endpoint_index].port_v4 != ctrler->port_v4){ //Moved by remove_endpoint.
+		endpoint_index = find(ctrler->ip_v4, ctrler->port_v4);
+		if(endpoint_index == size_t(-1)){
+			return;
+		}
+	}
+	endpoint& result = endpoints[endpoint_index];
+	if(result.outstanding != 0){
+		--result.outstanding;
+	}
+	double cost = ctrler->get_time_cost();
+	if(ctrler->get_errno() != 0){
+		++result.error_count;
+		if(cost < result.ewma_cost * 2){
+			cost = result.ewma_cost * 2;
+		}
+		if(cost < 1){
+			cost = 1;
+		}
+	}
+	if(result.ewma_cost == 0){ //The first sample.
+		result.ewma_cost = cost;
+		return;
+	}
+	result.ewma_cost += (cost - result.ewma_cost) * cort_socket_config::SOCKET_CLUSTER_EWMA_PERCENT / 100;
+}
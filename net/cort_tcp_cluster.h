@@ -0,0 +1,106 @@
+#ifndef CORT_TCP_CLUSTER_H_
+#define CORT_TCP_CLUSTER_H_
+
+#include "cort_tcp_ctrler.h"
+
+struct cort_tcp_cluster;
+
+//Await it to send a request to an endpoint of the cluster, see cort_tcp_cluster::call.
+struct cort_tcp_cluster_call : public cort_proto{
+	CO_DECL(cort_tcp_cluster_call)
+
+	cort_tcp_cluster* cluster;
+	cort_tcp_request_response* request;
+	size_t endpoint;		//Index of the endpoint selected, or size_t(-1) if the cluster is empty.
+
+	cort_tcp_cluster_call(){
+		cluster = 0;
+		request = 0;
+		endpoint = size_t(-1);
+	}
+
+	cort_proto* start();
+};
+
+//A set of endpoints(ip:port) serving the same requests. Every request is sent to the endpoint selected by the load:
+//the requests in flight and the EWMA of the time cost of its requests. A failed request counts as at least twice of the EWMA,
+//so a server failing fast does not attract more requests.
+//Every endpoint is a destination of the keep alive pool, so a cluster ctrler with keep alive reuses the connections of the endpoint selected.
+//When the loads are the same, the endpoint with idle connections is preferred to avoid a new connection.
+//A cluster is used by the coroutines of one thread.
+//Example:
+//    req.set_keep_alive(1000); ... 	//Set the request without the destination.
+//    CO_AWAIT(cluster.call(&call, &req));
+//Or select an endpoint for your own ctrler, and report its result:
+//    size_t endpoint = cluster.select(&ctrler);
+//    ...
+//    cluster.finish(endpoint, &ctrler);
+struct cort_tcp_cluster{
+	enum{
+		balance_p2c = 0,				//Power of two choices: compare two random endpoints, O(1) and avoids herding to the same one.
+		balance_least_outstanding = 1	//Compare all the endpoints.
+	};
+
+	struct endpoint{
+		uint32_t ip_v4;
+		uint16_t port_v4;
+		uint32_t outstanding;			//Requests in flight.
+		double ewma_cost;				//ms
+		uint64_t request_count;
+		uint64_t error_count;
+	};
+
+	cort_tcp_cluster();
+	~cort_tcp_cluster();
+
+	//Both ip and port have to use network byte order! Return false if memory allocation failed or it exists.
+	bool add_endpoint(uint32_t ip_arg, uint16_t port_arg);
+
+	//Port should use local order!
+	bool add_endpoint(const char* ip_arg, uint16_t port_arg);
+
+	//The requests in flight to the endpoint are not affected.
+	bool remove_endpoint(uint32_t ip_arg, uint16_t port_arg);
+
+	void set_balance_policy(uint8_t policy){
+		balance_policy = policy;
+	}
+
+	size_t size() const{
+		return endpoint_count;
+	}
+
+	const endpoint& get_endpoint(size_t index) const{
+		return endpoints[index];
+	}
+
+	//Set the destination of the ctrler to the endpoint selected, and count it in flight.
+	//Return the index of the endpoint, or size_t(-1) if the cluster is empty.
+	size_t select(cort_tcp_ctrler* ctrler);
+
+	//Report the result of the ctrler sent to the endpoint selected.
+	void finish(size_t endpoint_index, const cort_tcp_ctrler* ctrler);
+
+	cort_tcp_cluster_call* call(cort_tcp_cluster_call* arg, cort_tcp_request_response* request){
+		arg->cluster = this;
+		arg->request = request;
+		return arg;
+	}
+
+private:
+	//Smaller is better.
+	double get_load(const endpoint& arg) const;
+	bool is_better(size_t lhs, size_t rhs, uint16_t type_key) const;
+	size_t find(uint32_t ip_arg, uint16_t port_arg) const;
+
+	endpoint* endpoints;
+	size_t endpoint_count;
+	size_t endpoint_capacity;
+	uint64_t random_state;
+	uint8_t balance_policy;
+
+	cort_tcp_cluster(const cort_tcp_cluster&);
+	cort_tcp_cluster& operator=(const cort_tcp_cluster&);
+};
+
+#endif
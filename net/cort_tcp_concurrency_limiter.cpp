@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+
+#include "cort_tcp_concurrency_limiter.h"
+#include "cort_tcp_connection_pool.h"
+#include "cort_tcp_budget.h"
+
+namespace{
+	typedef std::map<uint64_t, cort_tcp_concurrency_limiter::state> limiter_table;
+	typedef cort_tcp_concurrency_limiter::queue_waiter queue_waiter;
+
+	struct thread_limiters{
+		limiter_table* table;		//0 if disabled.
+		cort_tcp_concurrency_limiter::policy* current_policy;
+		cort_tcp_concurrency_limiter::stats stat;
+	};
+
+	inline thread_limiters& get_thread_limiters(){
+		static __thread thread_limiters limiters;
+		return limiters;
+	}
+
+	inline uint64_t get_key(uint32_t ip_arg, uint16_t port_arg){
+		ip_v4_key key(ip_arg, port_arg, 0);
+		return key.data.i_data;
+	}
+
+	cort_tcp_concurrency_limiter::state* find(thread_limiters& limiters, uint64_t key){
+		if(limiters.table == 0){
+			return 0;
+		}
+		limiter_table::iterator it = limiters.table->find(key);
+		return it == limiters.table->end() ? 0 : &it->second;
+	}
+
+	//Forget the idle ones when the table is full, their limits are learned again.
+	bool is_idle(const cort_tcp_concurrency_limiter::state& arg){
+		return arg.in_flight == 0 && arg.queue_head == 0;
+	}
+
+	cort_tcp_concurrency_limiter::state* find_or_create(thread_limiters& limiters, uint64_t key){
+		limiter_table::iterator it = limiters.table->find(key);
+		if(it != limiters.table->end()){
+			return &it->second;
+		}
+		if(!cort_make_room(*limiters.table, cort_socket_config::SOCKET_LIMITER_MAX_COUNT, is_idle)){
+			return 0;
+		}
+		cort_tcp_concurrency_limiter::state& result = (*limiters.table)[key];
+		memset(&result, 0, sizeof(result));
+		result.limit = limiters.current_policy->initial_limit;
+		result.window_start = cort_timer_now_ms();
+		limiters.stat.limiter_count = limiters.table->size();
+		return &result;
+	}
+
+	void push_waiter(cort_tcp_concurrency_limiter::state& arg, queue_waiter* waiter){
+		waiter->next = 0;
+		waiter->prev = arg.queue_tail;
+		if(arg.queue_tail != 0){
+			arg.queue_tail->next = waiter;
+		}
+		else{
+			arg.queue_head = waiter;
+		}
+		arg.queue_tail = waiter;
+		waiter->linked = true;
+		++arg.queued;
+	}
+
+	void unlink_waiter(cort_tcp_concurrency_limiter::state& arg, queue_waiter* waiter){
+		if(waiter->prev != 0){
+			waiter->prev->next = waiter->next;
+		}
+		else{
+			arg.queue_head = waiter->next;
+		}
+		if(waiter->next != 0){
+			waiter->next->prev = waiter->prev;
+		}
+		else{
+			arg.queue_tail = waiter->prev;
+		}
+		waiter->prev = 0;
+		waiter->next = 0;
+		waiter->linked = false;
+		--arg.queued;
+	}
+
+	//Resuming a waiter may finish other requests and change the table, so the state is found again every time.
+	void grant_waiters(thread_limiters& limiters, uint64_t key){
+		cort_tcp_concurrency_limiter::state* current;
+		while((current = find(limiters, key)) != 0 && current->queue_head != 0 && current->in_flight < (uint32_t)current->limit){
+			queue_waiter* waiter = current->queue_head;
+			unlink_waiter(*current, waiter);
+			++current->in_flight;
+			waiter->ctrler->limiter_place = 1;
+			waiter->granted = true;
+			waiter->resume();
+		}
+	}
+
+	void update_limit(const cort_tcp_concurrency_limiter::policy& current_policy, cort_tcp_concurrency_limiter::state& arg,
+		uint8_t err, uint32_t time_cost_ms){
+		if(err != 0){
+			if(err < 64 && ((current_policy.drop_mask >> err) & 1) != 0){
+				arg.limit = arg.limit * current_policy.backoff_percent / 100;
+				++arg.drop_count;
+			}
+		}
+		else{
+			uint32_t rtt = time_cost_ms + 1;	//Never 0.
+			cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+			if(now - arg.window_start >= current_policy.min_rtt_window_ms){
+				arg.last_window_min_rtt = arg.window_min_rtt;
+				arg.window_min_rtt = 0;
+				arg.window_start = now;
+			}
+			if(arg.window_min_rtt == 0 || rtt < arg.window_min_rtt){
+				arg.window_min_rtt = rtt;
+			}
+			arg.min_rtt = arg.window_min_rtt;
+			if(arg.last_window_min_rtt != 0 && arg.last_window_min_rtt < arg.min_rtt){
+				arg.min_rtt = arg.last_window_min_rtt;
+			}
+			arg.last_rtt = rtt;
+			double step = log10(arg.limit);
+			if(step < 1){
+				step = 1;
+			}
+			double queue = arg.limit * (1 - (double)arg.min_rtt / rtt);
+			if(queue < current_policy.alpha * step){
+				if(arg.in_flight * 2 >= arg.limit){ //Do not grow when the limit is not used.
+					arg.limit += step;
+				}
+			}
+			else if(queue > current_policy.beta * step){
+				arg.limit -= step;
+			}
+		}
+		if(arg.limit < current_policy.min_limit){
+			arg.limit = current_policy.min_limit;
+		}
+		if(arg.limit > current_policy.max_limit){
+			arg.limit = current_policy.max_limit;
+		}
+	}
+}
+
+cort_tcp_concurrency_limiter::policy::policy(){
+	initial_limit = cort_socket_config::SOCKET_LIMITER_INITIAL_LIMIT;
+	min_limit = cort_socket_config::SOCKET_LIMITER_MIN_LIMIT;
+	max_limit = cort_socket_config::SOCKET_LIMITER_MAX_LIMIT;
+	max_queue = cort_socket_config::SOCKET_LIMITER_MAX_QUEUE;
+	alpha = cort_socket_config::SOCKET_LIMITER_ALPHA;
+	beta = cort_socket_config::SOCKET_LIMITER_BETA;
+	backoff_percent = cort_socket_config::SOCKET_LIMITER_BACKOFF_PERCENT;
+	min_rtt_window_ms = cort_socket_config::SOCKET_LIMITER_MIN_RTT_WINDOW_MS;
+	drop_mask = (1ULL << cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT);
+}
+
+cort_proto* cort_tcp_concurrency_limiter::queue_waiter::start(){
+	CO_BEGIN
+		thread_limiters& limiters = get_thread_limiters();
+		state* current = find(limiters, get_key(ctrler->ip_v4, ctrler->port_v4));
+		if(current == 0){ //Disabled or forgotten, nothing to wait for.
+			granted = true;
+			CO_RETURN;
+		}
+		push_waiter(*current, this);
+		++limiters.stat.queue_count;
+		if(ctrler->timeout != 0){
+			set_timeout(ctrler->timeout);
+		}
+		ctrler->limiter_waiter = this;
+		CO_YIELD();	//Resumed by grant_waiters, the timeout, cort_tcp_ctrler::cancel or cort_timer_destroy.
+		ctrler->limiter_waiter = 0;
+		if(granted){
+			ctrler->init_time_cost();
+			CO_RETURN;
+		}
+		thread_limiters& limiters = get_thread_limiters();
+		state* current = find(limiters, get_key(ctrler->ip_v4, ctrler->port_v4));
+		if(linked && current != 0){
+			unlink_waiter(*current, this);
+			if(!is_stopped()){
+				++current->reject_count;
+			}
+		}
+		if(!is_stopped()){ //Not canceled.
+			++limiters.stat.queue_timeout_count;
+			++limiters.stat.reject_count;
+		}
+		ctrler->set_errno(cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED);
+	CO_END
+}
+
+void cort_tcp_concurrency_limiter::set_policy(const policy* arg){
+	thread_limiters& limiters = get_thread_limiters();
+	if(arg == 0){
+		if(limiters.table == 0){
+			return;
+		}
+		//Unlink all the waiters before any of them runs, then they go on without limits.
+		queue_waiter* granted_head = 0;
+		queue_waiter* granted_tail = 0;
+		for(limiter_table::iterator it = limiters.table->begin(); it != limiters.table->end(); ++it){
+			while(it->second.queue_head != 0){
+				queue_waiter* waiter = it->second.queue_head;
+				unlink_waiter(it->second, waiter);
+				if(granted_tail != 0){
+					granted_tail->next = waiter;
+				}
+				else{
+					granted_head = waiter;
+				}
+				granted_tail = waiter;
+			}
+		}
+		delete limiters.table;
+		limiters.table = 0;
+		delete limiters.current_policy;
+		limiters.current_policy = 0;
+		limiters.stat.limiter_count = 0;
+		while(granted_head != 0){
+			queue_waiter* waiter = granted_head;
+			granted_head = waiter->next;
+			waiter->next = 0;
+			waiter->granted = true;
+			waiter->resume();
+		}
+		return;
+	}
+	if(limiters.table == 0){
+		limiters.table = new limiter_table();
+		limiters.current_policy = new policy();
+	}
+	*limiters.current_policy = *arg;
+	if(limiters.current_policy->min_limit == 0){
+		limiters.current_policy->min_limit = 1;
+	}
+	if(limiters.current_policy->max_limit < limiters.current_policy->min_limit){
+		limiters.current_policy->max_limit = limiters.current_policy->min_limit;
+	}
+}
+
+bool cort_tcp_concurrency_limiter::is_enabled(){
+	return get_thread_limiters().table != 0;
+}
+
+const cort_tcp_concurrency_limiter::state* cort_tcp_concurrency_limiter::get_state(uint32_t ip_arg, uint16_t port_arg){
+	return find(get_thread_limiters(), get_key(ip_arg, port_arg));
+}
+
+const cort_tcp_concurrency_limiter::stats& cort_tcp_concurrency_limiter::get_stats(){
+	return get_thread_limiters().stat;
+}
+
+uint8_t cort_tcp_concurrency_limiter::acquire(cort_tcp_ctrler* ctrler){
+	thread_limiters& limiters = get_thread_limiters();
+	if(limiters.table == 0){
+		return limiter_acquired;
+	}
+	state* current = find_or_create(limiters, get_key(ctrler->ip_v4, ctrler->port_v4));
+	if(current == 0){ //Too many destinations, it is not limited.
+		return limiter_acquired;
+	}
+	++current->request_count;
+	if(current->queue_head == 0 && current->in_flight < (uint32_t)current->limit){
+		++current->in_flight;
+		ctrler->limiter_place = 1;
+		return limiter_acquired;
+	}
+	if(current->queued < limiters.current_policy->max_queue){
+		return limiter_queued;
+	}
+	++current->reject_count;
+	++limiters.stat.reject_count;
+	ctrler->set_errno(cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED);
+	return limiter_rejected;
+}
+
+void cort_tcp_concurrency_limiter::release(uint32_t ip_arg, uint16_t port_arg, uint8_t err, uint32_t time_cost_ms){
+	thread_limiters& limiters = get_thread_limiters();
+	uint64_t key = get_key(ip_arg, port_arg);
+	state* current = find(limiters, key);
+	if(current == 0){
+		return;
+	}
+	update_limit(*limiters.current_policy, *current, err, time_cost_ms);
+	if(current->in_flight != 0){ //It may be acquired before the limiter is enabled.
+		--current->in_flight;
+	}
+	grant_waiters(limiters, key);
+}
+
+void cort_tcp_concurrency_limiter::release(uint32_t ip_arg, uint16_t port_arg){
+	thread_limiters& limiters = get_thread_limiters();
+	uint64_t key = get_key(ip_arg, port_arg);
+	state* current = find(limiters, key);
+	if(current == 0){
+		return;
+	}
+	if(current->in_flight != 0){
+		--current->in_flight;
+	}
+	grant_waiters(limiters, key);
+}
@@ -0,0 +1,116 @@
+#ifndef CORT_TCP_CONCURRENCY_LIMITER_H_
+#define CORT_TCP_CONCURRENCY_LIMITER_H_
+
+#include "cort_tcp_ctrler.h"
+
+//Thread local limits of the requests in flight to the destinations(ip:port), used by cort_tcp_request_response.
+//The limit adapts to the time costs like TCP Vegas: the destination is assumed to queue limit * (1 - min_rtt / rtt) requests,
+//where min_rtt is the least time cost in the recent window(no load) and rtt is the time cost of the request finished.
+//The limit grows by log10(limit) when the queue is less than alpha * log10(limit) and at least half of the limit is used,
+//and drops by log10(limit) when the queue is more than beta * log10(limit). A failure in drop_mask(a timeout by default)
+//multiplies the limit by backoff_percent%. So a fast destination gets more requests and a slow one gets fewer before it times out.
+//The time costs are in ms, so the destinations answering in about 1ms are not distinguished, and their limits only grow.
+//The requests beyond the limit wait in a FIFO queue of max_queue requests no longer than their timeout,
+//or fail at once with SOCKET_CONCURRENCY_LIMITED when the queue is full.
+//It is disabled until set_policy is called, then every destination is tracked.
+//Other ctrlers can use acquire and release around their own requests.
+struct cort_tcp_concurrency_limiter{
+	enum{
+		limiter_acquired = 0,
+		limiter_rejected = 1,		//The errno of the ctrler is set to SOCKET_CONCURRENCY_LIMITED.
+		limiter_queued = 2			//Await new cort_tcp_concurrency_limiter::queue_waiter(ctrler).
+	};
+
+	struct policy{
+		uint32_t initial_limit;
+		uint32_t min_limit;
+		uint32_t max_limit;
+		uint32_t max_queue;			//0 means the requests beyond the limit fail at once.
+		uint32_t alpha;
+		uint32_t beta;
+		uint32_t backoff_percent;
+		uint32_t min_rtt_window_ms;
+		uint64_t drop_mask;			//Bit n is set if the error code n(n < 64) means the destination is overloaded.
+
+		policy();
+	};
+
+	struct queue_waiter;
+
+	struct state{
+		double limit;
+		uint32_t in_flight;
+		uint32_t queued;
+		uint32_t min_rtt;				//ms + 1, of the current and the last window.
+		uint32_t last_rtt;
+		uint32_t window_min_rtt;
+		uint32_t last_window_min_rtt;
+		cort_timeout_waiter::time_ms_t window_start;
+		queue_waiter* queue_head;
+		queue_waiter* queue_tail;
+		uint64_t request_count;
+		uint64_t reject_count;			//Requests failed by SOCKET_CONCURRENCY_LIMITED, including the queue timeouts.
+		uint64_t drop_count;
+	};
+
+	struct stats{
+		uint64_t reject_count;
+		uint64_t queue_count;			//Requests queued.
+		uint64_t queue_timeout_count;
+		size_t limiter_count;
+	};
+
+	//A request waiting for the limit of its destination. It deletes itself when it finishes.
+	//The ctrler is granted if its errno is not set to SOCKET_CONCURRENCY_LIMITED, then init_time_cost is called again.
+	//cort_tcp_ctrler::cancel stops it by ctrler->limiter_waiter.
+	struct queue_waiter : public cort_timeout_waiter{
+		CO_DECL(queue_waiter)
+
+		cort_tcp_ctrler* ctrler;
+		queue_waiter* prev;
+		queue_waiter* next;
+		bool linked;
+		bool granted;
+
+		queue_waiter(cort_tcp_ctrler* ctrler_arg){
+			ctrler = ctrler_arg;
+			prev = 0;
+			next = 0;
+			linked = false;
+			granted = false;
+		}
+
+		cort_proto* start();
+
+	protected:
+		cort_proto* on_finish(){
+			delete this;
+			return 0;
+		}
+	};
+
+	//Enable the limiters of current thread, or disable and remove them if arg is 0. The waiters queued are granted then.
+	static void set_policy(const policy* arg);
+
+	static bool is_enabled();
+
+	//Limiter of the destination, or 0 if it is not tracked. Both ip and port have to use network byte order!
+	static const state* get_state(uint32_t ip_arg, uint16_t port_arg);
+
+	//Statistics of current thread.
+	static const stats& get_stats();
+
+	//Take a place of the destination of the ctrler, see limiter_acquired, limiter_rejected and limiter_queued.
+	//ctrler->limiter_place is set when a place is taken, at once or when the queue_waiter is granted, and only then the ctrler
+	//has to release the place when it finishes. It is not set if the limiter is disabled or the destination is not tracked.
+	static uint8_t acquire(cort_tcp_ctrler* ctrler);
+
+	//Release the place, and adapt the limit by the result of the request. err is the error code of the ctrler, 0 means success.
+	//Both ip and port have to use network byte order!
+	static void release(uint32_t ip_arg, uint16_t port_arg, uint8_t err, uint32_t time_cost_ms);
+
+	//Release the place without adapting the limit, for example, the request was canceled or not sent.
+	static void release(uint32_t ip_arg, uint16_t port_arg);
+};
+
+#endif
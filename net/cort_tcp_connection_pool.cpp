@@ -0,0 +1,642 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <algorithm>
+
+#include "cort_tcp_connection_pool.h"
+
+namespace{
+	typedef cort_tcp_connection_waiter_client client_t;
+
+	struct destination{
+		uint64_t key;
+		client_t* idle_head;		//The most recently used.
+		client_t* idle_tail;
+		client_t* wait_head;
+		client_t* wait_tail;
+		uint32_t idle_count;
+		uint32_t total_count;
+		uint32_t max_idle;
+		uint32_t max_total;
+		uint32_t min_idle;
+		uint32_t warm_keep_alive_ms;
+		uint32_t warming_count;			//Connecting for the min_idle.
+		uint8_t used;
+		uint8_t configured;			//Limits set by set_limit, so it is kept even without connections.
+		uint8_t lazy_validation;
+	};
+
+	struct thread_pool{
+		destination* table;			//Open addressing with linear probing, capacity is power of 2.
+		uint32_t capacity;
+		uint32_t size;
+		client_t* lru_head;			//The most recently used idle connection.
+		client_t* lru_tail;
+		cort_tcp_connection_pool::stats stat;
+		cort_proto* maintainer;
+		uint32_t warm_destination_count;	//Destinations with min_idle > 0.
+	};
+
+	inline thread_pool& get_thread_pool(){
+		static __thread thread_pool pool;
+		return pool;
+	}
+
+	inline uint32_t get_slot(uint64_t key, uint32_t capacity){
+		return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+	}
+
+	destination* find(thread_pool& pool, uint64_t key){
+		if(pool.capacity == 0){
+			return 0;
+		}
+		for(uint32_t i = get_slot(key, pool.capacity); ; i = (i + 1) & (pool.capacity - 1)){
+			destination& result = pool.table[i];
+			if(result.used == 0){
+				return 0;
+			}
+			if(result.key == key){
+				return &result;
+			}
+		}
+	}
+
+	//Return 0 if memory allocation failed. The returned pointer is valid until next insertion or erasion.
+	destination* find_or_insert(thread_pool& pool, uint64_t key){
+		destination* result = find(pool, key);
+		if(result != 0){
+			return result;
+		}
+		if((pool.size + 1) * 2 > pool.capacity){ //Load factor is no more than 1/2.
+			uint32_t new_capacity = (pool.capacity == 0 ? 16 : (pool.capacity << 1));
+			destination* new_table = (destination*)calloc(new_capacity, sizeof(destination));
+			if(new_table == 0){
+				return 0;
+			}
+			for(uint32_t i = 0; i < pool.capacity; ++i){
+				if(pool.table[i].used != 0){
+					uint32_t j = get_slot(pool.table[i].key, new_capacity);
+					while(new_table[j].used != 0){
+						j = (j + 1) & (new_capacity - 1);
+					}
+					new_table[j] = pool.table[i];
+				}
+			}
+			free(pool.table);
+			pool.table = new_table;
+			pool.capacity = new_capacity;
+		}
+		uint32_t i = get_slot(key, pool.capacity);
+		while(pool.table[i].used != 0){
+			i = (i + 1) & (pool.capacity - 1);
+		}
+		result = &pool.table[i];
+		memset(result, 0, sizeof(destination));
+		result->key = key;
+		result->used = 1;
+		result->max_idle = cort_socket_config::SOCKET_KEEPALIVE_MAX_IDLE_PER_DEST;
+		result->max_total = cort_socket_config::SOCKET_KEEPALIVE_MAX_TOTAL_PER_DEST;
+		++pool.size;
+		pool.stat.destination_count = pool.size;
+		return result;
+	}
+
+	//Backward shift deletion, so no tombstone is needed.
+	void erase_if_unused(thread_pool& pool, destination* dest){
+		if(dest->total_count != 0 || dest->wait_head != 0 || dest->configured != 0){
+			return;
+		}
+		uint32_t mask = pool.capacity - 1;
+		uint32_t i = (uint32_t)(dest - pool.table);
+		uint32_t j = i;
+		while(true){
+			j = (j + 1) & mask;
+			if(pool.table[j].used == 0){
+				break;
+			}
+			uint32_t k = get_slot(pool.table[j].key, pool.capacity);
+			//Move j to the hole i if its home slot k is not in (i, j] cyclically.
+			if((i <= j) ? (k <= i || k > j) : (k <= i && k > j)){
+				pool.table[i] = pool.table[j];
+				i = j;
+			}
+		}
+		pool.table[i].used = 0;
+		--pool.size;
+		pool.stat.destination_count = pool.size;
+		if(pool.size == 0){
+			free(pool.table);
+			pool.table = 0;
+			pool.capacity = 0;
+		}
+	}
+
+	inline uint64_t get_key(const client_t* client){
+		return ip_v4_key(client->ip_v4, client->port_v4, client->type_key).data.i_data;
+	}
+
+	void link_idle(thread_pool& pool, destination* dest, client_t* client){
+		client->pool_prev = 0;
+		client->pool_next = dest->idle_head;
+		if(dest->idle_head != 0){
+			dest->idle_head->pool_prev = client;
+		}
+		else{
+			dest->idle_tail = client;
+		}
+		dest->idle_head = client;
+		++dest->idle_count;
+
+		client->lru_prev = 0;
+		client->lru_next = pool.lru_head;
+		if(pool.lru_head != 0){
+			pool.lru_head->lru_prev = client;
+		}
+		else{
+			pool.lru_tail = client;
+		}
+		pool.lru_head = client;
+		++pool.stat.idle_count;
+		client->pool_state = cort_tcp_connection_waiter::pool_idle;
+	}
+
+	void unlink_idle(thread_pool& pool, destination* dest, client_t* client){
+		if(client->pool_prev != 0){
+			client->pool_prev->pool_next = client->pool_next;
+		}
+		else{
+			dest->idle_head = client->pool_next;
+		}
+		if(client->pool_next != 0){
+			client->pool_next->pool_prev = client->pool_prev;
+		}
+		else{
+			dest->idle_tail = client->pool_prev;
+		}
+		--dest->idle_count;
+
+		if(client->lru_prev != 0){
+			client->lru_prev->lru_next = client->lru_next;
+		}
+		else{
+			pool.lru_head = client->lru_next;
+		}
+		if(client->lru_next != 0){
+			client->lru_next->lru_prev = client->lru_prev;
+		}
+		else{
+			pool.lru_tail = client->lru_prev;
+		}
+		--pool.stat.idle_count;
+		if(client->lazy_expire_time != 0){
+			--pool.stat.unpolled_idle_count;
+			client->lazy_expire_time = 0;
+		}
+		client->pool_prev = 0;
+		client->pool_next = 0;
+		client->lru_prev = 0;
+		client->lru_next = 0;
+		client->pool_state = cort_tcp_connection_waiter::pool_in_use;
+	}
+
+	client_t* pop_waiter(destination* dest){
+		client_t* result = dest->wait_head;
+		if(result != 0){
+			dest->wait_head = result->pool_next;
+			if(dest->wait_head == 0){
+				dest->wait_tail = 0;
+			}
+			else{
+				dest->wait_head->pool_prev = 0;
+			}
+			result->pool_prev = 0;
+			result->pool_next = 0;
+		}
+		return result;
+	}
+
+	//The client is closed and released, so its destination may be erased.
+	void close_client(client_t* client){
+		client->clear();
+		client->retire_zero_copy();
+		client->close_cort_fd();
+		client->release();
+	}
+
+	//Connects for the min_idle of a destination, and puts the connection into the pool when it finishes.
+	struct warm_ctrler : public cort_tcp_ctrler{
+		CO_DECL(warm_ctrler)
+		cort_proto* start(){
+			CO_BEGIN
+				client_t* client = new client_t();
+				cort_tcp_connection_pool::acquire(client, ip_v4, port_v4, type_key);
+				if(client->pool_state == cort_tcp_connection_waiter::pool_waiting){ //Never wait, the connection is not needed now.
+					cort_tcp_connection_pool::cancel_wait(client);
+					delete client;
+					set_errno(cort_socket_error_codes::SOCKET_STATE_ERROR);
+					CO_RETURN;
+				}
+				set_connection_waiter(client);
+				CO_AWAIT(lock_connect());
+			CO_END
+		}
+		cort_proto* on_finish(){
+			thread_pool& pool = get_thread_pool();
+			destination* dest = find(pool, ip_v4_key(ip_v4, port_v4, type_key).data.i_data);
+			if(dest != 0){
+				--dest->warming_count;
+			}
+			if(get_errno() == 0 && connection_waiter && connection_waiter->is_connected()){
+				++pool.stat.warm_connect_count;
+				on_connection_inactive();
+			}
+			else{
+				++pool.stat.warm_failure_count;
+			}
+			cort_tcp_ctrler::on_finish();
+			delete this;
+			return 0;
+		}
+	};
+
+	void start_warm_ctrler(destination* dest){
+		ip_v4_key key(0, 0, 0);
+		key.data.i_data = dest->key;
+		++dest->warming_count;
+		warm_ctrler* ctrler = new warm_ctrler();
+		ctrler->set_dest_addr(key.data.s_data.ip_v4, key.data.s_data.port_v4);
+		ctrler->set_type_key(key.data.s_data.type_key);
+		ctrler->set_keep_alive(dest->warm_keep_alive_ms);
+		ctrler->set_timeout(cort_socket_config::SOCKET_KEEPALIVE_WARM_CONNECT_TIMEOUT_MS);
+		ctrler->start();	//dest may be moved after this.
+	}
+
+	//Start the connections that the destinations lack, no more than the rate allows in one interval.
+	void warm_destinations(thread_pool& pool){
+		uint32_t budget = cort_socket_config::SOCKET_KEEPALIVE_WARM_CONNECT_RATE * cort_socket_config::SOCKET_KEEPALIVE_MAINTAIN_INTERVAL_MS / 1000;
+		if(budget == 0){
+			budget = 1;
+		}
+		for(uint32_t i = 0; i < pool.capacity && budget != 0; ++i){
+			if(pool.table[i].used == 0 || pool.table[i].min_idle == 0){
+				continue;
+			}
+			uint64_t key = pool.table[i].key;
+			for(destination* dest = &pool.table[i]; dest != 0 && budget != 0; dest = find(pool, key)){
+				uint32_t target = std::min(dest->min_idle, dest->max_idle);
+				if(dest->idle_count + dest->warming_count >= target
+					|| (dest->max_total != 0 && dest->total_count >= dest->max_total)){
+					break;
+				}
+				--budget;
+				start_warm_ctrler(dest);
+			}
+		}
+	}
+
+	//An unpolled idle connection is alive if it is not expired and has nothing to read, not even the FIN.
+	bool is_lazy_alive(client_t* client, cort_timeout_waiter::time_ms_t now){
+		if(now >= client->lazy_expire_time){
+			return false;
+		}
+		char data;
+		while(true){
+			ssize_t result = recv(client->get_cort_fd(), &data, 1, MSG_PEEK | MSG_DONTWAIT);
+			if(result >= 0){
+				return false;
+			}
+			int thread_errno = errno;
+			if(thread_errno != EINTR){
+				return thread_errno == EAGAIN || thread_errno == EWOULDBLOCK;
+			}
+		}
+	}
+
+	//Close the expired unpolled idle connections from the least recently used one.
+	//When the maintainer is stopped, all the unpolled ones are closed, for no timer will close them later.
+	void sweep_lazy_idle(thread_pool& pool, bool stopped){
+		cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+		uint32_t checked_count = 0;
+		client_t* client = pool.lru_tail;
+		while(client != 0 && pool.stat.unpolled_idle_count != 0
+			&& (stopped || checked_count++ < cort_socket_config::SOCKET_KEEPALIVE_SWEEP_BATCH_COUNT)){
+			if(client->lazy_expire_time == 0){ //Polled, it has its own timer.
+				client = client->lru_prev;
+				continue;
+			}
+			if(!stopped && now < client->lazy_expire_time){
+				break;
+			}
+			cort_tcp_connection_pool::close_idle(client, !stopped);
+			client = pool.lru_tail;	//Closing may resume a waiter which changes the list.
+		}
+	}
+
+	//Tops up the min_idle and sweeps the expired unpolled idle connections, until neither is needed.
+	struct pool_maintainer : public cort_timeout_waiter{
+		CO_DECL(pool_maintainer)
+		cort_proto* start(){
+			CO_BEGIN
+				thread_pool& pool = get_thread_pool();
+				if(is_stopped()){
+					sweep_lazy_idle(pool, true);
+					CO_RETURN;
+				}
+				if(pool.warm_destination_count == 0 && pool.stat.unpolled_idle_count == 0){
+					CO_RETURN;
+				}
+				if(pool.warm_destination_count != 0){
+					warm_destinations(pool);
+				}
+				if(pool.stat.unpolled_idle_count != 0){
+					sweep_lazy_idle(pool, false);
+				}
+				set_timeout(cort_socket_config::SOCKET_KEEPALIVE_MAINTAIN_INTERVAL_MS);
+				CO_AGAIN;
+			CO_END
+		}
+		cort_proto* on_finish(){
+			get_thread_pool().maintainer = 0;
+			cort_timeout_waiter::on_finish();
+			delete this;
+			return 0;
+		}
+	};
+
+	void start_maintainer(thread_pool& pool){
+		if(pool.maintainer == 0){
+			pool_maintainer* maintainer = new pool_maintainer();
+			pool.maintainer = maintainer;
+			maintainer->start();
+		}
+	}
+}
+
+void cort_tcp_connection_pool::set_limit(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t max_idle, uint32_t max_total){
+	thread_pool& pool = get_thread_pool();
+	destination* dest = find_or_insert(pool, ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data);
+	if(dest == 0){
+		return;
+	}
+	dest->max_idle = max_idle;
+	dest->max_total = max_total;
+	dest->configured = 1;
+	uint64_t key = dest->key;
+	while(dest != 0 && dest->idle_count > max_idle){
+		++pool.stat.eviction_count;
+		client_t* client = dest->idle_tail;
+		unlink_idle(pool, dest, client);
+		close_client(client);
+		dest = find(pool, key);
+	}
+}
+
+void cort_tcp_connection_pool::set_min_idle(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t min_idle, uint32_t keep_alive_ms){
+	thread_pool& pool = get_thread_pool();
+	destination* dest = find_or_insert(pool, ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data);
+	if(dest == 0){
+		return;
+	}
+	if(keep_alive_ms == 0){ //The connections would not be kept.
+		min_idle = 0;
+	}
+	dest->configured = 1;
+	if(dest->min_idle == 0 && min_idle != 0){
+		++pool.warm_destination_count;
+	}
+	else if(dest->min_idle != 0 && min_idle == 0){
+		--pool.warm_destination_count;
+	}
+	dest->min_idle = min_idle;
+	dest->warm_keep_alive_ms = keep_alive_ms;
+	if(pool.warm_destination_count != 0){
+		start_maintainer(pool);
+	}
+}
+
+void cort_tcp_connection_pool::set_lazy_validation(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool enable){
+	destination* dest = find_or_insert(get_thread_pool(), ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data);
+	if(dest == 0){
+		return;
+	}
+	dest->configured = 1;
+	dest->lazy_validation = (enable ? 1 : 0);	//The current idle connections are not changed.
+}
+
+size_t cort_tcp_connection_pool::get_idle_count(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	destination* dest = find(get_thread_pool(), ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data);
+	return dest == 0 ? 0 : dest->idle_count;
+}
+
+size_t cort_tcp_connection_pool::get_total_count(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	destination* dest = find(get_thread_pool(), ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data);
+	return dest == 0 ? 0 : dest->total_count;
+}
+
+const cort_tcp_connection_pool::stats& cort_tcp_connection_pool::get_stats(){
+	return get_thread_pool().stat;
+}
+
+cort_tcp_connection_waiter_client* cort_tcp_connection_pool::checkout(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	thread_pool& pool = get_thread_pool();
+	++pool.stat.checkout_count;
+	uint64_t key = ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data;
+	destination* dest = find(pool, key);
+	cort_timeout_waiter::time_ms_t now = 0;
+	while(dest != 0 && dest->idle_head != 0){
+		client_t* client = dest->idle_head;
+		bool lazy = (client->lazy_expire_time != 0);
+		if(lazy && now == 0){
+			now = cort_timer_now_ms();
+		}
+		if(lazy && !is_lazy_alive(client, now)){
+			if(now < client->lazy_expire_time){
+				++pool.stat.validation_failure_count;
+			}
+			close_idle(client, true);
+			dest = find(pool, key);
+			continue;
+		}
+		++pool.stat.reuse_count;
+		unlink_idle(pool, dest, client);
+		client->clear();
+		client->remove_ref();
+		return client;
+	}
+	return 0;
+}
+
+void cort_tcp_connection_pool::acquire(client_t* client, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	thread_pool& pool = get_thread_pool();
+	client->ip_v4 = ip_arg;
+	client->port_v4 = port_arg;
+	client->type_key = type_key_arg;
+	destination* dest = find_or_insert(pool, get_key(client));
+	if(dest == 0){ //Out of memory, it is not limited or kept.
+		client->pool_state = cort_tcp_connection_waiter::pool_none;
+		return;
+	}
+	if(dest->max_total != 0 && dest->total_count >= dest->max_total){
+		++pool.stat.wait_count;
+		client->pool_next = 0;
+		client->pool_prev = dest->wait_tail;
+		if(dest->wait_tail != 0){
+			dest->wait_tail->pool_next = client;
+		}
+		else{
+			dest->wait_head = client;
+		}
+		dest->wait_tail = client;
+		client->pool_state = cort_tcp_connection_waiter::pool_waiting;
+		return;
+	}
+	++dest->total_count;
+	++pool.stat.connection_count;
+	client->pool_state = cort_tcp_connection_waiter::pool_in_use;
+}
+
+bool cort_tcp_connection_pool::checkin(client_t* client, uint32_t keep_alive_ms, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	thread_pool& pool = get_thread_pool();
+	if(client->pool_state == cort_tcp_connection_waiter::pool_none){ //The ctrler enabled keep alive after it got the connection.
+		acquire(client, ip_arg, port_arg, type_key_arg);
+		if(client->pool_state != cort_tcp_connection_waiter::pool_in_use){
+			cancel_wait(client);
+			return false;
+		}
+	}
+	uint64_t key = get_key(client);
+	destination* dest = find(pool, key);
+	client_t* waiter = pop_waiter(dest);
+	if(waiter != 0){ //The destination is saturated, the first waiter takes over the connection and its slot.
+		++pool.stat.handover_count;
+		client->remove_poll_request();
+		waiter->set_cort_fd(client->get_cort_fd());
+		client->set_cort_fd(-1);
+		std::swap(waiter->zero_copy, client->zero_copy);
+		client->pool_state = cort_tcp_connection_waiter::pool_none;
+		waiter->pool_state = cort_tcp_connection_waiter::pool_in_use;
+		waiter->resume();
+		return false;
+	}
+	if(dest->max_idle == 0){
+		return false;
+	}
+	client->add_ref();
+	link_idle(pool, dest, client);
+	bool lazy = (dest->lazy_validation != 0 && (client->zero_copy == 0 || client->zero_copy->get_deferred_count() == 0));
+	if(lazy){
+		client->clear_timeout();
+		client->remove_poll_request();
+		client->lazy_expire_time = cort_timer_now_ms() + keep_alive_ms;
+		++pool.stat.unpolled_idle_count;
+	}
+	if(dest->idle_count > dest->max_idle){
+		++pool.stat.eviction_count;
+		client_t* oldest = dest->idle_tail;
+		unlink_idle(pool, dest, oldest);
+		close_client(oldest);
+	}
+	while(pool.stat.idle_count > cort_socket_config::SOCKET_KEEPALIVE_MAX_IDLE_COUNT){
+		++pool.stat.eviction_count;
+		client_t* oldest = pool.lru_tail;
+		unlink_idle(pool, find(pool, get_key(oldest)), oldest);
+		close_client(oldest);
+	}
+	if(lazy){
+		start_maintainer(pool);
+	}
+	return true;
+}
+
+void cort_tcp_connection_pool::close_idle(client_t* client, bool expired){
+	thread_pool& pool = get_thread_pool();
+	if(client->pool_state == cort_tcp_connection_waiter::pool_idle){
+		unlink_idle(pool, find(pool, get_key(client)), client);
+	}
+	if(expired){
+		++pool.stat.expire_count;
+	}
+	else{
+		++pool.stat.eviction_count;
+	}
+	close_client(client);
+}
+
+void cort_tcp_connection_pool::release(client_t* client){
+	thread_pool& pool = get_thread_pool();
+	switch(client->pool_state){
+	case cort_tcp_connection_waiter::pool_waiting:
+		cancel_wait(client);
+		return;
+	case cort_tcp_connection_waiter::pool_idle:
+		unlink_idle(pool, find(pool, get_key(client)), client);
+		break;
+	case cort_tcp_connection_waiter::pool_in_use:
+		break;
+	default:
+		return;
+	}
+	client->pool_state = cort_tcp_connection_waiter::pool_none;
+	destination* dest = find(pool, get_key(client));
+	client_t* waiter = pop_waiter(dest);
+	if(waiter != 0){ //The slot is given to the first waiter, it connects now.
+		waiter->pool_state = cort_tcp_connection_waiter::pool_in_use;
+		waiter->resume();
+		return;
+	}
+	--dest->total_count;
+	--pool.stat.connection_count;
+	erase_if_unused(pool, dest);
+}
+
+void cort_tcp_connection_pool::cancel_wait(client_t* client, bool timed_out){
+	if(client->pool_state != cort_tcp_connection_waiter::pool_waiting){
+		return;
+	}
+	thread_pool& pool = get_thread_pool();
+	if(timed_out){
+		++pool.stat.wait_timeout_count;
+	}
+	destination* dest = find(pool, get_key(client));
+	if(client->pool_prev != 0){
+		client->pool_prev->pool_next = client->pool_next;
+	}
+	else{
+		dest->wait_head = client->pool_next;
+	}
+	if(client->pool_next != 0){
+		client->pool_next->pool_prev = client->pool_prev;
+	}
+	else{
+		dest->wait_tail = client->pool_prev;
+	}
+	client->pool_prev = 0;
+	client->pool_next = 0;
+	client->pool_state = cort_tcp_connection_waiter::pool_none;
+	erase_if_unused(pool, dest);
+}
+
+size_t cort_tcp_connection_pool::clear_idle(size_t count, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	thread_pool& pool = get_thread_pool();
+	uint64_t key = ip_v4_key(ip_arg, port_arg, type_key_arg).data.i_data;
+	size_t result = 0;
+	for(; result < count; ++result){
+		client_t* client;
+		if(ip_arg != 0){
+			destination* dest = find(pool, key);
+			if(dest == 0 || dest->idle_tail == 0){
+				break;
+			}
+			client = dest->idle_tail;
+		}
+		else{
+			client = pool.lru_tail;
+			if(client == 0){
+				break;
+			}
+		}
+		close_idle(client, false);
+	}
+	return result;
+}
@@ -0,0 +1,97 @@
+#ifndef CORT_TCP_CONNECTION_POOL_H_
+#define CORT_TCP_CONNECTION_POOL_H_
+
+#include "cort_tcp_ctrler.h"
+
+struct ip_v4_key{
+	union{
+		struct{
+			uint32_t ip_v4;
+			uint16_t port_v4;
+			uint16_t type_key;
+		}s_data;
+		uint64_t i_data;
+	}data;
+
+	ip_v4_key(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+		data.s_data.ip_v4 = ip_arg;
+		data.s_data.port_v4 = port_arg;
+		data.s_data.type_key = type_key_arg;
+	}
+};
+
+//Thread local pool of the keep alive client connections, used by cort_tcp_ctrler.
+//The destinations(type_key:ip:port) are stored in an open addressing hash table. Every destination has a limit of its idle connections
+//and a limit of all its connections in use or idle. When the total limit is reached, try_connect waits in FIFO order until a connection
+//of the destination is returned or closed, and a returned connection is handed to the first waiter directly.
+//The idle connections are also linked in a thread LRU list, so the least recently used one is closed in O(1)
+//when an idle limit is reached or clear_keep_alive_connection is called.
+//Only the ctrlers with keep_alive_ms > 0 use the pool.
+struct cort_tcp_connection_pool{
+	struct stats{
+		uint64_t checkout_count;		//Keep alive ctrlers asking for a connection.
+		uint64_t reuse_count;			//Checkouts that got an idle connection, reuse_count/checkout_count is the reuse rate.
+		uint64_t handover_count;		//Returned connections given to a waiting ctrler directly.
+		uint64_t eviction_count;		//Idle connections closed by the idle limits or clear_keep_alive_connection.
+		uint64_t expire_count;			//Idle connections closed by keep alive timeout or the remote.
+		uint64_t wait_count;			//Checkouts that waited because the destination was saturated.
+		uint64_t wait_timeout_count;
+		uint64_t warm_connect_count;	//Connections opened ahead of time for the min_idle.
+		uint64_t warm_failure_count;
+		uint64_t validation_failure_count;	//Unpolled idle connections found closed or readable when reused.
+		size_t idle_count;
+		size_t connection_count;			//Connections in use or idle of all the destinations.
+		size_t unpolled_idle_count;			//Idle connections without epoll registration or timer.
+		size_t destination_count;
+	};
+
+	//max_idle == 0 disables keep alive of the destination, max_total == 0 means no limit.
+	//The limits of a destination set here are kept even when it has no connection.
+	static void set_limit(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t max_idle, uint32_t max_total);
+
+	//A thread maintainer connects the destination until it has min_idle idle connections(no more than the limits), then tops it up
+	//every SOCKET_KEEPALIVE_MAINTAIN_INTERVAL_MS as the idle connections expire or are used. The new connections of all the destinations
+	//are no more than SOCKET_KEEPALIVE_WARM_CONNECT_RATE per second, so a cold start does not flood the servers.
+	//The maintainer keeps the timer loop running until min_idle of all the destinations is set to 0.
+	static void set_min_idle(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t min_idle, uint32_t keep_alive_ms);
+
+	//When enabled, the idle connections of the destination are removed from epoll and have no timer, so a big pool costs neither.
+	//A connection closed by the remote is found when it is checked out: it is expired, or recv(MSG_PEEK|MSG_DONTWAIT) does not
+	//return EAGAIN, then it is closed and the next one is tried. The maintainer closes the expired ones in batches, from the least
+	//recently used, until it meets one that is not expired. So they expire in time when the keep alive time of the destinations is the same.
+	//The idle connections with unfinished zero copy sends are still polled to drain the notifications.
+	static void set_lazy_validation(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool enable);
+
+	static size_t get_idle_count(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+
+	//Connections in use or idle, the waiting ctrlers are not included.
+	static size_t get_total_count(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+
+	//Statistics of current thread.
+	static const stats& get_stats();
+
+//Following functions are used by cort_tcp_ctrler.
+	//Pop the most recently used idle connection of the destination which is still alive, or return 0.
+	static cort_tcp_connection_waiter_client* checkout(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+
+	//Count a new connection of the destination, or make it wait when the destination is saturated.
+	static void acquire(cort_tcp_connection_waiter_client* client, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+
+	//Return a connection. Return true if it is idle in the pool now, false if it is handed to a waiter or not kept.
+	//The pool holds a reference of the idle connection. The caller polls it unless its lazy_expire_time is set.
+	static bool checkin(cort_tcp_connection_waiter_client* client, uint32_t keep_alive_ms, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+
+	//Close an idle connection and release it.
+	static void close_idle(cort_tcp_connection_waiter_client* client, bool expired);
+
+	//Called when the client is destroyed, the slot of its destination is given to the first waiter.
+	static void release(cort_tcp_connection_waiter_client* client);
+
+	//Stop waiting for a slot.
+	static void cancel_wait(cort_tcp_connection_waiter_client* client, bool timed_out = false);
+
+	//Close count idle connections of the destination, or of all the destinations if ip_arg is 0, in LRU order.
+	static size_t clear_idle(size_t count, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+};
+
+#endif
@@ -6,13 +6,19 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
 #include <stdio.h>
 #include <map>
 #include <vector>
 
 #include "cort_tcp_ctrler.h"
+#include "cort_tcp_connection_pool.h"
+#include "cort_tcp_source_addr.h"
+#include "cort_tcp_circuit_breaker.h"
+#include "cort_tcp_concurrency_limiter.h"
 namespace cort_socket_error_codes{
 	static error_str<0, 255> obj;
 	const char* error_info(uint8_t code){
@@ -32,6 +38,11 @@ cort_tcp_ctrler::cort_tcp_ctrler(){
 	ip_v4 = 0;
 	port_v4 = 0;
 	type_key = 0;
+	zero_copy_threshold = 0;
+	disable_adaptive_recv_size = 0;
+	disable_optimistic_recv = 0;
+	limiter_waiter = 0;
+	limiter_place = 0;
 	
 	errnum = 0;
 }
@@ -81,54 +92,382 @@ void cort_tcp_ctrler::refresh_socket_option(){
 	}
 }
 
-struct ip_v4_key{
-	union{
-		struct{
-			uint32_t ip_v4;
-			uint16_t port_v4;
-			uint16_t type_key;
-		}s_data;
-		uint64_t i_data;
-	}data;
-};
-
-//Here cort_tcp_connection_waiter_client* element in the vector should be its only strong reference!
-static __thread std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >* connection_tcp_pool = 0;
-static void remove_keep_alive(cort_tcp_connection_waiter_client* tcp_cort){
-	ip_v4_key key;
-	key.data.s_data.ip_v4 = tcp_cort->ip_v4;
-	key.data.s_data.port_v4 = tcp_cort->port_v4;
-	key.data.s_data.type_key = tcp_cort->type_key;
-	std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >::iterator it = connection_tcp_pool->find(key.data.i_data);
-	if(it != connection_tcp_pool->end()){
-		std::vector<cort_tcp_connection_waiter_client* >& dq = it->second;
-		cort_tcp_connection_waiter_client* last = dq.back();
-		last->waiter_pos = tcp_cort->waiter_pos;
-		dq[tcp_cort->waiter_pos] = last;
-		dq.pop_back();
-		
-		tcp_cort->clear();
-		tcp_cort->close_cort_fd();
-		tcp_cort->release();
-		if(dq.empty()){
-			if(connection_tcp_pool->size() == 1){
-				delete connection_tcp_pool;
-				connection_tcp_pool = 0;
-			}else{
-				connection_tcp_pool->erase(it);
+void cort_tcp_zero_copy_ctrl::defer_free(void* ptr){
+	if(next_seq == finished_seq){ //The kernel has finished all the send calls.
+		cort_buffer_pool::free(ptr);
+		return;
+	}
+	if(buffer_tail - buffer_head == buffer_capacity){
+		uint32_t new_capacity = (buffer_capacity == 0 ? 16 : (buffer_capacity << 1));
+		deferred_buffer* new_buffers = (deferred_buffer*)malloc(new_capacity * sizeof(deferred_buffer));
+		if(new_buffers == 0){ //We can only leak it rather than free it when the kernel is still reading.
+			return;
+		}
+		uint32_t count = buffer_tail - buffer_head;
+		for(uint32_t i = 0; i < count; ++i){
+			new_buffers[i] = buffers[(buffer_head + i) & (buffer_capacity - 1)];
+		}
+		free(buffers);
+		buffers = new_buffers;
+		buffer_capacity = new_capacity;
+		buffer_head = 0;
+		buffer_tail = count;
+	}
+	deferred_buffer& result = buffers[(buffer_tail++) & (buffer_capacity - 1)];
+	result.ptr = ptr;
+	result.seq = next_seq;
+}
+
+void cort_tcp_zero_copy_ctrl::release_finished(){
+	while(buffer_head != buffer_tail){
+		deferred_buffer& front = buffers[buffer_head & (buffer_capacity - 1)];
+		if((int32_t)(finished_seq - front.seq) < 0){
+			break;
+		}
+		cort_buffer_pool::free(front.ptr);
+		++buffer_head;
+	}
+}
+
+void cort_tcp_zero_copy_ctrl::free_all(){
+	finished_seq = next_seq;
+	release_finished();
+	buffer_head = 0;
+	buffer_tail = 0;
+	next_seq = 0;
+	finished_seq = 0;
+}
+
+void cort_tcp_zero_copy_ctrl::read_notification(int fd){
+#if defined(SO_EE_ORIGIN_ZEROCOPY)
+	char control[128];
+	while(true){
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != 0; cm = CMSG_NXTHDR(&msg, cm)){
+			if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) 
+				|| (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))){
+				continue;
+			}
+			struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+			if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY){
+				continue;
+			}
+			//TCP reports the finished range [ee_info, ee_data] in order.
+			finished_seq = err->ee_data + 1;
+			if((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0){
+				state = zero_copy_disabled;
+			}
+		}
+	}
+	release_finished();
+#endif
+}
+
+namespace{
+	//A closed socket whose zero copy buffers are still sent by the kernel. fd is a dup, so the socket is kept open.
+	struct zero_copy_grave{
+		int fd;
+		cort_tcp_zero_copy_ctrl* ctrl;
+		cort_timeout_waiter::time_ms_t expire_time;
+		zero_copy_grave* next;
+	};
+
+	struct zero_copy_graveyard{
+		zero_copy_grave* head;
+		cort_timeout_waiter* sweeper;
+	};
+
+	inline zero_copy_graveyard& get_thread_graveyard(){
+		static __thread zero_copy_graveyard graveyard;
+		return graveyard;
+	}
+
+	//Reset the socket so the kernel drops the data not sent, then the buffers can be freed.
+	void bury(zero_copy_grave* grave){
+		struct linger reset_linger;
+		reset_linger.l_onoff = 1;
+		reset_linger.l_linger = 0;
+		setsockopt(grave->fd, SOL_SOCKET, SO_LINGER, &reset_linger, sizeof(reset_linger));
+		close(grave->fd);
+		grave->ctrl->free_all();
+		delete grave->ctrl;
+		delete grave;
+	}
+
+	//Read the notifications of the graves, and close the finished or expired ones. Return true if some graves are left.
+	bool sweep_graveyard(zero_copy_graveyard& graveyard, bool force){
+		cort_timeout_waiter::time_ms_t now = cort_timer_now_ms();
+		zero_copy_grave** current = &graveyard.head;
+		while(*current != 0){
+			zero_copy_grave* grave = *current;
+			grave->ctrl->read_notification(grave->fd);
+			if(grave->ctrl->get_deferred_count() == 0){
+				*current = grave->next;
+				close(grave->fd);
+				delete grave->ctrl;
+				delete grave;
+			}
+			else if(force || now >= grave->expire_time){
+				*current = grave->next;
+				bury(grave);
+			}
+			else{
+				current = &grave->next;
 			}
 		}
+		return graveyard.head != 0;
 	}
+
+	struct zero_copy_sweeper : public cort_timeout_waiter{
+		CO_DECL(zero_copy_sweeper)
+		cort_proto* start(){
+			CO_BEGIN
+				if(!sweep_graveyard(get_thread_graveyard(), is_stopped())){
+					CO_RETURN;
+				}
+				set_timeout(cort_socket_config::SOCKET_ZERO_COPY_SWEEP_INTERVAL_MS);
+				CO_AGAIN;
+			CO_END
+		}
+		cort_proto* on_finish(){
+			get_thread_graveyard().sweeper = 0;
+			cort_timeout_waiter::on_finish();
+			delete this;
+			return 0;
+		}
+	};
+}
+
+void cort_tcp_zero_copy_ctrl::retire(int fd){
+	if(fd > 0 && get_deferred_count() != 0){
+		read_notification(fd);
+	}
+	if(get_deferred_count() != 0){
+		int grave_fd = (fd > 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1);
+		if(grave_fd < 0){ //We can only leak them rather than free them when the kernel is still reading.
+			buffer_head = buffer_tail;
+		}
+		else{
+			zero_copy_grave* grave = new zero_copy_grave();
+			grave->fd = grave_fd;
+			grave->ctrl = new cort_tcp_zero_copy_ctrl();
+			std::swap(buffers, grave->ctrl->buffers);
+			std::swap(buffer_head, grave->ctrl->buffer_head);
+			std::swap(buffer_tail, grave->ctrl->buffer_tail);
+			std::swap(buffer_capacity, grave->ctrl->buffer_capacity);
+			std::swap(next_seq, grave->ctrl->next_seq);
+			std::swap(finished_seq, grave->ctrl->finished_seq);
+			grave->expire_time = cort_timer_now_ms() + cort_socket_config::SOCKET_ZERO_COPY_LINGER_MS;
+			zero_copy_graveyard& graveyard = get_thread_graveyard();
+			grave->next = graveyard.head;
+			graveyard.head = grave;
+			if(graveyard.sweeper == 0){
+				zero_copy_sweeper* sweeper = new zero_copy_sweeper();
+				graveyard.sweeper = sweeper;
+				sweeper->start();
+			}
+		}
+	}
+	free_all();
+	state = zero_copy_unknown;
+}
+
+cort_tcp_connection_waiter::~cort_tcp_connection_waiter(){
+	retire_zero_copy();	//The fd is still open, it is closed by ~cort_fd_waiter.
+	delete zero_copy;
+}
+
+size_t cort_tcp_connection_waiter::prepare_zero_copy(send_buffer_ctrl& ctrler, size_t max_count, uint32_t min_size){
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+	if(zero_copy == 0){
+		zero_copy = new cort_tcp_zero_copy_ctrl();
+	}
+	if(zero_copy->state == cort_tcp_zero_copy_ctrl::zero_copy_unknown){
+		int flag = 1;
+		if(setsockopt(get_cort_fd(), SOL_SOCKET, SO_ZEROCOPY, &flag, sizeof(flag)) != 0){
+			zero_copy->state = cort_tcp_zero_copy_ctrl::zero_copy_disabled;
+			return 0;
+		}
+		zero_copy->state = cort_tcp_zero_copy_ctrl::zero_copy_enabled;
+	}
+	if(zero_copy->state != cort_tcp_zero_copy_ctrl::zero_copy_enabled){
+		return 0;
+	}
+	return ctrler.mark_zero_copy(max_count, min_size);
+#else
+	return 0;
+#endif
+}
+
+bool cort_tcp_connection_waiter::drain_zero_copy_notification(){
+	uint32_t poll_event = get_poll_result();
+	if(zero_copy == 0 || (poll_event & EPOLLERR) == 0){
+		return false;
+	}
+	zero_copy->read_notification(get_cort_fd());
+	int socket_error = 0;
+	socklen_t len = sizeof(socket_error);
+	if(getsockopt(get_cort_fd(), SOL_SOCKET, SO_ERROR, &socket_error, &len) != 0 || socket_error != 0){
+		return false;
+	}
+	set_poll_result(poll_event & (~EPOLLERR));
+	return true;
+}
+
+char* recv_buffer_ctrl::append_recv_block(){
+	if(recv_block_count == recv_block_capacity){
+		uint32_t new_capacity = (recv_block_capacity == 0 ? 4 : (recv_block_capacity << 1));
+		iovec* new_blocks = (iovec*)realloc(recv_blocks, new_capacity * sizeof(iovec));
+		if(new_blocks == 0){
+			return 0;
+		}
+		recv_blocks = new_blocks;
+		recv_block_capacity = new_capacity;
+	}
+	char* result = (char*)cort_buffer_pool::alloc(recv_block_size);
+	if(result == 0){
+		return 0;
+	}
+	recv_blocks[recv_block_count].iov_base = result;
+	recv_blocks[recv_block_count].iov_len = recv_block_size;
+	++recv_block_count;
+	recv_buffer = (char*)recv_blocks[0].iov_base;
+	return result;
+}
+
+void recv_buffer_ctrl::free_recv_blocks(uint32_t keep_count){
+	for(uint32_t i = keep_count; i < recv_block_count; ++i){
+		cort_buffer_pool::free(recv_blocks[i].iov_base);
+	}
+	if(recv_block_count > keep_count){
+		recv_block_count = keep_count;
+	}
+	if(recv_block_count == 0){
+		recv_buffer = 0;
+	}
+	else if(recv_blocks[0].iov_len != recv_block_size){ //A linearized block, we do not reuse it.
+		cort_buffer_pool::free(recv_blocks[0].iov_base);
+		recv_block_count = 0;
+		recv_buffer = 0;
+	}
+}
+
+char* recv_buffer_ctrl::linearize(){
+	if(recv_block_size == 0 || recv_block_count == 0 || (size_t)recved_size <= recv_blocks[0].iov_len){
+		return recv_buffer;
+	}
+	char* result = (char*)cort_buffer_pool::alloc(recved_size);
+	if(result == 0){
+		return 0;
+	}
+	size_t offset = 0;
+	for(uint32_t i = 0; i < recv_block_count && offset < (size_t)recved_size; ++i){
+		size_t len = recv_blocks[i].iov_len;
+		if(len > recved_size - offset){
+			len = recved_size - offset;
+		}
+		memcpy(result + offset, recv_blocks[i].iov_base, len);
+		offset += len;
+	}
+	free_recv_blocks(0);
+	recv_blocks[0].iov_base = result;
+	recv_blocks[0].iov_len = recved_size;
+	recv_block_count = 1;
+	recv_buffer = result;
+	return result;
+}
+
+ssize_t recv_buffer_ctrl::recv_segmented(int fd){
+	iovec data[max_recv_iov_count];
+	size_t rest_size = recv_buffer_size - recved_size;
+	size_t offset = recved_size;
+	uint32_t index = 0;
+	//Skip the full blocks.
+	for(; index < recv_block_count && offset >= recv_blocks[index].iov_len; ++index){
+		offset -= recv_blocks[index].iov_len;
+	}
+	//Allocate no more new blocks than the blocks already filled, so the unused space is no more than half like realloc doubling.
+	uint32_t new_block_limit = (index == 0 ? 1 : index);
+	uint32_t count = 0;
+	while(count < max_recv_iov_count && rest_size != 0){
+		if(index == recv_block_count){
+			if(new_block_limit-- == 0){
+				break;
+			}
+			if(append_recv_block() == 0){
+				break;
+			}
+		}
+		size_t len = recv_blocks[index].iov_len - offset;
+		if(len > rest_size){
+			len = rest_size;
+		}
+		data[count].iov_base = (char*)recv_blocks[index].iov_base + offset;
+		data[count].iov_len = len;
+		rest_size -= len;
+		offset = 0;
+		++index;
+		++count;
+	}
+	if(count == 0){
+		errno = ENOMEM;
+		return -1;
+	}
+	return readv(fd, data, count);
+}
+
+ssize_t send_buffer_ctrl::send_front(int fd, size_t& segment_count, size_t& file_send_size){
+	segment_count = get_memory_segment_count(cort_socket_config::SOCKET_SEND_MAX_IOV_COUNT);
+	file_send_size = 0;
+	if(segment_count == 0){ //A file segment at the front.
+		iovec& file_data = send_data[send_head];
+		off_t offset = (off_t)(size_t)file_data.iov_base;
+		file_send_size = file_data.iov_len;
+		if(file_send_size > cort_socket_config::SOCKET_SENDFILE_MAX_SIZE){
+			file_send_size = cort_socket_config::SOCKET_SENDFILE_MAX_SIZE;
+		}
+		segment_count = 1;
+		ssize_t result = sendfile(fd, (int)send_data_tag[send_head], &offset, file_send_size);
+		if(result == 0 && file_send_size != 0){ //The file is shorter than expected.
+			errno = ENODATA;
+			return -1;
+		}
+		return result;
+	}
+	if(segment_count < size()){ //Followed by a file segment, so hold the header until the file content.
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = send_data + send_head;
+		msg.msg_iovlen = segment_count;
+		return sendmsg(fd, &msg, (file_segment_count != 0 ? MSG_MORE : 0));
+	}
+	if(segment_count == 1){
+		return send(fd, send_data[send_head].iov_base, send_data[send_head].iov_len, 0);
+	}
+	return writev(fd, send_data + send_head, segment_count);
 }
 
 static cort_proto* on_connection_keepalive_timeout_or_readable(cort_proto* arg){
 	cort_tcp_connection_waiter_client* tcp_cort = (cort_tcp_connection_waiter_client*)arg;
-	remove_keep_alive(tcp_cort);
+	if(tcp_cort->drain_zero_copy_notification() && tcp_cort->get_poll_result() == 0){ //Only zero copy notifications, keep waiting.
+		return tcp_cort;
+	}
+	cort_tcp_connection_pool::close_idle(tcp_cort, true);
 	return 0;
 }
 
 static cort_proto* stop_poll_when_notification(cort_proto* arg){
 	cort_tcp_connection_waiter* tcp_cort = (cort_tcp_connection_waiter*)arg;
+	tcp_cort->drain_zero_copy_notification();
 	if(tcp_cort->get_parent() != 0  //This error happened after the connection finished some jobs before its parent knows. So do not pass error codes to parent.
 		|| tcp_cort->release() != 0){ //Or it is referenced by others. Usually, it should be only referenced by its parent!
 		if(tcp_cort->is_timeout_or_stopped()){
@@ -158,55 +497,37 @@ cort_proto* cort_tcp_connection_waiter::on_finish(){
     return 0;
 }
 
+cort_tcp_connection_waiter_client::~cort_tcp_connection_waiter_client(){
+	cort_tcp_connection_pool::release(this);
+}
+
 void cort_tcp_connection_waiter_client::keep_alive(uint32_t keep_alive_ms, uint32_t ip_v4, uint16_t port_v4, uint16_t type_key){
-	ip_v4_key key;
-	key.data.s_data.ip_v4 = ip_v4;
-	key.data.s_data.port_v4 = port_v4;
-	key.data.s_data.type_key = type_key;
-	
-	this->ip_v4 = ip_v4;
-	this->port_v4 = port_v4;
-	this->type_key = type_key;
-	this->add_ref();
+	this->set_parent(0);
+	if(!cort_tcp_connection_pool::checkin(this, keep_alive_ms, ip_v4, port_v4, type_key)){ //Handed to a waiter, or not kept. The caller releases it.
+		return;
+	}
+	if(this->lazy_expire_time != 0){ //Not polled, it is checked when reused.
+		return;
+	}
 	this->set_timeout(keep_alive_ms);
 	this->set_run_function(on_connection_keepalive_timeout_or_readable);
-	this->set_parent(0);
 	this->set_poll_request(EPOLLIN | EPOLLRDHUP);
-	if(connection_tcp_pool == 0){
-		connection_tcp_pool = new std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >();
-	}
-	std::vector<cort_tcp_connection_waiter_client* > & container = (*connection_tcp_pool)[key.data.i_data];
-	this->waiter_pos = container.size();
-	container.push_back(this);
 }
 
 cort_tcp_connection_waiter_client* cort_tcp_ctrler::get_keep_alive_connection_client(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
-	if(connection_tcp_pool == 0){
-		return 0;
-	}
-	ip_v4_key key;
-	key.data.s_data.ip_v4 = ip_arg;
-	key.data.s_data.port_v4 = port_arg;
-	key.data.s_data.type_key = type_key_arg;
-	std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >::iterator it = connection_tcp_pool->find(key.data.i_data);
-	cort_tcp_connection_waiter_client* p = 0;
-	if(it != connection_tcp_pool->end()){
-		std::vector<cort_tcp_connection_waiter_client* >& dq = it->second;
-		p = dq.back();
-		p->clear();
-		p->remove_ref();
-		dq.pop_back();
-		if(dq.empty()){
-			if(connection_tcp_pool->size() == 1){
-				delete connection_tcp_pool;
-				connection_tcp_pool = 0;
-			}
-			else{
-				connection_tcp_pool->erase(it);
-			}
-		}	
-	}
-	return p;
+	return cort_tcp_connection_pool::checkout(ip_arg, port_arg, type_key_arg);
+}
+
+void cort_tcp_ctrler::set_keep_alive_limit(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t max_idle, uint32_t max_total){
+	cort_tcp_connection_pool::set_limit(ip_arg, port_arg, type_key_arg, max_idle, max_total);
+}
+
+void cort_tcp_ctrler::set_keep_alive_min_idle(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t min_idle, uint32_t keep_alive_ms){
+	cort_tcp_connection_pool::set_min_idle(ip_arg, port_arg, type_key_arg, min_idle, keep_alive_ms);
+}
+
+void cort_tcp_ctrler::set_keep_alive_lazy_validation(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool enable){
+	cort_tcp_connection_pool::set_lazy_validation(ip_arg, port_arg, type_key_arg, enable);
 }
 
 void cort_tcp_connection_waiter::set_errno(uint8_t err){
@@ -216,14 +537,108 @@ void cort_tcp_connection_waiter::set_errno(uint8_t err){
 }
 
 void cort_tcp_connection_waiter::close_connection(uint8_t err){
+	cort_tcp_ctrler* parent_waiter = (cort_tcp_ctrler*)get_parent();
+	if(parent_waiter != 0 && parent_waiter->connection_waiter.get_ptr() == this){
+		parent_waiter->defer_zero_copy_segments();
+	}
+	retire_zero_copy();
 	close_cort_fd();
 	set_errno(err);
 }
 
+int cort_tcp_connection_waiter::start_connect(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool& connected, uint8_t& err){
+	connected = false;
+	if(cort_tcp_source_addr::need_trim(cort_tcp_connection_pool::get_total_count(ip_arg, port_arg, type_key_arg))){
+		//Before the ephemeral ports to the destination are exhausted.
+		cort_tcp_source_addr::on_trim(cort_tcp_connection_pool::clear_idle(cort_socket_config::SOCKET_KEEPALIVE_AUTO_RELEASE_COUNT,
+			ip_arg, port_arg, type_key_arg));
+	}
+	size_t attempt = 0;
+socket_again:
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if(sockfd == -1 ){
+		err = cort_socket_error_codes::SOCKET_CREATE_ERROR;
+		return -1;
+	}
+	struct sockaddr_in servaddr;
+	bzero(&servaddr,sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_port = port_arg;
+	servaddr.sin_addr.s_addr = ip_arg;
+	
+	int flag = fcntl(sockfd, F_GETFL);
+	if (-1 == flag || fcntl(sockfd, F_SETFL, flag | O_NONBLOCK) == -1){
+		close(sockfd);
+		err = cort_socket_error_codes::SOCKET_CREATE_ERROR;
+		return -1;
+	}
+	int status = -1;
+	int thread_errno = cort_tcp_source_addr::bind_source(sockfd, ip_arg, port_arg, attempt);
+	bool bound = (thread_errno == 0);
+	if(bound){
+	connect_again:
+		status = connect(sockfd,  (struct sockaddr*)(&servaddr), sizeof(sockaddr_in));
+		thread_errno = (status == 0 ? 0 : errno);
+		if(thread_errno == EINTR){
+			goto connect_again;
+		}
+	}
+	if(status == 0 || thread_errno == EISCONN){
+		connected = true;
+		return sockfd;
+	}
+	if(thread_errno == EINPROGRESS){
+		return sockfd;
+	}
+	close(sockfd);
+	if(thread_errno == EADDRNOTAVAIL){ //The ephemeral ports are exhausted, the idle connections of the same destination are reused already.
+		cort_tcp_connection_waiter_client::clear_keep_alive_connection(cort_socket_config::SOCKET_KEEPALIVE_AUTO_RELEASE_COUNT);
+		bool retry = (++attempt < cort_tcp_source_addr::get_source_count());
+		cort_tcp_source_addr::on_port_exhaustion(retry);
+		if(retry){ //Another source ip has its own ports.
+			goto socket_again;
+		}
+	}
+	else if(!bound){
+		err = cort_socket_error_codes::SOCKET_BIND_ERROR;
+		return -1;
+	}
+	err = cort_socket_error_codes::SOCKET_CONNECT_ERROR;
+	return -1;
+}
+
+uint8_t cort_tcp_connection_waiter::check_connected(int fd, uint32_t poll_event){
+	if( ((EPOLLHUP|EPOLLRDHUP|EPOLLERR) & poll_event) != 0){
+		return cort_socket_error_codes::SOCKET_CONNECT_REJECTED;
+	}
+	if((EPOLLOUT & poll_event) == 0){
+		return cort_socket_error_codes::SOCKET_CONNECT_ERROR;
+	}
+	int socket_error = 0;
+	socklen_t len = sizeof(socket_error);
+	if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &socket_error, &len) != 0 || socket_error != 0){
+		return cort_socket_error_codes::SOCKET_CONNECT_REJECTED;
+	}
+	return 0;
+}
+
 const static uint32_t connec_poll_request = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
 cort_proto* cort_tcp_connection_waiter::try_connect(){
 	CO_BEGIN
-		if(is_connected()){
+		if(pool_state == pool_waiting){
+			cort_tcp_ctrler* parent_waiter = (cort_tcp_ctrler*)get_parent();
+			if(parent_waiter->timeout != 0){ //It limits both the waiting and the connecting.
+				this->set_timeout(parent_waiter->timeout);
+				parent_waiter->timeout = 0;
+			}
+		}
+		CO_YIELD_IF(pool_state == pool_waiting);	//Resumed by the pool when a slot of the destination is free.
+		if(pool_state == pool_waiting){ //Timeout or stopped.
+			cort_tcp_connection_pool::cancel_wait((cort_tcp_connection_waiter_client*)this, true);
+			set_errno(cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT);
+			CO_RETURN;
+		}
+		if(is_connected()){ //Maybe a connection handed over by the pool.
 			CO_RETURN;
 		}
 		cort_tcp_ctrler* parent_waiter = (cort_tcp_ctrler*)get_parent();
@@ -235,65 +650,28 @@ cort_proto* cort_tcp_connection_waiter::try_connect(){
 			this->set_timeout(parent_waiter->timeout);
 			parent_waiter->timeout = 0;
 		}
-		int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-		if(sockfd == -1 ){
-			set_errno(cort_socket_error_codes::SOCKET_CREATE_ERROR);
-			CO_RETURN;
-		}
-		struct sockaddr_in servaddr;
-		bzero(&servaddr,sizeof(servaddr));
-		servaddr.sin_family = AF_INET;
-		servaddr.sin_port = (parent_waiter->port_v4);
-		servaddr.sin_addr.s_addr = (parent_waiter->ip_v4);
-		
-		int flag = fcntl(sockfd, F_GETFL);
-		if (-1 == flag || fcntl(sockfd, F_SETFL, flag | O_NONBLOCK) == -1){
-			close(sockfd);
-			set_errno(cort_socket_error_codes::SOCKET_CREATE_ERROR);
+		retire_zero_copy();
+		bool connected;
+		uint8_t err;
+		int sockfd = start_connect(parent_waiter->ip_v4, parent_waiter->port_v4, parent_waiter->type_key, connected, err);
+		if(sockfd == -1){
+			set_errno(err);
 			CO_RETURN;
 		}
-		int status;
-	connect_again:
-		status = connect(sockfd,  (struct sockaddr*)(&servaddr), sizeof(sockaddr_in));
-		if(status != 0){
-			int thread_errno = errno;
-			if(thread_errno == EISCONN){
-				set_cort_fd(sockfd);
-				CO_RETURN;
-			}
-			else if(thread_errno != EINPROGRESS){
-				if(thread_errno == EINTR){
-					goto connect_again;
-				}
-				else if(thread_errno == EADDRNOTAVAIL){
-					cort_tcp_connection_waiter_client::clear_keep_alive_connection(cort_socket_config::SOCKET_KEEPALIVE_AUTO_RELEASE_COUNT, 
-						parent_waiter->ip_v4, parent_waiter->port_v4, parent_waiter->type_key
-					);
-				}
-				close(sockfd);
-				set_errno(cort_socket_error_codes::SOCKET_CONNECT_ERROR);
-				CO_RETURN;
-			}
-		}
-		else{
-			set_cort_fd(sockfd);
+		set_cort_fd(sockfd);
+		if(connected){
 			parent_waiter->refresh_socket_option();
 			CO_RETURN;
 		}
-		set_cort_fd(sockfd);
 		set_poll_request(connec_poll_request);
 		CO_YIELD();
 		if(is_timeout_or_stopped()){
 			close_connection(cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT);
 			CO_RETURN;	
 		}
-		uint32_t poll_event = get_poll_result();
-		if( ((EPOLLHUP|EPOLLRDHUP|EPOLLERR) & poll_event) != 0){
-			close_connection(cort_socket_error_codes::SOCKET_CONNECT_REJECTED);
-			CO_RETURN;	
-		}
-		if((EPOLLOUT & poll_event) == 0){
-			close_connection(cort_socket_error_codes::SOCKET_CONNECT_ERROR);
+		uint8_t err = check_connected(get_cort_fd(), get_poll_result());
+		if(err != 0){
+			close_connection(err);
 			CO_RETURN;
 		}
 		((cort_tcp_ctrler*)get_parent())->refresh_socket_option();
@@ -308,6 +686,7 @@ cort_proto* cort_tcp_connection_waiter::try_send(){
 			CO_RETURN;
 		}
 		
+		drain_zero_copy_notification();
 		uint32_t poll_event = get_poll_result();
 		if( ((EPOLLHUP|EPOLLRDHUP|EPOLLERR|EPOLLIN) & poll_event) != 0){
 			close_connection(cort_socket_error_codes::SOCKET_REMOTE_CANCELED);
@@ -331,19 +710,39 @@ cort_proto* cort_tcp_connection_waiter::try_send(){
 			parent_waiter->timeout = 0;
 		}
 		send_buffer_ctrl& ctrler = parent_waiter->send_buffer;
-		size_t send_last_index = ctrler.get_free_index();
-		bool send_finished = true;
-		if(send_last_index != 0){			
+		if(!ctrler.empty()){			
 			int fd = get_connected_fd();
 			ssize_t current_sended_size;
+			size_t segment_count;
+			size_t zero_copy_count;
+			size_t file_send_size;
 		send_label:
-			if(send_last_index == 1){
-				current_sended_size = send(fd, ctrler.send_data[0].iov_base, ctrler.send_data[0].iov_len, 0);
+			segment_count = ctrler.get_memory_segment_count(cort_socket_config::SOCKET_SEND_MAX_IOV_COUNT);
+			zero_copy_count = 0;
+			file_send_size = 0;
+			if(segment_count != 0 && parent_waiter->zero_copy_threshold != 0){
+				zero_copy_count = prepare_zero_copy(ctrler, segment_count, parent_waiter->zero_copy_threshold);
 			}
-			else{
-				current_sended_size = writev(fd, ctrler.send_data, send_last_index);
+#if defined(MSG_ZEROCOPY)
+			if(zero_copy_count != 0){
+				segment_count = zero_copy_count;
+				struct msghdr msg;
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_iov = ctrler.send_data + ctrler.send_head;
+				msg.msg_iovlen = segment_count;
+				current_sended_size = sendmsg(fd, &msg, MSG_ZEROCOPY);
+				if(current_sended_size >= 0){
+					++zero_copy->next_seq;
+				}
+				else if(errno == ENOBUFS){ //Out of the optmem limit, copy it this time.
+					current_sended_size = writev(fd, ctrler.send_data + ctrler.send_head, segment_count);
+				}
+			}
+			else
+#endif
+			{
+				current_sended_size = ctrler.send_front(fd, segment_count, file_send_size);
 			}
-			
 			if(current_sended_size < 0){
 				int thread_errno = errno;
 				if(thread_errno == EINTR) {
@@ -355,33 +754,12 @@ cort_proto* cort_tcp_connection_waiter::try_send(){
 				close_connection(cort_socket_error_codes::SOCKET_SEND_ERROR);
 				CO_RETURN;
 			}
-			for(size_t i = 0; i < send_last_index ; ++i){
-				if(current_sended_size >= (ssize_t)ctrler.send_data[i].iov_len){
-					current_sended_size -= ctrler.send_data[i].iov_len;
-					int32_t back_result = ((int32_t*)ctrler.send_data_tag)[i];
-					if(back_result >= 0){
-						free((char*)(ctrler.send_data[i].iov_base) - ctrler.send_data_tag[i]);
-					}
-					ctrler.send_data[i].iov_base = 0;
-				}else {//current_sended_size maybe zero!
-					ctrler.send_data[i].iov_base = (char*)(ctrler.send_data[i].iov_base) + current_sended_size;
-					ctrler.send_data[i].iov_len -= current_sended_size;
-					ctrler.send_data_tag[i] += current_sended_size;
-					send_finished = false;
-					if(i != 0){
-						size_t j = 0;
-						for( ;i < send_last_index && ctrler.send_data[i].iov_base !=0; ++i,++j ){ //move ahead!
-							ctrler.send_data[j] = ctrler.send_data[i];
-							ctrler.send_data_tag[j] = ctrler.send_data_tag[i];
-						}
-						ctrler.send_data[j].iov_base = 0;
-					}
-					break;
-				}
-			}
 			//Send finished?
-			if(send_finished){
-				CO_RETURN;
+			if(ctrler.consume(current_sended_size, zero_copy) >= segment_count || (size_t)current_sended_size == file_send_size){
+				if(ctrler.empty()){
+					CO_RETURN;
+				}
+				goto send_label; //More segments to send, the socket may be still writable.
 			}
 		send_again_label:
 			set_poll_request(send_poll_request);
@@ -401,18 +779,19 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 			close_connection(cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT);
 			CO_RETURN;	
 		}
+		drain_zero_copy_notification();
 		uint32_t poll_event = get_poll_result();
 		if( ((EPOLLHUP|EPOLLERR) & poll_event) != 0){
 			close_connection(cort_socket_error_codes::SOCKET_REMOTE_CANCELED);
 			CO_RETURN;	
 		}
 		
-		if((poll_event & EPOLLIN) == 0){
+		cort_tcp_ctrler* parent_waiter = (cort_tcp_ctrler*)get_parent();
+		if((poll_event & EPOLLIN) == 0 && (recv_poll_waiting != 0 || parent_waiter->disable_optimistic_recv != 0)){
+			recv_poll_waiting = 1;
 			set_poll_request(recv_poll_request);
 			CO_AGAIN;
 		}
-
-		cort_tcp_ctrler* parent_waiter = (cort_tcp_ctrler*)get_parent();
 		
 		if(parent_waiter->timeout != 0){
 			this->set_timeout(parent_waiter->timeout);
@@ -422,18 +801,24 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 		recv_buffer_ctrl::recv_buffer_size_t to_recved_size;
 		ssize_t recved_size;
 		recv_buffer_ctrl* rcv_buf = &parent_waiter->recv_buffer;
-		if(rcv_buf->recv_buffer == 0 && rcv_buf->realloc_recv_buffer() == 0){ //alloc error.
+		if(rcv_buf->recv_buffer == 0 && rcv_buf->realloc_recv_buffer(parent_waiter->get_init_recv_size()) == 0){ //alloc error.
 			close_connection(cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR);
 			CO_RETURN;
 		}
 		int fd = get_cort_fd();
 	recv_label:
-		recved_size = recv(fd, rcv_buf->recv_buffer + rcv_buf->recved_size, 
+		if(rcv_buf->recv_block_size != 0){
+			recved_size = rcv_buf->recv_segmented(fd);
+		}
+		else{
+			recved_size = recv(fd, rcv_buf->recv_buffer + rcv_buf->recved_size, 
 				rcv_buf->recv_buffer_size - rcv_buf->recved_size, 0);
+		}
 		if(recved_size > 0){
 			rcv_buf->recved_size += recved_size;
 			if(rcv_buf->data0._.recv_check_further_needed != 0){ //You have to recv recv_buffer_size in total
 				if(rcv_buf->recved_size == rcv_buf->recv_buffer_size) {
+					parent_waiter->learn_recv_size();
 					if(EPOLLRDHUP & poll_event){
 						close_connection(0);
 					}
@@ -443,6 +828,7 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 					close_connection(cort_socket_error_codes::SOCKET_REMOTE_CANCELED);
 					CO_RETURN;	
 				}
+				recv_poll_waiting = 1;
 				set_poll_request(recv_poll_request);
 				CO_AGAIN;
 			}
@@ -454,9 +840,14 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 				goto recv_label;
 			}
 			if ((thread_errno == EAGAIN) || (thread_errno == EWOULDBLOCK) ){
+				recv_poll_waiting = 1;
 				set_poll_request(recv_poll_request);
 				CO_AGAIN;
 			}
+			if(thread_errno == ENOMEM){
+				close_connection(cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR);
+				CO_RETURN;
+			}
 			close_connection(cort_socket_error_codes::SOCKET_RECEIVE_ERROR);
 			CO_RETURN;
 		}
@@ -467,6 +858,7 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 		
 		to_recved_size = rcv_buf->recv_check(rcv_buf, parent_waiter);
 		if(to_recved_size == rcv_buf->recved_size){
+			parent_waiter->learn_recv_size();
 			if(rcv_buf->data0._.recv_finished_shrink_needed != 0){
 				rcv_buf->shrink_to_fit();
 			}
@@ -491,6 +883,7 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 		else{		
 			if(to_recved_size > 0){
 				if(to_recved_size <= rcv_buf->recved_size){
+					parent_waiter->learn_recv_size();
 					if(EPOLLRDHUP & poll_event){
 						close_connection(0);
 					}
@@ -515,16 +908,104 @@ cort_proto* cort_tcp_connection_waiter::try_recv(){
 			close_connection(cort_socket_error_codes::SOCKET_REMOTE_CANCELED);
 			CO_RETURN;	
 		}
+		recv_poll_waiting = 1;
 		set_poll_request(recv_poll_request);
 		CO_AGAIN;
 	CO_END
 }
 
+//EWMA of the received size for every type_key:ip:port, the weight of a new sample is 1/8.
+namespace{
+	//Open addressing with linear probing in a fixed table, key 0 is an empty slot. The ip and port of a destination are never 0.
+	struct recv_size_slot{
+		uint64_t key;
+		uint32_t size;
+	};
+
+	inline recv_size_slot*& get_thread_recv_size_table(){
+		static __thread recv_size_slot* table = 0;
+		return table;
+	}
+
+	inline uint32_t get_recv_size_slot(uint64_t key){
+		return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cort_socket_config::SOCKET_RECV_SIZE_TABLE_SIZE - 1);
+	}
+
+	//Return the slot of the key, or an empty slot for it if insert, or else 0.
+	recv_size_slot* find_recv_size(recv_size_slot* table, uint64_t key, bool insert){
+		uint32_t home = get_recv_size_slot(key);
+		for(uint32_t i = 0; i < cort_socket_config::SOCKET_RECV_SIZE_PROBE_COUNT; ++i){
+			recv_size_slot& current = table[(home + i) & (cort_socket_config::SOCKET_RECV_SIZE_TABLE_SIZE - 1)];
+			if(current.key == key){
+				return &current;
+			}
+			if(current.key == 0){
+				return insert ? &current : 0;
+			}
+		}
+		return 0;
+	}
+}
+
+void cort_tcp_ctrler::update_adaptive_recv_size(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, size_t recved_size){
+	recv_size_slot*& table = get_thread_recv_size_table();
+	if(table == 0){
+		table = (recv_size_slot*)calloc(cort_socket_config::SOCKET_RECV_SIZE_TABLE_SIZE, sizeof(recv_size_slot));
+		if(table == 0){
+			return;
+		}
+	}
+	if(recved_size > cort_buffer_pool::max_pooled_size){
+		recved_size = cort_buffer_pool::max_pooled_size;
+	}
+	ip_v4_key key(ip_arg, port_arg, type_key_arg);
+	recv_size_slot* slot = find_recv_size(table, key.data.i_data, true);
+	if(slot != 0 && slot->key == key.data.i_data){
+		slot->size = (uint32_t)((slot->size * 7 + recved_size) >> 3);
+		return;
+	}
+	if(slot == 0){ //All the probed slots are used by others, the home slot is learned again.
+		slot = &table[get_recv_size_slot(key.data.i_data)];
+	}
+	slot->key = key.data.i_data;
+	slot->size = (uint32_t)recved_size;
+}
+
+recv_buffer_ctrl::recv_buffer_size_t cort_tcp_ctrler::get_init_recv_size() const{
+	recv_size_slot* table = get_thread_recv_size_table();
+	if(disable_adaptive_recv_size != 0 || table == 0){
+		return recv_buffer_ctrl::default_init_recv_buffer_size;
+	}
+	ip_v4_key key(ip_v4, port_v4, type_key);
+	const recv_size_slot* slot = find_recv_size(table, key.data.i_data, false);
+	if(slot == 0){
+		return recv_buffer_ctrl::default_init_recv_buffer_size;
+	}
+	//A quarter headroom, so a response a little larger than average still needs no realloc.
+	size_t result = slot->size + (slot->size >> 2) + cort_buffer_pool::header_size;
+	size_t class_size = cort_buffer_pool::min_pooled_size;
+	while(class_size < result && class_size < cort_buffer_pool::max_pooled_size){
+		class_size <<= 1;
+	}
+	return (recv_buffer_ctrl::recv_buffer_size_t)(class_size - cort_buffer_pool::header_size);
+}
+
+void cort_tcp_ctrler::learn_recv_size(){
+	if(disable_adaptive_recv_size == 0 && recv_buffer.recv_block_size == 0){
+		update_adaptive_recv_size(ip_v4, port_v4, type_key, recv_buffer.recved_size);
+	}
+}
+
 //This is not const. Use it only you want to await it!
 cort_tcp_connection_waiter* cort_tcp_ctrler::lock_waiter(){
 	if(!this->connection_waiter){
 		if(this->keep_alive_ms > 0){
 			this->connection_waiter = get_keep_alive_connection_client(this->ip_v4, this->port_v4, this->type_key);
+			if(!this->connection_waiter){ //try_connect waits if the destination is saturated.
+				cort_tcp_connection_waiter_client* client = new cort_tcp_connection_waiter_client();
+				cort_tcp_connection_pool::acquire(client, this->ip_v4, this->port_v4, this->type_key);
+				this->connection_waiter = client;
+			}
 		}
 		if(!this->connection_waiter){
 			this->connection_waiter.init<cort_tcp_connection_waiter_client>();
@@ -532,6 +1013,7 @@ cort_tcp_connection_waiter* cort_tcp_ctrler::lock_waiter(){
 	}
 	cort_tcp_connection_waiter* result = this->connection_waiter.get_ptr();
 	result->set_parent(this);
+	result->recv_poll_waiting = 0;
 	return result;
 }
 
@@ -566,75 +1048,114 @@ void cort_tcp_ctrler::on_connection_inactive(){
 		if(keep_alive_ms > 0 && get_errno() == 0 && connection_waiter->is_connected()){
 			connection_waiter->keep_alive(keep_alive_ms, ip_v4, port_v4, type_key);
 		}
+		else{
+			defer_zero_copy_segments();
+		}
 		connection_waiter.clear();
 	}
 }
 
+void cort_tcp_ctrler::defer_zero_copy_segments(){
+	cort_tcp_connection_waiter* waiter = connection_waiter.get_ptr();
+	if(waiter != 0 && waiter->zero_copy != 0){
+		send_buffer.clear(waiter->zero_copy);
+	}
+}
+
+void cort_tcp_ctrler::close_connection(){
+	cort_tcp_connection_waiter* waiter = connection_waiter.get_ptr();
+	if(waiter == 0){
+		return;
+	}
+	defer_zero_copy_segments();
+	waiter->retire_zero_copy();
+	waiter->close_cort_fd();
+	connection_waiter.clear();
+}
+
+bool cort_tcp_ctrler::cancel(){
+	if(limiter_waiter != 0){
+		limiter_waiter->resume_on_stop();
+		return true;
+	}
+	cort_tcp_connection_waiter* waiter = connection_waiter.get_ptr();
+	if(waiter == 0 || waiter->get_parent() != this || is_finished() || get_wait_count() == 0){
+		return false;
+	}
+	defer_zero_copy_segments();
+	waiter->retire_zero_copy();	//resume_on_stop closes the fd.
+	waiter->resume_on_stop();
+	return true;
+}
+
 cort_proto* cort_tcp_ctrler::on_finish(){
 	if(connection_waiter){
 		if(get_errno() != 0){
+			defer_zero_copy_segments();
 			connection_waiter.clear();
 		}
 	}
 	return cort_proto::on_finish();
 }
 
-static cort_proto* release_when_notification(cort_proto* arg){
-	cort_tcp_connection_waiter_client* tcp_cort = (cort_tcp_connection_waiter_client*)arg;
-	tcp_cort->release();
-	return 0;
+size_t cort_tcp_connection_waiter_client::clear_keep_alive_connection(size_t count, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
+	return cort_tcp_connection_pool::clear_idle(count, ip_arg, port_arg, type_key_arg);
 }
 
-size_t cort_tcp_connection_waiter_client::clear_keep_alive_connection(size_t count, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg){
-	size_t result = 0;
-	if(connection_tcp_pool == 0){
-		return result;
-	}
-	
-	std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >::iterator it = connection_tcp_pool->begin();
-	size_t max_vector_size = it->second.size();
-	
-	if(ip_arg != 0){
-		ip_v4_key key;
-		key.data.s_data.ip_v4 = ip_arg;
-		key.data.s_data.port_v4 = port_arg;
-		key.data.s_data.type_key = type_key_arg;
-		it = connection_tcp_pool->find(key.data.i_data);
-	}else{
-		std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >::iterator end = connection_tcp_pool->end();
-		std::map<uint64_t, std::vector<cort_tcp_connection_waiter_client* > >::iterator begin = it;
-		++begin;
-		for(;begin != end;++begin){
-			size_t new_size = begin->second.size();
-			if(new_size > max_vector_size){
-				max_vector_size = new_size;
-				it = begin;
-			}
+namespace{
+	//Parent of a detached request, it deletes the request when the request finishes.
+	struct detached_request_reaper : public cort_proto{
+		CO_DECL(detached_request_reaper)
+		cort_tcp_request_response* request;
+
+		cort_proto* start(){
+			CO_BEGIN
+				CO_YIELD();
+				delete request;
+			CO_END
 		}
-	}
-	if(it != connection_tcp_pool->end()){
-		std::vector<cort_tcp_connection_waiter_client* >& dq = it->second;
-		while(!dq.empty() && count-- != 0){
-			cort_tcp_connection_waiter_client* last = dq.back();				
-			dq.pop_back();
-			last->close_cort_fd();
-			last->set_run_function(release_when_notification);
-			++result;
+
+		cort_proto* on_finish(){
+			delete this;
+			return 0;
 		}
-		if(dq.empty()){
-			if(connection_tcp_pool->size() == 1){
-				delete connection_tcp_pool;
-				connection_tcp_pool = 0;
-			}else{
-				connection_tcp_pool->erase(it);
-			}
-		}	
+	};
+}
+
+void cort_tcp_request_response::detach(bool cancel){
+	detached_request_reaper* reaper = new detached_request_reaper();
+	reaper->request = this;
+	reaper->start();
+	reaper->set_wait_count(1);
+	set_parent(reaper);
+	if(cancel){
+		this->cancel();	//The reaper may delete this at once.
 	}
-	return result;
 }
 
 cort_proto* cort_tcp_request_response::on_finish(){
 	finish_time_cost();
+	uint8_t err = get_errno();
+	if(err == cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED){ //Nothing is sent.
+		return cort_tcp_ctrler::on_finish();
+	}
+	bool has_place = (limiter_place != 0);	//Not set if the limiter is disabled or does not track the destination.
+	limiter_place = 0;
+	if(connection_waiter && connection_waiter->is_stopped()){ //Canceled or stopped by cort_timer_destroy, it is not the fault of the destination.
+		cort_tcp_circuit_breaker::release(ip_v4, port_v4);
+		if(has_place){
+			cort_tcp_concurrency_limiter::release(ip_v4, port_v4);
+		}
+	}
+	else{
+		cort_tcp_circuit_breaker::report(ip_v4, port_v4, err);
+		if(has_place && err == cort_socket_error_codes::SOCKET_CIRCUIT_OPEN){
+			cort_tcp_concurrency_limiter::release(ip_v4, port_v4);
+		}
+		else if(has_place){
+			cort_tcp_concurrency_limiter::release(ip_v4, port_v4, err, get_time_cost());
+		}
+	}
 	return cort_tcp_ctrler::on_finish();
 }
 
@@ -642,6 +1163,15 @@ cort_proto* cort_tcp_request_response::start(){
 	//Default is send first then recv mode.
 	CO_BEGIN
 		init_time_cost();
+		CO_AWAIT_IF(cort_tcp_concurrency_limiter::acquire(this) == cort_tcp_concurrency_limiter::limiter_queued,
+			new cort_tcp_concurrency_limiter::queue_waiter(this));
+		co_unlikely_if(get_errno() != 0){ //SOCKET_CONCURRENCY_LIMITED
+			CO_RETURN;
+		}
+		co_unlikely_if(!cort_tcp_circuit_breaker::allow(ip_v4, port_v4)){
+			set_errno(cort_socket_error_codes::SOCKET_CIRCUIT_OPEN);
+			CO_RETURN;
+		}
 		CO_AWAIT(lock_connect());
 		co_unlikely_if(get_errno() != 0){
 			CO_RETURN;	
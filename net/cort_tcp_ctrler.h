@@ -4,17 +4,66 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/uio.h>
 #include "../cort_timeout_waiter.h"
+#include "cort_buffer_pool.h"
 
 struct cort_tcp_connection_waiter;
 struct cort_tcp_connection_waiter_client;
 struct cort_tcp_ctrler;
 struct cort_tcp_connect_send_recv_data;
+struct cort_tcp_zero_copy_ctrl;
 
 namespace cort_socket_config{	//When the following config is changed, you have to compile again!
 	const static size_t SOCKET_KEEPALIVE_AUTO_RELEASE_COUNT = 24;
+	const static uint32_t SOCKET_KEEPALIVE_MAX_IDLE_PER_DEST = 1024;	//Default idle connections limit of a type_key:ip:port.
+	const static uint32_t SOCKET_KEEPALIVE_MAX_TOTAL_PER_DEST = 0;		//Default connections limit of a type_key:ip:port, 0 means no limit.
+	const static size_t SOCKET_KEEPALIVE_MAX_IDLE_COUNT = 65536;		//Idle connections limit of all the type_key:ip:port, per thread.
+	const static uint32_t SOCKET_KEEPALIVE_MAINTAIN_INTERVAL_MS = 100;	//Interval of topping up the min_idle and sweeping the expired unpolled idle connections.
+	const static uint32_t SOCKET_KEEPALIVE_SWEEP_BATCH_COUNT = 1024;	//Max idle connections checked by one sweep.
+	const static uint32_t SOCKET_KEEPALIVE_WARM_CONNECT_RATE = 200;		//Max new connections per second for the min_idle, per thread.
+	const static uint32_t SOCKET_KEEPALIVE_WARM_CONNECT_TIMEOUT_MS = 1000;
+	const static size_t SOCKET_EPHEMERAL_PORT_DEFAULT_COUNT = 28232;	//Used when ip_local_port_range can not be read.
+	const static size_t SOCKET_EPHEMERAL_PORT_TRIM_PERCENT = 90;		//Close some idle connections of a destination before connecting when its keep alive ones use so many ports.
+	const static uint32_t SOCKET_CLUSTER_EWMA_PERCENT = 20;				//Weight of the latest time cost in the EWMA of a cort_tcp_cluster endpoint.
+	const static uint32_t SOCKET_SHARD_VIRTUAL_NODE_COUNT = 160;		//Points on the hash ring of a cort_tcp_shard node per weight.
+	const static uint32_t SOCKET_BREAKER_CONSECUTIVE_FAILURES = 5;		//Default policy of cort_tcp_circuit_breaker, see cort_tcp_circuit_breaker::policy.
+	const static uint32_t SOCKET_BREAKER_FAILURE_PERCENT = 50;
+	const static uint32_t SOCKET_BREAKER_MIN_REQUESTS = 20;
+	const static uint32_t SOCKET_BREAKER_WINDOW_MS = 10000;
+	const static uint32_t SOCKET_BREAKER_OPEN_MS = 5000;
+	const static uint32_t SOCKET_BREAKER_MAX_OPEN_MS = 60000;
+	const static uint32_t SOCKET_BREAKER_PROBE_COUNT = 3;
+	const static uint32_t SOCKET_BREAKER_PROBE_TIMEOUT_MS = 10000;
+	const static size_t SOCKET_BREAKER_MAX_COUNT = 4096;			//Count limit of ip:port tracked by cort_tcp_circuit_breaker, per thread.
+	const static uint32_t SOCKET_HEDGE_DEFAULT_DELAY_MS = 50;		//Delay of the backup request before cort_hedge_policy has enough time costs.
+	const static uint32_t SOCKET_HEDGE_SAMPLE_COUNT = 256;			//Recent time costs kept by cort_hedge_policy.
+	const static uint32_t SOCKET_HEDGE_MIN_SAMPLE_COUNT = 20;
+	const static uint32_t SOCKET_HEDGE_BUDGET_PERCENT = 10;			//Backup requests are no more than this percent of the requests.
+	const static uint32_t SOCKET_HEDGE_BUDGET_BURST = 10;			//Backup requests saved up for a burst.
+	const static uint32_t SOCKET_RETRY_MAX_ATTEMPTS = 3;			//Default policy of cort_tcp_retry_request, see cort_retry_policy.
+	const static uint32_t SOCKET_RETRY_BACKOFF_MS = 10;
+	const static uint32_t SOCKET_RETRY_MAX_BACKOFF_MS = 1000;
+	const static uint32_t SOCKET_RETRY_BUDGET_PERCENT = 10;			//Retries are no more than this percent of the requests to an ip:port.
+	const static uint32_t SOCKET_RETRY_BUDGET_BURST = 10;			//Retries saved up for a burst, per ip:port.
+	const static size_t SOCKET_RETRY_BUDGET_MAX_COUNT = 4096;		//Count limit of ip:port whose retry budget is tracked by a cort_retry_policy.
+	const static uint32_t SOCKET_LIMITER_INITIAL_LIMIT = 20;			//Default policy of cort_tcp_concurrency_limiter, see cort_tcp_concurrency_limiter::policy.
+	const static uint32_t SOCKET_LIMITER_MIN_LIMIT = 1;
+	const static uint32_t SOCKET_LIMITER_MAX_LIMIT = 1000;
+	const static uint32_t SOCKET_LIMITER_MAX_QUEUE = 0;
+	const static uint32_t SOCKET_LIMITER_ALPHA = 3;
+	const static uint32_t SOCKET_LIMITER_BETA = 6;
+	const static uint32_t SOCKET_LIMITER_BACKOFF_PERCENT = 90;
+	const static uint32_t SOCKET_LIMITER_MIN_RTT_WINDOW_MS = 10000;
+	const static size_t SOCKET_LIMITER_MAX_COUNT = 4096;			//Count limit of ip:port tracked by cort_tcp_concurrency_limiter, per thread.
 	const static size_t SOCKET_RECV_BUFFER_DEFAULT_SIZE = 4096-64;
+	const static uint32_t SOCKET_ZERO_COPY_LINGER_MS = 10000;		//Time the zero copy buffers of a closed socket wait for the notifications before the socket is reset.
+	const static uint32_t SOCKET_ZERO_COPY_SWEEP_INTERVAL_MS = 100;	//Interval of reading the notifications of the closed sockets.
+	const static size_t SOCKET_SEND_MAX_IOV_COUNT = 1024;	//Segments count limit of one writev, IOV_MAX in linux.
+	const static size_t SOCKET_SENDFILE_MAX_SIZE = 1<<30;	//Bytes limit of one sendfile.
+	const static size_t SOCKET_RECV_SIZE_TABLE_SIZE = 4096;		//Slots of type_key:ip:port whose response size is learned, per thread. It is a power of 2.
+	const static size_t SOCKET_RECV_SIZE_PROBE_COUNT = 8;		//Slots probed for a type_key:ip:port before the first one is replaced.
 };
 
 namespace cort_socket_error_codes{
@@ -67,6 +116,12 @@ namespace cort_socket_error_codes{
 	//9: recv data failed. Maybe some system error.
 	CO_DECL_CODES(SOCKET_RECEIVE_ERROR, 9);
 	
+	//10: the circuit breaker of the destination is open, nothing is sent. See cort_tcp_circuit_breaker.
+	CO_DECL_CODES(SOCKET_CIRCUIT_OPEN, 10);
+	
+	//11: too many requests to the destination in flight, nothing is sent. See cort_tcp_concurrency_limiter.
+	CO_DECL_CODES(SOCKET_CONCURRENCY_LIMITED, 11);
+	
 	//50: bind error
 	CO_DECL_CODES(SOCKET_BIND_ERROR, 50);
 	
@@ -84,95 +139,338 @@ namespace cort_socket_error_codes{
 	CO_DECL_CODES(SOCKET_INVALID_LISTEN_ADDRESS, 255);	
 };
 
+//Buffers sent by MSG_ZEROCOPY can be freed only after the kernel notifies the completion by the error queue.
+//Every successful zero copy send call gets a sequence number in order, and the notifications report the finished range.
+struct cort_tcp_zero_copy_ctrl{
+	struct deferred_buffer{
+		void* ptr;
+		uint32_t seq;		//Free it after seq send calls are finished.
+	};
+	deferred_buffer* buffers;	//Ring buffer
+	uint32_t buffer_head;
+	uint32_t buffer_tail;
+	uint32_t buffer_capacity;	//Power of 2
+	uint32_t next_seq;			//Count of zero copy send calls.
+	uint32_t finished_seq;		//Count of the finished zero copy send calls.
+	uint8_t state;
+	
+	enum{
+		zero_copy_unknown = 0,
+		zero_copy_enabled = 1,
+		zero_copy_disabled = 2		//SO_ZEROCOPY failed, or the kernel copied the data anyway(loopback, for example).
+	};
+	
+	cort_tcp_zero_copy_ctrl(){
+		buffers = 0;
+		buffer_head = 0;
+		buffer_tail = 0;
+		buffer_capacity = 0;
+		next_seq = 0;
+		finished_seq = 0;
+		state = zero_copy_unknown;
+	}
+	~cort_tcp_zero_copy_ctrl(){
+		retire(-1);
+		free(buffers);
+	}
+	
+	size_t get_deferred_count() const{
+		return buffer_tail - buffer_head;
+	}
+	
+	//Free ptr after all the zero copy send calls issued until now are finished.
+	void defer_free(void* ptr);
+	
+	//Free the buffers whose send calls are finished.
+	void release_finished();
+	
+	//Read the notifications in the error queue of fd and free the buffers finished.
+	void read_notification(int fd);
+	
+	//Called before fd is closed or recreated, then the sequence is reset.
+	//The buffers the kernel may still be sending are never freed here: they are handed to a thread local graveyard
+	//with a dup of fd, which keeps the socket open until their notifications arrive, or until SOCKET_ZERO_COPY_LINGER_MS
+	//passes and the socket is reset, so the kernel drops them. If fd is -1, they are leaked, as we can not tell when they are finished.
+	void retire(int fd);
+	
+	//Free all the buffers, only after the socket is reset or the notifications of all the send calls arrived.
+	void free_all();
+private:
+	cort_tcp_zero_copy_ctrl(const cort_tcp_zero_copy_ctrl&);
+	cort_tcp_zero_copy_ctrl& operator=(const cort_tcp_zero_copy_ctrl&);
+};
+
+//The send queue. Segments are stored in send_data[send_head, send_tail).
+//Up to inline_send_queue_size segments are stored inline, more segments spill into a heap array that grows by doubling.
+//send_data_flag tells the kind of a segment, and send_data_tag is the offset from the cort_buffer_pool base of a strong reference segment.
+//They are kept apart, so advancing a partially sent segment never touches its kind. A strong reference segment is less than 2GB, so its offset fits.
+//zero_copy_flag marks a strong reference segment that has been passed to MSG_ZEROCOPY, so its release is deferred.
+//A file segment is sent by sendfile. Its iov_base is the file offset, iov_len is the rest length and the tag is the fd.
 struct send_buffer_ctrl{
 	typedef uint32_t size_type;
-	const static uint8_t max_send_queue_size = 3; //sizeof = 3*(16+4)+4
-	const static uint8_t send_npos = max_send_queue_size;
-	iovec send_data[max_send_queue_size];
-	size_type send_data_tag[max_send_queue_size]; 
+	const static uint8_t inline_send_queue_size = 3;
+	const static uint8_t weak_reference_flag = 1;
+	const static uint8_t zero_copy_flag = 2;
+	const static uint8_t file_segment_flag = 4;
+	const static uint8_t file_close_flag = 8;	//Close the fd after the file segment is sent or cleared.
+	iovec* send_data;
+	size_type* send_data_tag; 
+	uint8_t* send_data_flag;
+	size_type send_head;
+	size_type send_tail;
+	size_type send_capacity;
+	size_type file_segment_count;
+	iovec inline_send_data[inline_send_queue_size];
+	size_type inline_send_data_tag[inline_send_queue_size];
+	uint8_t inline_send_data_flag[inline_send_queue_size];
 
-	// capacity_size must be power of 2
 	send_buffer_ctrl(){	
-		send_data[0].iov_base = 0;
+		send_data = inline_send_data;
+		send_data_tag = inline_send_data_tag;
+		send_data_flag = inline_send_data_flag;
+		send_head = 0;
+		send_tail = 0;
+		send_capacity = inline_send_queue_size;
+		file_segment_count = 0;
 	}
 
 	~send_buffer_ctrl(){
 		clear();
+		if(send_data != inline_send_data){
+			free(send_data);
+		}
 	}
 	
-	void clear(){
-		for(int i = 0; i<max_send_queue_size; ++i){
-			if(send_data[i].iov_base == 0){
-				break;
+	static bool is_file_segment(uint8_t flag){
+		return (flag & file_segment_flag) != 0;
+	}
+	
+	static void free_segment(const iovec& data, size_type tag, uint8_t flag, cort_tcp_zero_copy_ctrl* zero_copy = 0){
+		if(is_file_segment(flag)){
+			if((flag & file_close_flag) != 0){
+				close((int)tag);
 			}
-			int32_t back_result = ((int32_t*)send_data_tag)[i];
-			if(back_result >= 0){
-				free((char*)(send_data[i].iov_base) - send_data_tag[i]);
+		}
+		else if((flag & weak_reference_flag) == 0){
+			char* base = (char*)(data.iov_base) - tag;
+			if((flag & zero_copy_flag) != 0){
+				if(zero_copy != 0){
+					zero_copy->defer_free(base);
+				}
+				//Or else it is leaked like cort_tcp_zero_copy_ctrl::retire(-1), the kernel may be still sending it.
+			}
+			else{
+				cort_buffer_pool::free(base);
 			}
 		}
-		send_data[0].iov_base = 0;
 	}
 	
-	size_t get_free_index() const{
-		size_t i = 0;
-		for(; i < max_send_queue_size;++i){
-			if(send_data[i].iov_base == 0){
-				return i;
+	//The spilled heap array is kept for reuse.
+	//The segments marked with zero_copy_flag are handed to zero_copy, or leaked if it is 0.
+	void clear(cort_tcp_zero_copy_ctrl* zero_copy = 0){
+		for(size_type i = send_head; i < send_tail; ++i){
+			free_segment(send_data[i], send_data_tag[i], send_data_flag[i], zero_copy);
+		}
+		send_head = 0;
+		send_tail = 0;
+		file_segment_count = 0;
+	}
+	
+	//Count of the segments waiting to be sent.
+	size_t size() const{
+		return send_tail - send_head;
+	}
+	
+	inline bool empty() const{return send_head == send_tail;}
+	
+	//Return the index of a new segment at the tail, or send_npos if memory allocation failed.
+	const static size_type send_npos = size_type(-1);
+	size_type push_index(){
+		if(send_tail == send_capacity){
+			if(send_head >= (send_capacity >> 1)){ //Reuse the sent space at the front.
+				size_type count = send_tail - send_head;
+				memmove(send_data, send_data + send_head, count * sizeof(iovec));
+				memmove(send_data_tag, send_data_tag + send_head, count * sizeof(size_type));
+				memmove(send_data_flag, send_data_flag + send_head, count);
+				send_head = 0;
+				send_tail = count;
+			}
+			else{
+				size_type new_capacity = send_capacity << 1;
+				iovec* new_data = (iovec*)malloc(new_capacity * (sizeof(iovec) + sizeof(size_type) + 1));
+				if(new_data == 0){
+					return send_npos;
+				}
+				size_type* new_data_tag = (size_type*)(new_data + new_capacity);
+				uint8_t* new_data_flag = (uint8_t*)(new_data_tag + new_capacity);
+				size_type count = send_tail - send_head;
+				memcpy(new_data, send_data + send_head, count * sizeof(iovec));
+				memcpy(new_data_tag, send_data_tag + send_head, count * sizeof(size_type));
+				memcpy(new_data_flag, send_data_flag + send_head, count);
+				if(send_data != inline_send_data){
+					free(send_data);
+				}
+				send_data = new_data;
+				send_data_tag = new_data_tag;
+				send_data_flag = new_data_flag;
+				send_capacity = new_capacity;
+				send_head = 0;
+				send_tail = count;
 			}
 		}
-		return i;
+		return send_tail++;
 	}
 	
 	//weak reference
 	char* set_send_buffer(char* src_buffer, int32_t arg_size){
-		size_t index = get_free_index();
-		if(index == max_send_queue_size){
+		size_type index = push_index();
+		if(index == send_npos){
 			return 0;
 		}
 		send_data[index].iov_base = src_buffer;
 		send_data[index].iov_len = arg_size;
-		send_data_tag[index] = 1<<31;
-		if(index != max_send_queue_size - 1){
-			send_data[index+1].iov_base = 0;
-		}
+		send_data_tag[index] = 0;
+		send_data_flag[index] = weak_reference_flag;
 		return src_buffer;
 	}
 
 	//strong reference
 	char* alloc_send_buffer(int32_t arg_size){
-		size_t index = get_free_index();
-		if(index == max_send_queue_size){
+		char* result = (char*)cort_buffer_pool::alloc(arg_size);
+		if(result == 0){
+			return 0;
+		}
+		size_type index = push_index();
+		if(index == send_npos){
+			cort_buffer_pool::free(result);
 			return 0;
 		}
-		char* result = (char*)malloc(arg_size);
 		send_data[index].iov_base = result;
 		send_data[index].iov_len = arg_size;
 		send_data_tag[index] = 0;
-		if(index != max_send_queue_size - 1){
-			send_data[index+1].iov_base = 0;
-		}
+		send_data_flag[index] = 0;
 		return result;
 	}
 	
 	//strong reference
 	char* copy_send_buffer(char* src_buffer, int32_t arg_size){
-		size_t index = get_free_index();
-		if(index == max_send_queue_size){
+		char* result = alloc_send_buffer(arg_size);
+		if(result != 0){
+			memcpy(result, src_buffer, arg_size);
+		}
+		return result;
+	}
+	
+	//Send length bytes from offset of the file fd by sendfile. The offset must be fit in a pointer.
+	//fd is weak referenced unless close_after_sent is true.
+	bool set_send_file(int fd, off_t offset, size_t length, bool close_after_sent = false){
+		if(fd < 0){
+			return false;
+		}
+		size_type index = push_index();
+		if(index == send_npos){
+			return false;
+		}
+		send_data[index].iov_base = (void*)(size_t)offset;
+		send_data[index].iov_len = length;
+		send_data_tag[index] = (size_type)fd;
+		send_data_flag[index] = file_segment_flag | (close_after_sent ? file_close_flag : 0);
+		++file_segment_count;
+		return true;
+	}
+	
+	//Move all the segments of src to the tail without copying the data.
+	//Return false if memory allocation failed, src keeps the segments not moved then.
+	bool splice(send_buffer_ctrl& src){
+		for(; src.send_head < src.send_tail; ++src.send_head){
+			size_type index = push_index();
+			if(index == send_npos){
+				return false;
+			}
+			send_data[index] = src.send_data[src.send_head];
+			send_data_tag[index] = src.send_data_tag[src.send_head];
+			send_data_flag[index] = src.send_data_flag[src.send_head];
+			if(is_file_segment(send_data_flag[index])){
+				++file_segment_count;
+				--src.file_segment_count;
+			}
+		}
+		src.send_head = 0;
+		src.send_tail = 0;
+		return true;
+	}
+
+	//Count of the memory segments at the front, no more than max_count.
+	size_t get_memory_segment_count(size_t max_count) const{
+		size_t count = send_tail - send_head;
+		if(count > max_count){
+			count = max_count;
+		}
+		if(file_segment_count == 0){
+			return count;
+		}
+		for(size_t i = 0; i < count; ++i){
+			if(is_file_segment(send_data_flag[send_head + i])){
+				return i;
+			}
+		}
+		return count;
+	}
+	
+	//Send the front of the queue by one call: a file segment by sendfile, no more than SOCKET_SENDFILE_MAX_SIZE,
+	//or else the memory segments before it, no more than SOCKET_SEND_MAX_IOV_COUNT, held by MSG_MORE if a file segment follows.
+	//segment_count is set to the count of the segments tried, and file_send_size to the size tried by sendfile or 0.
+	//Return as send, and errno is ENODATA if the file is shorter than expected.
+	ssize_t send_front(int fd, size_t& segment_count, size_t& file_send_size);
+	
+	//Return the count of the strong reference segments at the front whose total size reaches min_size, or 0.
+	//They are marked with zero_copy_flag so they can be sent by MSG_ZEROCOPY.
+	size_t mark_zero_copy(size_t max_count, size_t min_size){
+		size_t total_size = 0;
+		size_type end = send_head;
+		for(; end < send_tail && end - send_head < max_count && (send_data_flag[end] & (weak_reference_flag | file_segment_flag)) == 0; ++end){
+			total_size += send_data[end].iov_len;
+		}
+		if(total_size < min_size){
 			return 0;
 		}
-		char* result = (char*)(send_data[index].iov_base = (char*)malloc(arg_size));
-		if(result != 0){
-			(char*)memcpy(result, src_buffer, arg_size);
+		for(size_type i = send_head; i < end; ++i){
+			send_data_flag[i] |= zero_copy_flag;
 		}
-		send_data[index].iov_len = arg_size;
-		send_data_tag[index] = 0;
-		if(index != max_send_queue_size - 1){
-			send_data[index+1].iov_base = 0;
+		return end - send_head;
+	}
+	
+	//Remove the sent bytes from the front, a partially sent segment is advanced in place.
+	//The segments marked with zero_copy_flag are handed to zero_copy to be freed later.
+	//Return the count of the segments fully sent.
+	size_t consume(size_t sent_size, cort_tcp_zero_copy_ctrl* zero_copy = 0){
+		size_type i = send_head;
+		for(; i < send_tail; ++i){
+			if(sent_size < send_data[i].iov_len){ //sent_size maybe zero!
+				send_data[i].iov_base = (char*)(send_data[i].iov_base) + sent_size;
+				send_data[i].iov_len -= sent_size;
+				if((send_data_flag[i] & (weak_reference_flag | file_segment_flag)) == 0){
+					send_data_tag[i] += (size_type)sent_size;
+				}
+				break;
+			}
+			sent_size -= send_data[i].iov_len;
+			if(is_file_segment(send_data_flag[i])){
+				--file_segment_count;
+			}
+			free_segment(send_data[i], send_data_tag[i], send_data_flag[i], zero_copy);
+		}
+		size_t result = i - send_head;
+		send_head = i;
+		if(send_head == send_tail){
+			send_head = 0;
+			send_tail = 0;
 		}
 		return result;
 	}
-	
-	inline bool empty() const{return (send_data[0].iov_base == 0);}
+private:
+	send_buffer_ctrl(const send_buffer_ctrl&);
+	send_buffer_ctrl& operator=(const send_buffer_ctrl&);
 };
 
 struct recv_buffer_ctrl{
@@ -218,21 +516,36 @@ struct recv_buffer_ctrl{
 	const static recv_buffer_size_t default_init_recv_buffer_size = cort_socket_config::SOCKET_RECV_BUFFER_DEFAULT_SIZE;
 	
 	//strong reference
+	//In segmented mode, it only sets the receive limit. The blocks are allocated when the data arrive, so nothing is copied.
 	char* realloc_recv_buffer(recv_buffer_size_t new_buffer_size = default_init_recv_buffer_size){
+		if(recv_block_size != 0){
+			if(recv_block_count == 0 && append_recv_block() == 0){
+				return 0;
+			}
+			recv_buffer_size = new_buffer_size;
+			return recv_buffer;
+		}
 		if(recv_buffer == 0 || data0._.is_weak_reference == 1){
-			recv_buffer = (char*)malloc(new_buffer_size);
+			recv_buffer = (char*)cort_buffer_pool::alloc(new_buffer_size);
 			data0._.is_weak_reference = 0;	
 		}else if((new_buffer_size > recv_buffer_size) || (data0._.recv_finished_shrink_needed == 1)){
-			recv_buffer = (char*)realloc(recv_buffer, new_buffer_size);
+			recv_buffer = (char*)cort_buffer_pool::realloc(recv_buffer, new_buffer_size);
 		}
 		recv_buffer_size = new_buffer_size; 
 		return recv_buffer;
 	}
 	
-	//weak reference
+	//weak reference, it also leaves the segmented mode.
 	char* set_recv_buffer(char* buf, recv_buffer_size_t buf_size){
-		if(data0._.is_weak_reference == 0 && recv_buffer != 0){
-			free(recv_buffer);
+		if(recv_block_size != 0){
+			free_recv_blocks(0);
+			free(recv_blocks);
+			recv_blocks = 0;
+			recv_block_capacity = 0;
+			recv_block_size = 0;
+		}
+		else if(data0._.is_weak_reference == 0 && recv_buffer != 0){
+			cort_buffer_pool::free(recv_buffer);
 		}		
 		recv_buffer = buf;
 		recv_buffer_size = buf_size;
@@ -243,15 +556,87 @@ struct recv_buffer_ctrl{
 	}
 	
 	void shrink_to_fit(){
-		if(recv_buffer != 0 && recv_buffer_size > recved_size && data0._.is_weak_reference != 0){
-			recv_buffer = (char*)realloc(recv_buffer, recved_size);
+		if(recv_block_size == 0 && recv_buffer != 0 && recv_buffer_size > recved_size && data0._.is_weak_reference == 0){
+			recv_buffer = (char*)cort_buffer_pool::realloc(recv_buffer, recved_size);
 			recv_buffer_size = recved_size;
 		}
 	}
 	
+//Segmented mode
+	//The received data are stored in a chain of blocks filled by readv instead of one buffer enlarged by realloc,
+	//so a large response is never copied. recv_buffer points to the first block.
+	//recv_check can read the data by get_recv_block_count and get_recv_block, or call linearize for contiguous bytes.
+	const static uint32_t default_recv_block_size = 64*1024 - cort_buffer_pool::header_size;	//Fits a size class of the pool.
+	const static uint32_t max_recv_iov_count = 16;
+	
+	iovec* recv_blocks;				//iov_len is the block capacity.
+	uint32_t recv_block_count;
+	uint32_t recv_block_capacity;
+	uint32_t recv_block_size;		//0 means the usual contiguous mode.
+	
+	//Switch to segmented mode. The previous buffer is freed.
+	void set_segmented(uint32_t block_size = default_recv_block_size){
+		if(recv_block_size == 0){
+			if(recv_buffer != 0 && data0._.is_weak_reference == 0){
+				cort_buffer_pool::free(recv_buffer);
+			}
+			recv_buffer = 0;
+			recv_buffer_size = 0;
+			recved_size = 0;
+			data0.result_int = 0;
+		}
+		recv_block_size = block_size;
+	}
+	
+	bool is_segmented() const{
+		return recv_block_size != 0;
+	}
+	
+	//Count of the blocks that have received data.
+	size_t get_recv_block_count() const{
+		if(recv_block_size == 0){
+			return recved_size == 0 ? 0 : 1;
+		}
+		size_t count = 0;
+		for(size_t rest = recved_size; rest != 0 && count < recv_block_count; ++count){
+			rest -= (rest < recv_blocks[count].iov_len ? rest : recv_blocks[count].iov_len);
+		}
+		return count;
+	}
+	
+	//The data of the index-th block, iov_len is the received bytes in it.
+	iovec get_recv_block(size_t index) const{
+		iovec result;
+		if(recv_block_size == 0){
+			result.iov_base = recv_buffer;
+			result.iov_len = recved_size;
+			return result;
+		}
+		size_t offset = 0;
+		for(size_t i = 0; i < index; ++i){
+			offset += recv_blocks[i].iov_len;
+		}
+		result.iov_base = recv_blocks[index].iov_base;
+		result.iov_len = ((size_t)recved_size > offset ? recved_size - offset : 0);
+		if(result.iov_len > recv_blocks[index].iov_len){
+			result.iov_len = recv_blocks[index].iov_len;
+		}
+		return result;
+	}
+	
+	//Merge the received blocks into one contiguous buffer(copy only when more than one block is used), return it.
+	char* linearize();
+	
+	//Receive into the blocks by readv, no more than recv_buffer_size in total. Return as readv, and errno is ENOMEM if the allocation failed.
+	ssize_t recv_segmented(int fd);
+	
 	virtual ~recv_buffer_ctrl(){
-		if(recv_buffer != 0 && data0._.is_weak_reference == 0 ){
-			free(recv_buffer);
+		if(recv_block_size != 0){
+			free_recv_blocks(0);
+			free(recv_blocks);
+		}
+		else if(recv_buffer != 0 && data0._.is_weak_reference == 0 ){
+			cort_buffer_pool::free(recv_buffer);
 		}
 	}
 
@@ -261,12 +646,23 @@ struct recv_buffer_ctrl{
 		recved_size = 0;
 		data0.result_int = 0;
 		recv_check = &recv_check_packet;
+		recv_blocks = 0;
+		recv_block_count = 0;
+		recv_block_capacity = 0;
+		recv_block_size = 0;
 	}
 
+	//In segmented mode, only the first block is kept for reuse.
 	void clear(){
 		recved_size = 0;
 		data0.result_int = 0;
+		if(recv_block_size != 0){
+			free_recv_blocks(1);
+		}
 	}
+protected:
+	char* append_recv_block();
+	void free_recv_blocks(uint32_t keep_count);
 private:
 	recv_buffer_ctrl(const recv_buffer_ctrl&);
 };
@@ -278,6 +674,13 @@ struct cort_tcp_connection_waiter : public cort_fd_waiter{
 	
 	typedef cort_fd_waiter parent_type;
 	CO_DECL_PROTO(cort_tcp_connection_waiter)
+	
+	cort_tcp_connection_waiter(){
+		zero_copy = 0;
+		recv_poll_waiting = 0;
+		pool_state = pool_none;
+	}
+	~cort_tcp_connection_waiter();
 
 	//We assert the parent cort should only await this cort, and do not need other time information.
 	cort_proto* on_finish();
@@ -303,6 +706,52 @@ struct cort_tcp_connection_waiter : public cort_fd_waiter{
 	
 	void close_connection(uint8_t err = 0);
 	
+	//Create a nonblocking socket, bind it by cort_tcp_source_addr and start connecting to ip:port(network byte order).
+	//The idle connections of the destination are trimmed first when its ephemeral ports are running out.
+	//Return the fd, and connected is true if it is connected at once, or else wait for EPOLLOUT and call check_connected.
+	//Return -1 and set err if it failed.
+	static int start_connect(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool& connected, uint8_t& err);
+	
+	//Return 0 if the connecting fd is connected by the poll result, or else the error code.
+	static uint8_t check_connected(int fd, uint32_t poll_event);
+	
+	//Hand the zero copy buffers still sent by the kernel to the graveyard, see cort_tcp_zero_copy_ctrl::retire.
+	//Call it before the fd is closed. The fd leaves epoll first, or else the dup in the graveyard keeps reporting its events to this waiter.
+	void retire_zero_copy(){
+		if(zero_copy != 0){
+			remove_poll_request();
+			zero_copy->retire(get_cort_fd());
+		}
+	}
+	
+	//Read the MSG_ZEROCOPY notifications in the error queue and free the buffers the kernel finished with.
+	//Return true if EPOLLERR is only caused by the notifications, and EPOLLERR is removed from the poll result.
+	bool drain_zero_copy_notification();
+	
+	//Count of the sent buffers waiting for the zero copy notifications.
+	size_t get_zero_copy_deferred_count() const{
+		return zero_copy == 0 ? 0 : zero_copy->get_deferred_count();
+	}
+	
+	//Created when MSG_ZEROCOPY is used first time.
+	cort_tcp_zero_copy_ctrl* zero_copy;
+	
+	//try_recv has registered EPOLLIN and is waiting for it, so it does not try recv before EPOLLIN any more.
+	//It is reset when the waiter is locked by a ctrler.
+	uint8_t recv_poll_waiting;
+	
+	//State in cort_tcp_connection_pool. Only the client connections of the keep alive ctrlers are in the pool.
+	enum{
+		pool_none = 0,
+		pool_in_use = 1,
+		pool_idle = 2,
+		pool_waiting = 3	//try_connect waits until the destination has a free slot.
+	};
+	uint8_t pool_state;
+	
+	//Return the count of the segments that can be sent by MSG_ZEROCOPY now, 0 means using copy.
+	size_t prepare_zero_copy(send_buffer_ctrl& ctrler, size_t max_count, uint32_t min_size);
+	
 	virtual void keep_alive(uint32_t keep_alive_time, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg) = 0;
 };
 
@@ -351,6 +800,18 @@ public:
 	
 	static cort_tcp_connection_waiter_client* get_keep_alive_connection_client(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg = 0);
 	
+	//Idle and total connections limit of type_key:ip:port, see cort_tcp_connection_pool::set_limit.
+	//Both ip and port have to use network byte order!
+	static void set_keep_alive_limit(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t max_idle, uint32_t max_total);
+	
+	//Keep at least min_idle idle connections of type_key:ip:port, which are connected ahead of time, see cort_tcp_connection_pool::set_min_idle.
+	//Both ip and port have to use network byte order!
+	static void set_keep_alive_min_idle(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, uint32_t min_idle, uint32_t keep_alive_ms);
+	
+	//Idle connections of type_key:ip:port are not polled, but checked when they are reused, see cort_tcp_connection_pool::set_lazy_validation.
+	//Both ip and port have to use network byte order!
+	static void set_keep_alive_lazy_validation(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, bool enable);
+	
 //Send API
 public:
 	//You can await this function.
@@ -361,20 +822,26 @@ public:
 		return send_buffer.empty();
 	}
 	
-	//weak reference, return zero if too much data are waiting in the sending queue.
+	//weak reference, return zero if memory allocation failed.
 	char* set_send_buffer(char* src_buffer, int32_t arg_size){
 		return send_buffer.set_send_buffer(src_buffer, arg_size);
 	}
 
-	//strong reference, return zero if too much data are waiting in the sending queue.
+	//strong reference, return zero if memory allocation failed.
 	char* alloc_send_buffer(int32_t arg_size){
 		return send_buffer.alloc_send_buffer(arg_size);
 	}
 	
-	//strong reference, return zero if too much data to be sended
+	//strong reference, return zero if memory allocation failed.
 	char* copy_send_buffer(char* src_buffer, int32_t arg_size){
 		return send_buffer.copy_send_buffer(src_buffer, arg_size);
 	}
+	
+	//Send length bytes from offset of the file fd by sendfile. It can be mixed with the memory buffers, for example, a header.
+	//fd is weak referenced unless close_after_sent is true. Return false if memory allocation failed.
+	bool set_send_file(int fd, off_t offset, size_t length, bool close_after_sent = false){
+		return send_buffer.set_send_file(fd, offset, length, close_after_sent);
+	}
 
 //Recv API
 public:
@@ -393,18 +860,68 @@ public:
 		recv_buffer.set_recv_check_function(recv_check_function);
 	}
 	
-	//Strong reference
-	char* alloc_recv_buffer(recv_buffer_ctrl::recv_buffer_size_t init_size = recv_buffer_ctrl::default_init_recv_buffer_size){
+	//Strong reference. init_size == 0 means the size learned from the recent responses of the same type_key:ip:port,
+	//see set_disable_adaptive_recv_size.
+	char* alloc_recv_buffer(recv_buffer_ctrl::recv_buffer_size_t init_size = 0){
+		if(init_size == 0){
+			init_size = get_init_recv_size();
+		}
 		return recv_buffer.realloc_recv_buffer(init_size);
 	}
 	
+	//Initial size of the recv buffer allocated by try_recv or alloc_recv_buffer(0).
+	//It is an EWMA of the received size of type_key:ip:port plus some headroom, rounded up to fit a size class of cort_buffer_pool,
+	//or SOCKET_RECV_BUFFER_DEFAULT_SIZE if adaptive size is disabled or nothing is learned.
+	//The sizes are kept in a fixed table of SOCKET_RECV_SIZE_TABLE_SIZE slots, a new destination replaces one slot when its probed slots are used.
+	//The ctrlers created by the listener do not learn, because their destinations are the ephemeral ports of the clients.
+	recv_buffer_ctrl::recv_buffer_size_t get_init_recv_size() const;
+	
+	static void update_adaptive_recv_size(uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg, size_t recved_size);
+	
+	//Called by try_recv when a response is received.
+	void learn_recv_size();
+	
 	//Weak reference
 	char* set_recv_buffer(char* buffer, recv_buffer_ctrl::recv_buffer_size_t buffer_size){
 		return recv_buffer.set_recv_buffer(buffer, buffer_size);
 	}
 	
+	//Receive into a chain of block_size blocks instead of one buffer enlarged by realloc, see recv_buffer_ctrl::set_segmented.
+	//get_recv_buffer only returns the first block then, use get_recv_block or linearize_recv_buffer.
+	void set_segmented_recv(uint32_t block_size = recv_buffer_ctrl::default_recv_block_size){
+		recv_buffer.set_segmented(block_size);
+	}
+	
+	size_t get_recv_block_count() const{
+		return recv_buffer.get_recv_block_count();
+	}
+	
+	iovec get_recv_block(size_t index) const{
+		return recv_buffer.get_recv_block(index);
+	}
+	
+	//Contiguous received data. It copies only when the data are in more than one block.
+	char* linearize_recv_buffer(){
+		return recv_buffer.linearize();
+	}
+	
 //Operation
 public:
+	//Stop the connect, send or recv in flight as if it timed out, the connection is closed and the ctrler finishes at once.
+	//A ctrler queued by cort_tcp_concurrency_limiter leaves the queue and fails with SOCKET_CONCURRENCY_LIMITED.
+	//The finished ctrler may have been deleted by its parent when it returns. Only use it when the ctrler is awaiting
+	//lock_connect, lock_send, lock_recv or the limiter queue, for example, a cort_tcp_request_response in flight.
+	//Return false if the ctrler is not waiting.
+	bool cancel();
+	
+	//Close the connection at once and release the waiter. The zero copy buffers the kernel may be still sending,
+	//queued or sent, are freed after it finishes with them, see cort_tcp_zero_copy_ctrl::retire.
+	void close_connection();
+	
+	//Hand the queued segments passed to MSG_ZEROCOPY to the zero copy ctrl of the connection. Call it before the ctrl is retired.
+	//The rest of the send queue is dropped with them, as a partly sent queue can not be sent again.
+	void defer_zero_copy_segments();
+	
 	//Use cort_tcp_connection_waiter, for example.
 	template<typename connection_waiter_t>
 	void set_connection_waiter(connection_waiter_t* arg){
@@ -458,6 +975,13 @@ public:
 	uint32_t 	ip_v4;
 	uint16_t 	port_v4;
 	uint16_t 	type_key; 
+	uint32_t	zero_copy_threshold;
+	uint8_t		disable_adaptive_recv_size;
+	uint8_t		disable_optimistic_recv;
+	
+//Flow control
+	cort_timeout_waiter* limiter_waiter;	//The cort_tcp_concurrency_limiter::queue_waiter the ctrler is queued in, or 0.
+	uint8_t		limiter_place;				//1 if the ctrler holds a place of cort_tcp_concurrency_limiter to release.
 	
 //Rest
 	uint8_t 	errnum;
@@ -484,6 +1008,25 @@ public:
 		setsockopt_arg._.enable_reuse_address = value;
 	}
 	
+	//try_recv calls recv at once and waits for EPOLLIN only after EAGAIN, like try_send. So a response that has arrived
+	//costs no epoll_ctl or loop round trip. Disable it if the responses almost never arrive before try_recv.
+	void set_disable_optimistic_recv(uint8_t value = 1){
+		disable_optimistic_recv = value;
+	}
+	
+	//Do not learn or use the response size of type_key:ip:port. For example, the responses vary a lot or dest is not a fixed server.
+	void set_disable_adaptive_recv_size(uint8_t value = 1){
+		disable_adaptive_recv_size = value;
+	}
+	
+	//Send by MSG_ZEROCOPY when the strong reference segments at the front of the send queue have min_size bytes at least.
+	//Weak reference segments are always copied. 0 disables zero copy.
+	//The strong reference buffers are freed after the kernel notifies that it finished with them.
+	//It is only worth for large payloads(hundreds of KB), and the loopback device always copies.
+	void set_zero_copy_threshold(uint32_t min_size){
+		zero_copy_threshold = min_size;
+	}
+	
 	void refresh_socket_option();
 	
 //Time
@@ -519,14 +1062,37 @@ struct cort_tcp_request_response : public cort_tcp_ctrler{
 	//We provide a default action : connect, send data then receive data.
 	//This is the ususal case in RPC for client side.
 	//You should set_recv_buffer_ctrl to inform when the receive is finished.
+	//It fails with SOCKET_CIRCUIT_OPEN at once if the circuit breaker of the destination is open, see cort_tcp_circuit_breaker.
+	//It waits in a queue or fails with SOCKET_CONCURRENCY_LIMITED if the destination has too many requests in flight,
+	//see cort_tcp_concurrency_limiter. The time cost does not include the time queued.
 	cort_proto* start();
+	
+	//It is deleted when it finishes, instead of resuming its parent. It has to be allocated by new and in flight.
+	//Its keep alive connection is returned to the pool as usual, unless cancel is true, then it is canceled at once(see cancel).
+	void detach(bool cancel = false);
 protected:
 	cort_proto* on_finish();
 };
 
 struct cort_tcp_connection_waiter_client : public cort_tcp_connection_waiter{
-	size_t waiter_pos;
+	cort_tcp_connection_waiter_client* pool_prev;	//Link of the idle connections, or the waiters, of the destination.
+	cort_tcp_connection_waiter_client* pool_next;
+	cort_tcp_connection_waiter_client* lru_prev;	//Link of the idle connections of all the destinations.
+	cort_tcp_connection_waiter_client* lru_next;
+	cort_timeout_waiter::time_ms_t lazy_expire_time;	//Not 0 if it is idle without polling, see cort_tcp_connection_pool::set_lazy_validation.
+	
+	cort_tcp_connection_waiter_client(){
+		pool_prev = 0;
+		pool_next = 0;
+		lru_prev = 0;
+		lru_next = 0;
+		lazy_expire_time = 0;
+	}
+	~cort_tcp_connection_waiter_client();
+	
 	void keep_alive(uint32_t keep_alive_time, uint32_t ip_arg, uint16_t port_arg, uint16_t type_key_arg);
+	
+	//Close count idle connections of type_key:ip:port, or the least recently used ones of all the destinations if ip_arg is 0.
 	static size_t clear_keep_alive_connection(size_t count, uint32_t ip_arg = 0, uint16_t port_arg = 0, uint16_t type_key_arg = 0);
 };
 
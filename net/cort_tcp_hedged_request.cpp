@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "cort_tcp_hedged_request.h"
+
+cort_hedge_policy::cort_hedge_policy(){
+	delay_ms = 0;
+	percentile = 95;
+	budget_percent = cort_socket_config::SOCKET_HEDGE_BUDGET_PERCENT;
+	sample_count = 0;
+	next_sample = 0;
+	new_sample_count = 0;
+	percentile_delay = cort_socket_config::SOCKET_HEDGE_DEFAULT_DELAY_MS;
+	budget.init(cort_socket_config::SOCKET_HEDGE_BUDGET_BURST);
+	memset(&stat, 0, sizeof(stat));
+}
+
+uint32_t cort_hedge_policy::get_delay() const{
+	uint32_t result = (delay_ms != 0 ? delay_ms : percentile_delay);
+	return result == 0 ? 1 : result;	//A timer of 0ms never fires.
+}
+
+void cort_hedge_policy::on_request(){
+	++stat.request_count;
+	budget.earn(budget_percent, cort_socket_config::SOCKET_HEDGE_BUDGET_BURST);
+}
+
+bool cort_hedge_policy::try_hedge(){
+	if(!budget.try_spend()){
+		++stat.budget_reject_count;
+		return false;
+	}
+	++stat.hedge_count;
+	return true;
+}
+
+void cort_hedge_policy::add_sample(uint32_t time_cost_ms){
+	samples[next_sample] = time_cost_ms;
+	next_sample = (next_sample + 1) % cort_socket_config::SOCKET_HEDGE_SAMPLE_COUNT;
+	if(sample_count < cort_socket_config::SOCKET_HEDGE_SAMPLE_COUNT){
+		++sample_count;
+	}
+	//The percentile is computed again after every SOCKET_HEDGE_MIN_SAMPLE_COUNT samples.
+	if(++new_sample_count >= cort_socket_config::SOCKET_HEDGE_MIN_SAMPLE_COUNT){
+		update_delay();
+	}
+}
+
+void cort_hedge_policy::update_delay(){
+	uint32_t sorted[cort_socket_config::SOCKET_HEDGE_SAMPLE_COUNT];
+	memcpy(sorted, samples, sample_count * sizeof(uint32_t));
+	size_t index = (size_t)sample_count * percentile / 100;
+	if(index >= sample_count){
+		index = sample_count - 1;
+	}
+	std::nth_element(sorted, sorted + index, sorted + sample_count);
+	percentile_delay = sorted[index];
+	new_sample_count = 0;
+}
+
+cort_hedged_request::cort_hedged_request(){
+	primary = 0;
+	backup = 0;
+	result = 0;
+	primary_waited = 0;
+	backup_waited = 0;
+	timer = 0;
+	policy = 0;
+	start_time = 0;
+	cancel_loser = false;
+	backup_started = false;
+}
+
+cort_hedged_request::~cort_hedged_request(){
+	delete primary;
+	delete backup;
+}
+
+void cort_hedged_request::set_requests(cort_tcp_request_response* primary_arg, cort_tcp_request_response* backup_arg){
+	delete primary;
+	delete backup;
+	primary = primary_arg;
+	backup = backup_arg;
+	result = 0;
+	backup_started = false;
+}
+
+void cort_hedged_request::start_backup(){
+	if(timer != 0){
+		timer->set_parent(0);
+		timer->resume_on_stop();	//It deletes itself.
+		timer = 0;
+	}
+	if(policy != 0 && !policy->try_hedge()){
+		delete backup;
+		backup = 0;
+		return;
+	}
+	backup_started = true;
+	backup_waited = backup->cort_start();
+	if(backup_waited != 0){
+		backup_waited->set_parent(this);
+	}
+}
+
+void cort_hedged_request::finish_result(){
+	if(timer != 0){
+		timer->set_parent(0);
+		timer->resume_on_stop();
+		timer = 0;
+	}
+	if(policy != 0 && result->get_errno() == 0){
+		if(result == primary){
+			policy->add_sample(primary->get_time_cost());
+		}
+		else{
+			policy->add_sample((uint32_t)(cort_timer_now_ms() - start_time));	//The primary has run so long at least.
+			policy->on_backup_win();
+		}
+	}
+	if(result == primary && backup_waited != 0){
+		backup->detach(cancel_loser);
+		backup = 0;
+		backup_waited = 0;
+	}
+	else if(result == backup && primary_waited != 0){
+		primary->detach(cancel_loser);
+		primary = 0;
+		primary_waited = 0;
+	}
+}
+
+bool cort_hedged_request::wait_again(){
+	cort_proto* resumer = get_resumer();
+	set_resumer(0);
+	if(resumer != 0){
+		if(resumer == timer){ //It deletes itself.
+			timer = 0;
+			if(backup != 0 && !backup_started){
+				start_backup();
+			}
+		}
+		else if(resumer == primary_waited){
+			primary_waited = 0;
+		}
+		else if(resumer == backup_waited){
+			backup_waited = 0;
+		}
+	}
+	while(true){
+		if(primary_waited == 0 && primary->get_errno() == 0){
+			result = primary;
+		}
+		else if(backup_started && backup_waited == 0 && backup->get_errno() == 0){
+			result = backup;
+		}
+		else if(primary_waited == 0 && backup != 0 && !backup_started){ //The primary failed before the delay.
+			start_backup();
+			continue;
+		}
+		else if(primary_waited == 0 && backup_waited == 0){ //Both failed.
+			result = primary;
+		}
+		else{
+			set_wait_count(1);
+			return true;
+		}
+		finish_result();
+		return false;
+	}
+}
+
+cort_proto* cort_hedged_request::start(){
+	CO_BEGIN
+		result = 0;
+		backup_started = false;
+		start_time = cort_timer_now_ms();
+		if(policy != 0){
+			policy->on_request();
+		}
+		set_resumer(0);
+		primary_waited = primary->cort_start();
+		if(primary_waited != 0){
+			primary_waited->set_parent(this);
+			if(backup != 0){
+				timer = new cort_timeout(policy != 0 ? policy->get_delay() : cort_socket_config::SOCKET_HEDGE_DEFAULT_DELAY_MS);
+				timer->cort_start();
+				timer->set_parent(this);
+			}
+			set_wait_count(1);
+		}
+		CO_YIELD_IF(primary_waited != 0);	//Resumed by the primary, the backup or the timer.
+		CO_YIELD_AGAIN_IF(wait_again());
+	CO_END
+}
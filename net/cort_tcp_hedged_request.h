@@ -0,0 +1,115 @@
+#ifndef CORT_TCP_HEDGED_REQUEST_H_
+#define CORT_TCP_HEDGED_REQUEST_H_
+
+#include "cort_tcp_ctrler.h"
+#include "cort_tcp_budget.h"
+
+//Delay and budget of the backup requests, shared by the hedged requests to the same service. It is used by the coroutines of one thread.
+//The delay is fixed, or the percentile of the recent time costs of the primary requests. A primary request that lost to its backup
+//counts as the time it has run, which is less than its real time cost, but not less than the delay.
+//Every request earns budget_percent/100 backup, saved up to SOCKET_HEDGE_BUDGET_BURST, and every backup spends 1.
+//So the backups add no more than budget_percent of the load, even when all the primary requests are slow.
+struct cort_hedge_policy{
+	struct stats{
+		uint64_t request_count;
+		uint64_t hedge_count;			//Backup requests sent.
+		uint64_t backup_win_count;		//Backup requests succeeded first.
+		uint64_t budget_reject_count;	//Backup requests not sent for the budget.
+	};
+
+	uint32_t delay_ms;				//0 means the percentile of the recent time costs.
+	uint32_t percentile;
+	uint32_t budget_percent;
+
+	cort_hedge_policy();
+
+	//Delay of the backup request now.
+	uint32_t get_delay() const;
+
+	const stats& get_stats() const{
+		return stat;
+	}
+
+//Following functions are used by cort_hedged_request.
+	void on_request();
+	void add_sample(uint32_t time_cost_ms);
+	bool try_hedge();
+	void on_backup_win(){
+		++stat.backup_win_count;
+	}
+
+private:
+	void update_delay();
+
+	uint32_t samples[cort_socket_config::SOCKET_HEDGE_SAMPLE_COUNT];	//Ring buffer
+	uint32_t sample_count;
+	uint32_t next_sample;
+	uint32_t new_sample_count;		//Added since the percentile was computed.
+	uint32_t percentile_delay;
+	cort_token_budget budget;
+	stats stat;
+};
+
+//Send the primary request, and if it does not succeed within the delay of the policy, send the backup request to another endpoint.
+//It finishes when one of them succeeds, or both of them failed. get_result is the one succeeded first, or the failed primary.
+//The other one is the loser, it is detached(see cort_tcp_request_response::detach). It is canceled if set_cancel_loser,
+//or else it runs on in background and its keep alive connection is reused after it finishes.
+//When the primary request fails before the delay, the backup is sent at once.
+//Example:
+//    primary = new cort_tcp_request_response(); ...	//Set the requests to different endpoints, and the same timeout.
+//    backup = new cort_tcp_request_response(); ...
+//    hedged.set_requests(primary, backup);
+//    hedged.set_policy(&policy);
+//    CO_AWAIT(&hedged);
+//    hedged.get_result()->get_recv_buffer() ...
+struct cort_hedged_request : public cort_proto{
+	CO_DECL(cort_hedged_request)
+
+	cort_hedged_request();
+	~cort_hedged_request();
+
+	//Both are allocated by new and deleted by the hedged request. backup can be 0, then it is only the primary.
+	void set_requests(cort_tcp_request_response* primary_arg, cort_tcp_request_response* backup_arg);
+
+	//Without a policy, the delay is SOCKET_HEDGE_DEFAULT_DELAY_MS and there is no budget.
+	void set_policy(cort_hedge_policy* arg){
+		policy = arg;
+	}
+
+	void set_cancel_loser(bool value = true){
+		cancel_loser = value;
+	}
+
+	//Valid until the hedged request is deleted or set_requests again.
+	cort_tcp_request_response* get_result() const{
+		return result;
+	}
+
+	bool is_hedged() const{
+		return backup_started;
+	}
+
+	cort_proto* start();
+
+private:
+	void start_backup();
+	void finish_result();
+	//Return true if it has to wait for the requests in flight again.
+	bool wait_again();
+
+	cort_tcp_request_response* primary;
+	cort_tcp_request_response* backup;
+	cort_tcp_request_response* result;
+	cort_proto* primary_waited;		//Not 0 while it is in flight.
+	cort_proto* backup_waited;
+	cort_timeout* timer;		//Delay of the backup, it deletes itself when it finishes.
+	cort_hedge_policy* policy;
+	cort_timeout_waiter::time_ms_t start_time;
+	bool cancel_loser;
+	bool backup_started;
+
+	cort_hedged_request(const cort_hedged_request&);
+	cort_hedged_request& operator=(const cort_hedged_request&);
+};
+
+#endif
@@ -198,6 +198,7 @@ cort_proto* cort_tcp_listener::on_accept_error(){
 static void remove_keep_alive(cort_tcp_server_waiter* tcp_cort){
 	uint32_t result = tcp_cort->get_poll_result();
 	if(result == 0 || (((EPOLLRDHUP|EPOLLERR) & result) != 0)){//timeout
+		tcp_cort->retire_zero_copy();
 		tcp_cort->close_cort_fd();
 		tcp_cort->release();
 	}
@@ -210,6 +211,9 @@ static void remove_keep_alive(cort_tcp_server_waiter* tcp_cort){
 
 static cort_proto* on_connection_keepalive_timeout_or_readable_server(cort_proto* arg){
 	cort_tcp_server_waiter* tcp_cort = (cort_tcp_server_waiter*)arg;
+	if(tcp_cort->drain_zero_copy_notification() && tcp_cort->get_poll_result() == 0){ //Only zero copy notifications, keep waiting.
+		return tcp_cort;
+	}
 	remove_keep_alive(tcp_cort);
 	return 0;
 }
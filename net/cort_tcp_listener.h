@@ -20,6 +20,7 @@ struct tcp_ctrler_static_creator{
         waiter->set_poll_result(init_poll_result);
 		result->set_connection_waiter(waiter);
 		result->set_dest_addr(dest_ip, dest_port);
+		result->set_disable_adaptive_recv_size();	//Every client port is a new destination, nothing learned is used again.
 		((connection_waiter_t*)waiter)->ctrler_creator = this_type::create;
 		result->cort_start();
 	}
@@ -0,0 +1,437 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+#include "cort_tcp_multiplexer.h"
+
+cort_tcp_mux_request::~cort_tcp_mux_request(){
+	if(mux != 0){
+		mux->abandon(this);
+	}
+	free_response();
+}
+
+void cort_tcp_mux_request::free_response(){
+	cort_buffer_pool::free(response);
+	response = 0;
+	response_size = 0;
+}
+
+cort_proto* cort_tcp_mux_request::wait(){
+	CO_BEGIN
+		if(mux == 0){ //Failed or finished before waiting.
+			CO_RETURN;
+		}
+		if(wait_timeout != 0){
+			set_timeout(wait_timeout);
+		}
+		CO_YIELD();
+		if(mux != 0){ //Resumed by timeout or stop, not by the multiplexer.
+			mux->abandon(this);
+			errnum = cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT;
+		}
+	CO_END
+}
+
+cort_tcp_multiplexer::cort_tcp_multiplexer(){
+	ip_v4 = 0;
+	port_v4 = 0;
+	state = state_closed;
+	in_run = 0;
+	dispatch_by_id = false;
+	response_check = 0;
+	connect_timeout = 0;
+	idle_timeout = 0;
+	queued_request_count = 0;
+	read_buffer = 0;
+	read_size = 0;
+	read_capacity = 0;
+	fifo_base_seq = 0;
+	waiting_count = 0;
+	done_head = 0;
+	done_tail = 0;
+	send_call_count = 0;
+	sent_request_count = 0;
+}
+
+cort_tcp_multiplexer::~cort_tcp_multiplexer(){
+	//The requests should have finished, we only detach them here.
+	for(std::deque<cort_tcp_mux_request*>::iterator it = fifo_waiters.begin(); it != fifo_waiters.end(); ++it){
+		if(*it != 0){
+			(*it)->mux = 0;
+		}
+	}
+	for(std::map<uint64_t, cort_tcp_mux_request*>::iterator it = id_waiters.begin(); it != id_waiters.end(); ++it){
+		it->second->mux = 0;
+	}
+	for(cort_tcp_mux_request* req = done_head; req != 0; req = req->next_done){
+		req->mux = 0;
+	}
+	cort_buffer_pool::free(read_buffer);
+}
+
+void cort_tcp_multiplexer::set_dest_addr(const char* ip, uint16_t port){
+	uint32_t ip_int ;
+	inet_pton(AF_INET, ip, &ip_int);
+	set_dest_addr(ip_int, htons(port));
+}
+
+cort_tcp_mux_request* cort_tcp_multiplexer::request(cort_tcp_mux_request* req, const char* data, size_t size, uint32_t timeout_ms, uint64_t request_id){
+	assert(req->mux == 0);
+	req->free_response();
+	req->request_data = data;
+	req->request_size = size;
+	req->request_id = request_id;
+	req->wait_timeout = timeout_ms;
+	req->errnum = 0;
+	req->responded = 0;
+	req->next_done = 0;
+	if(enqueue(req)){
+		req->mux = this;
+	}
+	return req;
+}
+
+bool cort_tcp_multiplexer::enqueue(cort_tcp_mux_request* req){
+	if(response_check == 0 || ip_v4 == 0 || port_v4 == 0){
+		req->errnum = cort_socket_error_codes::SOCKET_INVALID_CONNECT_ADDRESS;
+		return false;
+	}
+	if(dispatch_by_id && id_waiters.find(req->request_id) != id_waiters.end()){
+		req->errnum = cort_socket_error_codes::SOCKET_STATE_ERROR;
+		return false;
+	}
+	if(send_buffer.copy_send_buffer((char*)req->request_data, (int32_t)req->request_size) == 0){
+		req->errnum = cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+		return false;
+	}
+	if(state == state_closed && !in_run){
+		//Connect now so the error goes to this request only, no other request is waiting.
+		uint8_t err = begin_connect();
+		if(err != 0){
+			send_buffer.clear();
+			req->errnum = err;
+			return false;
+		}
+		set_run_function(&cort_start_static);	//run is resumed by poll or timeout later.
+	}
+	if(dispatch_by_id){
+		id_waiters[req->request_id] = req;
+	}
+	else{
+		req->seq = fifo_base_seq + fifo_waiters.size();
+		fifo_waiters.push_back(req);
+	}
+	++waiting_count;
+	++queued_request_count;
+	if(in_run){ //run will send it or connect again before it waits.
+		return true;
+	}
+	if(state == state_connected){
+		clear_timeout();	//The idle timer.
+	}
+	update_poll_request();	//Sent in next loop, so the requests queued before are sent together.
+	return true;
+}
+
+void cort_tcp_multiplexer::abandon(cort_tcp_mux_request* req){
+	if(req->responded != 0 || req->errnum != 0){ //In done list.
+		cort_tcp_mux_request** prev = &done_head;
+		cort_tcp_mux_request* last = 0;
+		for(; *prev != 0 && *prev != req; prev = &((*prev)->next_done)){
+			last = *prev;
+		}
+		if(*prev == req){
+			*prev = req->next_done;
+			if(done_tail == req){
+				done_tail = last;
+			}
+		}
+	}
+	else{
+		if(dispatch_by_id){
+			id_waiters.erase(req->request_id);
+		}
+		else{
+			//Keep the slot, the response will be dropped when it arrives.
+			fifo_waiters[(size_t)(req->seq - fifo_base_seq)] = 0;
+		}
+		--waiting_count;
+		if(waiting_count == 0 && state == state_connected && idle_timeout != 0 && !in_run){
+			set_timeout(idle_timeout);
+		}
+	}
+	req->next_done = 0;
+	req->mux = 0;
+}
+
+void cort_tcp_multiplexer::finish_request(cort_tcp_mux_request* req, uint8_t err){
+	req->errnum = err;
+	req->next_done = 0;
+	if(done_tail == 0){
+		done_head = req;
+	}
+	else{
+		done_tail->next_done = req;
+	}
+	done_tail = req;
+	--waiting_count;
+}
+
+void cort_tcp_multiplexer::resume_done(){
+	while(done_head != 0){
+		cort_tcp_mux_request* req = done_head;
+		done_head = req->next_done;
+		if(done_head == 0){
+			done_tail = 0;
+		}
+		req->next_done = 0;
+		req->mux = 0;
+		req->clear_timeout();
+		req->resume();
+	}
+}
+
+void cort_tcp_multiplexer::close_connection(uint8_t err){
+	close_cort_fd();
+	clear_timeout();
+	state = state_closed;
+	for(std::deque<cort_tcp_mux_request*>::iterator it = fifo_waiters.begin(); it != fifo_waiters.end(); ++it){
+		if(*it != 0){
+			finish_request(*it, err);
+		}
+	}
+	fifo_waiters.clear();
+	fifo_base_seq = 0;
+	for(std::map<uint64_t, cort_tcp_mux_request*>::iterator it = id_waiters.begin(); it != id_waiters.end(); ++it){
+		finish_request(it->second, err);
+	}
+	id_waiters.clear();
+	send_buffer.clear();
+	queued_request_count = 0;
+	read_size = 0;
+}
+
+void cort_tcp_multiplexer::close(uint8_t err){
+	close_connection(err);
+	if(in_run){
+		return;
+	}
+	cort_timeout_waiter::on_finish();
+	resume_done();
+}
+
+const static uint32_t mux_connect_poll_request = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+void cort_tcp_multiplexer::update_poll_request(){
+	if(state == state_connecting){
+		set_poll_request(mux_connect_poll_request);
+		return;
+	}
+	set_poll_request(send_buffer.empty() ? (EPOLLIN | EPOLLRDHUP) : (EPOLLIN | EPOLLRDHUP | EPOLLOUT));
+}
+
+uint8_t cort_tcp_multiplexer::begin_connect(){
+	cort_timeout_waiter::clear();	//Reset the timeout state of last connection.
+	bool connected;
+	uint8_t err;
+	int sockfd = cort_tcp_connection_waiter::start_connect(ip_v4, port_v4, 0, connected, err);
+	if(sockfd == -1){
+		return err;
+	}
+	set_cort_fd(sockfd);
+	if(connected){
+		state = state_connected;
+		return 0;
+	}
+	state = state_connecting;
+	if(connect_timeout != 0){
+		set_timeout(connect_timeout);
+	}
+	return 0;
+}
+
+uint8_t cort_tcp_multiplexer::check_connected(uint32_t poll_event){
+	uint8_t err = cort_tcp_connection_waiter::check_connected(get_cort_fd(), poll_event);
+	if(err != 0){
+		return err;
+	}
+	clear_timeout();
+	state = state_connected;
+	return 0;
+}
+
+//All the queued requests are sent together, no more than SOCKET_SEND_MAX_IOV_COUNT in one call.
+uint8_t cort_tcp_multiplexer::flush_send(){
+	int fd = get_cort_fd();
+	size_t segment_count;
+	size_t file_send_size;
+	while(!send_buffer.empty()){
+		ssize_t sent_size = send_buffer.send_front(fd, segment_count, file_send_size);
+		if(sent_size < 0){
+			int thread_errno = errno;
+			if(thread_errno == EINTR){
+				continue;
+			}
+			if(thread_errno == EAGAIN || thread_errno == EWOULDBLOCK){
+				return 0;
+			}
+			return cort_socket_error_codes::SOCKET_SEND_ERROR;
+		}
+		++send_call_count;
+		size_t sent_count = send_buffer.consume(sent_size);
+		sent_request_count += sent_count;
+		queued_request_count -= sent_count;
+	}
+	return 0;
+}
+
+//Reads until EAGAIN, the responses are dispatched after every recv.
+uint8_t cort_tcp_multiplexer::read_responses(){
+	int fd = get_cort_fd();
+	while(true){
+		if(read_size == read_capacity){
+			size_t new_capacity = (read_capacity == 0 ? cort_socket_config::SOCKET_RECV_BUFFER_DEFAULT_SIZE : (read_capacity << 1));
+			char* new_buffer = (char*)cort_buffer_pool::realloc(read_buffer, new_capacity);
+			if(new_buffer == 0){
+				return cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+			}
+			read_buffer = new_buffer;
+			read_capacity = cort_buffer_pool::capacity(new_buffer);
+		}
+		ssize_t recved_size = recv(fd, read_buffer + read_size, read_capacity - read_size, 0);
+		if(recved_size > 0){
+			read_size += recved_size;
+			uint8_t err = dispatch_responses();
+			if(err != 0){
+				return err;
+			}
+			continue;
+		}
+		if(recved_size == 0){
+			return cort_socket_error_codes::SOCKET_REMOTE_CANCELED;
+		}
+		int thread_errno = errno;
+		if(thread_errno == EINTR){
+			continue;
+		}
+		if(thread_errno == EAGAIN || thread_errno == EWOULDBLOCK){
+			return 0;
+		}
+		return cort_socket_error_codes::SOCKET_RECEIVE_ERROR;
+	}
+}
+
+uint8_t cort_tcp_multiplexer::dispatch_responses(){
+	size_t offset = 0;
+	size_t needed_size = 0;
+	while(offset < read_size){
+		uint64_t id = 0;
+		int32_t response_size = response_check(read_buffer + offset, read_size - offset, &id);
+		if(response_size < 0){
+			return cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR;
+		}
+		if(response_size == 0 || (size_t)response_size > read_size - offset){
+			needed_size = (size_t)response_size;
+			break;
+		}
+		cort_tcp_mux_request* req = 0;
+		if(dispatch_by_id){
+			std::map<uint64_t, cort_tcp_mux_request*>::iterator it = id_waiters.find(id);
+			if(it != id_waiters.end()){ //Or it is abandoned.
+				req = it->second;
+				id_waiters.erase(it);
+			}
+		}
+		else{
+			if(fifo_waiters.empty()){
+				return cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR;
+			}
+			req = fifo_waiters.front();
+			fifo_waiters.pop_front();
+			++fifo_base_seq;
+		}
+		if(req != 0){
+			req->response = (char*)cort_buffer_pool::alloc(response_size);
+			if(req->response == 0){
+				finish_request(req, cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR);
+				return cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+			}
+			memcpy(req->response, read_buffer + offset, response_size);
+			req->response_size = response_size;
+			req->responded = 1;
+			finish_request(req, 0);
+		}
+		offset += response_size;
+	}
+	if(offset != 0){
+		read_size -= offset;
+		memmove(read_buffer, read_buffer + offset, read_size);
+	}
+	if(needed_size > read_capacity){
+		char* new_buffer = (char*)cort_buffer_pool::realloc(read_buffer, needed_size);
+		if(new_buffer == 0){
+			return cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+		}
+		read_buffer = new_buffer;
+		read_capacity = cort_buffer_pool::capacity(new_buffer);
+	}
+	return 0;
+}
+
+cort_proto* cort_tcp_multiplexer::run(){
+	CO_BEGIN
+	run_label:
+		in_run = 1;
+		uint8_t err = 0;
+		uint32_t poll_event = get_poll_result();
+		clear_poll_result();
+		if(state == state_closed){ //Requests are queued after the connection closed in last loop.
+			err = begin_connect();
+			poll_event = 0;
+		}
+		else if(is_timeout_or_stopped()){ //Connect timeout, or idle timeout when no request is waiting.
+			err = cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT;
+		}
+		else if(state == state_connecting){
+			err = check_connected(poll_event);
+		}
+		else if(((EPOLLHUP|EPOLLERR) & poll_event) != 0){
+			err = cort_socket_error_codes::SOCKET_REMOTE_CANCELED;
+		}
+		if(err == 0 && state == state_connected){
+			if((poll_event & (EPOLLIN|EPOLLRDHUP)) != 0){
+				err = read_responses();
+			}
+			if(err == 0){
+				err = flush_send();
+			}
+		}
+		if(err != 0){
+			close_connection(err);
+		}
+		resume_done();
+		in_run = 0;
+		if(state == state_closed){
+			if(waiting_count != 0 && !is_stopped()){ //Queued by the coroutines just resumed.
+				goto run_label;
+			}
+			CO_RETURN;
+		}
+		if(state == state_connected){
+			flush_send();	//The requests queued by the coroutines just resumed, an error will be found in next loop.
+			if(waiting_count != 0){
+				clear_timeout();
+			}
+			else if(idle_timeout != 0 && !is_set_timeout()){
+				set_timeout(idle_timeout);
+			}
+		}
+		update_poll_request();
+		CO_AGAIN;
+	CO_END
+}
@@ -0,0 +1,181 @@
+#ifndef CORT_TCP_MULTIPLEXER_H_
+#define CORT_TCP_MULTIPLEXER_H_
+
+#include <deque>
+#include <map>
+#include "cort_tcp_ctrler.h"
+
+struct cort_tcp_multiplexer;
+
+//A request sent by cort_tcp_multiplexer. Usually it is a member of the coroutine that sends it.
+//The request bytes are copied when it is queued, the response is owned by the request until next request or destruction.
+//Example:
+//    CO_AWAIT(mux.request(&req, buf, size, 100));	//in FIFO mode
+//    if(req.get_errno() == 0){
+//        use(req.get_response(), req.get_response_size());
+//    }
+struct cort_tcp_mux_request : public cort_timeout_waiter{
+	CO_DECL(cort_tcp_mux_request, wait)
+
+	cort_tcp_multiplexer* mux;	//Not 0 when the request is waiting, or it is finished but not resumed yet.
+	const char* request_data;
+	size_t request_size;
+	uint64_t request_id;		//Used in id mode, see cort_tcp_multiplexer::set_response_check_function.
+	uint64_t seq;				//Position in the FIFO of the multiplexer.
+	char* response;
+	size_t response_size;
+	uint32_t wait_timeout;
+	uint8_t errnum;
+	uint8_t responded;
+	cort_tcp_mux_request* next_done;	//Link of the requests to be resumed by the multiplexer.
+
+	cort_tcp_mux_request(){
+		mux = 0;
+		request_data = 0;
+		request_size = 0;
+		request_id = 0;
+		seq = 0;
+		response = 0;
+		response_size = 0;
+		wait_timeout = 0;
+		errnum = 0;
+		responded = 0;
+		next_done = 0;
+	}
+	~cort_tcp_mux_request();
+
+	uint8_t get_errno() const{
+		return errnum;
+	}
+
+	const char* get_response() const{
+		return response;
+	}
+
+	size_t get_response_size() const{
+		return response_size;
+	}
+
+	void free_response();
+
+	cort_proto* wait();
+};
+
+//Many coroutines share one connection by cort_tcp_multiplexer. The requests are queued and the queued requests are sent by one writev
+//when the socket is writable, and the responses are dispatched to the requests in FIFO order or by the request id that response_check returns.
+//One cort_fd_waiter coroutine reads and writes the connection, because one fd has only one poll request in cort_proto.
+//It connects when the first request is queued, and all the waiting requests fail with the error code when the connection is broken.
+//It connects like a cort_tcp_ctrler(see cort_tcp_connection_waiter::start_connect), so the source addresses of cort_tcp_source_addr are used.
+//The multiplexer must live longer than its requests.
+struct cort_tcp_multiplexer : public cort_fd_waiter{
+	CO_DECL(cort_tcp_multiplexer, run)
+
+	//data and size are the received bytes not dispatched yet.
+	//Return 0 if more bytes are needed, positive length of the first response, or negative number if the data are bad.
+	//In id mode, set *request_id to the id of the first response.
+	typedef int32_t (*response_check_function_t)(const char* data, size_t size, uint64_t* request_id);
+
+	cort_tcp_multiplexer();
+	~cort_tcp_multiplexer();
+
+	//Both ip and port have to use network byte order!
+	void set_dest_addr(uint32_t ip, uint16_t port){
+		ip_v4 = ip;
+		port_v4 = port;
+	}
+
+	//Port should use local order!
+	void set_dest_addr(const char* ip, uint16_t port);
+
+	//by_id == false: responses are in the same order as the requests.
+	//by_id == true: the request ids of the waiting requests should be unique.
+	void set_response_check_function(response_check_function_t func, bool by_id = false){
+		response_check = func;
+		dispatch_by_id = by_id;
+	}
+
+	void set_connect_timeout(uint32_t timeout_ms){
+		connect_timeout = timeout_ms;
+	}
+
+	//Close the connection when no request is waiting for idle_ms. 0 means keeping it until close.
+	void set_idle_timeout(uint32_t idle_ms){
+		idle_timeout = idle_ms;
+	}
+
+	//Queue the request, you can await the result. timeout_ms == 0 means waiting until the connection is broken or closed.
+	cort_tcp_mux_request* request(cort_tcp_mux_request* req, const char* data, size_t size, uint32_t timeout_ms = 0, uint64_t request_id = 0);
+
+	//Fail all the waiting requests with err and close the connection.
+	void close(uint8_t err = cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT);
+
+	bool is_connected() const{
+		return state == state_connected;
+	}
+
+	//Count of the requests waiting for the responses.
+	size_t get_waiting_count() const{
+		return waiting_count;
+	}
+
+	//Count of the writev/send calls and the requests sent, the ratio shows how the requests are coalesced.
+	uint64_t get_send_call_count() const{
+		return send_call_count;
+	}
+
+	uint64_t get_sent_request_count() const{
+		return sent_request_count;
+	}
+
+	cort_proto* run();
+
+protected:
+	friend struct cort_tcp_mux_request;
+	bool enqueue(cort_tcp_mux_request* req);
+	void abandon(cort_tcp_mux_request* req);
+
+	//Following functions return 0 or the error code.
+	uint8_t begin_connect();
+	uint8_t check_connected(uint32_t poll_event);
+	uint8_t flush_send();
+	uint8_t read_responses();
+	uint8_t dispatch_responses();
+
+	void finish_request(cort_tcp_mux_request* req, uint8_t err);
+	void close_connection(uint8_t err);
+	void resume_done();
+	void update_poll_request();
+
+	enum{
+		state_closed = 0,
+		state_connecting = 1,
+		state_connected = 2
+	};
+
+	uint32_t ip_v4;
+	uint16_t port_v4;
+	uint8_t state;
+	uint8_t in_run;
+	bool dispatch_by_id;
+	response_check_function_t response_check;
+	uint32_t connect_timeout;
+	uint32_t idle_timeout;
+
+	send_buffer_ctrl send_buffer;
+	size_t queued_request_count;	//Requests in send_buffer.
+	char* read_buffer;
+	size_t read_size;
+	size_t read_capacity;
+
+	std::deque<cort_tcp_mux_request*> fifo_waiters;	//0 for a request that has been abandoned.
+	uint64_t fifo_base_seq;
+	std::map<uint64_t, cort_tcp_mux_request*> id_waiters;
+	size_t waiting_count;
+	cort_tcp_mux_request* done_head;
+	cort_tcp_mux_request* done_tail;
+
+	uint64_t send_call_count;
+	uint64_t sent_request_count;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "cort_tcp_pipeline_server.h"
+
+cort_tcp_pipeline_handler::~cort_tcp_pipeline_handler(){
+	cort_buffer_pool::free(request);
+}
+
+cort_proto* cort_tcp_pipeline_handler::on_finish(){
+	cort_proto* result = cort_proto::on_finish();
+	if(result != 0){
+		return result;
+	}
+	if(server == 0){ //The connection is closed, nobody owns it now.
+		delete this;
+		return 0;
+	}
+	server->finish_handler(this);	//It may be deleted here.
+	return 0;
+}
+
+cort_tcp_pipeline_server::cort_tcp_pipeline_server(){
+	request_check = 0;
+	handler_creator = 0;
+	handler_start = 0;
+	max_concurrency = 1;
+	idle_timeout = 0;
+	ip_v4 = 0;
+	port_v4 = 0;
+	errnum = 0;
+	in_run = 0;
+	read_closed = 0;
+	close_pending = 0;
+	dispatch_blocked = 0;
+	read_buffer = 0;
+	read_size = 0;
+	read_capacity = 0;
+	needed_size = 0;
+	handler_head = 0;
+	handler_tail = 0;
+	handler_count = 0;
+	recv_call_count = 0;
+	send_call_count = 0;
+	request_count = 0;
+}
+
+cort_tcp_pipeline_server::~cort_tcp_pipeline_server(){
+	drop_handlers(handler_head);
+	cort_buffer_pool::free(read_buffer);
+}
+
+//The finished handlers are deleted, the running ones are detached and delete themselves when they finish.
+void cort_tcp_pipeline_server::drop_handlers(cort_tcp_pipeline_handler* first){
+	while(first != 0){
+		cort_tcp_pipeline_handler* handler = first;
+		first = first->next;
+		if(handler->finished != 0){
+			delete handler;
+		}
+		else{
+			handler->server = 0;
+			handler->next = 0;
+		}
+	}
+}
+
+cort_proto* cort_tcp_pipeline_server::on_finish(){
+	drop_handlers(handler_head);
+	handler_head = 0;
+	handler_tail = 0;
+	handler_count = 0;
+	send_buffer.clear();
+	close_cort_fd();
+	on_connection_closed();
+	cort_timeout_waiter::on_finish();
+	delete this;
+	return 0;
+}
+
+bool cort_tcp_pipeline_server::can_dispatch() const{
+	return close_pending == 0 && handler_count < max_concurrency
+		&& send_buffer.size() < cort_socket_config::SOCKET_SEND_MAX_IOV_COUNT;	//Or the client is not reading the responses.
+}
+
+bool cort_tcp_pipeline_server::is_read_paused() const{
+	return read_closed != 0 || !can_dispatch();
+}
+
+void cort_tcp_pipeline_server::update_poll_request(bool wake){
+	uint32_t poll_req = (is_read_paused() ? 0 : (EPOLLIN | EPOLLRDHUP));
+	if(wake || !send_buffer.empty()){
+		poll_req |= EPOLLOUT;
+	}
+	if(poll_req == 0){ //Only waiting for the handlers.
+		remove_poll_request();
+		return;
+	}
+	set_poll_request(poll_req);
+}
+
+void cort_tcp_pipeline_server::finish_handler(cort_tcp_pipeline_handler* handler){
+	handler->finished = 1;
+	collect_responses();
+	if(!in_run){ //Resume run in next loop, so the responses finished in this loop are sent together.
+		update_poll_request(true);
+	}
+}
+
+//Queue the responses of the finished handlers at the front, in the request order.
+void cort_tcp_pipeline_server::collect_responses(){
+	while(handler_head != 0 && handler_head->finished != 0){
+		cort_tcp_pipeline_handler* handler = handler_head;
+		if(!send_buffer.splice(handler->response)){
+			errnum = cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;	//run closes the connection.
+			return;
+		}
+		handler_head = handler->next;
+		if(handler_head == 0){
+			handler_tail = 0;
+		}
+		--handler_count;
+		++request_count;
+		if(handler->close_after_response != 0){
+			close_pending = 1;
+			drop_handlers(handler_head);
+			handler_head = 0;
+			handler_tail = 0;
+			handler_count = 0;
+		}
+		delete handler;
+	}
+}
+
+//Start a handler for every complete request in read_buffer, until max_concurrency handlers are running.
+uint8_t cort_tcp_pipeline_server::dispatch_requests(){
+	size_t offset = 0;
+	uint8_t err = 0;
+	needed_size = 0;
+	dispatch_blocked = 0;
+	while(offset < read_size){
+		if(!can_dispatch()){
+			dispatch_blocked = 1;
+			break;
+		}
+		int32_t request_size = request_check(read_buffer + offset, read_size - offset);
+		if(request_size < 0){
+			err = cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR;
+			break;
+		}
+		if(request_size == 0 || (size_t)request_size > read_size - offset){
+			needed_size = (size_t)request_size;
+			break;
+		}
+		cort_tcp_pipeline_handler* handler = handler_creator();
+		handler->request = (char*)cort_buffer_pool::alloc(request_size);
+		if(handler->request == 0){
+			delete handler;
+			err = cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+			break;
+		}
+		memcpy(handler->request, read_buffer + offset, request_size);
+		handler->request_size = request_size;
+		handler->server = this;
+		if(handler_tail == 0){
+			handler_head = handler;
+		}
+		else{
+			handler_tail->next = handler;
+		}
+		handler_tail = handler;
+		++handler_count;
+		offset += request_size;
+		handler_start(handler);	//It may finish and be deleted at once.
+	}
+	if(close_pending != 0){ //The requests after the closing one are dropped.
+		read_size = 0;
+		needed_size = 0;
+		return err;
+	}
+	if(offset != 0){
+		read_size -= offset;
+		memmove(read_buffer, read_buffer + offset, read_size);
+	}
+	return err;
+}
+
+//Reads until EAGAIN or the reading is paused, the requests are dispatched after every recv.
+uint8_t cort_tcp_pipeline_server::read_requests(){
+	int fd = get_cort_fd();
+	while(!is_read_paused()){
+		if(read_size == read_capacity || needed_size > read_capacity){
+			size_t new_capacity = (read_capacity == 0 ? cort_socket_config::SOCKET_RECV_BUFFER_DEFAULT_SIZE : (read_capacity << 1));
+			if(new_capacity < needed_size){
+				new_capacity = needed_size;
+			}
+			char* new_buffer = (char*)cort_buffer_pool::realloc(read_buffer, new_capacity);
+			if(new_buffer == 0){
+				return cort_socket_error_codes::SOCKET_ALLOC_MEMORY_ERROR;
+			}
+			read_buffer = new_buffer;
+			read_capacity = cort_buffer_pool::capacity(new_buffer);
+		}
+		ssize_t recved_size = recv(fd, read_buffer + read_size, read_capacity - read_size, 0);
+		++recv_call_count;
+		if(recved_size > 0){
+			read_size += recved_size;
+			uint8_t err = dispatch_requests();
+			if(err != 0){
+				return err;
+			}
+			continue;
+		}
+		if(recved_size == 0){ //The client closed, we still send the responses of the received requests.
+			read_closed = 1;
+			return 0;
+		}
+		int thread_errno = errno;
+		if(thread_errno == EINTR){
+			continue;
+		}
+		if(thread_errno == EAGAIN || thread_errno == EWOULDBLOCK){
+			return 0;
+		}
+		return cort_socket_error_codes::SOCKET_RECEIVE_ERROR;
+	}
+	return 0;
+}
+
+//All the queued responses are sent together, no more than SOCKET_SEND_MAX_IOV_COUNT in one call.
+uint8_t cort_tcp_pipeline_server::flush_send(){
+	int fd = get_cort_fd();
+	size_t segment_count;
+	size_t file_send_size;
+	while(!send_buffer.empty()){
+		ssize_t sent_size = send_buffer.send_front(fd, segment_count, file_send_size);
+		if(sent_size < 0){
+			int thread_errno = errno;
+			if(thread_errno == EINTR){
+				continue;
+			}
+			if(thread_errno == EAGAIN || thread_errno == EWOULDBLOCK){
+				return 0;
+			}
+			return cort_socket_error_codes::SOCKET_SEND_ERROR;
+		}
+		++send_call_count;
+		send_buffer.consume(sent_size);
+	}
+	return 0;
+}
+
+cort_proto* cort_tcp_pipeline_server::run(){
+	CO_BEGIN
+		in_run = 1;
+		uint8_t err = 0;
+		uint32_t poll_event = get_poll_result();
+		clear_poll_result();
+		if(is_timeout_or_stopped()){ //Idle timeout.
+			err = cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT;
+		}
+		else if(((EPOLLHUP|EPOLLERR) & poll_event) != 0){
+			err = cort_socket_error_codes::SOCKET_REMOTE_CANCELED;
+		}
+		else{
+			do{
+				//The requests left in the buffer when the handlers were too many.
+				err = dispatch_requests();
+				if(err == 0 && (poll_event & (EPOLLIN|EPOLLRDHUP)) != 0){
+					err = read_requests();
+				}
+				if(err == 0){
+					err = flush_send();
+				}
+				poll_event |= EPOLLIN;	//The flushed responses may make room for more requests.
+			}while(err == 0 && dispatch_blocked != 0 && can_dispatch());
+		}
+		in_run = 0;
+		if(err == 0){
+			err = errnum;
+		}
+		if(err != 0){
+			errnum = err;
+			CO_RETURN;
+		}
+		bool idle = (handler_head == 0 && send_buffer.empty());
+		if(idle && (read_closed != 0 || close_pending != 0)){
+			CO_RETURN;
+		}
+		if(!idle){
+			clear_timeout();
+		}
+		else if(idle_timeout != 0 && !is_set_timeout()){
+			set_timeout(idle_timeout);
+		}
+		update_poll_request(false);
+		CO_AGAIN;
+	CO_END
+}
@@ -0,0 +1,225 @@
+#ifndef CORT_TCP_PIPELINE_SERVER_H_
+#define CORT_TCP_PIPELINE_SERVER_H_
+
+#include "cort_tcp_ctrler.h"
+
+struct cort_tcp_pipeline_server;
+
+//A request handled by cort_tcp_pipeline_server. Subclass it and implement start, which reads get_request and fills the response.
+//It can await other coroutines. The responses are sent in the order of the requests, whenever the handlers finish.
+//The handler is created by new and deleted by the server after its response is queued.
+//Example:
+//    struct echo_handler : public cort_tcp_pipeline_handler{
+//        CO_DECL(echo_handler)
+//        static int32_t request_check(const char* data, size_t size);
+//        cort_proto* start(){
+//            CO_BEGIN
+//                copy_response_buffer(get_request(), (int32_t)get_request_size());
+//            CO_END
+//        }
+//    };
+//    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler>::create);
+struct cort_tcp_pipeline_handler : public cort_proto{
+	cort_tcp_pipeline_server* server;	//0 when the connection is closed before the handler finishes.
+	char* request;
+	size_t request_size;
+	cort_tcp_pipeline_handler* next;	//Link of the handlers of one connection in request order.
+	uint8_t finished;
+	uint8_t close_after_response;
+	send_buffer_ctrl response;
+
+	cort_tcp_pipeline_handler(){
+		server = 0;
+		request = 0;
+		request_size = 0;
+		next = 0;
+		finished = 0;
+		close_after_response = 0;
+	}
+	virtual ~cort_tcp_pipeline_handler();
+
+	const char* get_request() const{
+		return request;
+	}
+
+	size_t get_request_size() const{
+		return request_size;
+	}
+
+	//weak reference, return zero if memory allocation failed.
+	char* set_response_buffer(char* src_buffer, int32_t arg_size){
+		return response.set_send_buffer(src_buffer, arg_size);
+	}
+
+	//strong reference, return zero if memory allocation failed.
+	char* alloc_response_buffer(int32_t arg_size){
+		return response.alloc_send_buffer(arg_size);
+	}
+
+	//strong reference, return zero if memory allocation failed.
+	char* copy_response_buffer(const char* src_buffer, int32_t arg_size){
+		return response.copy_send_buffer((char*)src_buffer, arg_size);
+	}
+
+	//See cort_tcp_ctrler::set_send_file.
+	bool set_response_file(int fd, off_t offset, size_t length, bool close_after_sent = false){
+		return response.set_send_file(fd, offset, length, close_after_sent);
+	}
+
+	//Close the connection after this response is sent. The later requests are dropped, for example, "Connection: close" in http.
+	void set_close_after_response(uint8_t value = 1){
+		close_after_response = value;
+	}
+
+	//The connection has been closed, so the response will be dropped.
+	bool is_detached() const{
+		return server == 0;
+	}
+
+	cort_proto* on_finish();
+};
+
+//One coroutine per accepted connection. It reads the requests, splits them by request_check, even many requests in one recv,
+//and starts a handler for each of them. Up to max_concurrency handlers run at the same time, their responses are queued
+//in the request order and sent by one writev per loop. So a pipelining client needs no extra recv or send call per request.
+//Unlike tcp_ctrler_static_creator, the connection is never handed to cort_tcp_server_waiter::keep_alive between requests.
+//It closes when the client closes(after the responses of the received requests are sent), on errors, or idle_timeout.
+struct cort_tcp_pipeline_server : public cort_fd_waiter{
+	CO_DECL(cort_tcp_pipeline_server, run)
+
+	//data and size are the received bytes not handled yet.
+	//Return 0 if more bytes are needed, positive length of the first request, or negative number if the data are bad.
+	typedef int32_t (*request_check_function_t)(const char* data, size_t size);
+	typedef cort_tcp_pipeline_handler* (*handler_creator_t)();
+
+	cort_tcp_pipeline_server();
+	~cort_tcp_pipeline_server();
+
+	void set_request_check_function(request_check_function_t func){
+		request_check = func;
+	}
+
+	//start_func is usually handler_t::cort_start_static.
+	void set_handler_creator(handler_creator_t create_func, run_type start_func){
+		handler_creator = create_func;
+		handler_start = start_func;
+	}
+
+	template<typename handler_t>
+	static cort_tcp_pipeline_handler* create_handler(){
+		return new handler_t();
+	}
+
+	//handler_t has to provide static int32_t request_check(const char* data, size_t size).
+	template<typename handler_t>
+	void set_handler_type(){
+		set_request_check_function(&handler_t::request_check);
+		set_handler_creator(&create_handler<handler_t>, &handler_t::cort_start_static);
+	}
+
+	//1 in default: the requests are handled one by one. The later requests stay in the buffer until the handler finishes.
+	void set_max_concurrency(uint32_t count){
+		max_concurrency = (count == 0 ? 1 : count);
+	}
+
+	//Close the connection when no request is received or handled for idle_ms. 0 means keeping it until the client closes.
+	void set_idle_timeout(uint32_t idle_ms){
+		idle_timeout = idle_ms;
+	}
+
+	uint8_t get_errno() const{
+		return errnum;
+	}
+
+	uint32_t get_ip() const{
+		return ip_v4;
+	}
+
+	uint16_t get_port() const{
+		return port_v4;
+	}
+
+	//Count of the recv calls, send calls and the requests handled. The ratios show how the pipelined requests are batched.
+	uint64_t get_recv_call_count() const{
+		return recv_call_count;
+	}
+
+	uint64_t get_send_call_count() const{
+		return send_call_count;
+	}
+
+	uint64_t get_request_count() const{
+		return request_count;
+	}
+
+	//Called by the handler when it finishes.
+	void finish_handler(cort_tcp_pipeline_handler* handler);
+
+	cort_proto* run();
+
+	//The connection is closed and this is deleted after it.
+	virtual void on_connection_closed(){}
+
+	void init(int fd, uint32_t ip_arg, uint16_t port_arg){
+		set_cort_fd(fd);
+		ip_v4 = ip_arg;
+		port_v4 = port_arg;
+	}
+
+protected:
+	cort_proto* on_finish();
+
+	//Following functions return 0 or the error code.
+	uint8_t read_requests();
+	uint8_t dispatch_requests();
+	uint8_t flush_send();
+
+	void collect_responses();
+	void drop_handlers(cort_tcp_pipeline_handler* first);
+	bool can_dispatch() const;
+	bool is_read_paused() const;
+	void update_poll_request(bool wake);
+
+	request_check_function_t request_check;
+	handler_creator_t handler_creator;
+	run_type handler_start;
+	uint32_t max_concurrency;
+	uint32_t idle_timeout;
+	uint32_t ip_v4;
+	uint16_t port_v4;
+	uint8_t errnum;
+	uint8_t in_run;
+	uint8_t read_closed;		//The client closed.
+	uint8_t close_pending;		//A handler set close_after_response.
+	uint8_t dispatch_blocked;	//Complete requests are left in read_buffer because can_dispatch is false.
+
+	send_buffer_ctrl send_buffer;
+	char* read_buffer;
+	size_t read_size;
+	size_t read_capacity;
+	size_t needed_size;			//Size of the incomplete request at the front of read_buffer, 0 if unknown.
+
+	cort_tcp_pipeline_handler* handler_head;
+	cort_tcp_pipeline_handler* handler_tail;
+	uint32_t handler_count;
+
+	uint64_t recv_call_count;
+	uint64_t send_call_count;
+	uint64_t request_count;
+};
+
+//Use it as the ctrler creator of cort_tcp_listener, see cort_tcp_pipeline_server::set_handler_type.
+//You can subclass cort_tcp_pipeline_server as server_t to set max_concurrency or idle_timeout in its constructor.
+template<typename handler_t, typename server_t = cort_tcp_pipeline_server>
+struct tcp_pipeline_static_creator{
+	//waiter is always 0 because the pipeline server never uses cort_tcp_server_waiter::keep_alive.
+	static void create(int fd, int dest_ip, int dest_port, cort_tcp_connection_waiter* /* waiter */, uint32_t init_poll_result){
+		server_t* result = new server_t();
+		result->init(fd, (uint32_t)dest_ip, (uint16_t)dest_port);
+		result->template set_handler_type<handler_t>();
+		result->set_poll_result(init_poll_result);
+		result->cort_start();
+	}
+};
+
+#endif
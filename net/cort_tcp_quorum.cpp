@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cort_tcp_quorum.h"
+
+cort_tcp_quorum::cort_tcp_quorum(){
+	request_count = 0;
+	quorum = 0;
+	success_bitmap = 0;
+	finished_bitmap = 0;
+	timer = 0;
+	deadline_ms = 0;
+	cancel_stragglers = false;
+	timed_out = false;
+}
+
+cort_tcp_quorum::~cort_tcp_quorum(){
+	clear_requests();
+}
+
+bool cort_tcp_quorum::add_request(cort_tcp_request_response* request){
+	if(request_count == max_request_count){
+		return false;
+	}
+	requests[request_count] = request;
+	waited[request_count] = 0;
+	++request_count;
+	return true;
+}
+
+void cort_tcp_quorum::clear_requests(){
+	for(size_t i = 0; i < request_count; ++i){
+		delete requests[i];
+	}
+	request_count = 0;
+	success_bitmap = 0;
+	finished_bitmap = 0;
+	timed_out = false;
+}
+
+bool cort_tcp_quorum::is_quorum_reached() const{
+	size_t need = ((quorum == 0 || quorum > request_count) ? request_count : quorum);
+	return get_success_count() >= need;
+}
+
+void cort_tcp_quorum::on_request_finished(size_t index){
+	waited[index] = 0;
+	finished_bitmap |= (1ULL << index);
+	if(requests[index]->get_errno() == 0){
+		success_bitmap |= (1ULL << index);
+	}
+}
+
+bool cort_tcp_quorum::wait_again(){
+	cort_proto* resumer = get_resumer();
+	set_resumer(0);
+	if(resumer != 0){
+		if(resumer == timer){ //It deletes itself.
+			timer = 0;
+			timed_out = true;
+		}
+		else{
+			for(size_t i = 0; i < request_count; ++i){
+				if(waited[i] == resumer){
+					on_request_finished(i);
+					break;
+				}
+			}
+		}
+	}
+	size_t need = ((quorum == 0 || quorum > request_count) ? request_count : quorum);
+	size_t finished_count = (size_t)__builtin_popcountll(finished_bitmap);
+	size_t failed_count = finished_count - get_success_count();
+	if(!timed_out && get_success_count() < need && failed_count <= request_count - need && finished_count < request_count){
+		set_wait_count(1);
+		return true;
+	}
+	if(timer != 0){
+		timer->set_parent(0);
+		timer->resume_on_stop();
+		timer = 0;
+	}
+	for(size_t i = 0; i < request_count; ++i){
+		if(waited[i] != 0){
+			waited[i] = 0;
+			cort_tcp_request_response* straggler = requests[i];
+			requests[i] = 0;
+			straggler->detach(cancel_stragglers);
+		}
+	}
+	return false;
+}
+
+cort_proto* cort_tcp_quorum::start(){
+	CO_BEGIN
+		success_bitmap = 0;
+		finished_bitmap = 0;
+		timed_out = false;
+		set_resumer(0);
+		for(size_t i = 0; i < request_count; ++i){
+			waited[i] = requests[i]->cort_start();
+			if(waited[i] != 0){
+				waited[i]->set_parent(this);
+			}
+			else{
+				on_request_finished(i);
+			}
+		}
+		if(deadline_ms != 0){ //Stopped at once if it is finished already.
+			timer = new cort_timeout(deadline_ms);
+			timer->cort_start();
+			timer->set_parent(this);
+		}
+		CO_YIELD_IF(wait_again());	//Resumed by a request or the timer.
+		CO_YIELD_AGAIN_IF(wait_again());
+	CO_END
+}
@@ -0,0 +1,95 @@
+#ifndef CORT_TCP_QUORUM_H_
+#define CORT_TCP_QUORUM_H_
+
+#include "cort_tcp_ctrler.h"
+
+//Send the requests at the same time, and finish when quorum of them succeeded, when the quorum can not be reached any more,
+//or when the deadline is over. So the time cost is bounded by the deadline even if some servers are slow.
+//Request i succeeded if bit i of get_success_bitmap is set, and it finished(maybe failed) if bit i of get_finished_bitmap is set.
+//The requests still in flight are the stragglers, they are detached(see cort_tcp_request_response::detach) and get_request returns 0 for them.
+//They run on in background and their keep alive connections are reused after they finish, unless set_cancel_stragglers.
+//Example:
+//    quorum.add_request(req); ...		//Allocated by new.
+//    quorum.set_quorum(2);
+//    quorum.set_deadline(50);
+//    CO_AWAIT(&quorum);
+//    for each bit i in quorum.get_success_bitmap(): quorum.get_request(i)->get_recv_buffer() ...
+struct cort_tcp_quorum : public cort_proto{
+	CO_DECL(cort_tcp_quorum)
+
+	const static size_t max_request_count = 64;		//Bits of the bitmap.
+
+	cort_tcp_quorum();
+	~cort_tcp_quorum();
+
+	//The request is allocated by new and deleted by the quorum. Return false if there are max_request_count requests already.
+	bool add_request(cort_tcp_request_response* request);
+
+	//Delete the requests, so the quorum can be used again.
+	void clear_requests();
+
+	//0 or more than the requests means all of them.
+	void set_quorum(size_t count){
+		quorum = count;
+	}
+
+	//0 means no deadline.
+	void set_deadline(uint32_t deadline_ms_arg){
+		deadline_ms = deadline_ms_arg;
+	}
+
+	void set_cancel_stragglers(bool value = true){
+		cancel_stragglers = value;
+	}
+
+	size_t size() const{
+		return request_count;
+	}
+
+	//0 if it is a straggler.
+	cort_tcp_request_response* get_request(size_t index) const{
+		return requests[index];
+	}
+
+	uint64_t get_success_bitmap() const{
+		return success_bitmap;
+	}
+
+	uint64_t get_finished_bitmap() const{
+		return finished_bitmap;
+	}
+
+	size_t get_success_count() const{
+		return (size_t)__builtin_popcountll(success_bitmap);
+	}
+
+	bool is_quorum_reached() const;
+
+	//Finished by the deadline.
+	bool is_timeout() const{
+		return timed_out;
+	}
+
+	cort_proto* start();
+
+private:
+	void on_request_finished(size_t index);
+	//Return true if it has to wait for the requests in flight again.
+	bool wait_again();
+
+	cort_tcp_request_response* requests[max_request_count];
+	cort_proto* waited[max_request_count];		//Not 0 while it is in flight.
+	size_t request_count;
+	size_t quorum;
+	uint64_t success_bitmap;
+	uint64_t finished_bitmap;
+	cort_timeout* timer;
+	uint32_t deadline_ms;
+	bool cancel_stragglers;
+	bool timed_out;
+
+	cort_tcp_quorum(const cort_tcp_quorum&);
+	cort_tcp_quorum& operator=(const cort_tcp_quorum&);
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cort_tcp_retry_request.h"
+#include "cort_tcp_connection_pool.h"
+
+cort_retry_policy::cort_retry_policy(){
+	max_attempts = cort_socket_config::SOCKET_RETRY_MAX_ATTEMPTS;
+	backoff_ms = cort_socket_config::SOCKET_RETRY_BACKOFF_MS;
+	max_backoff_ms = cort_socket_config::SOCKET_RETRY_MAX_BACKOFF_MS;
+	budget_percent = cort_socket_config::SOCKET_RETRY_BUDGET_PERCENT;
+	retry_mask = default_retry_mask();
+	random_state = cort_random_seed(this);
+	memset(&stat, 0, sizeof(stat));
+}
+
+//Nothing is sent when they happen, so the request is never processed twice.
+uint64_t cort_retry_policy::default_retry_mask(){
+	return (1ULL << cort_socket_error_codes::SOCKET_CONNECT_ERROR)
+		| (1ULL << cort_socket_error_codes::SOCKET_CONNECT_REJECTED);
+}
+
+uint32_t cort_retry_policy::get_backoff(uint32_t attempt){
+	uint64_t result = backoff_ms;
+	for(uint32_t i = 1; i < attempt && result < max_backoff_ms; ++i){
+		result <<= 1;
+	}
+	if(result > max_backoff_ms){
+		result = max_backoff_ms;
+	}
+	result = result - (result >> 1) + cort_random_next(random_state) % ((result >> 1) + 1);
+	return result == 0 ? 1 : (uint32_t)result;	//A sleeper of 0ms never wakes up.
+}
+
+//Forget the destinations with full budget when the table is full, the same as new ones.
+static bool is_budget_full(const cort_token_budget& arg){
+	return arg.tokens >= cort_socket_config::SOCKET_RETRY_BUDGET_BURST;
+}
+
+cort_token_budget* cort_retry_policy::find_or_create(uint32_t ip_arg, uint16_t port_arg){
+	uint64_t key = ip_v4_key(ip_arg, port_arg, 0).data.i_data;
+	std::map<uint64_t, cort_token_budget>::iterator it = budgets.find(key);
+	if(it != budgets.end()){
+		return &it->second;
+	}
+	if(!cort_make_room(budgets, cort_socket_config::SOCKET_RETRY_BUDGET_MAX_COUNT, is_budget_full)){
+		return 0;
+	}
+	cort_token_budget& result = budgets[key];
+	result.init(cort_socket_config::SOCKET_RETRY_BUDGET_BURST);
+	return &result;
+}
+
+double cort_retry_policy::get_budget(uint32_t ip_arg, uint16_t port_arg) const{
+	std::map<uint64_t, cort_token_budget>::const_iterator it = budgets.find(ip_v4_key(ip_arg, port_arg, 0).data.i_data);
+	return it == budgets.end() ? cort_socket_config::SOCKET_RETRY_BUDGET_BURST : it->second.tokens;
+}
+
+void cort_retry_policy::on_request(uint32_t ip_arg, uint16_t port_arg){
+	++stat.request_count;
+	cort_token_budget* budget = find_or_create(ip_arg, port_arg);
+	if(budget == 0){
+		return;
+	}
+	budget->earn(budget_percent, cort_socket_config::SOCKET_RETRY_BUDGET_BURST);
+}
+
+bool cort_retry_policy::try_retry(uint32_t ip_arg, uint16_t port_arg){
+	cort_token_budget* budget = find_or_create(ip_arg, port_arg);
+	if(budget == 0 || !budget->try_spend()){ //Too many destinations failing, do not retry any of the new ones.
+		++stat.budget_reject_count;
+		return false;
+	}
+	++stat.retry_count;
+	return true;
+}
+
+cort_tcp_retry_request::cort_tcp_retry_request(){
+	request = 0;
+	sleeper = 0;
+	creator = 0;
+	creator_arg_data = 0;
+	policy = 0;
+	start_time = 0;
+	deadline_ms = 0;
+	attempt_count = 0;
+	sleeping = false;
+}
+
+cort_tcp_retry_request::~cort_tcp_retry_request(){
+	delete request;
+}
+
+bool cort_tcp_retry_request::new_attempt(){
+	cort_tcp_request_response* next = (creator != 0 ? creator(creator_arg_data, attempt_count) : 0);
+	if(next == 0){ //The last attempt is kept as the result.
+		return false;
+	}
+	delete request;
+	request = next;
+	if(deadline_ms != 0){
+		uint32_t elapsed = (uint32_t)(cort_timer_now_ms() - start_time);
+		uint32_t left = (elapsed < deadline_ms ? deadline_ms - elapsed : 1);
+		if(request->timeout == 0 || request->timeout > left){
+			request->set_timeout(left);
+		}
+	}
+	if(attempt_count == 0 && policy != 0){
+		policy->on_request(request->ip_v4, request->port_v4);
+	}
+	++attempt_count;
+	return true;
+}
+
+bool cort_tcp_retry_request::next_step(){
+	if(sleeping){ //The backoff is over.
+		sleeping = false;
+		return new_attempt();
+	}
+	if(policy == 0 || !policy->is_retryable(request->get_errno()) || attempt_count >= policy->max_attempts){
+		return false;
+	}
+	uint32_t backoff = policy->get_backoff(attempt_count);
+	if(deadline_ms != 0 && (uint32_t)(cort_timer_now_ms() - start_time) + backoff >= deadline_ms){
+		policy->on_deadline_reject();
+		return false;
+	}
+	if(!policy->try_retry(request->ip_v4, request->port_v4)){
+		return false;
+	}
+	sleeping = true;
+	sleeper = new cort_sleeper(backoff);	//It deletes itself.
+	return true;
+}
+
+bool cort_tcp_retry_request::wait_again(){
+	bool next = (attempt_count == 0 ? new_attempt() : next_step());
+	while(next){
+		cort_proto* waited = (sleeping ? sleeper->cort_start() : request->cort_start());
+		if(waited != 0){
+			waited->set_parent(this);
+			set_wait_count(1);
+			return true;
+		}
+		next = next_step();	//The attempt finished at once.
+	}
+	return false;
+}
+
+cort_proto* cort_tcp_retry_request::start(){
+	CO_BEGIN
+		attempt_count = 0;
+		sleeping = false;
+		start_time = cort_timer_now_ms();
+		delete request;
+		request = 0;
+		CO_YIELD_IF(wait_again());	//Resumed by the attempts and the backoffs by turns.
+		CO_YIELD_AGAIN_IF(wait_again());
+	CO_END
+}
@@ -0,0 +1,131 @@
+#ifndef CORT_TCP_RETRY_REQUEST_H_
+#define CORT_TCP_RETRY_REQUEST_H_
+
+#include <map>
+#include "cort_tcp_ctrler.h"
+#include "cort_tcp_budget.h"
+
+//Which errors are retried, the backoff between the attempts, and the retry budget of every destination(ip:port),
+//shared by the retry requests to the same service. It is used by the coroutines of one thread.
+//Only the errors in retry_mask are retried. The default mask has the errors that happen before the request is sent:
+//SOCKET_CONNECT_ERROR and SOCKET_CONNECT_REJECTED. Add SOCKET_REMOTE_CANCELED or SOCKET_OPERATION_TIMEOUT only for idempotent requests.
+//The backoff before retry n(from 1) is a random time in [b/2, b], b = min(backoff_ms * 2^(n-1), max_backoff_ms),
+//so the retries of the requests failed at the same time do not arrive at the same time.
+//Every first attempt to a destination earns budget_percent/100 retry, saved up to SOCKET_RETRY_BUDGET_BURST, and every retry spends 1.
+//So the retries add no more than budget_percent of the load to a destination, even when all the requests to it fail.
+struct cort_retry_policy{
+	struct stats{
+		uint64_t request_count;			//First attempts.
+		uint64_t retry_count;
+		uint64_t budget_reject_count;	//Retries not sent for the budget.
+		uint64_t deadline_reject_count;	//Retries not sent because the backoff would pass the deadline.
+	};
+
+	uint32_t max_attempts;			//Including the first one.
+	uint32_t backoff_ms;
+	uint32_t max_backoff_ms;
+	uint32_t budget_percent;
+	uint64_t retry_mask;			//Bit n is set if the error code n(n < 64) is retried.
+
+	cort_retry_policy();
+	static uint64_t default_retry_mask();
+
+	bool is_retryable(uint8_t err) const{
+		return err != 0 && err < 64 && ((retry_mask >> err) & 1) != 0;
+	}
+
+	//Backoff before the retry, attempt is the count of the attempts finished. It is at least 1ms.
+	uint32_t get_backoff(uint32_t attempt);
+
+	//Retries the destination can send now. Both ip and port have to use network byte order!
+	double get_budget(uint32_t ip_arg, uint16_t port_arg) const;
+
+	const stats& get_stats() const{
+		return stat;
+	}
+
+//Following functions are used by cort_tcp_retry_request.
+	void on_request(uint32_t ip_arg, uint16_t port_arg);
+	bool try_retry(uint32_t ip_arg, uint16_t port_arg);
+	void on_deadline_reject(){
+		++stat.deadline_reject_count;
+	}
+
+private:
+	cort_token_budget* find_or_create(uint32_t ip_arg, uint16_t port_arg);
+
+	std::map<uint64_t, cort_token_budget> budgets;
+	uint64_t random_state;
+	stats stat;
+};
+
+//Send a request and send it again after a backoff if it failed with an error retried by the policy, until it succeeds,
+//max_attempts is reached, the budget of the destination is spent, or the next attempt would start after the deadline.
+//Every attempt is a new request made by the creator, because a request can not be sent twice. The creator can also select
+//another endpoint, for example, by cort_tcp_cluster::select. The failed attempt is deleted when the next one is made.
+//The deadline bounds all the attempts and backoffs: the timeout of an attempt is cut to the time left.
+//The backoff is a cort_sleeper on the timer heap, so nothing is blocked.
+//Example:
+//    cort_tcp_request_response* create(void* arg, uint32_t attempt){ ... }	//Allocated by new, or 0 if it failed.
+//    retry.set_request_creator(create, arg);
+//    retry.set_policy(&policy);
+//    retry.set_deadline(500);
+//    CO_AWAIT(&retry);
+//    retry.get_result()->get_errno() ...
+struct cort_tcp_retry_request : public cort_proto{
+	CO_DECL(cort_tcp_retry_request)
+
+	typedef cort_tcp_request_response* (*request_creator_type)(void* arg, uint32_t attempt);	//attempt is 0 for the first one.
+
+	cort_tcp_retry_request();
+	~cort_tcp_retry_request();
+
+	void set_request_creator(request_creator_type creator_arg, void* arg){
+		creator = creator_arg;
+		creator_arg_data = arg;
+	}
+
+	//Without a policy, it never retries.
+	void set_policy(cort_retry_policy* arg){
+		policy = arg;
+	}
+
+	//0 means no deadline.
+	void set_deadline(uint32_t deadline_ms_arg){
+		deadline_ms = deadline_ms_arg;
+	}
+
+	//The last attempt, or 0 if the creator failed at the first one. It is deleted by the retry request,
+	//valid until it is deleted or started again.
+	cort_tcp_request_response* get_result() const{
+		return request;
+	}
+
+	uint32_t get_attempt_count() const{
+		return attempt_count;
+	}
+
+	cort_proto* start();
+
+private:
+	bool new_attempt();
+	//Return true if there is a backoff or a new attempt to wait for.
+	bool next_step();
+	//Return true if it has to wait for the backoff or the attempt in flight.
+	bool wait_again();
+
+	cort_tcp_request_response* request;
+	cort_sleeper* sleeper;
+	request_creator_type creator;
+	void* creator_arg_data;
+	cort_retry_policy* policy;
+	cort_timeout_waiter::time_ms_t start_time;
+	uint32_t deadline_ms;
+	uint32_t attempt_count;
+	bool sleeping;
+
+	cort_tcp_retry_request(const cort_tcp_retry_request&);
+	cort_tcp_retry_request& operator=(const cort_tcp_retry_request&);
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "cort_tcp_shard.h"
+
+namespace{
+	//The finalizer of splitmix64.
+	inline uint64_t mix_hash(uint64_t arg){
+		arg ^= arg >> 30;
+		arg *= 0xBF58476D1CE4E5B9ULL;
+		arg ^= arg >> 27;
+		arg *= 0x94D049BB133111EBULL;
+		arg ^= arg >> 31;
+		return arg;
+	}
+
+	//It only depends on the address of the node, so the points of a node are the same after other nodes are added or removed.
+	inline uint64_t get_point_hash(uint32_t ip_arg, uint16_t port_arg, uint32_t replica){
+		return mix_hash((((uint64_t)ip_arg << 16) | port_arg) * 0x9E3779B97F4A7C15ULL + replica);
+	}
+
+	int compare_point(const void* lhs, const void* rhs){
+		uint64_t lhs_hash = ((const cort_tcp_shard::point*)lhs)->hash;
+		uint64_t rhs_hash = ((const cort_tcp_shard::point*)rhs)->hash;
+		return lhs_hash < rhs_hash ? -1 : (lhs_hash > rhs_hash ? 1 : 0);
+	}
+}
+
+cort_proto* cort_tcp_shard_call::start(){
+	CO_BEGIN
+		node = shard->select(request, key_hash);
+		if(node == size_t(-1)){
+			request->set_errno(cort_socket_error_codes::SOCKET_INVALID_CONNECT_ADDRESS);
+			CO_RETURN;
+		}
+		CO_AWAIT(request);
+	CO_END
+}
+
+cort_tcp_shard::cort_tcp_shard(){
+	nodes = 0;
+	node_count = 0;
+	node_capacity = 0;
+	point_hashes = 0;
+	point_nodes = 0;
+	point_count = 0;
+	point_capacity = 0;
+	virtual_node_count = cort_socket_config::SOCKET_SHARD_VIRTUAL_NODE_COUNT;
+}
+
+cort_tcp_shard::~cort_tcp_shard(){
+	free(nodes);
+	free(point_hashes);
+	free(point_nodes);
+}
+
+uint64_t cort_tcp_shard::hash_key(const void* key, size_t size){
+	const unsigned char* data = (const unsigned char*)key;
+	uint64_t result = 0xCBF29CE484222325ULL;
+	for(size_t i = 0; i < size; ++i){
+		result ^= data[i];
+		result *= 0x100000001B3ULL;
+	}
+	return mix_hash(result);
+}
+
+size_t cort_tcp_shard::find(uint32_t ip_arg, uint16_t port_arg) const{
+	for(size_t i = 0; i < node_count; ++i){
+		if(nodes[i].ip_v4 == ip_arg && nodes[i].port_v4 == port_arg){
+			return i;
+		}
+	}
+	return size_t(-1);
+}
+
+bool cort_tcp_shard::add_node(uint32_t ip_arg, uint16_t port_arg, uint32_t weight, uint16_t type_key_arg){
+	if(weight == 0 || find(ip_arg, port_arg) != size_t(-1)){
+		return false;
+	}
+	if(node_count == node_capacity){
+		size_t new_capacity = (node_capacity == 0 ? 8 : (node_capacity << 1));
+		node* new_nodes = (node*)realloc(nodes, new_capacity * sizeof(node));
+		if(new_nodes == 0){
+			return false;
+		}
+		nodes = new_nodes;
+		node_capacity = new_capacity;
+	}
+	size_t new_point_count = (size_t)weight * virtual_node_count;
+	if(point_count + new_point_count > point_capacity){
+		size_t new_capacity = (point_capacity == 0 ? 64 : point_capacity);
+		while(new_capacity < point_count + new_point_count){
+			new_capacity <<= 1;
+		}
+		uint64_t* new_hashes = (uint64_t*)realloc(point_hashes, new_capacity * sizeof(uint64_t));
+		if(new_hashes == 0){
+			return false;
+		}
+		point_hashes = new_hashes;
+		uint32_t* new_nodes = (uint32_t*)realloc(point_nodes, new_capacity * sizeof(uint32_t));
+		if(new_nodes == 0){
+			return false;
+		}
+		point_nodes = new_nodes;
+		point_capacity = new_capacity;
+	}
+	point* added = (point*)malloc(new_point_count * sizeof(point));
+	if(added == 0){
+		return false;
+	}
+	size_t index = node_count++;
+	node& result = nodes[index];
+	memset(&result, 0, sizeof(node));
+	result.ip_v4 = ip_arg;
+	result.port_v4 = port_arg;
+	result.weight = weight;
+	result.type_key = type_key_arg;
+
+	for(size_t i = 0; i < new_point_count; ++i){
+		added[i].hash = get_point_hash(ip_arg, port_arg, (uint32_t)i);
+		added[i].node_index = (uint32_t)index;
+	}
+	qsort(added, new_point_count, sizeof(point), compare_point);
+
+	//Merge from the tail, so the points of the ring are moved at most once.
+	size_t old_pos = point_count;
+	size_t added_pos = new_point_count;
+	size_t pos = point_count + new_point_count;
+	while(added_pos != 0){
+		--pos;
+		if(old_pos != 0 && point_hashes[old_pos - 1] > added[added_pos - 1].hash){
+			--old_pos;
+			point_hashes[pos] = point_hashes[old_pos];
+			point_nodes[pos] = point_nodes[old_pos];
+		}
+		else{
+			--added_pos;
+			point_hashes[pos] = added[added_pos].hash;
+			point_nodes[pos] = added[added_pos].node_index;
+		}
+	}
+	point_count += new_point_count;
+	free(added);
+	return true;
+}
+
+bool cort_tcp_shard::add_node(const char* ip_arg, uint16_t port_arg, uint32_t weight, uint16_t type_key_arg){
+	return add_node(inet_addr(ip_arg), htons(port_arg), weight, type_key_arg);
+}
+
+bool cort_tcp_shard::remove_node(uint32_t ip_arg, uint16_t port_arg){
+	size_t index = find(ip_arg, port_arg);
+	if(index == size_t(-1)){
+		return false;
+	}
+	size_t last = node_count - 1;
+	//Filter the points in place, the order is kept. The last node is moved to the index.
+	size_t pos = 0;
+	for(size_t i = 0; i < point_count; ++i){
+		uint32_t node_index = point_nodes[i];
+		if(node_index == index){
+			continue;
+		}
+		point_hashes[pos] = point_hashes[i];
+		point_nodes[pos] = (node_index == last ? (uint32_t)index : node_index);
+		++pos;
+	}
+	point_count = pos;
+	nodes[index] = nodes[last];
+	node_count = last;
+	return true;
+}
+
+size_t cort_tcp_shard::lookup(uint64_t key_hash) const{
+	if(point_count == 0){
+		return size_t(-1);
+	}
+	//The first point whose hash is not less than key_hash. The half is chosen without a branch, which is hard to predict for hashes.
+	const uint64_t* base = point_hashes;
+	size_t rest = point_count;
+	while(rest > 1){
+		size_t half = rest >> 1;
+		base = (base[half - 1] < key_hash ? base + half : base);
+		rest -= half;
+	}
+	size_t low = (size_t)(base - point_hashes) + (*base < key_hash ? 1 : 0);
+	if(low == point_count){ //Wrap around the ring.
+		low = 0;
+	}
+	return point_nodes[low];
+}
+
+size_t cort_tcp_shard::select(cort_tcp_ctrler* ctrler, uint64_t key_hash){
+	size_t result = lookup(key_hash);
+	if(result == size_t(-1)){
+		return result;
+	}
+	node& selected = nodes[result];
+	++selected.request_count;
+	ctrler->set_dest_addr(selected.ip_v4, selected.port_v4);
+	if(selected.type_key != 0){
+		ctrler->set_type_key(selected.type_key);
+	}
+	return result;
+}
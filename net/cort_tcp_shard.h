@@ -0,0 +1,119 @@
+#ifndef CORT_TCP_SHARD_H_
+#define CORT_TCP_SHARD_H_
+
+#include "cort_tcp_ctrler.h"
+
+struct cort_tcp_shard;
+
+//Await it to send a request to the node owning the key, see cort_tcp_shard::call.
+struct cort_tcp_shard_call : public cort_proto{
+	CO_DECL(cort_tcp_shard_call)
+
+	cort_tcp_shard* shard;
+	cort_tcp_request_response* request;
+	uint64_t key_hash;
+	size_t node;		//Index of the node selected, or size_t(-1) if the shard is empty.
+
+	cort_tcp_shard_call(){
+		shard = 0;
+		request = 0;
+		key_hash = 0;
+		node = size_t(-1);
+	}
+
+	cort_proto* start();
+};
+
+//A set of nodes(ip:port) routed by key with a consistent hash ring. Every node owns weight * virtual_node_count points on the ring,
+//and a key belongs to the node of the first point not less than the hash of the key.
+//Removing a node only moves the keys of it to the other nodes, adding a node only takes keys from the others.
+//Both of them update the sorted points in one pass, without sorting the whole ring again.
+//Lookup is a binary search on the points, O(log(points)) and without allocation.
+//Every node is a destination of the keep alive pool with its own type_key, so a shard ctrler with keep alive reuses the connections of the node.
+//A node added with type_key 0 keeps the type_key of the ctrler.
+//A shard is used by the coroutines of one thread.
+//Example:
+//    req.set_keep_alive(1000); ... 	//Set the request without the destination.
+//    CO_AWAIT(shard.call(&call, &req, cort_tcp_shard::hash_key(key, key_size)));
+//Or select the node for your own ctrler:
+//    size_t node = shard.select(&ctrler, cort_tcp_shard::hash_key(key, key_size));
+struct cort_tcp_shard{
+	struct node{
+		uint32_t ip_v4;
+		uint16_t port_v4;
+		uint16_t type_key;
+		uint32_t weight;
+		uint64_t request_count;
+	};
+
+	struct point{
+		uint64_t hash;
+		uint32_t node_index;
+	};
+
+	cort_tcp_shard();
+	~cort_tcp_shard();
+
+	//Points of a node per weight, it only works before the first add_node. Default is SOCKET_SHARD_VIRTUAL_NODE_COUNT.
+	void set_virtual_node_count(uint32_t count){
+		if(node_count == 0 && count != 0){
+			virtual_node_count = count;
+		}
+	}
+
+	//Both ip and port have to use network byte order! Return false if memory allocation failed, weight is 0 or it exists.
+	bool add_node(uint32_t ip_arg, uint16_t port_arg, uint32_t weight = 1, uint16_t type_key_arg = 0);
+
+	//Port should use local order!
+	bool add_node(const char* ip_arg, uint16_t port_arg, uint32_t weight = 1, uint16_t type_key_arg = 0);
+
+	//The requests in flight to the node are not affected. Return false if it does not exist.
+	bool remove_node(uint32_t ip_arg, uint16_t port_arg);
+
+	size_t size() const{
+		return node_count;
+	}
+
+	size_t point_size() const{
+		return point_count;
+	}
+
+	const node& get_node(size_t index) const{
+		return nodes[index];
+	}
+
+	//Index of the node owning the key hash, or size_t(-1) if the shard is empty.
+	size_t lookup(uint64_t key_hash) const;
+
+	//Set the destination of the ctrler to the node owning the key hash, and the type_key too unless the type_key of the node is 0.
+	//Return the index of the node, or size_t(-1) if the shard is empty.
+	size_t select(cort_tcp_ctrler* ctrler, uint64_t key_hash);
+
+	cort_tcp_shard_call* call(cort_tcp_shard_call* arg, cort_tcp_request_response* request, uint64_t key_hash){
+		arg->shard = this;
+		arg->request = request;
+		arg->key_hash = key_hash;
+		return arg;
+	}
+
+	//FNV-1a with a final mix, so that similar keys spread on the ring.
+	static uint64_t hash_key(const void* key, size_t size);
+
+private:
+	size_t find(uint32_t ip_arg, uint16_t port_arg) const;
+
+	node* nodes;
+	size_t node_count;
+	size_t node_capacity;
+	//The points sorted by hash. The hashes are apart from the node indexes, so a lookup only touches half of the memory.
+	uint64_t* point_hashes;
+	uint32_t* point_nodes;
+	size_t point_count;
+	size_t point_capacity;
+	uint32_t virtual_node_count;
+
+	cort_tcp_shard(const cort_tcp_shard&);
+	cort_tcp_shard& operator=(const cort_tcp_shard&);
+};
+
+#endif
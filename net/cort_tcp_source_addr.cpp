@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "cort_tcp_ctrler.h"
+#include "cort_tcp_source_addr.h"
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+namespace{
+	struct thread_source{
+		uint32_t* ips;
+		size_t count;
+		size_t next;
+		uint8_t policy;
+		cort_tcp_source_addr::stats stat;
+	};
+
+	inline thread_source& get_thread_source(){
+		static __thread thread_source source;
+		return source;
+	}
+
+	//Size of ip_local_port_range, read once for the process.
+	size_t get_ephemeral_port_count(){
+		static size_t result = 0;
+		if(result != 0){
+			return result;
+		}
+		size_t port_count = cort_socket_config::SOCKET_EPHEMERAL_PORT_DEFAULT_COUNT;
+		FILE* file = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r");
+		if(file != 0){
+			unsigned int low, high;
+			if(fscanf(file, "%u %u", &low, &high) == 2 && high >= low){
+				port_count = high - low + 1;
+			}
+			fclose(file);
+		}
+		result = port_count;
+		return result;
+	}
+}
+
+void cort_tcp_source_addr::set_source_ips(const uint32_t* ips, size_t count, uint8_t policy){
+	thread_source& source = get_thread_source();
+	free(source.ips);
+	source.ips = 0;
+	source.count = 0;
+	source.next = 0;
+	source.policy = policy;
+	if(count == 0){
+		return;
+	}
+	source.ips = (uint32_t*)malloc(count * sizeof(uint32_t));
+	if(source.ips == 0){
+		return;
+	}
+	memcpy(source.ips, ips, count * sizeof(uint32_t));
+	source.count = count;
+}
+
+size_t cort_tcp_source_addr::get_source_count(){
+	return get_thread_source().count;
+}
+
+const cort_tcp_source_addr::stats& cort_tcp_source_addr::get_stats(){
+	return get_thread_source().stat;
+}
+
+int cort_tcp_source_addr::bind_source(int fd, uint32_t dest_ip, uint16_t dest_port, size_t attempt){
+	thread_source& source = get_thread_source();
+	if(source.count == 0){
+		return 0;
+	}
+	size_t index;
+	if(source.policy == source_by_destination){
+		uint64_t key = ((uint64_t)dest_ip << 16) | dest_port;
+		index = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) + attempt;
+	}
+	else if(attempt == 0){
+		index = source.next++;
+	}
+	else{ //Next to the source ip of the last attempt.
+		index = source.next - 1 + attempt;
+	}
+	index %= source.count;
+
+	int flag = 1;
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &flag, sizeof(flag));	//Old kernels pick the port at bind, it still works.
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = source.ips[index];
+	addr.sin_port = 0;
+	++source.stat.bind_count;
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		int thread_errno = errno;
+		++source.stat.bind_error_count;
+		return thread_errno == EADDRINUSE ? EADDRNOTAVAIL : thread_errno;	//EADDRINUSE means no port left before IP_BIND_ADDRESS_NO_PORT.
+	}
+	return 0;
+}
+
+bool cort_tcp_source_addr::need_trim(size_t destination_connection_count){
+	thread_source& source = get_thread_source();
+	size_t source_count = (source.count == 0 || source.policy == source_by_destination) ? 1 : source.count;	//A destination always uses one source ip.
+	size_t port_count = get_ephemeral_port_count() * source_count;
+	return destination_connection_count * 100 >= port_count * cort_socket_config::SOCKET_EPHEMERAL_PORT_TRIM_PERCENT;
+}
+
+void cort_tcp_source_addr::on_port_exhaustion(bool retry){
+	thread_source& source = get_thread_source();
+	++source.stat.port_exhaustion_count;
+	if(retry){
+		++source.stat.retry_count;
+	}
+}
+
+void cort_tcp_source_addr::on_trim(size_t trimmed_count){
+	get_thread_source().stat.trim_count += trimmed_count;
+}
@@ -0,0 +1,48 @@
+#ifndef CORT_TCP_SOURCE_ADDR_H_
+#define CORT_TCP_SOURCE_ADDR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Thread local source addresses of the client connections, used by cort_tcp_ctrler.
+//Every source ip has its own ephemeral ports toward a destination, so more source ips mean more connections to a single server.
+//The socket is bound with IP_BIND_ADDRESS_NO_PORT, so the kernel still picks the port at connect, by the whole 4-tuple.
+//When connect fails with EADDRNOTAVAIL, the least recently used idle keep alive connections are closed and the next source ip is tried.
+//Before the keep alive connections of a destination use up its ephemeral ports, some of its idle ones are closed, see need_trim.
+struct cort_tcp_source_addr{
+	enum{
+		source_round_robin = 0,		//Every connection uses the next source ip.
+		source_by_destination = 1	//A destination(ip:port) always uses the same source ip, unless it fails.
+	};
+
+	struct stats{
+		uint64_t bind_count;
+		uint64_t bind_error_count;
+		uint64_t port_exhaustion_count;	//EADDRNOTAVAIL from bind or connect.
+		uint64_t retry_count;			//Connects tried again with another source ip after the port exhaustion.
+		uint64_t trim_count;			//Idle connections closed by need_trim before the ports are exhausted.
+	};
+
+	//Both ips have to use network byte order! count == 0 means no binding, the kernel picks the source ip as before.
+	static void set_source_ips(const uint32_t* ips, size_t count, uint8_t policy = source_round_robin);
+
+	static size_t get_source_count();
+
+	//Statistics of current thread.
+	static const stats& get_stats();
+
+//Following functions are used by cort_tcp_ctrler.
+	//Bind the socket to the source ip for the attempt-th connect to the destination.
+	//Return 0 if bound or no source ip is set, EADDRNOTAVAIL if the ports are exhausted, or other errno.
+	static int bind_source(int fd, uint32_t dest_ip, uint16_t dest_port, size_t attempt);
+
+	//Whether the keep alive connections of current thread to a destination are close to the ephemeral ports it can use,
+	//that is SOCKET_EPHEMERAL_PORT_TRIM_PERCENT of ip_local_port_range for every source ip it may connect from.
+	//The ports of a 4-tuple are not shared among the destinations, so the connections to other destinations are not counted.
+	static bool need_trim(size_t destination_connection_count);
+
+	static void on_port_exhaustion(bool retry);
+	static void on_trim(size_t trimmed_count);
+};
+
+#endif
@@ -58,6 +58,11 @@ struct print_result_cort: public cort_auto{
             printf("succeed: %u, error: %u, averaget_time_cost: %fms \n", success_count_total, error_count_total, ((double)(total_time_cost))/total);
             success_count_total = 0, error_count_total = 0, total_time_cost = 0;
             error_counter.output();
+            {
+                const cort_buffer_pool::stats& pool_stats = cort_buffer_pool::get_stats();
+                printf("buffer pool: %llu hits, %llu misses, %zu bytes cached\n", 
+                    (unsigned long long)pool_stats.hit_count, (unsigned long long)pool_stats.miss_count, pool_stats.cached_bytes);
+            }
         CO_END
     }
 };
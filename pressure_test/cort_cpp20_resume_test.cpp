@@ -0,0 +1,110 @@
+#ifdef CORT_CPP20_RESUME_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../cort_cpp20.h"
+
+//Compare the cost of "await a leaf coroutine, then be resumed by it" between the CO_AWAIT state machine and cort_task.
+//The leaf yields and the driver resumes it, so every round is one await and one resume of the awaiting coroutine.
+struct leaf_cort : public cort_proto{
+    CO_DECL(leaf_cort)
+    cort_proto* start(){
+        CO_BEGIN
+            CO_YIELD();
+        CO_END
+    }
+};
+
+leaf_cort leaf;
+size_t finished_rounds = 0;
+
+struct macro_loop_cort : public cort_proto{
+    CO_DECL(macro_loop_cort)
+    size_t round_count;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_AGAIN_IF(finished_rounds++ < round_count, &leaf);
+        CO_END
+    }
+};
+
+cort_task<size_t> cpp20_loop(size_t round_count){
+    size_t i = 0;
+    for(; i < round_count; ++i){
+        co_await &leaf;
+    }
+    co_return i;
+}
+
+//Await the cort_task by CO_AWAIT, so the cost of the bridge to the outer macro coroutine is also measured.
+struct cpp20_wrapper_cort : public cort_proto{
+    CO_DECL(cpp20_wrapper_cort)
+    cort_task<size_t> task;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(&task);
+            finished_rounds = task.get_result();
+        CO_END
+    }
+};
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double run_macro(size_t round_count){
+    finished_rounds = 0;
+    macro_loop_cort loop;
+    loop.round_count = round_count;
+    double begin = now_ns();
+    loop.start();
+    while(!loop.is_finished()){
+        leaf.resume();
+    }
+    return (now_ns() - begin) / round_count;
+}
+
+double run_cpp20(size_t round_count){
+    finished_rounds = 0;
+    cpp20_wrapper_cort wrapper;
+    wrapper.task = cpp20_loop(round_count);
+    double begin = now_ns();
+    wrapper.start();
+    while(!wrapper.is_finished()){
+        leaf.resume();
+    }
+    double result = (now_ns() - begin) / round_count;
+    if(finished_rounds != round_count){
+        printf("cpp20 rounds mismatch: %zu\n", finished_rounds);
+    }
+    return result;
+}
+
+//Create and finish many short cort_task to check the frame pool.
+double run_cpp20_create(size_t round_count){
+    double begin = now_ns();
+    for(size_t i = 0; i < round_count; ++i){
+        cort_task<size_t> task = cpp20_loop(0);
+        task.cort_start();
+    }
+    return (now_ns() - begin) / round_count;
+}
+
+int main(int argc, char* argv[]){
+    size_t round_count = 10000000;
+    if(argc > 1){
+        round_count = (size_t)atol(argv[1]);
+    }
+    for(int i = 0; i < 3; ++i){
+        double macro_ns = run_macro(round_count);
+        double cpp20_ns = run_cpp20(round_count);
+        double create_ns = run_cpp20_create(round_count);
+        printf("await+resume: macro %.2fns, cpp20 %.2fns; cpp20 task create+finish: %.2fns\n", macro_ns, cpp20_ns, create_ns);
+    }
+    cort_frame_pool::trim();
+    return 0;
+}
+
+#endif
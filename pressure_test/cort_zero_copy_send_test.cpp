@@ -0,0 +1,143 @@
+#ifdef CORT_ZERO_COPY_SEND_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "../net/cort_tcp_ctrler.h"
+
+//Send payloads by the copy path and by MSG_ZEROCOPY, output the CPU time per GB of each.
+//arg1: MB to send in each mode, default: 2048
+//arg2: payload KB of each send, default: 512
+//arg3 arg4: ip and port of a discard server. Default: fork a local one. Notice the loopback device always copies,
+//so zero copy is disabled after the first notification and only a remote server shows the real difference.
+
+size_t total_mb = 2048;
+size_t payload_kb = 512;
+const char* ip = "127.0.0.1";
+unsigned short port = 0;
+
+int start_discard_server(){
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0 
+        || getsockname(listen_fd, (struct sockaddr*)&addr, &len) != 0){
+        printf("discard server error\n");
+        exit(1);
+    }
+    port = ntohs(addr.sin_port);
+    int pid = fork();
+    if(pid == 0){
+        static char buffer[1<<20];
+        while(true){
+            int fd = accept(listen_fd, 0, 0);
+            if(fd < 0){
+                continue;
+            }
+            while(recv(fd, buffer, sizeof(buffer), 0) > 0){
+            }
+            close(fd);
+        }
+    }
+    close(listen_fd);
+    return pid;
+}
+
+double cpu_ms(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0
+        + usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+}
+
+struct send_cort : public cort_tcp_ctrler{
+    CO_DECL(send_cort)
+    size_t rest_count;
+    double begin_cpu_ms;
+    cort_timeout_waiter::time_ms_t begin_ms;
+    send_cort(uint32_t zero_copy_threshold){
+        set_dest_addr(ip, port);
+        set_zero_copy_threshold(zero_copy_threshold);
+        setsockopt_arg.data = 0;
+        rest_count = total_mb * 1024 / payload_kb;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            begin_cpu_ms = cpu_ms();
+            begin_ms = cort_timer_refresh_clock();
+            CO_AWAIT(lock_connect());
+            co_unlikely_if(get_errno() != 0){
+                printf("error: %s\n", cort_socket_error_codes::error_info(get_errno()));
+                CO_RETURN;
+            }
+            if(rest_count != 0){
+                char* payload = alloc_send_buffer(payload_kb * 1024);
+                memset(payload, 'a', payload_kb * 1024);
+            }
+            CO_AWAIT_AGAIN_IF(rest_count-- != 0, lock_send());
+            double cost_ms = cpu_ms() - begin_cpu_ms;
+            double gb = total_mb / 1024.0;
+            cort_tcp_zero_copy_ctrl* zero_copy = connection_waiter->zero_copy;
+            printf("%s: %.1f cpu ms/GB, %.1f wall ms/GB, %u zero copy calls(%s), %zu buffers waiting for notifications\n", 
+                zero_copy_threshold == 0 ? "copy     " : "zero copy", cost_ms / gb, (cort_timer_refresh_clock() - begin_ms) / gb,
+                zero_copy == 0 ? 0 : zero_copy->next_seq, 
+                zero_copy == 0 ? "off" : (zero_copy->state == cort_tcp_zero_copy_ctrl::zero_copy_disabled ? "disabled" : "enabled"),
+                connection_waiter->get_zero_copy_deferred_count());
+            close_connection();
+        CO_END
+    }
+};
+
+struct main_cort : public cort_proto{
+    CO_DECL(main_cort)
+    send_cort* copy_sender;
+    send_cort* zero_copy_sender;
+    cort_proto* start(){
+        CO_BEGIN
+            copy_sender = new send_cort(0);
+            CO_AWAIT(copy_sender);
+            delete copy_sender;
+            zero_copy_sender = new send_cort(64 * 1024);
+            CO_AWAIT(zero_copy_sender);
+            delete zero_copy_sender;
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    if(argc > 1){
+        total_mb = atoi(argv[1]);
+    }
+    if(argc > 2){
+        payload_kb = atoi(argv[2]);
+    }
+    int pid = 0;
+    if(argc > 4){
+        ip = argv[3];
+        port = (unsigned short)atoi(argv[4]);
+    }
+    else{
+        pid = start_discard_server();
+    }
+    cort_timer_init();
+    main_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    if(pid != 0){
+        kill(pid, SIGKILL);
+        waitpid(pid, 0, 0);
+    }
+    return 0;
+}
+
+#endif
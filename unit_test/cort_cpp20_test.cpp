@@ -0,0 +1,180 @@
+#ifdef CORT_CPP20_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../cort_cpp20.h"
+
+//The cort_task coroutines await the timers and the tcp ctrlers, and they are awaited by CO_AWAIT.
+//Every step logs where it is resumed, then the log is compared with the expected resume order.
+int failed_count = 0;
+char resume_log[256];
+
+void log_step(const char* step){
+    if(resume_log[0] != 0){
+        strcat(resume_log, " ");
+    }
+    strcat(resume_log, step);
+}
+
+void check_log(const char* name, const char* expected){
+    if(strcmp(resume_log, expected) != 0){
+        printf("%s order error: \"%s\", expected \"%s\"\n", name, resume_log, expected);
+        ++failed_count;
+    }
+    resume_log[0] = 0;
+}
+
+struct sleep_cort : public cort_timeout_waiter{
+    CO_DECL(sleep_cort)
+    cort_proto* start(){
+        CO_BEGIN
+            CO_YIELD();
+        CO_END
+    }
+};
+
+//Return the milliseconds it slept.
+cort_task<uint32_t> sleep_task(const char* name, uint32_t sleep_ms){
+    char step[32];
+    snprintf(step, sizeof(step), "%s+", name);
+    log_step(step);
+    cort_timeout_waiter::time_ms_t begin_ms = cort_timer_refresh_clock();
+    sleep_cort sleeper;
+    sleeper.set_timeout(sleep_ms);
+    co_await &sleeper;
+    snprintf(step, sizeof(step), "%s-", name);
+    log_step(step);
+    co_return (uint32_t)(cort_timer_refresh_clock() - begin_ms);
+}
+
+cort_tcp_listener listener;
+unsigned short port;
+char frame[] = "\0\0\0\5hello";
+
+bool is_echoed(cort_tcp_ctrler* ctrler){
+    return ctrler->get_errno() == 0 && ctrler->get_recv_buffer_size() == (int32_t)sizeof(frame) - 1
+        && memcmp(ctrler->get_recv_buffer(), frame, sizeof(frame) - 1) == 0;
+}
+
+void init_ctrler(cort_tcp_ctrler* ctrler){
+    ctrler->set_dest_addr("127.0.0.1", port);
+    ctrler->set_timeout(1000);
+    ctrler->set_send_buffer(frame, sizeof(frame) - 1);
+    ctrler->alloc_recv_buffer();
+    ctrler->set_recv_check_function(recv_check_frame);
+}
+
+//co_await the pointer of a ctrler, by its default entrance function.
+cort_task<bool> request_task(){
+    cort_tcp_request_response request;
+    init_ctrler(&request);
+    log_step("request+");
+    co_await &request;
+    log_step("request-");
+    co_return is_echoed(&request);
+}
+
+//co_await the entrance functions of a ctrler one by one.
+cort_task<bool> member_task(){
+    cort_tcp_ctrler ctrler;
+    init_ctrler(&ctrler);
+    co_await cort_await(&ctrler, &cort_tcp_ctrler::try_connect);
+    log_step("connected");
+    co_await cort_await(&ctrler, &cort_tcp_ctrler::try_send);
+    log_step("sent");
+    co_await cort_await(&ctrler, &cort_tcp_ctrler::try_recv);
+    log_step("received");
+    co_return is_echoed(&ctrler);
+}
+
+cort_task<int> add_task(int a, int b){
+    co_return a + b;
+}
+
+//A finished frame is cached by cort_frame_pool, and the next task of the same size class gets it.
+void test_frame_reuse(){
+    cort_task<int> first = add_task(1, 2);
+    void* first_frame = first.handle.address();
+    bool first_finished = (first.cort_start() == 0);
+    int first_result = first.get_result();
+    first.destroy();
+    cort_task<int> second = add_task(3, 4);
+    bool reused = (second.handle.address() == first_frame);
+    bool second_finished = (second.cort_start() == 0);
+    if(!first_finished || first_result != 3 || !reused || !second_finished || second.get_result() != 7){
+        printf("frame reuse error: %d, %d, reused: %d\n", first_result, second.get_result(), (int)reused);
+        ++failed_count;
+    }
+}
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_task<uint32_t> slow_task;
+    cort_task<uint32_t> fast_task;
+    cort_task<bool> ctrler_task;
+
+    cort_proto* start(){
+        CO_BEGIN
+            //The faster timer resumes its task first, and the parent is resumed after both.
+            slow_task = sleep_task("slow", 30);
+            fast_task = sleep_task("fast", 10);
+            CO_AWAIT_ALL(&slow_task, &fast_task);
+            log_step("all");
+            check_log("timer", "slow+ fast+ fast- slow- all");
+            if(!slow_task.is_finished() || !fast_task.is_finished() || slow_task.get_result() < 30 || fast_task.get_result() < 10
+                || fast_task.get_result() >= slow_task.get_result()){
+                printf("timer error: slow %d ms, fast %d ms\n", (int)slow_task.get_result(), (int)fast_task.get_result());
+                ++failed_count;
+            }
+
+            ctrler_task = request_task();
+            CO_AWAIT(&ctrler_task);
+            log_step("parent");
+            check_log("request", "request+ request- parent");
+            if(!ctrler_task.get_result()){
+                puts("request error");
+                ++failed_count;
+            }
+
+            ctrler_task = member_task();
+            CO_AWAIT(&ctrler_task);
+            log_step("parent");
+            check_log("member", "connected sent received parent");
+            if(!ctrler_task.get_result()){
+                puts("member error");
+                ++failed_count;
+            }
+
+            test_frame_reuse();
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<> >::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts(cort_socket_error_codes::error_info(listener.get_errno()));
+        return 1;
+    }
+    {
+        test_cort test;
+        test.start();
+        cort_timer_loop();
+        if(!test.is_finished()){
+            puts("test not finished");
+            ++failed_count;
+        }
+    }
+    cort_timer_destroy();
+    cort_frame_pool::trim();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -74,6 +74,7 @@ cort_proto* fibonacci_cort::start(){
         }
         //CO_AWAIT_ALL(corts[0], corts[1]); //You can place no more than ten corts for CO_AWAIT_ALL.
         //CO_AWAIT_RANGE(corts, corts+2);   //Or using forward iterator of coroutine pointer for variate count.
+        //CO_AWAIT_RANGE_LIMITED(corts, corts+2, 1);   //Or no more than 1 of them running at the same time.
         //CO_AWAIT(corts[0]); 
         //CO_AWAIT(corts[1]);     //Or await one bye one. They must be put in different lines!
         
@@ -111,6 +112,107 @@ cort_proto* fibonacci_cort::start(){
     CO_END
 }
 
+//Every leaf is paused once by the scheduler, so we can count how many leaves are running at the same time.
+const static int leaf_count = 8;
+const static int window_size = 3;
+int running_count = 0;
+int max_running_count = 0;
+
+struct leaf_cort : public cort_proto{
+    CO_DECL(leaf_cort)
+    int state; //0: not started, 1: running, 2: finished.
+    leaf_cort(){
+        state = 0;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            state = 1;
+            if(++running_count > max_running_count){
+                max_running_count = running_count;
+            }
+            push_work(this);
+            CO_YIELD();
+            --running_count;
+            state = 2;
+        CO_END
+    }
+};
+
+int count_leaves(const leaf_cort* leaves, int state, int count = leaf_count){
+    int result = 0;
+    for(int i = 0; i < count; ++i){
+        result += (leaves[i].state == state ? 1 : 0);
+    }
+    return result;
+}
+
+struct window_test_cort : public cort_proto{
+    CO_DECL(window_test_cort)
+    leaf_cort all_leaves[leaf_count];
+    leaf_cort any_leaves[leaf_count];
+    leaf_cort* all_ptrs[leaf_count];
+    leaf_cort* any_ptrs[leaf_count];
+    int failed_count;
+    window_test_cort(){
+        for(int i = 0; i < leaf_count; ++i){
+            all_ptrs[i] = &all_leaves[i];
+            any_ptrs[i] = &any_leaves[i];
+        }
+        failed_count = 0;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_RANGE_LIMITED(all_ptrs, all_ptrs + leaf_count, window_size);
+            printf("limited: %d finished, no more than %d running\n", count_leaves(all_leaves, 2), max_running_count);
+            if(count_leaves(all_leaves, 2) != leaf_count || max_running_count != window_size || running_count != 0){
+                ++failed_count;
+            }
+            max_running_count = 0;
+            //Resumed after 2 finished, the running ones are still waited by the window and no more leaf is started.
+            CO_AWAIT_RANGE_ANY_N_LIMITED(2, any_ptrs, any_ptrs + leaf_count, window_size);
+            printf("any 2 limited: %d finished, %d running, %d not started\n", count_leaves(any_leaves, 2),
+                count_leaves(any_leaves, 1), count_leaves(any_leaves, 0));
+            if(count_leaves(any_leaves, 2) != 2 || count_leaves(any_leaves, 1) != window_size - 1 || max_running_count != window_size){
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
+//The loop awaits a paused leaf again and again by CO_AWAIT_AGAIN. Its parent must be resumed only after the loop finished,
+//not after the first leaf finished.
+struct loop_cort : public cort_proto{
+    CO_DECL(loop_cort)
+    leaf_cort leaves[3];
+    int loop_count;
+    loop_cort(){
+        loop_count = 0;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT_AGAIN_IF(loop_count < 3, &leaves[loop_count++]);
+        CO_END
+    }
+};
+
+struct loop_parent_cort : public cort_proto{
+    CO_DECL(loop_parent_cort)
+    loop_cort loop;
+    int failed_count;
+    loop_parent_cort(){
+        failed_count = 0;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(&loop);
+            printf("await again: %d loops, %d leaves finished\n", loop.loop_count, count_leaves(loop.leaves, 2, 3));
+            if(!loop.is_finished() || count_leaves(loop.leaves, 2, 3) != 3){
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
 int main(int argc, char* argv[]){ 
     if(argc <= 1){
         argc = 18;
@@ -124,6 +226,25 @@ int main(int argc, char* argv[]){
         //sleep(1);
     }
     printf("%d\n", main_task.result);
-    return 0;
+
+    window_test_cort window_test;
+    window_test.start();
+    while(pop_execute_work()){
+    }
+    //The rest running leaves finished after the window test.
+    if(!window_test.is_finished() || count_leaves(window_test.any_leaves, 1) != 0 || running_count != 0){
+        ++window_test.failed_count;
+    }
+
+    loop_parent_cort loop_test;
+    loop_test.start();
+    while(pop_execute_work()){
+    }
+    if(!loop_test.is_finished()){
+        ++loop_test.failed_count;
+    }
+    int failed_count = window_test.failed_count + loop_test.failed_count;
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
 }
 #endif
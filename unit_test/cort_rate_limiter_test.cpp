@@ -0,0 +1,151 @@
+#ifdef CORT_RATE_LIMITER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../cort_rate_limiter.h"
+
+//The limiter has 100 tokens per second and a burst of 5, so a token is refilled every 10ms.
+//Every step starts with an empty bucket, then some waiters wait at the same time.
+int failed_count = 0;
+int finish_order = 0;
+cort_rate_limiter limiter(100, 5);
+
+struct waiter_cort : public cort_proto{
+    CO_DECL(waiter_cort)
+    cort_sync_waiter waiter;
+    size_t count;
+    uint32_t timeout_ms;
+    uint32_t delay_ms;
+    int order;
+    cort_timeout_waiter::time_ms_t finish_time;
+
+    void init(size_t count_arg, uint32_t timeout_arg = 0, uint32_t delay_arg = 0){
+        count = count_arg;
+        timeout_ms = timeout_arg;
+        delay_ms = delay_arg;
+        order = -1;
+        finish_time = 0;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_SLEEP_IF(delay_ms != 0, delay_ms);
+            CO_AWAIT(limiter.wait_acquire(&waiter, count, timeout_ms));
+            order = finish_order++;
+            finish_time = cort_timer_now_ms();
+        CO_END
+    }
+};
+
+//It blocks the thread, so the refill timer is resumed late and the tokens are more than the first waiter needs.
+struct blocker_cort : public cort_proto{
+    CO_DECL(blocker_cort)
+    cort_proto* start(){
+        usleep(50 * 1000);
+        return 0;
+    }
+};
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    waiter_cort waiters[3];
+    blocker_cort blocker;
+    cort_timeout_waiter::time_ms_t start_time;
+    const char* step;
+
+    void next(const char* step_arg){
+        step = step_arg;
+        limiter.try_acquire((size_t)limiter.get_tokens());
+        finish_order = 0;
+        start_time = cort_timer_now_ms();
+    }
+
+    //Waiter i finished in the order with the result between min_time_ms and max_time_ms.
+    void check(size_t i, int order, uint8_t result, uint32_t min_time_ms, uint32_t max_time_ms){
+        const waiter_cort& current = waiters[i];
+        uint32_t time_cost = (uint32_t)(current.finish_time - start_time);
+        const char* result_info = current.waiter.is_acquired() ? "acquired" : (current.waiter.is_rejected() ? "rejected" : "timeout");
+        printf("%s: waiter %d %s after %dms\n", step, (int)i, result_info, (int)time_cost);
+        if(current.order != order || current.waiter.acquired != result || time_cost < min_time_ms || time_cost > max_time_ms){
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            if(!limiter.try_acquire(5) || limiter.try_acquire(1)){
+                puts("burst error");
+                ++failed_count;
+            }
+
+            //The waiters are resumed by one refill in FIFO order.
+            next("batch");
+            for(size_t i = 0; i < 3; ++i){
+                waiters[i].init(1);
+            }
+            CO_AWAIT_ALL(&waiters[0], &waiters[1], &waiters[2], &blocker);
+            check(0, 0, cort_sync_proto::sync_granted, 50, 80);
+            check(1, 1, cort_sync_proto::sync_granted, 50, 80);
+            check(2, 2, cort_sync_proto::sync_granted, 50, 80);
+            if(waiters[0].finish_time != waiters[2].finish_time || limiter.get_tokens() < 1.9 || limiter.get_tokens() > 3){
+                puts("batch error");
+                ++failed_count;
+            }
+
+            //The second waiter can not go before the first one, though its token is refilled earlier.
+            next("fifo");
+            waiters[0].init(3);
+            waiters[1].init(1);
+            CO_AWAIT_ALL(&waiters[0], &waiters[1]);
+            check(0, 0, cort_sync_proto::sync_granted, 25, 50);
+            check(1, 1, cort_sync_proto::sync_granted, 35, 60);
+
+            //The second waiter would wait 40ms and the third one asks for more than the burst, both are rejected at once.
+            next("max wait");
+            limiter.set_max_wait(30);
+            waiters[0].init(2);
+            waiters[1].init(2);
+            waiters[2].init(6);
+            CO_AWAIT_ALL(&waiters[0], &waiters[1], &waiters[2]);
+            check(0, 2, cort_sync_proto::sync_granted, 15, 40);
+            check(1, 0, cort_sync_proto::sync_rejected, 0, 5);
+            check(2, 1, cort_sync_proto::sync_rejected, 0, 5);
+            limiter.set_max_wait(0);
+
+            //The first waiter times out, then the second one is granted as it leaves, rather than by the refill of the first one.
+            next("timeout");
+            waiters[0].init(5, 20);
+            waiters[1].init(1);
+            CO_AWAIT_ALL(&waiters[0], &waiters[1]);
+            check(0, 1, cort_sync_proto::sync_wait, 15, 35);
+            check(1, 0, cort_sync_proto::sync_granted, 15, 35);
+            if(limiter.has_waiter()){
+                puts("timeout error");
+                ++failed_count;
+            }
+
+            //The only waiter times out before its refill at 50ms. The next one comes at 15ms with 1.5 tokens and needs 3,
+            //so it is granted at about 30ms, rather than by the refill timer left for the first one.
+            CO_SLEEP(40);   //The refill timer left by the last step fires and finishes.
+            next("timeout alone");
+            waiters[0].init(5, 10);
+            waiters[1].init(3, 0, 15);
+            CO_AWAIT_ALL(&waiters[0], &waiters[1]);
+            check(0, 0, cort_sync_proto::sync_wait, 5, 20);
+            check(1, 1, cort_sync_proto::sync_granted, 25, 42);
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    cort_timer_init();
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifdef CORT_SYNC_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../cort_sync.h"
+
+//Some workers share a mutex, a semaphore with 2 slots and a wait group. The main coroutine waits the group.
+//A watcher waits a condition with timeout to check the timeout path.
+cort_mutex mutex;
+cort_semaphore slots(2);
+cort_condition condition;
+cort_wait_group group;
+
+int failed_count = 0;
+int in_lock_count = 0;
+int in_slot_count = 0;
+int max_in_slot_count = 0;
+
+struct worker_cort : public cort_auto{
+    CO_DECL(worker_cort)
+    cort_sync_waiter waiter;
+    int id;
+    worker_cort(int i) : id(i){}
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(mutex.wait_lock(&waiter));
+            if(++in_lock_count != 1){
+                printf("worker %d: mutex is broken!\n", id);
+                ++failed_count;
+            }
+            printf("worker %d: locked\n", id);
+            CO_SLEEP(10);
+            --in_lock_count;
+            mutex.unlock();
+
+            CO_AWAIT(slots.wait_acquire(&waiter));
+            if(++in_slot_count > max_in_slot_count){
+                max_in_slot_count = in_slot_count;
+            }
+            CO_SLEEP(25);
+            --in_slot_count;
+            slots.release();
+
+            condition.notify_all();
+            group.done();
+        CO_END
+    }
+};
+
+struct watcher_cort : public cort_auto{
+    CO_DECL(watcher_cort)
+    cort_sync_waiter waiter;
+    int notified_count;
+    int expected_notified_count;
+    bool waited;
+    watcher_cort(int n) : expected_notified_count(n){
+        notified_count = 0;
+        waited = false;
+    }
+    cort_proto* start(){
+        CO_BEGIN
+            if(waiter.is_acquired()){
+                ++notified_count;
+            }
+            //We wait again until timeout.
+            CO_AWAIT_AGAIN_IF(!waited || waiter.is_acquired(), (waited = true, condition.wait_notified(&waiter, 100)));
+            printf("watcher: %d notifications before %s\n", notified_count, waiter.is_timeout() ? "timeout" : "stopped");
+            //Every worker notifies once after it leaves the slots, and the workers leave 10ms apart by the mutex.
+            if(notified_count != expected_notified_count || !waiter.is_timeout()){
+                printf("watcher: condition is broken!\n");
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
+//The semaphore has 3, the head waiter asks for 5 and times out, then the waiter behind it asking for 1 is granted at once.
+cort_semaphore small_slots(3);
+
+struct small_waiter_cort : public cort_auto{
+    CO_DECL(small_waiter_cort)
+    cort_sync_waiter waiter;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(small_slots.wait_acquire(&waiter, 1000, 1));
+            printf("small waiter: %s after %dms, %d left\n", waiter.is_acquired() ? "acquired" : "timeout",
+                (int)waiter.get_time_cost(), (int)small_slots.get_count());
+            if(!waiter.is_acquired() || waiter.get_time_cost() > 100 || small_slots.get_count() != 2){
+                printf("small waiter: semaphore is broken!\n");
+                ++failed_count;
+            }
+            small_slots.release();
+        CO_END
+    }
+};
+
+struct big_waiter_cort : public cort_auto{
+    CO_DECL(big_waiter_cort)
+    cort_sync_waiter waiter;
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(small_slots.wait_acquire(&waiter, 20, 5));
+            printf("big waiter: %s\n", waiter.is_acquired() ? "acquired" : "timeout");
+            if(!waiter.is_timeout()){
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
+struct main_cort : public cort_proto{
+    CO_DECL(main_cort)
+    cort_sync_waiter waiter;
+    int worker_count;
+    main_cort(int n) : worker_count(n){}
+    cort_proto* start(){
+        CO_BEGIN
+            group.add(worker_count);
+            for(int i = 0; i < worker_count; ++i){
+                (new worker_cort(i))->start();
+            }
+            CO_AWAIT(group.wait_all_done(&waiter, 10000));
+            printf("all done: %s, max %d workers in 2 slots\n", waiter.is_acquired() ? "yes" : "timeout", max_in_slot_count);
+            if(!waiter.is_acquired() || max_in_slot_count > 2 || (worker_count > 1 && max_in_slot_count != 2)){
+                printf("semaphore or wait group is broken!\n");
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    int worker_count = 5;
+    if(argc > 1){
+        worker_count = atoi(argv[1]);
+    }
+    cort_timer_init();
+    (new watcher_cort(worker_count))->start();
+    (new big_waiter_cort())->start();
+    (new small_waiter_cort())->start();
+    main_cort test(worker_count);
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    if(!test.is_finished()){
+        ++failed_count;
+    }
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifdef CORT_TCP_CIRCUIT_BREAKER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_circuit_breaker.h"
+
+//First the failure rate by allow and report. Then the requests to a port nobody listens: the breaker opens after 3 rejected connects,
+//fails the requests at once, opens again when the probe fails, and closes when the probe succeeds after the server starts.
+//At last the probes which never report a failure or a success.
+int failed_count = 0;
+
+void test_failure_rate(){
+    uint32_t ip = inet_addr("10.0.0.1");
+    uint16_t port = htons(80);
+    for(int i = 0; i < 9; ++i){
+        if(!cort_tcp_circuit_breaker::allow(ip, port)){
+            ++failed_count;
+        }
+        cort_tcp_circuit_breaker::report(ip, port, (i & 1) ? cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT : 0);
+        cort_tcp_circuit_breaker::report(ip, port, cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR);	//Ignored
+    }
+    const cort_tcp_circuit_breaker::state* state = cort_tcp_circuit_breaker::get_state(ip, port);
+    if(state == 0 || state->status != cort_tcp_circuit_breaker::breaker_closed || state->window_request_count != 9 || state->window_failure_count != 4){
+        puts("failure rate error");
+        ++failed_count;
+        return;
+    }
+    //5 of 10 failed.
+    cort_tcp_circuit_breaker::report(ip, port, cort_socket_error_codes::SOCKET_SEND_ERROR);
+    if(state->status != cort_tcp_circuit_breaker::breaker_open || cort_tcp_circuit_breaker::allow(ip, port)){
+        puts("failure rate open error");
+        ++failed_count;
+    }
+}
+
+//The probes finished with an ignored error, released without a result, or lost.
+void test_probe(){
+    cort_tcp_circuit_breaker::policy policy;
+    policy.consecutive_failures = 1;
+    policy.open_ms = 0;
+    policy.max_open_ms = 0;
+    policy.probe_count = 2;
+    policy.probe_timeout_ms = 20;
+    cort_tcp_circuit_breaker::set_policy(&policy);
+    uint32_t ip = inet_addr("10.0.0.2");
+    uint16_t port = htons(80);
+    cort_tcp_circuit_breaker::report(ip, port, cort_socket_error_codes::SOCKET_CONNECT_REJECTED);
+    const cort_tcp_circuit_breaker::state* state = cort_tcp_circuit_breaker::get_state(ip, port);
+    if(state == 0 || state->status != cort_tcp_circuit_breaker::breaker_open){
+        puts("probe open error");
+        ++failed_count;
+        return;
+    }
+    bool allowed = cort_tcp_circuit_breaker::allow(ip, port) && cort_tcp_circuit_breaker::allow(ip, port);
+    cort_tcp_circuit_breaker::report(ip, port, 0);
+    cort_tcp_circuit_breaker::report(ip, port, cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR);
+    //The ignored probe is replaced, then a canceled one is replaced.
+    allowed = allowed && cort_tcp_circuit_breaker::allow(ip, port) && !cort_tcp_circuit_breaker::allow(ip, port);
+    cort_tcp_circuit_breaker::release(ip, port);
+    allowed = allowed && cort_tcp_circuit_breaker::allow(ip, port);
+    cort_tcp_circuit_breaker::report(ip, port, 0);
+    if(!allowed || state->status != cort_tcp_circuit_breaker::breaker_closed){
+        printf("probe replace error, status %d\n", (int)state->status);
+        ++failed_count;
+    }
+    //The probes are lost, it opens again after probe_timeout_ms.
+    cort_tcp_circuit_breaker::report(ip, port, cort_socket_error_codes::SOCKET_CONNECT_REJECTED);
+    allowed = cort_tcp_circuit_breaker::allow(ip, port) && cort_tcp_circuit_breaker::allow(ip, port) && !cort_tcp_circuit_breaker::allow(ip, port);
+    usleep(30 * 1000);
+    cort_timer_refresh_clock();
+    if(!allowed || cort_tcp_circuit_breaker::allow(ip, port) || state->status != cort_tcp_circuit_breaker::breaker_open){
+        printf("probe timeout error, status %d\n", (int)state->status);
+        ++failed_count;
+    }
+    //Half open again with new probes.
+    if(!cort_tcp_circuit_breaker::allow(ip, port) || state->status != cort_tcp_circuit_breaker::breaker_half_open){
+        puts("probe reopen error");
+        ++failed_count;
+    }
+    cort_tcp_circuit_breaker::set_policy(0);
+}
+
+cort_tcp_listener listener;
+unsigned short port;
+char frame[] = "\0\0\0\5hello";
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_request_response* req;
+    const char* step;
+
+    test_cort(){
+        req = 0;
+    }
+
+    ~test_cort(){
+        delete req;
+    }
+
+    cort_tcp_request_response* next_request(const char* step_arg){
+        delete req;
+        step = step_arg;
+        req = new cort_tcp_request_response();
+        req->set_dest_addr("127.0.0.1", port);
+        req->set_timeout(1000);
+        req->set_send_buffer(frame, sizeof(frame) - 1);
+        req->alloc_recv_buffer();
+        req->set_recv_check_function(recv_check_frame);
+        return req;
+    }
+
+    void check(uint8_t expected_errno, uint8_t expected_status){
+        const cort_tcp_circuit_breaker::state* state = cort_tcp_circuit_breaker::get_state(inet_addr("127.0.0.1"), htons(port));
+        if(req->get_errno() != expected_errno || state == 0 || state->status != expected_status){
+            printf("%s: %s, status %d\n", step, cort_socket_error_codes::error_info(req->get_errno()), state == 0 ? -1 : state->status);
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(next_request("failure 1"));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, cort_tcp_circuit_breaker::breaker_closed);
+            CO_AWAIT(next_request("failure 2"));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, cort_tcp_circuit_breaker::breaker_closed);
+            CO_AWAIT(next_request("failure 3"));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, cort_tcp_circuit_breaker::breaker_open);
+            CO_AWAIT(next_request("open"));
+            check(cort_socket_error_codes::SOCKET_CIRCUIT_OPEN, cort_tcp_circuit_breaker::breaker_open);
+            CO_SLEEP(60);
+            CO_AWAIT(next_request("failed probe"));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, cort_tcp_circuit_breaker::breaker_open);
+            CO_SLEEP(60);	//Opened for 100ms this time.
+            CO_AWAIT(next_request("open again"));
+            check(cort_socket_error_codes::SOCKET_CIRCUIT_OPEN, cort_tcp_circuit_breaker::breaker_open);
+            listener.set_listen_port(port);
+            listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<> >::create);
+            listener.start();
+            CO_SLEEP(60);
+            CO_AWAIT(next_request("probe"));
+            check(0, cort_tcp_circuit_breaker::breaker_closed);
+            const cort_tcp_circuit_breaker::stats& stat = cort_tcp_circuit_breaker::get_stats();
+            printf("open: %d, close: %d, reject: %d, open breakers: %d\n", (int)stat.open_count, (int)stat.close_count,
+                (int)stat.reject_count, (int)stat.open_breaker_count);
+            //The breaker of test_failure_rate is still open.
+            if(stat.open_count != 3 || stat.close_count != 1 || stat.reject_count != 3 || stat.open_breaker_count != 1 || stat.breaker_count != 2){
+                ++failed_count;
+            }
+            cort_tcp_circuit_breaker::set_policy(0);
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    port = find_free_port();
+    cort_timer_init();
+    cort_tcp_circuit_breaker::policy policy;
+    policy.consecutive_failures = 3;
+    policy.min_requests = 10;
+    policy.open_ms = 50;
+    policy.max_open_ms = 200;
+    policy.probe_count = 1;
+    cort_tcp_circuit_breaker::set_policy(&policy);
+    test_failure_rate();
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    test_probe();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,114 @@
+#ifdef CORT_TCP_CLUSTER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_cluster.h"
+
+//Two servers echo the frames, the fast one sleeps 1ms and the slow one sleeps 20ms.
+const static int worker_count = 8;
+const static int request_count_per_worker = 25;
+int failed_count = 0;
+
+struct test_server : public cort_tcp_pipeline_server{
+    test_server(){
+        set_max_concurrency(64);
+        set_idle_timeout(3000);
+    }
+};
+
+cort_tcp_listener fast_listener;
+cort_tcp_listener slow_listener;
+cort_tcp_cluster cluster;
+char frame[] = "\0\0\0\5hello";
+
+struct worker : public cort_proto{
+    CO_DECL(worker)
+    cort_tcp_request_response* req;
+    cort_tcp_cluster_call call;
+    int done;
+
+    worker(){
+        req = 0;
+        done = 0;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            if(req != 0){
+                if(req->get_errno() != 0 || req->get_recv_buffer_size() != (int32_t)sizeof(frame) - 1){
+                    printf("request error: %s\n", cort_socket_error_codes::error_info(req->get_errno()));
+                    ++failed_count;
+                }
+                delete req;
+                req = 0;
+            }
+            if(done == request_count_per_worker){
+                CO_RETURN;
+            }
+            ++done;
+            req = new cort_tcp_request_response();
+            req->set_timeout(1000);
+            req->set_keep_alive(1000);
+            req->set_send_buffer(frame, sizeof(frame) - 1);
+            req->alloc_recv_buffer();
+            req->set_recv_check_function(recv_check_frame);
+            CO_AWAIT_AGAIN(cluster.call(&call, req));
+        CO_END
+    }
+};
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    worker workers[worker_count];
+    worker* worker_ptrs[worker_count];
+
+    cort_proto* start(){
+        CO_BEGIN
+            for(int i = 0; i < worker_count; ++i){
+                worker_ptrs[i] = &workers[i];
+            }
+            CO_AWAIT_RANGE(worker_ptrs, worker_ptrs + worker_count);
+            uint64_t fast_count = cluster.get_endpoint(0).request_count;
+            uint64_t slow_count = cluster.get_endpoint(1).request_count;
+            printf("fast: %d requests, %.1fms; slow: %d requests, %.1fms\n", (int)fast_count, cluster.get_endpoint(0).ewma_cost,
+                (int)slow_count, cluster.get_endpoint(1).ewma_cost);
+            if(fast_count + slow_count != worker_count * request_count_per_worker || fast_count < slow_count * 3
+                || cluster.get_endpoint(0).outstanding != 0 || cluster.get_endpoint(1).outstanding != 0){
+                ++failed_count;
+            }
+            cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+            fast_listener.stop_listen();
+            slow_listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    unsigned short fast_port = find_free_port();
+    unsigned short slow_port = find_free_port();
+    cort_timer_init();
+    fast_listener.set_listen_port(fast_port);
+    fast_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<1>, test_server>::create);
+    fast_listener.start();
+    slow_listener.set_listen_port(slow_port);
+    slow_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<20>, test_server>::create);
+    slow_listener.start();
+    if(fast_listener.get_errno() != 0 || slow_listener.get_errno() != 0){
+        puts("listen error");
+        return 1;
+    }
+    cluster.add_endpoint("127.0.0.1", fast_port);
+    cluster.add_endpoint("127.0.0.1", slow_port);
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
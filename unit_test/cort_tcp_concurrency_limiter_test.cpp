@@ -0,0 +1,240 @@
+#ifdef CORT_TCP_CONCURRENCY_LIMITER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_concurrency_limiter.h"
+
+//The server echoes the frames after 50ms.
+const static size_t request_count = 4;
+int failed_count = 0;
+
+cort_tcp_listener listener;
+unsigned short server_port;
+char frame[] = "\0\0\0\5hello";
+
+void test_limit(){
+    uint32_t ip = inet_addr("127.0.0.1");
+    cort_tcp_concurrency_limiter::policy policy;
+    policy.initial_limit = 2;
+    cort_tcp_concurrency_limiter::set_policy(&policy);
+    cort_tcp_request_response req[3];
+    for(int i = 0; i < 3; ++i){
+        req[i].set_dest_addr(ip, 1);
+    }
+    if(cort_tcp_concurrency_limiter::acquire(&req[0]) != cort_tcp_concurrency_limiter::limiter_acquired
+        || cort_tcp_concurrency_limiter::acquire(&req[1]) != cort_tcp_concurrency_limiter::limiter_acquired
+        || cort_tcp_concurrency_limiter::acquire(&req[2]) != cort_tcp_concurrency_limiter::limiter_rejected
+        || req[2].get_errno() != cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED){
+        puts("reject error");
+        ++failed_count;
+    }
+    //No queue at the destination, it grows.
+    cort_tcp_concurrency_limiter::release(ip, 1, 0, 10);
+    const cort_tcp_concurrency_limiter::state* state = cort_tcp_concurrency_limiter::get_state(ip, 1);
+    if(state == 0 || state->limit != 3 || state->in_flight != 1 || state->min_rtt != 11){
+        puts("grow error");
+        ++failed_count;
+    }
+    //Not used, it does not grow.
+    cort_tcp_concurrency_limiter::release(ip, 1, 0, 10);
+    if(state->limit != 3 || state->in_flight != 0){
+        puts("unused limit error");
+        ++failed_count;
+    }
+    //A timeout cuts it.
+    cort_tcp_concurrency_limiter::acquire(&req[0]);
+    cort_tcp_concurrency_limiter::release(ip, 1, cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT, 1000);
+    if(state->limit < 2.69 || state->limit > 2.71 || state->drop_count != 1){
+        puts("drop error");
+        ++failed_count;
+    }
+    //The time cost is 10 times of min_rtt, so there is a long queue at the destination, it drops.
+    policy.initial_limit = 100;
+    cort_tcp_concurrency_limiter::set_policy(&policy);
+    for(int i = 0; i < 20; ++i){
+        req[0].set_dest_addr(ip, 2);
+        cort_tcp_concurrency_limiter::acquire(&req[0]);
+        cort_tcp_concurrency_limiter::release(ip, 2, 0, i == 0 ? 9 : 99);
+    }
+    state = cort_tcp_concurrency_limiter::get_state(ip, 2);
+    if(state == 0 || state->limit < 100 - 19 * 2 || state->limit > 100 - 19 * 1.9){ //log10(limit) is a bit less than 2.
+        printf("vegas drop error: %f\n", state == 0 ? 0 : state->limit);
+        ++failed_count;
+    }
+    cort_tcp_concurrency_limiter::set_policy(0);
+    if(cort_tcp_concurrency_limiter::is_enabled() || cort_tcp_concurrency_limiter::get_state(ip, 1) != 0){
+        ++failed_count;
+    }
+    //No place is taken when it is disabled, so nothing is released.
+    cort_tcp_request_response disabled_req;
+    disabled_req.set_dest_addr(ip, 1);
+    if(cort_tcp_concurrency_limiter::acquire(&disabled_req) != cort_tcp_concurrency_limiter::limiter_acquired || disabled_req.limiter_place != 0){
+        puts("disabled place error");
+        ++failed_count;
+    }
+}
+
+cort_tcp_request_response* new_request(uint32_t timeout){
+    cort_tcp_request_response* result = new cort_tcp_request_response();
+    result->set_dest_addr("127.0.0.1", server_port);
+    result->set_timeout(timeout);
+    result->set_send_buffer(frame, sizeof(frame) - 1);
+    result->alloc_recv_buffer();
+    result->set_recv_check_function(recv_check_frame);
+    return result;
+}
+
+//Await a request after delay_ms and record when it finished. The limiter is enabled by enable_policy before the request starts.
+struct request_cort : public cort_proto{
+    CO_DECL(request_cort)
+    cort_tcp_request_response* request;
+    const cort_tcp_concurrency_limiter::policy* enable_policy;
+    uint32_t delay_ms;
+    cort_timeout_waiter::time_ms_t finish_time;
+
+    request_cort(){
+        request = 0;
+        enable_policy = 0;
+        delay_ms = 0;
+        finish_time = 0;
+    }
+    ~request_cort(){
+        delete request;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_SLEEP_IF(delay_ms != 0, delay_ms);
+            if(enable_policy != 0){
+                cort_tcp_concurrency_limiter::set_policy(enable_policy);
+            }
+            CO_AWAIT(request);
+            finish_time = cort_timer_now_ms();
+        CO_END
+    }
+};
+
+//Cancel the request queued after 10ms.
+struct cancel_cort : public cort_proto{
+    CO_DECL(cancel_cort)
+    cort_tcp_request_response* target;
+    bool canceled;
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_SLEEP(10);
+            canceled = target->cancel();
+        CO_END
+    }
+};
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    request_cort requests[request_count];
+    cancel_cort canceler;
+    cort_tcp_concurrency_limiter::policy policy;
+    cort_timeout_waiter::time_ms_t start_time;
+    const char* step;
+
+    void next(const char* step_arg, uint32_t max_queue, uint32_t last_timeout = 1000){
+        step = step_arg;
+        policy.initial_limit = 2;
+        policy.max_queue = max_queue;
+        cort_tcp_concurrency_limiter::set_policy(0);    //Learn from the beginning.
+        cort_tcp_concurrency_limiter::set_policy(&policy);
+        for(size_t i = 0; i < request_count; ++i){
+            delete requests[i].request;
+            requests[i].request = new_request(i + 1 == request_count ? last_timeout : 1000);
+            requests[i].enable_policy = 0;
+            requests[i].delay_ms = 0;
+        }
+        start_time = cort_timer_now_ms();
+    }
+
+    //Request i finished no earlier than min_time_ms with error expected_errno.
+    void check(size_t i, uint8_t expected_errno, uint32_t min_time_ms, uint32_t max_time_ms){
+        cort_tcp_request_response* request = requests[i].request;
+        uint32_t time_cost = (uint32_t)(requests[i].finish_time - start_time);
+        printf("%s: request %d %s, finished after %dms, time cost %dms\n", step, (int)i,
+            cort_socket_error_codes::error_info(request->get_errno()), (int)time_cost, (int)request->get_time_cost());
+        if(request->get_errno() != expected_errno || time_cost < min_time_ms || time_cost > max_time_ms
+            || (expected_errno == 0 && request->get_time_cost() > 80)){ //The time queued is not counted.
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            next("queued", 10);
+            CO_AWAIT_ALL(&requests[0], &requests[1], &requests[2], &requests[3]);
+            check(0, 0, 45, 80);
+            check(1, 0, 45, 80);
+            check(2, 0, 90, 150);
+            check(3, 0, 90, 150);
+            next("rejected", 0);
+            CO_AWAIT_ALL(&requests[0], &requests[1], &requests[2], &requests[3]);
+            check(0, 0, 45, 80);
+            check(1, 0, 45, 80);
+            check(2, cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED, 0, 5);
+            check(3, cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED, 0, 5);
+            next("queue timeout", 10, 20);
+            CO_AWAIT_ALL(&requests[0], &requests[1], &requests[2], &requests[3]);
+            check(2, 0, 90, 150);
+            check(3, cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED, 15, 40);
+            printf("rejected: %d, queued: %d, queue timeout: %d\n", (int)cort_tcp_concurrency_limiter::get_stats().reject_count,
+                (int)cort_tcp_concurrency_limiter::get_stats().queue_count, (int)cort_tcp_concurrency_limiter::get_stats().queue_timeout_count);
+            if(cort_tcp_concurrency_limiter::get_stats().queue_timeout_count != 1){
+                ++failed_count;
+            }
+            next("canceled", 10);
+            canceler.target = requests[3].request;
+            CO_AWAIT_ALL(&requests[0], &requests[1], &requests[2], &requests[3], &canceler);
+            check(2, 0, 90, 150);
+            check(3, cort_socket_error_codes::SOCKET_CONCURRENCY_LIMITED, 5, 30);
+            if(!canceler.canceled || cort_tcp_concurrency_limiter::get_state(inet_addr("127.0.0.1"), htons(server_port))->queued != 0
+                || cort_tcp_concurrency_limiter::get_stats().queue_timeout_count != 1){ //Not counted as a queue timeout.
+                puts("cancel error");
+                ++failed_count;
+            }
+            //The first request starts before the limiter is enabled, so it does not release the place of the second one.
+            //The third one waits until the second one finishes.
+            next("acquired while disabled", 10);
+            cort_tcp_concurrency_limiter::set_policy(0);
+            policy.initial_limit = 1;
+            requests[1].delay_ms = 25;
+            requests[1].enable_policy = &policy;
+            requests[2].delay_ms = 25;
+            CO_AWAIT_ALL(&requests[0], &requests[1], &requests[2]);
+            check(0, 0, 45, 80);
+            check(1, 0, 70, 110);
+            check(2, 0, 115, 180);
+            cort_tcp_concurrency_limiter::set_policy(0);
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_limit();
+    server_port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(server_port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<50> >::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts("listen error");
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
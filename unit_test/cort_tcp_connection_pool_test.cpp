@@ -0,0 +1,194 @@
+#ifdef CORT_TCP_CONNECTION_POOL_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_connection_pool.h"
+
+//The server sleeps 5ms and echoes the frame.
+//A frame whose body is "close" makes the server close the connection when it is idle for 10ms.
+const static int client_count = 10;
+const static uint32_t max_idle = 2;
+const static uint32_t max_total = 3;
+int failed_count = 0;
+int server_connection_count = 0;
+int max_server_connection_count = 0;
+
+struct pool_echo_handler : public cort_tcp_pipeline_handler{
+    CO_DECL(pool_echo_handler)
+    static int32_t request_check(const char* data, size_t size){
+        return check_frame(data, size);
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            if(get_request_size() == frame_header_size + 5 && memcmp(get_request() + frame_header_size, "close", 5) == 0){
+                server->set_idle_timeout(10);
+            }
+            CO_SLEEP(5);
+            copy_response_buffer(get_request(), (int32_t)get_request_size());
+        CO_END
+    }
+};
+
+struct test_server : public cort_tcp_pipeline_server{
+    test_server(){
+        if(++server_connection_count > max_server_connection_count){
+            max_server_connection_count = server_connection_count;
+        }
+        set_idle_timeout(3000);
+    }
+    void on_connection_closed(){
+        --server_connection_count;
+    }
+};
+
+cort_tcp_listener listener;
+unsigned short port;
+char frame[] = "\0\0\0\5hello";
+char close_frame[] = "\0\0\0\5close";
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_request_response* clients[client_count];
+    int wave;
+    int wave_size;
+    char* wave_frame;
+
+    void start_wave(int count, char* sent_frame, uint32_t keep_alive_ms){
+        wave_size = count;
+        wave_frame = sent_frame;
+        for(int i = 0; i < wave_size; ++i){
+            clients[i] = new cort_tcp_request_response();
+            clients[i]->set_dest_addr("127.0.0.1", port);
+            clients[i]->set_timeout(1000);
+            clients[i]->set_keep_alive(keep_alive_ms);
+            clients[i]->set_send_buffer(wave_frame, sizeof(frame) - 1);
+            clients[i]->alloc_recv_buffer();
+            clients[i]->set_recv_check_function(recv_check_frame);
+        }
+    }
+
+    void check_wave(){
+        for(int i = 0; i < wave_size; ++i){
+            if(clients[i]->get_errno() != 0 || clients[i]->get_recv_buffer_size() != (int32_t)sizeof(frame) - 1
+                || memcmp(clients[i]->get_recv_buffer(), wave_frame, sizeof(frame) - 1) != 0){
+                printf("client %d of wave %d error: %s\n", i, wave, cort_socket_error_codes::error_info(clients[i]->get_errno()));
+                ++failed_count;
+            }
+            delete clients[i];
+        }
+        const cort_tcp_connection_pool::stats& stat = cort_tcp_connection_pool::get_stats();
+        size_t idle_count = cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(port), 0);
+        printf("wave %d: %d max connections, %d idle, %d unpolled, checkout: %d, reuse: %d, handover: %d, wait: %d, eviction: %d, "
+            "expire: %d, validation failure: %d\n", wave, max_server_connection_count, (int)idle_count, (int)stat.unpolled_idle_count,
+            (int)stat.checkout_count, (int)stat.reuse_count, (int)stat.handover_count, (int)stat.wait_count, (int)stat.eviction_count,
+            (int)stat.expire_count, (int)stat.validation_failure_count);
+        if(max_server_connection_count > (int)max_total || idle_count > max_idle){
+            ++failed_count;
+        }
+    }
+
+    void check_warm(){
+        const cort_tcp_connection_pool::stats& stat = cort_tcp_connection_pool::get_stats();
+        size_t idle_count = cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(port), 0);
+        printf("warm: %d idle, warm connect: %d, warm failure: %d\n", (int)idle_count, (int)stat.warm_connect_count, (int)stat.warm_failure_count);
+        if(idle_count != max_idle || stat.warm_connect_count < max_idle || stat.warm_failure_count != 0){
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            cort_tcp_ctrler::set_keep_alive_limit(inet_addr("127.0.0.1"), htons(port), 0, max_idle, max_total);
+            wave = 0;
+            start_wave(client_count, frame, 1000);
+            CO_AWAIT_RANGE(clients, clients + wave_size);
+            check_wave();
+            if(cort_tcp_connection_pool::get_stats().wait_count == 0){ //More clients than max_total.
+                ++failed_count;
+            }
+
+            CO_SLEEP(20);
+            wave = 1;
+            start_wave(client_count, frame, 1000);
+            CO_AWAIT_RANGE(clients, clients + wave_size);
+            check_wave();
+            if(cort_tcp_connection_pool::get_stats().reuse_count == 0){
+                ++failed_count;
+            }
+
+            cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+            if(cort_tcp_connection_pool::get_stats().idle_count != 0){
+                ++failed_count;
+            }
+
+            //The unpolled idle connection closed by the server is found when it is checked out.
+            cort_tcp_ctrler::set_keep_alive_lazy_validation(inet_addr("127.0.0.1"), htons(port), 0, true);
+            wave = 2;
+            start_wave(1, close_frame, 1000);
+            CO_AWAIT_RANGE(clients, clients + wave_size);
+            check_wave();
+            if(cort_tcp_connection_pool::get_stats().unpolled_idle_count != 1){
+                ++failed_count;
+            }
+            CO_SLEEP(20);
+            wave = 3;
+            start_wave(1, frame, 50);
+            CO_AWAIT_RANGE(clients, clients + wave_size);
+            check_wave();
+            if(cort_tcp_connection_pool::get_stats().validation_failure_count != 1){
+                ++failed_count;
+            }
+            //The maintainer closes the expired one.
+            CO_SLEEP(300);
+            if(cort_tcp_connection_pool::get_stats().unpolled_idle_count != 0 || cort_tcp_connection_pool::get_stats().idle_count != 0){
+                ++failed_count;
+            }
+            cort_tcp_ctrler::set_keep_alive_lazy_validation(inet_addr("127.0.0.1"), htons(port), 0, false);
+
+            //The warmer connects ahead of time, so the idle connections are ready without any request.
+            cort_tcp_ctrler::set_keep_alive_min_idle(inet_addr("127.0.0.1"), htons(port), 0, max_idle, 5000);
+            CO_SLEEP(300);
+            check_warm();
+            cort_tcp_ctrler::set_keep_alive_min_idle(inet_addr("127.0.0.1"), htons(port), 0, 0, 0);
+            cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+
+            //The unpolled idle connection not expired yet is closed when the timers stop.
+            cort_tcp_ctrler::set_keep_alive_lazy_validation(inet_addr("127.0.0.1"), htons(port), 0, true);
+            wave = 4;
+            start_wave(1, frame, 5000);
+            CO_AWAIT_RANGE(clients, clients + wave_size);
+            check_wave();
+            listener.stop_listen();
+            cort_timer_destroy();
+            if(cort_tcp_connection_pool::get_stats().unpolled_idle_count != 0 || cort_tcp_connection_pool::get_stats().idle_count != 0){
+                puts("stopped maintainer error");
+                ++failed_count;
+            }
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<pool_echo_handler, test_server>::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts(cort_socket_error_codes::error_info(listener.get_errno()));
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,148 @@
+#ifdef CORT_TCP_HEDGED_REQUEST_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_connection_pool.h"
+#include "../net/cort_tcp_hedged_request.h"
+
+//The fast server echoes the frames at once, the slow one echoes them after 200ms, and nobody listens the closed port.
+//The delay of the backup is 20ms.
+int failed_count = 0;
+
+cort_tcp_listener fast_listener;
+cort_tcp_listener slow_listener;
+unsigned short fast_port;
+unsigned short slow_port;
+unsigned short closed_port;
+char frame[] = "\0\0\0\5hello";
+
+void test_policy(){
+    cort_hedge_policy policy;
+    if(policy.get_delay() != cort_socket_config::SOCKET_HEDGE_DEFAULT_DELAY_MS){
+        ++failed_count;
+    }
+    for(uint32_t i = 1; i <= 100; ++i){
+        policy.add_sample(i);
+    }
+    if(policy.get_delay() != 96){
+        printf("p95 delay: %d\n", (int)policy.get_delay());
+        ++failed_count;
+    }
+    policy.budget_percent = 0;
+    for(uint32_t i = 0; i < cort_socket_config::SOCKET_HEDGE_BUDGET_BURST; ++i){
+        policy.on_request();
+        if(!policy.try_hedge()){
+            ++failed_count;
+        }
+    }
+    policy.on_request();
+    if(policy.try_hedge() || policy.get_stats().budget_reject_count != 1){
+        puts("budget error");
+        ++failed_count;
+    }
+}
+
+cort_tcp_request_response* new_request(unsigned short port){
+    cort_tcp_request_response* result = new cort_tcp_request_response();
+    result->set_dest_addr("127.0.0.1", port);
+    result->set_timeout(1000);
+    result->set_keep_alive(1000);
+    result->set_send_buffer(frame, sizeof(frame) - 1);
+    result->alloc_recv_buffer();
+    result->set_recv_check_function(recv_check_frame);
+    return result;
+}
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_hedged_request hedged;
+    cort_hedge_policy policy;
+    const char* step;
+    cort_timeout_waiter::time_ms_t start_time;
+
+    test_cort(){
+        policy.delay_ms = 20;
+        hedged.set_policy(&policy);
+    }
+
+    cort_hedged_request* next(const char* step_arg, unsigned short primary_port, unsigned short backup_port, bool cancel_loser = false){
+        step = step_arg;
+        start_time = cort_timer_now_ms();
+        hedged.set_requests(new_request(primary_port), new_request(backup_port));
+        hedged.set_cancel_loser(cancel_loser);
+        return &hedged;
+    }
+
+    void check(unsigned short expected_port, bool expected_hedged, uint32_t max_time_ms){
+        cort_tcp_request_response* result = hedged.get_result();
+        uint32_t time_cost = (uint32_t)(cort_timer_now_ms() - start_time);
+        if(result == 0 || result->get_errno() != 0 || result->port_v4 != htons(expected_port)
+            || result->get_recv_buffer_size() != (int32_t)sizeof(frame) - 1 || hedged.is_hedged() != expected_hedged || time_cost > max_time_ms){
+            printf("%s error: %s, hedged %d, %dms\n", step, result == 0 ? "no result" : cort_socket_error_codes::error_info(result->get_errno()),
+                (int)hedged.is_hedged(), (int)time_cost);
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(next("fast primary", fast_port, slow_port));
+            check(fast_port, false, 15);
+            CO_AWAIT(next("slow primary", slow_port, fast_port));
+            check(fast_port, true, 100);
+            CO_SLEEP(250);	//The loser finishes and its connection is kept.
+            if(cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(slow_port), 0) != 1){
+                puts("loser connection is not kept");
+                ++failed_count;
+            }
+            CO_AWAIT(next("slow primary canceled", slow_port, fast_port, true));
+            check(fast_port, true, 100);
+            //The canceled loser does not take the idle connection back.
+            if(cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(slow_port), 0) != 0){
+                puts("canceled loser error");
+                ++failed_count;
+            }
+            CO_AWAIT(next("failed primary", closed_port, fast_port));
+            check(fast_port, true, 15);
+            const cort_hedge_policy::stats& stat = policy.get_stats();
+            printf("requests: %d, hedged: %d, backup won: %d\n", (int)stat.request_count, (int)stat.hedge_count, (int)stat.backup_win_count);
+            if(stat.request_count != 4 || stat.hedge_count != 3 || stat.backup_win_count != 3){
+                ++failed_count;
+            }
+            hedged.set_requests(0, 0);
+            cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+            fast_listener.stop_listen();
+            slow_listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_policy();
+    fast_port = find_free_port();
+    slow_port = find_free_port();
+    closed_port = find_free_port();
+    cort_timer_init();
+    fast_listener.set_listen_port(fast_port);
+    fast_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<0> >::create);
+    fast_listener.start();
+    slow_listener.set_listen_port(slow_port);
+    slow_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<200> >::create);
+    slow_listener.start();
+    if(fast_listener.get_errno() != 0 || slow_listener.get_errno() != 0){
+        puts("listen error");
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,223 @@
+#ifdef CORT_TCP_MULTIPLEXER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "../net/cort_tcp_multiplexer.h"
+
+//A frame is 4 bytes body length and 8 bytes request id in network byte order, then the body.
+//The server echoes the frames received by one read, in reverse order if it is started with reverse = true.
+//A frame whose body is "drop" is not echoed.
+const static size_t frame_header_size = 12;
+const static int requester_count = 100;
+const static int request_count_per_requester = 20;
+
+size_t make_frame(char* buffer, uint64_t id, const char* body){
+    uint32_t body_size = (uint32_t)strlen(body);
+    uint32_t net_size = htonl(body_size);
+    uint32_t net_id[2] = {htonl((uint32_t)(id >> 32)), htonl((uint32_t)id)};
+    memcpy(buffer, &net_size, 4);
+    memcpy(buffer + 4, net_id, 8);
+    memcpy(buffer + frame_header_size, body, body_size);
+    return frame_header_size + body_size;
+}
+
+int32_t check_frame(const char* data, size_t size, uint64_t* request_id){
+    if(size < frame_header_size){
+        return 0;
+    }
+    uint32_t net_size;
+    uint32_t net_id[2];
+    memcpy(&net_size, data, 4);
+    memcpy(net_id, data + 4, 8);
+    *request_id = (((uint64_t)ntohl(net_id[0])) << 32) | ntohl(net_id[1]);
+    return (int32_t)(frame_header_size + ntohl(net_size));
+}
+
+void serve(int fd, bool reverse){
+    static char buffer[1<<16];
+    static char output[1<<16];
+    size_t size = 0;
+    ssize_t result;
+    while((result = read(fd, buffer + size, sizeof(buffer) - size)) > 0){
+        size += result;
+        size_t offsets[1024];
+        size_t frame_count = 0;
+        size_t offset = 0;
+        uint64_t id;
+        int32_t frame_size;
+        while((frame_size = check_frame(buffer + offset, size - offset, &id)) > 0 && (size_t)frame_size <= size - offset && frame_count < 1024){
+            offsets[frame_count++] = offset;
+            offset += frame_size;
+        }
+        size_t output_size = 0;
+        for(size_t i = 0; i < frame_count; ++i){
+            size_t frame_offset = offsets[reverse ? (frame_count - 1 - i) : i];
+            size_t length = (size_t)check_frame(buffer + frame_offset, size - frame_offset, &id);
+            if(length == frame_header_size + 4 && memcmp(buffer + frame_offset + frame_header_size, "drop", 4) == 0){
+                continue;
+            }
+            memcpy(output + output_size, buffer + frame_offset, length);
+            output_size += length;
+        }
+        if(output_size != 0 && write(fd, output, output_size) != (ssize_t)output_size){
+            break;
+        }
+        memmove(buffer, buffer + offset, size - offset);
+        size -= offset;
+    }
+}
+
+int fork_server(unsigned short& port, bool reverse){
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0
+        || getsockname(listen_fd, (struct sockaddr*)&addr, &len) != 0){
+        printf("server error\n");
+        exit(1);
+    }
+    port = ntohs(addr.sin_port);
+    int pid = fork();
+    if(pid == 0){
+        while(true){
+            int fd = accept(listen_fd, 0, 0);
+            if(fd >= 0){
+                serve(fd, reverse);
+                close(fd);
+            }
+        }
+    }
+    close(listen_fd);
+    return pid;
+}
+
+int failed_count = 0;
+
+//Every requester sends its requests one by one, all the requesters share one multiplexer.
+struct requester : public cort_proto{
+    CO_DECL(requester)
+    cort_tcp_multiplexer* mux;
+    cort_tcp_mux_request req;
+    int index;
+    int sent_count;
+    uint64_t id;
+    char request[64];
+    size_t request_size;
+
+    cort_proto* start(){
+        CO_BEGIN
+            if(sent_count != 0){
+                if(req.get_errno() != 0 || req.get_response_size() != request_size
+                    || memcmp(req.get_response(), request, request_size) != 0){
+                    printf("requester %d request %d failed: %s\n", index, sent_count, cort_socket_error_codes::error_info(req.get_errno()));
+                    ++failed_count;
+                }
+            }
+            if(sent_count == request_count_per_requester){
+                CO_RETURN;
+            }
+            ++sent_count;
+            id = ((uint64_t)index << 32) | sent_count;
+            char body[32];
+            sprintf(body, "request %d %d", index, sent_count);
+            request_size = make_frame(request, id, body);
+            CO_AWAIT_AGAIN(mux->request(&req, request, request_size, 1000, id));
+        CO_END
+    }
+};
+
+struct test_driver : public cort_proto{
+    CO_DECL(test_driver)
+    cort_tcp_multiplexer fifo_mux;
+    cort_tcp_multiplexer id_mux;
+    requester requesters[requester_count];
+    requester* requester_ptrs[requester_count];
+    cort_tcp_mux_request drop_req;
+    char drop_request[32];
+
+    test_driver(unsigned short fifo_port, unsigned short reverse_port){
+        fifo_mux.set_dest_addr("127.0.0.1", fifo_port);
+        fifo_mux.set_response_check_function(&check_frame);
+        fifo_mux.set_connect_timeout(1000);
+        id_mux.set_dest_addr("127.0.0.1", reverse_port);
+        id_mux.set_response_check_function(&check_frame, true);
+        id_mux.set_connect_timeout(1000);
+        for(int i = 0; i < requester_count; ++i){
+            requester_ptrs[i] = &requesters[i];
+        }
+    }
+
+    void prepare(cort_tcp_multiplexer* mux){
+        for(int i = 0; i < requester_count; ++i){
+            requesters[i].mux = mux;
+            requesters[i].index = i;
+            requesters[i].sent_count = 0;
+        }
+    }
+
+    //The requesters queue their requests at the same time, so the queued requests are sent together by fewer calls.
+    void report(const char* name, cort_tcp_multiplexer* mux){
+        printf("%s: %d requests, %llu send calls, %d failed\n", name, (int)mux->get_sent_request_count(),
+            (unsigned long long)mux->get_send_call_count(), failed_count);
+        if(mux->get_send_call_count() >= mux->get_sent_request_count()){
+            printf("%s: the requests are not batched\n", name);
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            prepare(&fifo_mux);
+            CO_AWAIT_RANGE(requester_ptrs, requester_ptrs + requester_count);
+            report("fifo", &fifo_mux);
+            fifo_mux.close();
+            prepare(&id_mux);
+            CO_AWAIT_RANGE(requester_ptrs, requester_ptrs + requester_count);
+            report("id", &id_mux);
+
+            //The response is never received, the request times out and the connection is still usable.
+            size_t size = make_frame(drop_request, 0, "drop");
+            CO_AWAIT(id_mux.request(&drop_req, drop_request, size, 50, 0));
+            if(drop_req.get_errno() != cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT || id_mux.get_waiting_count() != 0){
+                printf("drop request failed: %s\n", cort_socket_error_codes::error_info(drop_req.get_errno()));
+                ++failed_count;
+            }
+            prepare(&id_mux);
+            CO_AWAIT_RANGE(requester_ptrs, requester_ptrs + requester_count);
+            report("id after timeout", &id_mux);
+            if(!id_mux.is_connected()){
+                printf("id connection is closed\n");
+                ++failed_count;
+            }
+            id_mux.close();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    unsigned short fifo_port, reverse_port;
+    int fifo_pid = fork_server(fifo_port, false);
+    int reverse_pid = fork_server(reverse_port, true);
+    cort_timer_init();
+    test_driver* driver = new test_driver(fifo_port, reverse_port);
+    driver->start();
+    cort_timer_loop();
+    delete driver;
+    cort_timer_destroy();
+    kill(fifo_pid, SIGKILL);
+    kill(reverse_pid, SIGKILL);
+    waitpid(fifo_pid, 0, 0);
+    waitpid(reverse_pid, 0, 0);
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,127 @@
+#ifdef CORT_TCP_PIPELINE_SERVER_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+
+//The handler sleeps (body[0] - '0') ms and echoes the frame. A frame whose body is "close" closes the connection after its response.
+const static int pipelined_count = 64;
+int failed_count = 0;
+
+struct pipeline_echo_handler : public cort_tcp_pipeline_handler{
+    CO_DECL(pipeline_echo_handler)
+    static int32_t request_check(const char* data, size_t size){
+        return check_frame(data, size);
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            const char* body = get_request() + frame_header_size;
+            if(get_request_size() == frame_header_size + 5 && memcmp(body, "close", 5) == 0){
+                set_close_after_response();
+            }
+            CO_SLEEP_IF(body[0] > '0' && body[0] <= '9', body[0] - '0');
+            copy_response_buffer(get_request(), (int32_t)get_request_size());
+        CO_END
+    }
+};
+
+cort_tcp_listener listener;
+
+struct test_server : public cort_tcp_pipeline_server{
+    test_server(){
+        set_max_concurrency(16);
+        set_idle_timeout(3000);
+    }
+    void on_connection_closed(){
+        printf("server: %d requests, %d recv calls, %d send calls, errno: %s\n", (int)get_request_count(), (int)get_recv_call_count(),
+            (int)get_send_call_count(), cort_socket_error_codes::error_info(get_errno()));
+        //The client sends 64 pipelined frames and a "close" frame, the frame after it is dropped.
+        if(get_errno() != 0 || get_request_count() != pipelined_count + 1 || get_send_call_count() >= get_request_count()){
+            ++failed_count;
+        }
+        listener.stop_listen();
+    }
+};
+
+bool read_full(int fd, char* buffer, size_t size){
+    while(size != 0){
+        ssize_t result = read(fd, buffer, size);
+        if(result <= 0){
+            return false;
+        }
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+//The bodies sleep longer for the earlier frames, so the later handlers finish first and the responses have to be reordered.
+int run_client(unsigned short port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        printf("client connect error\n");
+        return 1;
+    }
+    static char request[1<<16];
+    size_t request_size = 0;
+    for(int i = 0; i < pipelined_count; ++i){
+        char body[32];
+        sprintf(body, "%d frame %d", (pipelined_count - i) % 8, i);
+        request_size += make_frame(request + request_size, body);
+    }
+    size_t close_offset = request_size;
+    request_size += make_frame(request + request_size, "close");
+    request_size += make_frame(request + request_size, "dropped");
+    if(write(fd, request, request_size) != (ssize_t)request_size){
+        printf("client write error\n");
+        return 1;
+    }
+    static char response[1<<16];
+    if(!read_full(fd, response, close_offset + frame_header_size + 5) || memcmp(response, request, close_offset + frame_header_size + 5) != 0){
+        printf("client response error\n");
+        return 1;
+    }
+    if(read(fd, response, 1) != 0){
+        printf("client connection is not closed\n");
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    unsigned short port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<pipeline_echo_handler, test_server>::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts(cort_socket_error_codes::error_info(listener.get_errno()));
+        return 1;
+    }
+    int pid = fork();
+    if(pid == 0){
+        _exit(run_client(port));
+    }
+    cort_timer_loop();
+    cort_timer_destroy();
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        ++failed_count;
+    }
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,125 @@
+#ifdef CORT_TCP_QUORUM_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_connection_pool.h"
+#include "../net/cort_tcp_quorum.h"
+
+//Requests 0, 1 and 2 are sent to the fast server which echoes the frames at once, request 3 to the slow one which echoes after 200ms,
+//and request 4 to the closed port nobody listens.
+const static size_t request_count = 5;
+int failed_count = 0;
+
+cort_tcp_listener fast_listener;
+cort_tcp_listener slow_listener;
+unsigned short fast_port;
+unsigned short slow_port;
+unsigned short closed_port;
+char frame[] = "\0\0\0\5hello";
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_quorum quorum;
+    const char* step;
+    cort_timeout_waiter::time_ms_t start_time;
+
+    cort_tcp_quorum* next(const char* step_arg, size_t quorum_count, uint32_t deadline_ms, bool cancel_stragglers = false){
+        step = step_arg;
+        start_time = cort_timer_now_ms();
+        quorum.clear_requests();
+        for(size_t i = 0; i < request_count; ++i){
+            cort_tcp_request_response* req = new cort_tcp_request_response();
+            req->set_dest_addr("127.0.0.1", (i < 3 ? fast_port : (i == 3 ? slow_port : closed_port)));
+            req->set_timeout(1000);
+            req->set_keep_alive(1000);
+            req->set_send_buffer(frame, sizeof(frame) - 1);
+            req->alloc_recv_buffer();
+            req->set_recv_check_function(recv_check_frame);
+            quorum.add_request(req);
+        }
+        quorum.set_quorum(quorum_count);
+        quorum.set_deadline(deadline_ms);
+        quorum.set_cancel_stragglers(cancel_stragglers);
+        return &quorum;
+    }
+
+    void check(bool expected_timeout, uint32_t min_time_ms, uint32_t max_time_ms){
+        uint32_t time_cost = (uint32_t)(cort_timer_now_ms() - start_time);
+        printf("%s: success 0x%x, finished 0x%x, %dms\n", step, (int)quorum.get_success_bitmap(), (int)quorum.get_finished_bitmap(), (int)time_cost);
+        if(quorum.is_timeout() != expected_timeout || time_cost < min_time_ms || time_cost > max_time_ms
+            || quorum.get_request(3) != 0 || (quorum.get_success_bitmap() & ~0x7ULL) != 0){
+            ++failed_count;
+        }
+        for(size_t i = 0; i < request_count; ++i){
+            bool finished = ((quorum.get_finished_bitmap() >> i) & 1) != 0;
+            if(finished == (quorum.get_request(i) == 0)){ //Only the stragglers are detached.
+                printf("request %d error\n", (int)i);
+                ++failed_count;
+            }
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(next("quorum 3", 3, 100));
+            check(false, 0, 50);
+            if(quorum.get_success_count() != 3 || !quorum.is_quorum_reached()){
+                ++failed_count;
+            }
+            CO_SLEEP(250);	//The straggler finishes and its connection is kept.
+            if(cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(slow_port), 0) != 1){
+                puts("straggler connection is not kept");
+                ++failed_count;
+            }
+            CO_AWAIT(next("quorum 4", 4, 50, true));
+            check(true, 50, 150);
+            if(quorum.get_success_count() != 3 || quorum.is_quorum_reached()){
+                ++failed_count;
+            }
+            //The canceled straggler does not take the idle connection back.
+            if(cort_tcp_connection_pool::get_idle_count(inet_addr("127.0.0.1"), htons(slow_port), 0) != 0){
+                puts("canceled straggler error");
+                ++failed_count;
+            }
+            CO_AWAIT(next("quorum 5", 5, 1000));
+            check(false, 0, 150); //Impossible when request 4 failed.
+            if(((quorum.get_finished_bitmap() >> 4) & 1) == 0 || quorum.is_quorum_reached()){
+                ++failed_count;
+            }
+            quorum.clear_requests();
+            CO_SLEEP(250);
+            cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+            fast_listener.stop_listen();
+            slow_listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    fast_port = find_free_port();
+    slow_port = find_free_port();
+    closed_port = find_free_port();
+    cort_timer_init();
+    fast_listener.set_listen_port(fast_port);
+    fast_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<0> >::create);
+    fast_listener.start();
+    slow_listener.set_listen_port(slow_port);
+    slow_listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<200> >::create);
+    slow_listener.start();
+    if(fast_listener.get_errno() != 0 || slow_listener.get_errno() != 0){
+        puts("listen error");
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
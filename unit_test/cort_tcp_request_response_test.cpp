@@ -0,0 +1,509 @@
+#ifdef CORT_TCP_REQUEST_RESPONSE_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+
+//The buffers of cort_tcp_request_response: the segmented recv buffer by a socket pair, the send queue and its file segments,
+//the learned recv size, then the requests to an echo server, including the optimistic recv, and a zero copy send timed out.
+int failed_count = 0;
+
+void fill_data(char* data, size_t size, size_t seed){
+    for(size_t i = 0; i < size; ++i){
+        data[i] = (char)((i + seed) % 251);
+    }
+}
+
+//Receive size bytes written to the other end of the socket pair in segmented mode.
+bool recv_all(recv_buffer_ctrl& buffer, int fd, size_t size){
+    buffer.realloc_recv_buffer((recv_buffer_ctrl::recv_buffer_size_t)size);
+    while((size_t)buffer.recved_size < size){
+        ssize_t result = buffer.recv_segmented(fd);
+        if(result <= 0){
+            return false;
+        }
+        buffer.recved_size += (recv_buffer_ctrl::recv_buffer_size_t)result;
+    }
+    return true;
+}
+
+void test_segmented_buffer(){
+    const static size_t block_size = 1024;
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+        puts("socketpair error");
+        ++failed_count;
+        return;
+    }
+    char data[10000];
+    fill_data(data, sizeof(data), 0);
+    recv_buffer_ctrl buffer;
+    buffer.set_segmented(block_size);
+    if(write(fds[1], data, sizeof(data)) != (ssize_t)sizeof(data) || !recv_all(buffer, fds[0], sizeof(data))){
+        puts("segmented recv error");
+        ++failed_count;
+    }
+    //The last block has 10000 - 9 * 1024 bytes.
+    size_t offset = 0;
+    for(size_t i = 0; i < buffer.get_recv_block_count(); ++i){
+        iovec block = buffer.get_recv_block(i);
+        if(block.iov_len != (i == 9 ? sizeof(data) - 9 * block_size : block_size) || memcmp(block.iov_base, data + offset, block.iov_len) != 0){
+            printf("block %d error\n", (int)i);
+            ++failed_count;
+        }
+        offset += block.iov_len;
+    }
+    if(buffer.get_recv_block_count() != 10 || offset != sizeof(data)){
+        printf("block count error: %d\n", (int)buffer.get_recv_block_count());
+        ++failed_count;
+    }
+    char* linear = buffer.linearize();
+    if(linear == 0 || memcmp(linear, data, sizeof(data)) != 0 || buffer.get_recv_block_count() != 1
+        || buffer.get_recv_block(0).iov_len != sizeof(data)){
+        puts("linearize error");
+        ++failed_count;
+    }
+    //The linearized block is not reused.
+    buffer.clear();
+    if(buffer.recv_block_count != 0 || buffer.recv_buffer != 0){
+        puts("clear linearized error");
+        ++failed_count;
+    }
+    fill_data(data, 3000, 1);
+    if(write(fds[1], data, 3000) != 3000 || !recv_all(buffer, fds[0], 3000) || buffer.get_recv_block_count() != 3){
+        puts("segmented recv again error");
+        ++failed_count;
+    }
+    //Only the first block is kept for the next response.
+    char* first_block = buffer.recv_buffer;
+    buffer.clear();
+    fill_data(data, 500, 2);
+    if(buffer.recv_block_count != 1 || write(fds[1], data, 500) != 500 || !recv_all(buffer, fds[0], 500)
+        || buffer.recv_buffer != first_block || buffer.get_recv_block_count() != 1 || memcmp(buffer.recv_buffer, data, 500) != 0){
+        puts("clear reuse error");
+        ++failed_count;
+    }
+    //A weak reference buffer leaves the segmented mode, and the blocks are freed.
+    buffer.set_recv_buffer(data, sizeof(data));
+    if(buffer.is_segmented() || buffer.recv_blocks != 0 || buffer.recv_block_capacity != 0 || buffer.recv_block_count != 0){
+        puts("leave segmented mode error");
+        ++failed_count;
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//Whether the segments waiting to be sent are the bytes of expected.
+bool check_queue(const send_buffer_ctrl& queue, const char* expected, size_t size){
+    size_t offset = 0;
+    for(send_buffer_ctrl::size_type i = queue.send_head; i < queue.send_tail; ++i){
+        const iovec& data = queue.send_data[i];
+        if(offset + data.iov_len > size || memcmp(data.iov_base, expected + offset, data.iov_len) != 0){
+            return false;
+        }
+        offset += data.iov_len;
+    }
+    return offset == size;
+}
+
+void test_send_queue(){
+    char data[256];
+    fill_data(data, sizeof(data), 4);
+    send_buffer_ctrl queue;
+    //Strong and weak references in turn, the 4th one spills to the heap.
+    for(int i = 0; i < 4; ++i){
+        if(i % 2 == 0){
+            queue.copy_send_buffer(data + i * 2, 2);
+        }
+        else{
+            queue.set_send_buffer(data + i * 2, 2);
+        }
+    }
+    if(queue.send_data == queue.inline_send_data || queue.send_capacity != 6 || !check_queue(queue, data, 8)
+        || queue.send_data_flag[0] != 0 || queue.send_data_flag[1] != send_buffer_ctrl::weak_reference_flag){
+        puts("spill error");
+        ++failed_count;
+    }
+    //The strong reference segment partially sent is freed from its base later.
+    if(queue.consume(5) != 2 || queue.send_data_tag[queue.send_head] != 1 || !check_queue(queue, data + 5, 3)){
+        puts("partial consume error");
+        ++failed_count;
+    }
+    //Half of the heap array is sent, so it is moved to the front rather than grown.
+    queue.consume(2);
+    queue.copy_send_buffer(data + 8, 2);
+    queue.set_send_buffer(data + 10, 2);
+    queue.copy_send_buffer(data + 12, 2);
+    if(queue.send_capacity != 6 || queue.send_head != 0 || queue.size() != 4 || !check_queue(queue, data + 7, 7)){
+        puts("front reuse error");
+        ++failed_count;
+    }
+    for(int i = 7; i < 128; ++i){
+        queue.copy_send_buffer(data + i * 2, 2);
+    }
+    if(queue.size() != 125 || !check_queue(queue, data + 7, 249)){
+        puts("grow error");
+        ++failed_count;
+    }
+    //The heap array is kept for reuse.
+    iovec* heap_data = queue.send_data;
+    queue.clear();
+    if(!queue.empty() || queue.send_data != heap_data){
+        puts("clear error");
+        ++failed_count;
+    }
+}
+
+bool is_fd_open(int fd){
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+//A file segment closes its fd when it is cleared only if it owns the fd.
+void test_file_segment(int file_fd){
+    int owned_fd = dup(file_fd);
+    send_buffer_ctrl queue;
+    queue.set_send_buffer((char*)"header", 6);
+    queue.set_send_file(file_fd, 0, 10);
+    queue.set_send_file(owned_fd, 10, 10, true);
+    if(queue.file_segment_count != 2 || queue.get_memory_segment_count(1024) != 1 || queue.send_data_tag[1] != (send_buffer_ctrl::size_type)file_fd){
+        puts("file segment error");
+        ++failed_count;
+    }
+    send_buffer_ctrl other;
+    other.splice(queue);
+    if(!queue.empty() || queue.file_segment_count != 0 || other.file_segment_count != 2){
+        puts("file segment splice error");
+        ++failed_count;
+    }
+    other.clear();
+    if(other.file_segment_count != 0 || is_fd_open(owned_fd) || !is_fd_open(file_fd)){
+        puts("file segment clear error");
+        ++failed_count;
+    }
+}
+
+//The initial recv size is learned for every type_key:ip:port, with a quarter headroom in a size class of cort_buffer_pool.
+void test_recv_size(){
+    cort_tcp_request_response request;
+    request.set_dest_addr("127.0.0.9", 1);
+    bool error = (request.get_init_recv_size() != recv_buffer_ctrl::default_init_recv_buffer_size);
+    cort_tcp_ctrler::update_adaptive_recv_size(inet_addr("127.0.0.9"), htons(1), 0, 1000);
+    error = error || request.get_init_recv_size() != 2048 - cort_buffer_pool::header_size;
+    cort_tcp_ctrler::update_adaptive_recv_size(inet_addr("127.0.0.9"), htons(1), 0, 9000);  //The average is 2000 now.
+    error = error || request.get_init_recv_size() != 4096 - cort_buffer_pool::header_size;
+    request.set_disable_adaptive_recv_size();
+    error = error || request.get_init_recv_size() != recv_buffer_ctrl::default_init_recv_buffer_size;
+    cort_tcp_request_response other_type;
+    other_type.set_dest_addr("127.0.0.9", 1);
+    other_type.set_type_key(1);
+    error = error || other_type.get_init_recv_size() != recv_buffer_ctrl::default_init_recv_buffer_size;
+    //The table is full of other destinations, a new one still replaces a slot.
+    for(size_t i = 1; i <= 2 * cort_socket_config::SOCKET_RECV_SIZE_TABLE_SIZE; ++i){
+        cort_tcp_ctrler::update_adaptive_recv_size(inet_addr("127.0.0.10"), htons((uint16_t)i), 0, 100);
+    }
+    cort_tcp_request_response crowded;
+    crowded.set_dest_addr("127.0.0.11", 1);
+    cort_tcp_ctrler::update_adaptive_recv_size(inet_addr("127.0.0.11"), htons(1), 0, 1000);
+    error = error || crowded.get_init_recv_size() != 2048 - cort_buffer_pool::header_size;
+    if(error){
+        puts("recv size error");
+        ++failed_count;
+    }
+}
+
+cort_tcp_listener listener;
+unsigned short port;
+const static size_t large_body_size = 100000;
+char large_frame[frame_header_size + large_body_size];
+const static size_t many_segment_count = cort_socket_config::SOCKET_SEND_MAX_IOV_COUNT * 2 + 1;
+const static size_t many_segment_size = 3;
+char many_segment_frame[frame_header_size + many_segment_count * many_segment_size];
+//The file is sent from file_offset, between a header and a trailer. It is larger than one sendfile sends to the socket buffer.
+const static size_t file_size = (1 << 20) + 1000;
+const static size_t file_offset = 1000;
+const static char file_trailer[] = "trailer";
+char* file_frame;
+size_t file_frame_size;
+int file_fd;
+
+//If it sleeps after sending, the response has arrived before recv, and the optimistic recv gets it without waiting for EPOLLIN.
+//Or else the server in the same thread has not run yet, so the recv gets EAGAIN and waits.
+struct late_recv_request : public cort_tcp_request_response{
+    CO_DECL(late_recv_request)
+    uint32_t sleep_ms;
+    bool recv_paused;
+
+    late_recv_request(){
+        sleep_ms = 0;
+        recv_paused = false;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(lock_connect());
+            co_unlikely_if(get_errno() != 0){
+                CO_RETURN;
+            }
+            CO_AWAIT(lock_send());
+            co_unlikely_if(get_errno() != 0){
+                CO_RETURN;
+            }
+            CO_SLEEP_IF(sleep_ms != 0, sleep_ms);
+            {
+                //Like CO_AWAIT(lock_recv()), but we know whether it paused.
+                cort_proto* paused_waiter = lock_recv()->cort_start();
+                recv_paused = (paused_waiter != 0);
+                if(recv_paused){
+                    paused_waiter->set_parent(this);
+                    set_wait_count(1);
+                }
+            }
+            CO_AWAIT_UNKNOWN_IF(recv_paused);
+            on_connection_inactive();
+        CO_END
+    }
+};
+
+//A server that never accepts nor reads, its small recv buffer is soon full.
+int listen_silently(unsigned short& silent_port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int buffer_size = 4096;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 
+        || getsockname(fd, (struct sockaddr*)&addr, &len) != 0){
+        close(fd);
+        return -1;
+    }
+    silent_port = ntohs(addr.sin_port);
+    return fd;
+}
+
+//All the segments are passed to MSG_ZEROCOPY by the first send, then the send to the silent server times out partly sent.
+//SO_ZEROCOPY is not set, so the kernel copies and never notifies, as if it is still sending every segment.
+const static size_t zero_copy_segment_count = cort_socket_config::SOCKET_SEND_MAX_IOV_COUNT;
+const static size_t zero_copy_segment_size = 12000;
+const static uint32_t zero_copy_size_class = 14 - cort_buffer_pool::min_class_shift; //16K bytes with the header.
+struct zero_copy_timeout_request : public cort_tcp_ctrler{
+    CO_DECL(zero_copy_timeout_request)
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(lock_connect());
+            co_unlikely_if(get_errno() != 0){
+                CO_RETURN;
+            }
+            {
+                int buffer_size = 4096;
+                setsockopt(connection_waiter->get_connected_fd(), SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+                connection_waiter->zero_copy = new cort_tcp_zero_copy_ctrl();
+                connection_waiter->zero_copy->state = cort_tcp_zero_copy_ctrl::zero_copy_enabled;
+                set_zero_copy_threshold(1);
+                for(size_t i = 0; i < zero_copy_segment_count; ++i){
+                    memset(alloc_send_buffer(zero_copy_segment_size), 'z', zero_copy_segment_size);
+                }
+            }
+            CO_AWAIT(lock_send());
+        CO_END
+    }
+};
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_request_response* request;
+    late_recv_request late_requests[3];
+    int owned_fd;
+    zero_copy_timeout_request* zero_copy_request;
+    int silent_fd;
+    size_t cached_count;
+
+    test_cort(){
+        request = 0;
+    }
+    ~test_cort(){
+        delete request;
+    }
+
+    //The initial recv size of the next request to the echo server fits the size class.
+    void check_recv_size(size_t class_size){
+        recv_buffer_ctrl::recv_buffer_size_t init_size = new_request(large_frame, 0)->get_init_recv_size();
+        if(init_size != (recv_buffer_ctrl::recv_buffer_size_t)(class_size - cort_buffer_pool::header_size)){
+            printf("learned recv size error: %d\n", (int)init_size);
+            ++failed_count;
+        }
+    }
+
+    void check_file_response(bool fd_error){
+        if(request->get_errno() != 0 || request->get_recv_buffer_size() != (int32_t)file_frame_size
+            || memcmp(request->get_recv_buffer(), file_frame, file_frame_size) != 0 || fd_error){
+            printf("file response error: %s\n", cort_socket_error_codes::error_info(request->get_errno()));
+            ++failed_count;
+        }
+    }
+
+    cort_tcp_request_response* new_request(char* frame, size_t frame_size){
+        delete request;
+        request = new cort_tcp_request_response();
+        request->set_dest_addr("127.0.0.1", port);
+        request->set_timeout(1000);
+        request->set_send_buffer(frame, (int32_t)frame_size);
+        request->set_recv_check_function(recv_check_frame);
+        return request;
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            //A response in many blocks.
+            new_request(large_frame, sizeof(large_frame))->set_segmented_recv(4096);
+            CO_AWAIT(request);
+            if(request->get_errno() != 0 || request->get_recv_buffer_size() != (int32_t)sizeof(large_frame) || request->get_recv_block_count() < 2
+                || request->get_recv_block(0).iov_len != 4096 || memcmp(request->linearize_recv_buffer(), large_frame, sizeof(large_frame)) != 0){
+                printf("segmented response error: %s, %d blocks\n", cort_socket_error_codes::error_info(request->get_errno()),
+                    (int)request->get_recv_block_count());
+                ++failed_count;
+            }
+
+            //More segments than one writev sends, half of them are strong references.
+            new_request(many_segment_frame, frame_header_size)->alloc_recv_buffer();
+            for(size_t i = 0; i < many_segment_count; ++i){
+                char* segment = many_segment_frame + frame_header_size + i * many_segment_size;
+                if(i % 2 == 0){
+                    request->copy_send_buffer(segment, many_segment_size);
+                }
+                else{
+                    request->set_send_buffer(segment, many_segment_size);
+                }
+            }
+            CO_AWAIT(request);
+            if(request->get_errno() != 0 || request->get_recv_buffer_size() != (int32_t)sizeof(many_segment_frame)
+                || memcmp(request->get_recv_buffer(), many_segment_frame, sizeof(many_segment_frame)) != 0){
+                printf("many segments error: %s\n", cort_socket_error_codes::error_info(request->get_errno()));
+                ++failed_count;
+            }
+            //The response of 6151 bytes is learned, the segmented one before is not.
+            check_recv_size(8192);
+
+            //Header, file and trailer, the file is weak referenced.
+            new_request(file_frame, frame_header_size)->alloc_recv_buffer();
+            request->set_send_file(file_fd, file_offset, file_size - file_offset);
+            request->set_send_buffer((char*)file_trailer, sizeof(file_trailer) - 1);
+            CO_AWAIT(request);
+            check_file_response(!is_fd_open(file_fd));
+            //The fd is closed after the file is sent.
+            owned_fd = dup(file_fd);
+            new_request(file_frame, frame_header_size)->alloc_recv_buffer();
+            request->set_send_file(owned_fd, file_offset, file_size - file_offset, true);
+            request->set_send_buffer((char*)file_trailer, sizeof(file_trailer) - 1);
+            CO_AWAIT(request);
+            check_file_response(is_fd_open(owned_fd));
+            //The file responses are larger than max_pooled_size, so they are learned as max_pooled_size.
+            //The average is (6151 * 7 + 131072) / 8 = 21766, then (21766 * 7 + 131072) / 8 = 35429.
+            check_recv_size(65536);
+
+            //Optimistic after the response arrived, optimistic before the response arrived, and disabled.
+            //The disabled one may have EPOLLIN reported during the sleep, so only its response is checked.
+            for(int i = 0; i < 3; ++i){
+                late_requests[i].sleep_ms = (i == 1 ? 0 : 20);
+                late_requests[i].set_dest_addr("127.0.0.1", port);
+                late_requests[i].set_timeout(1000);
+                late_requests[i].set_send_buffer(many_segment_frame, sizeof(many_segment_frame));
+                late_requests[i].alloc_recv_buffer();
+                late_requests[i].set_recv_check_function(recv_check_frame);
+            }
+            late_requests[2].set_disable_optimistic_recv();
+            CO_AWAIT_ALL(&late_requests[0], &late_requests[1], &late_requests[2]);
+            for(int i = 0; i < 3; ++i){
+                printf("late recv %d: %s\n", i, late_requests[i].recv_paused ? "paused" : "not paused");
+                if(late_requests[i].get_errno() != 0 || late_requests[i].get_recv_buffer_size() != (int32_t)sizeof(many_segment_frame)
+                    || memcmp(late_requests[i].get_recv_buffer(), many_segment_frame, sizeof(many_segment_frame)) != 0
+                    || (i < 2 && late_requests[i].recv_paused != (i == 1))){
+                    printf("late recv error: %s\n", cort_socket_error_codes::error_info(late_requests[i].get_errno()));
+                    ++failed_count;
+                }
+            }
+
+            //The zero copy segments queued when the send times out are kept for the kernel like the sent ones,
+            //none of them is back to cort_buffer_pool after the ctrler is deleted.
+            {
+                unsigned short silent_port;
+                silent_fd = listen_silently(silent_port);
+                zero_copy_request = new zero_copy_timeout_request();
+                zero_copy_request->set_dest_addr("127.0.0.1", silent_port);
+                zero_copy_request->set_timeout(100);
+                cort_buffer_pool::set_high_water(64 << 20);
+                cort_buffer_pool::trim(); //The segments are not taken from the cache.
+                cached_count = cort_buffer_pool::get_stats().cached_count[zero_copy_size_class];
+            }
+            CO_AWAIT(zero_copy_request);
+            {
+                uint8_t err = zero_copy_request->get_errno();
+                delete zero_copy_request;
+                size_t freed_count = cort_buffer_pool::get_stats().cached_count[zero_copy_size_class] - cached_count;
+                if(silent_fd < 0 || err != cort_socket_error_codes::SOCKET_OPERATION_TIMEOUT || freed_count != 0){
+                    printf("zero copy timeout error: %s, %d segments freed\n", cort_socket_error_codes::error_info(err), (int)freed_count);
+                    ++failed_count;
+                }
+                close(silent_fd);
+                cort_buffer_pool::set_high_water(cort_buffer_pool::default_high_water);
+            }
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_segmented_buffer();
+    test_send_queue();
+    test_recv_size();
+    uint32_t net_size = htonl(large_body_size);
+    memcpy(large_frame, &net_size, 4);
+    fill_data(large_frame + frame_header_size, large_body_size, 3);
+    net_size = htonl(many_segment_count * many_segment_size);
+    memcpy(many_segment_frame, &net_size, 4);
+    fill_data(many_segment_frame + frame_header_size, many_segment_count * many_segment_size, 5);
+    char file_name[] = "/tmp/cort_tcp_request_response_test_XXXXXX";
+    file_fd = mkstemp(file_name);
+    if(file_fd < 0){
+        puts("file error");
+        return 1;
+    }
+    unlink(file_name);
+    file_frame_size = frame_header_size + file_size - file_offset + sizeof(file_trailer) - 1;
+    file_frame = (char*)malloc(file_frame_size + file_offset);
+    fill_data(file_frame, file_size, 6);
+    if(write(file_fd, file_frame, file_size) != (ssize_t)file_size){
+        puts("file error");
+        return 1;
+    }
+    memmove(file_frame + frame_header_size, file_frame + file_offset, file_size - file_offset);
+    memcpy(file_frame + frame_header_size + file_size - file_offset, file_trailer, sizeof(file_trailer) - 1);
+    net_size = htonl(file_frame_size - frame_header_size);
+    memcpy(file_frame, &net_size, 4);
+    test_file_segment(file_fd);
+    port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<> >::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts(cort_socket_error_codes::error_info(listener.get_errno()));
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    close(file_fd);
+    free(file_frame);
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,171 @@
+#ifdef CORT_TCP_RETRY_REQUEST_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_retry_request.h"
+
+//The server echoes the frames at once, and nobody listens the closed port.
+int failed_count = 0;
+
+recv_buffer_ctrl::recv_buffer_size_t recv_check_bad(recv_buffer_ctrl* arg, cort_tcp_ctrler*){
+    return arg->recved_size == 0 ? 0 : recv_buffer_ctrl::unexpected_data_received;
+}
+
+cort_tcp_listener listener;
+unsigned short server_port;
+unsigned short closed_port;
+char frame[] = "\0\0\0\5hello";
+
+//How the attempts of a test are made.
+struct attempt_plan{
+    uint32_t closed_count;      //The first attempts are sent to the closed port.
+    bool bad_response;
+};
+
+cort_tcp_request_response* create_request(void* arg, uint32_t attempt){
+    const attempt_plan* plan = (const attempt_plan*)arg;
+    cort_tcp_request_response* result = new cort_tcp_request_response();
+    result->set_dest_addr("127.0.0.1", attempt < plan->closed_count ? closed_port : server_port);
+    result->set_timeout(1000);
+    result->set_send_buffer(frame, sizeof(frame) - 1);
+    result->alloc_recv_buffer();
+    result->set_recv_check_function(plan->bad_response ? recv_check_bad : recv_check_frame);
+    return result;
+}
+
+void test_policy(){
+    cort_retry_policy policy;
+    if(!policy.is_retryable(cort_socket_error_codes::SOCKET_CONNECT_REJECTED)
+        || policy.is_retryable(cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR) || policy.is_retryable(0)){
+        puts("mask error");
+        ++failed_count;
+    }
+    policy.backoff_ms = 10;
+    policy.max_backoff_ms = 50;
+    uint32_t expected_max[] = {10, 10, 20, 40, 50, 50};
+    for(uint32_t attempt = 0; attempt < 6; ++attempt){
+        for(int i = 0; i < 100; ++i){
+            uint32_t backoff = policy.get_backoff(attempt);
+            if(backoff < expected_max[attempt] / 2 || backoff > expected_max[attempt]){
+                printf("backoff error: %d after %d attempts\n", (int)backoff, (int)attempt);
+                ++failed_count;
+                break;
+            }
+        }
+    }
+    uint32_t ip = inet_addr("127.0.0.1");
+    policy.budget_percent = 50;
+    for(uint32_t i = 0; i < cort_socket_config::SOCKET_RETRY_BUDGET_BURST; ++i){
+        if(!policy.try_retry(ip, 1)){
+            ++failed_count;
+        }
+    }
+    if(policy.try_retry(ip, 1) || policy.get_budget(ip, 2) != cort_socket_config::SOCKET_RETRY_BUDGET_BURST){
+        puts("budget error");
+        ++failed_count;
+    }
+    policy.on_request(ip, 1);
+    policy.on_request(ip, 1);
+    if(!policy.try_retry(ip, 1) || policy.try_retry(ip, 1)){ //Two requests earn one retry.
+        puts("budget earning error");
+        ++failed_count;
+    }
+    const cort_retry_policy::stats& stat = policy.get_stats();
+    if(stat.request_count != 2 || stat.retry_count != 11 || stat.budget_reject_count != 2){
+        ++failed_count;
+    }
+}
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_retry_request retry;
+    cort_retry_policy policy;
+    attempt_plan plan;
+    const char* step;
+    cort_timeout_waiter::time_ms_t start_time;
+
+    test_cort(){
+        policy.backoff_ms = 10;
+        policy.max_backoff_ms = 40;
+        retry.set_policy(&policy);
+        retry.set_request_creator(create_request, &plan);
+    }
+
+    cort_tcp_retry_request* next(const char* step_arg, uint32_t closed_count, bool bad_response = false, uint32_t deadline_ms = 0){
+        step = step_arg;
+        start_time = cort_timer_now_ms();
+        plan.closed_count = closed_count;
+        plan.bad_response = bad_response;
+        retry.set_deadline(deadline_ms);
+        return &retry;
+    }
+
+    void check(uint8_t expected_errno, uint32_t expected_attempts, uint32_t min_time_ms, uint32_t max_time_ms){
+        cort_tcp_request_response* result = retry.get_result();
+        uint32_t time_cost = (uint32_t)(cort_timer_now_ms() - start_time);
+        printf("%s: %s, %d attempts, %dms\n", step, result == 0 ? "no result" : cort_socket_error_codes::error_info(result->get_errno()),
+            (int)retry.get_attempt_count(), (int)time_cost);
+        if(result == 0 || result->get_errno() != expected_errno || retry.get_attempt_count() != expected_attempts
+            || time_cost < min_time_ms || time_cost > max_time_ms){
+            ++failed_count;
+        }
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_AWAIT(next("success", 0));
+            check(0, 1, 0, 10);
+            CO_AWAIT(next("success after retries", 2));
+            check(0, 3, 15, 60);    //Backoff 5~10ms then 10~20ms.
+            CO_AWAIT(next("all failed", 10));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, 3, 15, 60);
+            CO_AWAIT(next("bad response", 0, true));
+            check(cort_socket_error_codes::SOCKET_RECEIVED_CHECK_ERROR, 1, 0, 10);
+            policy.backoff_ms = 100;
+            policy.max_backoff_ms = 1000;
+            CO_AWAIT(next("deadline", 10, false, 40));
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, 1, 0, 10);
+            if(policy.get_stats().deadline_reject_count != 1){
+                ++failed_count;
+            }
+            policy.backoff_ms = 1;
+            policy.max_attempts = 100;
+            policy.budget_percent = 0;
+            CO_AWAIT(next("budget", 100));
+            //4 retries are spent before, so the budget left is SOCKET_RETRY_BUDGET_BURST - 4.
+            check(cort_socket_error_codes::SOCKET_CONNECT_REJECTED, cort_socket_config::SOCKET_RETRY_BUDGET_BURST - 4 + 1, 0, 100);
+            printf("requests: %d, retries: %d, budget rejected: %d\n", (int)policy.get_stats().request_count,
+                (int)policy.get_stats().retry_count, (int)policy.get_stats().budget_reject_count);
+            if(policy.get_stats().budget_reject_count != 1){
+                ++failed_count;
+            }
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_policy();
+    server_port = find_free_port();
+    closed_port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(server_port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<> >::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts("listen error");
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,181 @@
+#ifdef CORT_TCP_SHARD_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_connection_pool.h"
+#include "../net/cort_tcp_shard.h"
+
+//First the ring alone: the keys spread by the weights, and removing a node only moves the keys of it.
+//Then two servers echo the frames, and every key is always sent to the same server on the keep alive connections of its type_key.
+const static int key_count = 20000;
+const static int request_count = 40;
+int failed_count = 0;
+
+void test_ring(){
+    cort_tcp_shard shard;
+    char ip[32];
+    for(int i = 0; i < 10; ++i){
+        sprintf(ip, "10.0.0.%d", i + 1);
+        shard.add_node(ip, 80, (i == 0 ? 2 : 1));
+    }
+    if(shard.add_node("10.0.0.1", 80) || shard.size() != 10
+        || shard.point_size() != 11 * cort_socket_config::SOCKET_SHARD_VIRTUAL_NODE_COUNT){
+        puts("add error");
+        ++failed_count;
+    }
+    uint32_t owners[key_count];
+    int counts[10] = {0};
+    for(int i = 0; i < key_count; ++i){
+        uint64_t hash = cort_tcp_shard::hash_key(&i, sizeof(i));
+        owners[i] = shard.get_node(shard.lookup(hash)).ip_v4;
+        ++counts[(ntohl(owners[i]) & 0xFF) - 1];
+    }
+    //The average is key_count / 11, the first node has twice of it.
+    for(int i = 0; i < 10; ++i){
+        int expected = key_count / 11 * (i == 0 ? 2 : 1);
+        if(counts[i] < expected * 3 / 4 || counts[i] > expected * 5 / 4){
+            printf("node %d owns %d keys, expected %d\n", i, counts[i], expected);
+            ++failed_count;
+        }
+    }
+
+    uint32_t removed = inet_addr("10.0.0.4");
+    if(!shard.remove_node(removed, htons(80)) || shard.remove_node(removed, htons(80))){
+        puts("remove error");
+        ++failed_count;
+    }
+    int moved_count = 0;
+    for(int i = 0; i < key_count; ++i){
+        uint32_t owner = shard.get_node(shard.lookup(cort_tcp_shard::hash_key(&i, sizeof(i)))).ip_v4;
+        if(owner == removed || (owners[i] != removed && owner != owners[i])){
+            ++failed_count;
+        }
+        if(owner != owners[i]){
+            ++moved_count;
+        }
+    }
+    if(moved_count != counts[3]){
+        printf("moved %d keys, expected %d\n", moved_count, counts[3]);
+        ++failed_count;
+    }
+
+    //Adding it back restores the same owners.
+    shard.add_node(removed, htons(80));
+    for(int i = 0; i < key_count; ++i){
+        if(shard.get_node(shard.lookup(cort_tcp_shard::hash_key(&i, sizeof(i)))).ip_v4 != owners[i]){
+            ++failed_count;
+            break;
+        }
+    }
+
+    cort_tcp_shard empty;
+    if(empty.lookup(1) != size_t(-1)){
+        ++failed_count;
+    }
+
+    //The type_key of the ctrler is kept unless the node has its own.
+    cort_tcp_shard typed;
+    typed.add_node("10.0.0.1", 80);
+    cort_tcp_request_response req;
+    req.set_type_key(3);
+    typed.select(&req, 1);
+    uint16_t kept_type_key = req.type_key;
+    typed.remove_node(inet_addr("10.0.0.1"), htons(80));
+    typed.add_node("10.0.0.1", 80, 1, 5);
+    typed.select(&req, 1);
+    if(kept_type_key != 3 || req.type_key != 5){
+        printf("type_key error: %d, %d\n", (int)kept_type_key, (int)req.type_key);
+        ++failed_count;
+    }
+}
+
+cort_tcp_listener listeners[2];
+unsigned short ports[2];
+cort_tcp_shard shard;
+char frame[] = "\0\0\0\5hello";
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_request_response* req;
+    cort_tcp_shard_call call;
+    int done;
+    uint16_t owner_ports[request_count / 2];
+
+    test_cort(){
+        req = 0;
+        done = 0;
+    }
+
+    //Every key is sent twice one by one, the second time has to go to the same server on the keep alive connection.
+    cort_proto* start(){
+        CO_BEGIN
+            if(req != 0){
+                int key = (done - 1) % (request_count / 2);
+                if(req->get_errno() != 0 || req->get_recv_buffer_size() != (int32_t)sizeof(frame) - 1){
+                    printf("request error: %s\n", cort_socket_error_codes::error_info(req->get_errno()));
+                    ++failed_count;
+                }
+                else if(done <= request_count / 2){
+                    owner_ports[key] = req->port_v4;
+                }
+                else if(owner_ports[key] != req->port_v4){
+                    printf("key %d moved\n", key);
+                    ++failed_count;
+                }
+                delete req;
+                req = 0;
+            }
+            if(done == request_count){
+                for(size_t i = 0; i < shard.size(); ++i){
+                    const cort_tcp_shard::node& node = shard.get_node(i);
+                    printf("node %d: %d requests, %d idle connections\n", (int)i, (int)node.request_count,
+                        (int)cort_tcp_connection_pool::get_idle_count(node.ip_v4, node.port_v4, node.type_key));
+                    if(node.request_count == 0 || cort_tcp_connection_pool::get_idle_count(node.ip_v4, node.port_v4, node.type_key) != 1){
+                        ++failed_count;
+                    }
+                }
+                cort_tcp_connection_waiter_client::clear_keep_alive_connection(100);
+                listeners[0].stop_listen();
+                listeners[1].stop_listen();
+                CO_RETURN;
+            }
+            int key = done % (request_count / 2);
+            ++done;
+            req = new cort_tcp_request_response();
+            req->set_timeout(1000);
+            req->set_keep_alive(1000);
+            req->set_send_buffer(frame, sizeof(frame) - 1);
+            req->alloc_recv_buffer();
+            req->set_recv_check_function(recv_check_frame);
+            CO_AWAIT_AGAIN(shard.call(&call, req, cort_tcp_shard::hash_key(&key, sizeof(key))));
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_ring();
+    cort_timer_init();
+    for(int i = 0; i < 2; ++i){
+        ports[i] = find_free_port();
+        listeners[i].set_listen_port(ports[i]);
+        listeners[i].set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<> >::create);
+        listeners[i].start();
+        if(listeners[i].get_errno() != 0){
+            puts(cort_socket_error_codes::error_info(listeners[i].get_errno()));
+            return 1;
+        }
+        shard.add_node("127.0.0.1", ports[i], 1, 7);
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,116 @@
+#ifdef CORT_TCP_SOURCE_ADDR_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "cort_tcp_test_echo_server.h"
+#include "../net/cort_tcp_source_addr.h"
+
+//The clients connect to the server at 127.0.0.1 from the source ips 127.0.0.2 and 127.0.0.3 in turn.
+const static int client_count = 4;
+const static int source_count = 2;
+int failed_count = 0;
+int source_connection_count[source_count] = {0};
+
+struct test_server : public cort_tcp_pipeline_server{
+    void on_connection_closed(){
+        uint32_t ip = ntohl(get_ip());
+        if(ip == 0x7F000002 || ip == 0x7F000003){
+            ++source_connection_count[ip - 0x7F000002];
+        }
+        else{
+            printf("unexpected source ip %x\n", ip);
+            ++failed_count;
+        }
+    }
+};
+
+//The connections to a destination are trimmed near the ports of the source ips it may use.
+void test_trim(){
+    size_t limit = 1;   //The least connections to trim with one source ip.
+    while(!cort_tcp_source_addr::need_trim(limit)){
+        limit *= 2;
+    }
+    for(size_t step = limit / 4; step != 0; step /= 2){
+        if(!cort_tcp_source_addr::need_trim(limit - step)){
+            continue;
+        }
+        limit -= step;
+    }
+    uint32_t source_ips[source_count] = {inet_addr("127.0.0.2"), inet_addr("127.0.0.3")};
+    cort_tcp_source_addr::set_source_ips(source_ips, source_count);
+    bool round_robin_error = cort_tcp_source_addr::need_trim(limit) || !cort_tcp_source_addr::need_trim(limit * source_count);
+    cort_tcp_source_addr::set_source_ips(source_ips, source_count, cort_tcp_source_addr::source_by_destination);
+    bool by_destination_error = cort_tcp_source_addr::need_trim(limit - 1) || !cort_tcp_source_addr::need_trim(limit);
+    cort_tcp_source_addr::set_source_ips(0, 0);
+    printf("trim from %d connections of a destination\n", (int)limit);
+    if(cort_tcp_source_addr::need_trim(limit - 1) || round_robin_error || by_destination_error){
+        puts("trim error");
+        ++failed_count;
+    }
+}
+
+cort_tcp_listener listener;
+unsigned short port;
+char frame[] = "\0\0\0\5hello";
+
+struct test_cort : public cort_proto{
+    CO_DECL(test_cort)
+    cort_tcp_request_response* clients[client_count];
+
+    cort_proto* start(){
+        CO_BEGIN
+            uint32_t source_ips[source_count] = {inet_addr("127.0.0.2"), inet_addr("127.0.0.3")};
+            cort_tcp_source_addr::set_source_ips(source_ips, source_count);
+            for(int i = 0; i < client_count; ++i){
+                clients[i] = new cort_tcp_request_response();
+                clients[i]->set_dest_addr("127.0.0.1", port);
+                clients[i]->set_timeout(1000);
+                clients[i]->set_send_buffer(frame, sizeof(frame) - 1);
+                clients[i]->alloc_recv_buffer();
+                clients[i]->set_recv_check_function(recv_check_frame);
+            }
+            CO_AWAIT_RANGE(clients, clients + client_count);
+            for(int i = 0; i < client_count; ++i){
+                if(clients[i]->get_errno() != 0 || clients[i]->get_recv_buffer_size() != (int32_t)sizeof(frame) - 1){
+                    printf("client %d error: %s\n", i, cort_socket_error_codes::error_info(clients[i]->get_errno()));
+                    ++failed_count;
+                }
+                delete clients[i];
+            }
+            cort_tcp_source_addr::set_source_ips(0, 0);
+            CO_SLEEP(50); //Wait for the server to close.
+            const cort_tcp_source_addr::stats& stat = cort_tcp_source_addr::get_stats();
+            printf("bind: %d, bind error: %d, from 127.0.0.2: %d, from 127.0.0.3: %d\n", (int)stat.bind_count, (int)stat.bind_error_count,
+                source_connection_count[0], source_connection_count[1]);
+            if(stat.bind_count != client_count || stat.bind_error_count != 0
+                || source_connection_count[0] != client_count / 2 || source_connection_count[1] != client_count / 2){
+                ++failed_count;
+            }
+            listener.stop_listen();
+        CO_END
+    }
+};
+
+int main(int argc, char* argv[]){
+    test_trim();
+    port = find_free_port();
+    cort_timer_init();
+    listener.set_listen_port(port);
+    listener.set_ctrler_creator(tcp_pipeline_static_creator<echo_handler<>, test_server>::create);
+    listener.start();
+    if(listener.get_errno() != 0){
+        puts(cort_socket_error_codes::error_info(listener.get_errno()));
+        return 1;
+    }
+    test_cort test;
+    test.start();
+    cort_timer_loop();
+    cort_timer_destroy();
+    printf(failed_count == 0 ? "test passed\n" : "test failed\n");
+    return failed_count == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef CORT_TCP_TEST_ECHO_SERVER_H_
+#define CORT_TCP_TEST_ECHO_SERVER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "../net/cort_tcp_listener.h"
+#include "../net/cort_tcp_pipeline_server.h"
+
+//The echo server shared by the unit tests of the tcp ctrlers.
+//A frame is 4 bytes body length in network byte order, then the body.
+const static size_t frame_header_size = 4;
+
+//Return 0 if the header is not received yet, or the frame size.
+inline int32_t check_frame(const char* data, size_t size){
+    if(size < frame_header_size){
+        return 0;
+    }
+    uint32_t net_size;
+    memcpy(&net_size, data, 4);
+    return (int32_t)(frame_header_size + ntohl(net_size));
+}
+
+//Write a frame of body to buffer, return the frame size.
+inline size_t make_frame(char* buffer, const char* body){
+    uint32_t body_size = (uint32_t)strlen(body);
+    uint32_t net_size = htonl(body_size);
+    memcpy(buffer, &net_size, 4);
+    memcpy(buffer + frame_header_size, body, body_size);
+    return frame_header_size + body_size;
+}
+
+inline recv_buffer_ctrl::recv_buffer_size_t recv_check_frame(recv_buffer_ctrl* arg, cort_tcp_ctrler*){
+    return check_frame(arg->recv_buffer, arg->recved_size);
+}
+
+//It echoes every frame after sleep_ms.
+template<int sleep_ms = 0>
+struct echo_handler : public cort_tcp_pipeline_handler{
+    CO_DECL(echo_handler)
+    static int32_t request_check(const char* data, size_t size){
+        return check_frame(data, size);
+    }
+
+    cort_proto* start(){
+        CO_BEGIN
+            CO_SLEEP_IF(sleep_ms != 0, sleep_ms);
+            copy_response_buffer(get_request(), (int32_t)get_request_size());
+        CO_END
+    }
+};
+
+//A port of 127.0.0.1 nobody listens now.
+inline unsigned short find_free_port(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (struct sockaddr*)&addr, &len) != 0){
+        printf("port error\n");
+        exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+#endif